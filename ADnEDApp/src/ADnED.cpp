@@ -9,6 +9,7 @@
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <algorithm>
 #include "dirent.h"
 #include <sys/types.h>
 #include <syscall.h> 
@@ -19,6 +20,7 @@
 #include <epicsThread.h>
 #include <epicsExport.h>
 #include <epicsString.h>
+#include <epicsAtomic.h>
 #include <iocsh.h>
 #include <drvSup.h>
 #include <registryFunction.h>
@@ -41,20 +43,18 @@ using nEDChannel::nEDMonitorRequester;
 
 //Definitions of static class data members
 const epicsInt32 ADnED::s_ADNED_MAX_STRING_SIZE = ADNED_MAX_STRING_SIZE;
-const epicsInt32 ADnED::s_ADNED_MAX_DETS = ADNED_MAX_DETS;
-const epicsInt32 ADnED::s_ADNED_MAX_CHANNELS = ADNED_MAX_CHANNELS;
 const epicsUInt32 ADnED::s_ADNED_ALLOC_STATUS_OK = 0;
 const epicsUInt32 ADnED::s_ADNED_ALLOC_STATUS_REQ = 1;
 const epicsUInt32 ADnED::s_ADNED_ALLOC_STATUS_FAIL = 2;
-//These 2D plot options need to match the mbbo record that uses ADNED_DET_2D_TYPE parameter.
-const epicsUInt32 ADnED::s_ADNED_2D_PLOT_XY = 0;
-const epicsUInt32 ADnED::s_ADNED_2D_PLOT_XTOF = 1;
-const epicsUInt32 ADnED::s_ADNED_2D_PLOT_YTOF = 2;
-const epicsUInt32 ADnED::s_ADNED_2D_PLOT_PIXELIDTOF = 3;
 
 //C Function prototypes to tie in with EPICS
 static void ADnEDEventTaskC(void *drvPvt);
 static void ADnEDFrameTaskC(void *drvPvt);
+static void ADnEDWorkerTaskC(void *drvPvt);
+static void ADnEDReplayTaskC(void *drvPvt);
+static void ADnEDGeneratorTaskC(void *drvPvt);
+static void ADnEDPoolTaskC(void *pPvt, ADnEDChunk *pChunk, epicsUInt32 worker);
+static void ADnEDPoolWakeC(void *pPvt, epicsUInt32 worker);
 
 /**
  * Constructor. 
@@ -63,10 +63,13 @@ static void ADnEDFrameTaskC(void *drvPvt);
  * @param maxBuffers Used by asynPortDriver (set to -1 for unlimited)
  * @param maxMemory Used by asynPortDriver (set to -1 for unlimited)
  * @param debug This debug flag for the driver. 
+ * @param maxDets The max number of detectors (1 to ADNED_MAX_DETS_LIMIT)
+ * @param maxChannels The max number of PVAccess channels (1 to ADNED_MAX_CHANNELS_LIMIT)
+ * @param poolThreads The number of threads in the packet processing pool (0 to ADNED_POOL_MAX_THREADS)
  */
-ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
+ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug, int maxDets, int maxChannels, int poolThreads)
   : ADDriver(portName,
-             s_ADNED_MAX_DETS+1, /* maxAddr (different detectors use different asyn address*/ 
+             getMaxAddr(maxDets, maxChannels), /* maxAddr (different detectors use different asyn address, and the detector TOF arrays, delta frames and events use more)*/ 
              NUM_DRIVER_PARAMS,
              maxBuffers,
              maxMemory,
@@ -76,6 +79,17 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
              1, /* Autoconnect */
              0, /* default priority */
              0), /* Default stack size*/
+    m_maxDets(maxDets),
+    m_maxChannels(maxChannels),
+    m_poolThreads(poolThreads),
+    m_numShards(maxChannels+poolThreads),
+    m_ChannelState(maxChannels),
+    m_DetState(maxDets+1),
+    p_MonitorRequester(maxChannels),
+    p_Monitor(maxChannels),
+    p_Channel(maxChannels),
+    p_Transform(maxDets+1, static_cast<ADnEDTransformBase *>(NULL)),
+    m_ConfigManager(maxChannels, maxDets),
     m_debug(debug)
 {
   int status = asynSuccess;
@@ -103,6 +117,18 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsEventCreate failure for stop frame.\n", functionName);
     return;
   }
+  m_startReplay = epicsEventMustCreate(epicsEventEmpty);
+  if (!m_startReplay) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsEventCreate failure for start replay.\n", functionName);
+    return;
+  }
+  m_replayStop = 0;
+  m_startGenerator = epicsEventMustCreate(epicsEventEmpty);
+  if (!m_startGenerator) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsEventCreate failure for start generator.\n", functionName);
+    return;
+  }
+  m_generatorStop = 0;
 
   //Add the params to the paramLib 
   //createParam adds the parameters to all param lists automatically (using maxAddr).
@@ -119,10 +145,62 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   createParam(ADnEDSeqIDMissingParamString,       asynParamInt32,    &ADnEDSeqIDMissingParam);
   createParam(ADnEDSeqIDNumMissingParamString,    asynParamInt32,    &ADnEDSeqIDNumMissingParam);
   createParam(ADnEDBadTimeStampParamString,       asynParamInt32,    &ADnEDBadTimeStampParam);
+  createParam(ADnEDBacklogParamString,            asynParamInt32,    &ADnEDBacklogParam);
+  createParam(ADnEDDroppedParamString,            asynParamInt32,    &ADnEDDroppedParam);
   createParam(ADnEDPChargeParamString,            asynParamFloat64,  &ADnEDPChargeParam);
   createParam(ADnEDPChargeIntParamString,         asynParamFloat64,  &ADnEDPChargeIntParam);
   createParam(ADnEDEventUpdatePeriodParamString,  asynParamFloat64,  &ADnEDEventUpdatePeriodParam);
   createParam(ADnEDFrameUpdatePeriodParamString,  asynParamFloat64,  &ADnEDFrameUpdatePeriodParam);
+  createParam(ADnEDFrameCopyTimeParamString,      asynParamFloat64,  &ADnEDFrameCopyTimeParam);
+  createParam(ADnEDFullArrayEnableParamString,    asynParamInt32,    &ADnEDFullArrayEnableParam);
+  createParam(ADnEDDeltaEnableParamString,        asynParamInt32,    &ADnEDDeltaEnableParam);
+  createParam(ADnEDSparseEnableParamString,       asynParamInt32,    &ADnEDSparseEnableParam);
+  createParam(ADnEDEventModeEnableParamString,    asynParamInt32,    &ADnEDEventModeEnableParam);
+  createParam(ADnEDEventBatchSizeParamString,     asynParamInt32,    &ADnEDEventBatchSizeParam);
+  createParam(ADnEDPoolThreadsParamString,        asynParamInt32,    &ADnEDPoolThreadsParam);
+  createParam(ADnEDPoolChunkSizeParamString,      asynParamInt32,    &ADnEDPoolChunkSizeParam);
+  createParam(ADnEDShmEnableParamString,          asynParamInt32,    &ADnEDShmEnableParam);
+  createParam(ADnEDShmNameParamString,            asynParamOctet,    &ADnEDShmNameParam);
+  createParam(ADnEDShmFramesParamString,          asynParamInt32,    &ADnEDShmFramesParam);
+  createParam(ADnEDRecordEnableParamString,       asynParamInt32,    &ADnEDRecordEnableParam);
+  createParam(ADnEDRecordFileParamString,         asynParamOctet,    &ADnEDRecordFileParam);
+  createParam(ADnEDRecordPacketsParamString,      asynParamInt32,    &ADnEDRecordPacketsParam);
+  createParam(ADnEDRecordDroppedParamString,      asynParamInt32,    &ADnEDRecordDroppedParam);
+  createParam(ADnEDRecordPulsesParamString,       asynParamInt32,    &ADnEDRecordPulsesParam);
+  createParam(ADnEDRecordSizeParamString,         asynParamFloat64,  &ADnEDRecordSizeParam);
+  createParam(ADnEDReplayEnableParamString,       asynParamInt32,    &ADnEDReplayEnableParam);
+  createParam(ADnEDReplayFileParamString,         asynParamOctet,    &ADnEDReplayFileParam);
+  createParam(ADnEDReplayModeParamString,         asynParamInt32,    &ADnEDReplayModeParam);
+  createParam(ADnEDReplayScaleParamString,        asynParamFloat64,  &ADnEDReplayScaleParam);
+  createParam(ADnEDReplayBusyParamString,         asynParamInt32,    &ADnEDReplayBusyParam);
+  createParam(ADnEDReplayPacketsParamString,      asynParamInt32,    &ADnEDReplayPacketsParam);
+  createParam(ADnEDReplayEventsParamString,       asynParamFloat64,  &ADnEDReplayEventsParam);
+  createParam(ADnEDReplayRateParamString,         asynParamFloat64,  &ADnEDReplayRateParam);
+  createParam(ADnEDGenEnableParamString,          asynParamInt32,    &ADnEDGenEnableParam);
+  createParam(ADnEDGenRateParamString,            asynParamFloat64,  &ADnEDGenRateParam);
+  createParam(ADnEDGenEventsParamString,          asynParamInt32,    &ADnEDGenEventsParam);
+  createParam(ADnEDGenPulsesParamString,          asynParamInt32,    &ADnEDGenPulsesParam);
+  createParam(ADnEDGenLateParamString,            asynParamInt32,    &ADnEDGenLateParam);
+  createParam(ADnEDGenEventRateParamString,       asynParamFloat64,  &ADnEDGenEventRateParam);
+  createParam(ADnEDStatsResetParamString,         asynParamInt32,    &ADnEDStatsResetParam);
+  createParam(ADnEDStatsLatencyHistParamString,   asynParamInt32Array, &ADnEDStatsLatencyHistParam);
+  createParam(ADnEDStatsLatencyMeanParamString,   asynParamFloat64,  &ADnEDStatsLatencyMeanParam);
+  createParam(ADnEDStatsLatencyMaxParamString,    asynParamFloat64,  &ADnEDStatsLatencyMaxParam);
+  createParam(ADnEDStatsPacketHistParamString,    asynParamInt32Array, &ADnEDStatsPacketHistParam);
+  createParam(ADnEDStatsPacketMeanParamString,    asynParamFloat64,  &ADnEDStatsPacketMeanParam);
+  createParam(ADnEDStatsPacketMaxParamString,     asynParamFloat64,  &ADnEDStatsPacketMaxParam);
+  createParam(ADnEDStatsWorkerLockHistParamString, asynParamInt32Array, &ADnEDStatsWorkerLockHistParam);
+  createParam(ADnEDStatsWorkerLockMeanParamString, asynParamFloat64, &ADnEDStatsWorkerLockMeanParam);
+  createParam(ADnEDStatsWorkerLockMaxParamString, asynParamFloat64,  &ADnEDStatsWorkerLockMaxParam);
+  createParam(ADnEDStatsFrameLockHistParamString, asynParamInt32Array, &ADnEDStatsFrameLockHistParam);
+  createParam(ADnEDStatsFrameLockMeanParamString, asynParamFloat64,  &ADnEDStatsFrameLockMeanParam);
+  createParam(ADnEDStatsFrameLockMaxParamString,  asynParamFloat64,  &ADnEDStatsFrameLockMaxParam);
+  createParam(ADnEDStatsCopyHistParamString,      asynParamInt32Array, &ADnEDStatsCopyHistParam);
+  createParam(ADnEDStatsCopyMeanParamString,      asynParamFloat64,  &ADnEDStatsCopyMeanParam);
+  createParam(ADnEDStatsCopyMaxParamString,       asynParamFloat64,  &ADnEDStatsCopyMaxParam);
+  createParam(ADnEDStatsCallbackHistParamString,  asynParamInt32Array, &ADnEDStatsCallbackHistParam);
+  createParam(ADnEDStatsCallbackMeanParamString,  asynParamFloat64,  &ADnEDStatsCallbackMeanParam);
+  createParam(ADnEDStatsCallbackMaxParamString,   asynParamFloat64,  &ADnEDStatsCallbackMaxParam);
   createParam(ADnEDNumChannelsParamString,        asynParamInt32,    &ADnEDNumChannelsParam);
   createParam(ADnEDPVNameParamString,             asynParamOctet,    &ADnEDPVNameParam);
   createParam(ADnEDNumDetParamString,             asynParamInt32,    &ADnEDNumDetParam);
@@ -138,10 +216,17 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   createParam(ADnEDDetNDArrayTOFEndParamString,   asynParamInt32,    &ADnEDDetNDArrayTOFEndParam);
   createParam(ADnEDDetEventRateParamString,       asynParamInt32,    &ADnEDDetEventRateParam);
   createParam(ADnEDDetEventTotalParamString,      asynParamFloat64,  &ADnEDDetEventTotalParam);
+  createParam(ADnEDRejectNoDetParamString,        asynParamFloat64,  &ADnEDRejectNoDetParam);
+  createParam(ADnEDDetRejectTOFRangeParamString,  asynParamFloat64,  &ADnEDDetRejectTOFRangeParam);
+  createParam(ADnEDDetRejectTOFROIParamString,    asynParamFloat64,  &ADnEDDetRejectTOFROIParam);
+  createParam(ADnEDDetRejectPixelROIParamString,  asynParamFloat64,  &ADnEDDetRejectPixelROIParam);
+  createParam(ADnEDDetRejectTransformParamString, asynParamFloat64,  &ADnEDDetRejectTransformParam);
+  createParam(ADnEDDetRejectPlotRangeParamString, asynParamFloat64,  &ADnEDDetRejectPlotRangeParam);
   createParam(ADnEDDetTOFROIStartParamString,     asynParamInt32,    &ADnEDDetTOFROIStartParam);
   createParam(ADnEDDetTOFROISizeParamString,      asynParamInt32,    &ADnEDDetTOFROISizeParam);
   createParam(ADnEDDetTOFROIEnableParamString,    asynParamInt32,    &ADnEDDetTOFROIEnableParam);
   createParam(ADnEDDetTOFArrayResetParamString,   asynParamInt32,    &ADnEDDetTOFArrayResetParam);
+  createParam(ADnEDDetNDArrayModeParamString,     asynParamInt32,    &ADnEDDetNDArrayModeParam);
   //Params to use with ADnEDTransform
   createParam(ADnEDDetTOFTransFile0ParamString,   asynParamOctet,    &ADnEDDetTOFTransFile0Param);
   createParam(ADnEDDetTOFTransFile1ParamString,   asynParamOctet,    &ADnEDDetTOFTransFile1Param);
@@ -179,55 +264,70 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   createParam(ADnEDTOFMaxParamString,             asynParamInt32,    &ADnEDTOFMaxParam);
   createParam(ADnEDAllocSpaceParamString,         asynParamInt32,    &ADnEDAllocSpaceParam);
   createParam(ADnEDAllocSpaceStatusParamString,   asynParamInt32,    &ADnEDAllocSpaceStatusParam);
+  createParam(ADnEDAllocModeParamString,          asynParamInt32,    &ADnEDAllocModeParam);
+  createParam(ADnEDAllocPrefaultParamString,      asynParamInt32,    &ADnEDAllocPrefaultParam);
+  createParam(ADnEDAllocLockParamString,          asynParamInt32,    &ADnEDAllocLockParam);
+  createParam(ADnEDAllocMemoryParamString,        asynParamFloat64,  &ADnEDAllocMemoryParam);
+  createParam(ADnEDAllocShardMaxParamString,      asynParamInt32,    &ADnEDAllocShardMaxParam);
+  createParam(ADnEDAllocShardMemoryParamString,   asynParamFloat64,  &ADnEDAllocShardMemoryParam);
   createParam(ADnEDLastParamString,               asynParamInt32,    &ADnEDLastParam);
 
   //Initialize non static, non const, data members
   m_acquiring = 0;
-  for (int chan=0; chan<s_ADNED_MAX_CHANNELS; ++chan) {
-    m_seqCounter[chan] = 0;
-    m_seqID[chan] = 0;
-    m_lastSeqID[chan] = -1; //Init to -1 to catch packet trains stuck at zero
-  }
+  for (int chan=0; chan<m_maxChannels; ++chan) {
+    m_ChannelState[chan].seqCounter = 0;
+    m_ChannelState[chan].seqID = 0;
+    m_ChannelState[chan].lastSeqID = -1; //Init to -1 to catch packet trains stuck at zero
+    m_ChannelState[chan].numDropped = 0;
+    m_ChannelState[chan].timeStamp.put(0,0);
+    m_ChannelState[chan].timeStampLast.put(0,0);
+    m_ChannelState[chan].detEvents.resize(m_maxDets+1, 0);
+    m_ChannelState[chan].detRejects.resize((m_maxDets+1)*ADNED_REJECT_NUM, 0);
+    m_ChannelState[chan].pEventNDArray = NULL;
+    m_ChannelState[chan].eventNDArrayCount = 0;
+    m_ChannelState[chan].ingestThreadConfig = 0;
+    m_ChannelState[chan].paused = 0;
+    m_ChannelState[chan].eventMode = 0;
+    m_ChannelState[chan].eventBatchSize = 0;
+    m_ChannelState[chan].chunkSize = 0;
+  }
+  m_PoolThreadConfig.resize(m_poolThreads, 0);
   m_pulseCounter = 0;
   m_pChargeInt = 0.0;
   m_nowTimeSecs = 0.0;
   m_lastTimeSecs = 0.0;
   p_Data = NULL;
+  ADnEDMemory::init(&m_DataBlock);
+  p_DataChanged = NULL;
+  m_dataNumPages = 0;
+  p_Delta = NULL;
+  p_DeltaPages = NULL;
+  m_eventNDArrayCounter = 0;
   m_dataAlloc = true;
   m_dataMaxSize = 0;
   m_bufferMaxSize = 0;
   m_tofMax = 0;
-  for (int chan=0; chan<s_ADNED_MAX_CHANNELS; ++chan) {
-    m_TimeStamp[chan].put(0,0);
-    m_TimeStampLast[chan].put(0,0);
-  }
-
-  for (int i=0; i<=s_ADNED_MAX_DETS; ++i) {
-    p_PixelMap[i] = NULL;
-    m_PixelMapSize[i] = 0;
-    
-    m_detStartValues[i] = 0;
-    m_detEndValues[i] = 0;
-    m_detSizeValues[i] = 0;
-    m_NDArrayStartValues[i] = 0;
-    m_NDArrayTOFStartValues[i] = 0;
-    m_detTOFROIStartValues[i] = 0;
-    m_detTOFROISizeValues[i] = 0;
-    m_detTOFROIEnabled[i] = 0;
-    m_detPixelMappingEnabled[i] = 0;
-    m_detTOFTransType[i] = 0;
-    m_detTOFTransOffset[i] = 0;
-    m_detTOFTransScale[i] = 0;
-
-    m_detPixelROIStartX[i] = 0;
-    m_detPixelROISizeX[i] = 0;
-    m_detPixelROIStartY[i] = 0;
-    m_detPixelROISizeY[i] = 0;
-    m_detPixelSizeX[i] = 0;
-    m_detPixelROIEnable[i] = 0;
-
-    m_detTotalEvents[i] = 0.0;
-  }
+  m_eventsSinceLastUpdate = 0;
+
+  for (int i=0; i<=m_maxDets; ++i) {
+    m_DetState[i].pixelMapSize = 0;
+    m_DetState[i].startValue = 0;
+    m_DetState[i].endValue = 0;
+    m_DetState[i].sizeValue = 0;
+    m_DetState[i].eventsSinceLastUpdate = 0;
+    m_DetState[i].totalEvents = 0.0;
+    std::fill(m_DetState[i].totalRejects, m_DetState[i].totalRejects+ADNED_REJECT_NUM, 0.0);
+  }
+
+  //The per channel (and per pool thread) objects can't be copied, so these are arrays rather than vectors.
+  p_Histogram = new ADnEDHistogram[m_numShards];
+  p_Shard = new ADnEDShard[m_numShards];
+  p_Ring = new ADnEDRing[m_maxChannels];
+  p_LatencyStats = new ADnEDStats[m_maxChannels];
+  p_WorkerArg = new ADnEDWorkerArg[m_maxChannels];
+  p_PoolBatch = new ADnEDPoolBatch[m_maxChannels];
+  p_Pool = NULL;
+  p_Recorder = NULL;
   
   //Create the thread that reads the data 
   status = (epicsThreadCreate("ADnEDEventTask",
@@ -260,7 +360,7 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   }
   //Create a different monitor requestor for each PVAccess channel that we want to connect to. This is
   //so we can distinguish which channel caused a monitor, which is necessary in the eventHandler function.
-  for (int channel=0; channel<s_ADNED_MAX_CHANNELS; ++channel) {
+  for (int channel=0; channel<m_maxChannels; ++channel) {
     p_MonitorRequester[channel] = (shared_ptr<nEDMonitorRequester>)(new nEDMonitorRequester(monitorStr, this, channel));  
     if (!p_MonitorRequester[channel]) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s ERROR: Failed to create nEDMonitorRequester. channel: %d\n", functionName, channel);
@@ -279,11 +379,54 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   paramStatus = ((setIntegerParam(ADnEDEventRateParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setDoubleParam(ADnEDPChargeParam, 0.0) == asynSuccess) && paramStatus);
   paramStatus = ((setDoubleParam(ADnEDPChargeIntParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDFrameCopyTimeParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDFullArrayEnableParam, 1) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDDeltaEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDSparseEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDEventModeEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDEventBatchSizeParam, ADNED_EVENT_BATCH_SIZE) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDPoolThreadsParam, m_poolThreads) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDPoolChunkSizeParam, ADNED_POOL_CHUNK_SIZE) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDShmEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setStringParam(ADnEDShmNameParam, " ") == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDShmFramesParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDRecordEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setStringParam(ADnEDRecordFileParam, " ") == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDRecordPacketsParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDRecordDroppedParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDRecordPulsesParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDRecordSizeParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDReplayEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setStringParam(ADnEDReplayFileParam, " ") == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDReplayModeParam, ADNED_REPLAY_REAL_TIME) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDReplayScaleParam, 1.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDReplayBusyParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDReplayPacketsParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDReplayEventsParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDReplayRateParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDGenEnableParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDGenRateParam, 60.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDGenEventsParam, 10000) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDGenPulsesParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDGenLateParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDGenEventRateParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDStatsResetParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsPacketMeanParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsPacketMaxParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsWorkerLockMeanParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsWorkerLockMaxParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsFrameLockMeanParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsFrameLockMaxParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsCopyMeanParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsCopyMaxParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsCallbackMeanParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDStatsCallbackMaxParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDRejectNoDetParam, 0.0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDNumDetParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDNumChannelsParam, 0) == asynSuccess) && paramStatus);
   //Loop over asyn addresses for detector and channel specific params. We create both here because
   //we are using the Asyn address to handle both the detector and channel params. 
-  for (int det=0; det<=s_ADNED_MAX_DETS; det++) {
+  for (int det=0; det<std::max(m_maxDets+1, m_maxChannels); det++) {
 
     //Channel params (0-based)
     paramStatus = ((setIntegerParam(det, ADnEDSeqCounterParam, 0) == asynSuccess) && paramStatus);
@@ -292,6 +435,8 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
     paramStatus = ((setIntegerParam(det, ADnEDSeqIDMissingParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDSeqIDNumMissingParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDBadTimeStampParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(det, ADnEDBacklogParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(det, ADnEDDroppedParam, 0) == asynSuccess) && paramStatus);
 
     //Detector params (1-based) - we just don't use the addr=0 params.
     paramStatus = ((setIntegerParam(det, ADnEDDetPixelNumStartParam, 0) == asynSuccess) && paramStatus);
@@ -306,10 +451,16 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
     paramStatus = ((setIntegerParam(det, ADnEDDetNDArrayTOFEndParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDDetEventRateParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setDoubleParam(det, ADnEDDetEventTotalParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(det, ADnEDDetRejectTOFRangeParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(det, ADnEDDetRejectTOFROIParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(det, ADnEDDetRejectPixelROIParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(det, ADnEDDetRejectTransformParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(det, ADnEDDetRejectPlotRangeParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDDetTOFROIStartParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDDetTOFROISizeParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDDetTOFROIEnableParam, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(det, ADnEDDetTOFArrayResetParam, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(det, ADnEDDetNDArrayModeParam, ADNED_DET_NDARRAY_NONE) == asynSuccess) && paramStatus);
     //Params to use with ADnEDTransform
     paramStatus = ((setStringParam(det, ADnEDDetTOFTransFile0Param, " ") == asynSuccess) && paramStatus);
     paramStatus = ((setStringParam(det, ADnEDDetTOFTransFile1Param, " ") == asynSuccess) && paramStatus);
@@ -347,6 +498,12 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   paramStatus = ((setIntegerParam(ADnEDTOFMaxParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDAllocSpaceParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_OK) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDAllocModeParam, ADNED_MEMORY_DEFAULT) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDAllocPrefaultParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDAllocLockParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDAllocMemoryParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDAllocShardMaxParam, ADNED_SHARD_DEFAULT_MAX) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDAllocShardMemoryParam, 0.0) == asynSuccess) && paramStatus);
   paramStatus = ((setStringParam (ADManufacturer, "SNS") == asynSuccess) && paramStatus);
   paramStatus = ((setStringParam (ADModel, "nED areaDetector") == asynSuccess) && paramStatus);
 
@@ -356,10 +513,71 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Unable To Set Driver Parameters In Constructor.\n", functionName);
   }
 
-  for (int det=1; det<=s_ADNED_MAX_DETS; det++) {
+  for (int det=1; det<=m_maxDets; det++) {
     p_Transform[det] = new ADnEDTransform();
   }
 
+  buildConfig();
+
+  //Create the threads that histogram the packets queued by the monitor callbacks (one per channel)
+  for (int chan=0; chan<m_maxChannels; ++chan) {
+    char workerName[s_ADNED_MAX_STRING_SIZE] = {0};
+    epicsSnprintf(workerName, s_ADNED_MAX_STRING_SIZE-1, "ADnEDWorker%d", chan);
+    p_WorkerArg[chan].pDriver = this;
+    p_WorkerArg[chan].channelID = chan;
+    status = (epicsThreadCreate(workerName,
+                                epicsThreadPriorityHigh,
+                                epicsThreadGetStackSize(epicsThreadStackMedium),
+                                (EPICSTHREADFUNC)ADnEDWorkerTaskC,
+                                &p_WorkerArg[chan]) == NULL);
+    if (status) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure for %s.\n", functionName, workerName);
+      return;
+    }
+  }
+
+  //Create the pool threads that help the channel threads with large packets
+  if (m_poolThreads > 0) {
+    ADnEDPool *pPool = new ADnEDPool(m_poolThreads, ADnEDPoolTaskC, this, ADnEDPoolWakeC);
+    if (pPool->start("ADnEDPool") != 0) {
+      //Any threads that did start still use the pool object, so it is not deleted.
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to start the pool threads. Packets will not be split.\n", functionName);
+    } else {
+      p_Pool = pPool;
+    }
+  }
+
+  //Create the thread that replays recorded packets, in place of the PVAccess channels
+  status = (epicsThreadCreate("ADnEDReplayTask",
+                              epicsThreadPriorityHigh,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)ADnEDReplayTaskC,
+                              this) == NULL);
+  if (status) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure for ADnEDReplayTask.\n", functionName);
+    return;
+  }
+
+  //Create the thread that generates synthetic packets, in place of the PVAccess channels
+  status = (epicsThreadCreate("ADnEDGeneratorTask",
+                              epicsThreadPriorityHigh,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)ADnEDGeneratorTaskC,
+                              this) == NULL);
+  if (status) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s epicsThreadCreate failure for ADnEDGeneratorTask.\n", functionName);
+    return;
+  }
+
+  //Create the thread that records the raw packets to file, when that is enabled
+  ADnEDRecorder *pRecorder = new ADnEDRecorder(m_maxChannels);
+  if (pRecorder->start("ADnEDRecorder") != ADNED_RECORD_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to start the recorder thread. Recording is not available.\n", functionName);
+    delete pRecorder;
+  } else {
+    p_Recorder = pRecorder;
+  }
+
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s End Of Constructor.\n", functionName);
 
   epicsThreadSleep(1);
@@ -374,6 +592,19 @@ ADnED::~ADnED()
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "ADnED::~ADnED Called.\n");
 }
 
+/**
+ * Work out the number of asyn addresses. The detector params and 2-D plot arrays
+ * use addresses 1 to maxDets, and the channel params use 0 to maxChannels-1. The
+ * detector TOF arrays, delta frames and event mode arrays come after the detectors.
+ * @param maxDets The max number of detectors
+ * @param maxChannels The max number of PVAccess channels
+ * @return The number of asyn addresses
+ */
+int ADnED::getMaxAddr(int maxDets, int maxChannels)
+{
+  return std::max((2*maxDets)+3, maxChannels);
+}
+
 /**
  * Class function to create a PVAccess client factory
  */
@@ -407,6 +638,48 @@ void ADnED::report(FILE *fp, int details)
   fprintf(fp, "ADnED port=%s\n", this->portName);
   if (details > 0) { 
     fprintf(fp, "ADnED driver details...\n");
+    m_PixelLookup.report(fp);
+    fprintf(fp, "Event pre-pass implementation: %s\n", p_Histogram[0].getSimdName());
+    fprintf(fp, "Configuration version: %d, retired snapshots in use: %d\n",
+            m_ConfigManager.current()->m_version, m_ConfigManager.getNumRetired());
+    for (int chan=0; chan<m_maxChannels; ++chan) {
+      fprintf(fp, "Channel %d packet backlog: %d (ring size %d), dropped: %d\n",
+              chan, p_Ring[chan].getBacklog(), p_Ring[chan].getSize(),
+              epicsAtomicGetIntT(&m_ChannelState[chan].numDropped));
+    }
+    if (p_Pool != NULL) {
+      fprintf(fp, "Pool threads: %d, chunks: %d, chunks stolen: %d\n",
+              p_Pool->getNumThreads(), p_Pool->getNumChunks(), p_Pool->getNumStolen());
+    }
+    fprintf(fp, "Data buffer: %s, %lu bytes%s, shards: %s\n",
+            ADnEDMemory::getModeName(m_DataBlock.mode), 
+            static_cast<unsigned long>(ADnEDMemory::getFootprint(&m_DataBlock)),
+            m_DataBlock.locked ? " (locked)" : "", 
+            ADnEDMemory::getModeName(p_Shard[0].getMode()));
+    if (p_Recorder != NULL) {
+      fprintf(fp, "Recorder: %s, packets: %d, dropped: %d, pulses: %d\n",
+              p_Recorder->isRecording() ? "recording" : "stopped", p_Recorder->getNumPackets(),
+              p_Recorder->getNumDropped(), p_Recorder->getNumPulses());
+    }
+    m_DataMutex.lock();
+    for (int shard=0; shard<m_numShards; ++shard) {
+      fprintf(fp, "Shard %d: %lu bytes in use\n", shard,
+              static_cast<unsigned long>(p_Shard[shard].getFootprint()));
+    }
+    m_DataMutex.unlock();
+    m_Generator.report(fp);
+    fprintf(fp, "Hot path stats (times in us, packet sizes in events):\n");
+    for (int chan=0; chan<m_maxChannels; ++chan) {
+      char name[s_ADNED_MAX_STRING_SIZE] = {0};
+      epicsSnprintf(name, s_ADNED_MAX_STRING_SIZE-1, "Channel %d latency", chan);
+      p_LatencyStats[chan].report(fp, name);
+    }
+    m_PacketStats.report(fp, "Packet size");
+    m_WorkerLockStats.report(fp, "Worker lock wait");
+    m_FrameLockStats.report(fp, "Frame lock wait");
+    m_CopyStats.report(fp, "Frame copy");
+    m_CallbackStats.report(fp, "NDArray callbacks");
+    ADnEDThreadConfig::report(fp);
   }
 
   fprintf(fp, "ADnED finished.\n");
@@ -513,6 +786,52 @@ asynStatus ADnED::writeInt32(asynUser *pasynUser, epicsInt32 value)
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s. Cannot configure during acqusition.\n", functionName);
       return asynError;
     }
+  } else if (function == ADnEDRecordEnableParam) {
+    if (p_Recorder == NULL) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Recording is not available.\n", functionName);
+      return asynError;
+    }
+    if (value) {
+      char fileName[ADNED_MAX_STRING_SIZE] = {0};
+      char replayFileName[ADNED_MAX_STRING_SIZE] = {0};
+      int replayEnable = 0;
+      getStringParam(ADnEDRecordFileParam, sizeof(fileName), fileName);
+      getStringParam(ADnEDReplayFileParam, sizeof(replayFileName), replayFileName);
+      getIntegerParam(ADnEDReplayEnableParam, &replayEnable);
+      //Recording would append to the file that is being replayed.
+      if ((replayEnable) && (strcmp(fileName, replayFileName) == 0)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Cannot record to the replay file %s.\n", functionName, fileName);
+        return asynError;
+      }
+      if (p_Recorder->open(fileName) != ADNED_RECORD_OK) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to start recording to %s.\n", functionName, fileName);
+        return asynError;
+      }
+    } else {
+      p_Recorder->close();
+    }
+    updateRecordParams();
+  } else if (function == ADnEDStatsResetParam) {
+    if (value) {
+      resetStats();
+      setIntegerParam(ADnEDStatsResetParam, 0);
+    }
+  } else if ((function == ADnEDReplayEnableParam) || (function == ADnEDReplayModeParam) ||
+             (function == ADnEDGenEnableParam) || (function == ADnEDGenEventsParam)) {
+    if (adStatus == ADStatusAcquire) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s. Cannot configure during acqusition.\n", functionName);
+      return asynError;
+    }
+  } else if ((function == ADnEDAllocModeParam) || 
+             (function == ADnEDAllocPrefaultParam) || 
+             (function == ADnEDAllocLockParam) ||
+             (function == ADnEDAllocShardMaxParam)) {
+    if (adStatus != ADStatusAcquire) {
+      m_dataAlloc = true;
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s. Cannot configure during acqusition.\n", functionName);
+      return asynError;
+    }
   } else if (function == ADnEDAllocSpaceParam) {
     if (adStatus != ADStatusAcquire) {
       if (allocArray() != asynSuccess) {
@@ -529,22 +848,23 @@ asynStatus ADnED::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
   } else if (function == ADnEDNumDetParam) {
     if (adStatus != ADStatusAcquire) {
-      if (value > s_ADNED_MAX_DETS) {
+      if (value > m_maxDets) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                   "%s Error Setting Number Of Detectors. Max: %d\n", 
-                  functionName, s_ADNED_MAX_DETS);
+                  functionName, m_maxDets);
         return asynError;
       }
+      m_dataAlloc = true;
     } else {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s. Cannot configure during acqusition.\n", functionName);
       return asynError;
     } 
   } else if (function == ADnEDNumChannelsParam) {
       if (adStatus != ADStatusAcquire) {
-      if (value > s_ADNED_MAX_CHANNELS) {
+      if (value > m_maxChannels) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                   "%s Error Setting Number Of PVAccess channels. Max: %d\n", 
-                  functionName, s_ADNED_MAX_CHANNELS);
+                  functionName, m_maxChannels);
         return asynError;
       }
     } else {
@@ -552,41 +872,70 @@ asynStatus ADnED::writeInt32(asynUser *pasynUser, epicsInt32 value)
       return asynError;
     }
   } else if (function == ADnEDDetTOFTransPrintParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     printTofTrans(addr);
   } else if (function == ADnEDDetTOFTransDebugParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
+    lockShards();
     if (value != 0) {
       p_Transform[addr]->setDebug(true);
     } else {
       p_Transform[addr]->setDebug(false);
     }
+    unlockShards();
   } else if (function == ADnEDDetPixelMapPrintParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     printPixelMap(addr);
   } else if (function == ADnEDDetPixelROISizeXParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     if (value <= 0) {
       value = 1;
     }
   } else if (function == ADnEDDetPixelROIEnableParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     //If we enable Pixel ROI Filter, disable the TOF ROI Filter
     if (value == 1) {
       setIntegerParam(addr, ADnEDDetTOFROIEnableParam, 0);
     }
   } else if (function == ADnEDDetTOFROIEnableParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     //If we enable TOF ROI Filter, disable the Pixel ROI Filter
     if (value == 1) {
       setIntegerParam(addr, ADnEDDetPixelROIEnableParam, 0);
     }
   } else if (function == ADnEDDetTOFArrayResetParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     //Clear the TOF Array for this detector
     resetTOFArray(addr);
   }
 
   epicsUInt32 transIndex = 0;
   if (matchTransInt(function, transIndex)) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
+    //The channel threads use the transformation objects without the asyn port lock.
+    lockShards();
     if (p_Transform[addr]->setIntParam(transIndex, value) != ADNED_TRANSFORM_OK) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s Error loading int32 into p_Transform[%d]. transIndex: %d, value: %d\n", functionName, addr, transIndex, value);
       status = asynError;
     }
+    unlockShards();
   }
 
   if (m_dataAlloc) {
@@ -607,6 +956,10 @@ asynStatus ADnED::writeInt32(asynUser *pasynUser, epicsInt32 value)
     return(status);
   }
 
+  if (matchConfigParam(function)) {
+    buildConfig();
+  }
+
   //Do callbacks so higher layers see any changes 
   callParamCallbacks(addr);
 
@@ -635,11 +988,17 @@ asynStatus ADnED::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 
   epicsUInt32 transIndex = 0;
   if (matchTransFloat(function, transIndex)) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
+    //The channel threads use the transformation objects without the asyn port lock.
+    lockShards();
     if (p_Transform[addr]->setDoubleParam(transIndex, value) != ADNED_TRANSFORM_OK) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s Error loading float64 into p_Transform[%d]. transIndex: %d, value: %f\n", functionName, addr, transIndex, value);
       status = asynError;
     }
+    unlockShards();
   }
 
   if (function == ADnEDFrameUpdatePeriodParam) {
@@ -660,6 +1019,10 @@ asynStatus ADnED::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
               functionName, addr, function, value);
     return(status);
   }
+
+  if (matchConfigParam(function)) {
+    buildConfig();
+  }
   
   //Do callbacks so higher layers see any changes 
   callParamCallbacks(addr);
@@ -690,6 +1053,9 @@ asynStatus ADnED::writeOctet(asynUser *pasynUser, const char *value,
  
   epicsUInt32 transIndex = 0;
   if (matchTransFile(function, transIndex)) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
         
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s Set Det %d TOF Transformation (Index %d) File: %s.\n", functionName, addr, transIndex, value);
@@ -705,11 +1071,14 @@ asynStatus ADnED::writeOctet(asynUser *pasynUser, const char *value,
           pArray = static_cast<epicsFloat64 *>(calloc(arraySize, sizeof(epicsFloat64)));
         }
         file.readDataIntoDoubleArray(&pArray);
+        //The channel threads use the transformation objects without the asyn port lock.
+        lockShards();
         if (p_Transform[addr]->setDoubleArray(transIndex, pArray, arraySize) != ADNED_TRANSFORM_OK) {
           asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s Error loading array into p_Transform[%d]\n", functionName, addr);
           status = asynError;
         }
+        unlockShards();
       }
     } catch (std::exception &e) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -722,34 +1091,35 @@ asynStatus ADnED::writeOctet(asynUser *pasynUser, const char *value,
     }
     
   } else if (function == ADnEDDetPixelMapFileParam) {
+    if (checkDetAddr(addr, functionName) != asynSuccess) {
+      return asynError;
+    }
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s Set Det %d Pixel Map File: %s.\n", functionName, addr, value);
     
-    if (p_PixelMap[addr]) {
-        free(p_PixelMap[addr]);
-        p_PixelMap[addr] = NULL;
-        m_PixelMapSize[addr] = 0;
-      }
+    //The event handler may still be using the old map through its configuration
+    //snapshot, so we drop our reference rather than freeing it.
+    m_DetState[addr].pixelMap.reset();
+    m_DetState[addr].pixelMapSize = 0;
 
     try {
       ADnEDFile file = ADnEDFile(value);
       if (file.getSize() != 0) {
-        m_PixelMapSize[addr] = file.getSize();
-        if (p_PixelMap[addr] == NULL) {
-          p_PixelMap[addr] = static_cast<epicsUInt32 *>(calloc(m_PixelMapSize[addr], sizeof(epicsUInt32)));
-        }
-        file.readDataIntoIntArray(&p_PixelMap[addr]);
+        m_DetState[addr].pixelMapSize = file.getSize();
+        epicsUInt32 *pPixelMap = static_cast<epicsUInt32 *>(calloc(m_DetState[addr].pixelMapSize, sizeof(epicsUInt32)));
+        m_DetState[addr].pixelMap = std::tr1::shared_ptr<epicsUInt32>(pPixelMap, free);
+        file.readDataIntoIntArray(&pPixelMap);
         if ((status = checkPixelMap(addr)) == asynError) {
-          free(p_PixelMap[addr]);
-          p_PixelMap[addr] = NULL;
+          m_DetState[addr].pixelMap.reset();
         }
       }
     } catch (std::exception &e) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s Error parsing pixel mapping file. Det: %d. %s\n", functionName, addr, e.what());
-      free(p_PixelMap[addr]);
-      p_PixelMap[addr] = NULL;
+      m_DetState[addr].pixelMap.reset();
+      m_DetState[addr].pixelMapSize = 0;
     }
+    buildConfig();
   } else {
     // If this parameter belongs to a base class call its method 
     if (function < ADNED_FIRST_DRIVER_COMMAND) {
@@ -778,19 +1148,23 @@ asynStatus ADnED::writeOctet(asynUser *pasynUser, const char *value,
 }
 
 /**
- * For debug purposes, print pixel map array to stdout.
+ * For debug purposes, print pixel map array (with ASYN_TRACEIO_DRIVER).
  * @param det The detector number (1 based)
  */
 void ADnED::printPixelMap(epicsUInt32 det)
 { 
-  printf("ADnED::printPixelMap. Det: %d\n", det);
-  if ((m_PixelMapSize[det] > 0) && (p_PixelMap[det])) {
-    printf("m_PixelMapSize[%d]: %d\n", det, m_PixelMapSize[det]);
-    for (epicsUInt32 index=0; index<m_PixelMapSize[det]; ++index) {
-      printf("p_PixelMap[%d][%d]: %d\n", det, index, (p_PixelMap[det])[index]);
+  const char* functionName = "ADnED::printPixelMap";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s Det: %d\n", functionName, det);
+  if ((m_DetState[det].pixelMapSize > 0) && (m_DetState[det].pixelMap)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s Det: %d, pixelMapSize: %d\n", 
+              functionName, det, m_DetState[det].pixelMapSize);
+    for (epicsUInt32 index=0; index<m_DetState[det].pixelMapSize; ++index) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s Det: %d, pixelMap[%d]: %d\n", 
+                functionName, det, index, (m_DetState[det].pixelMap.get())[index]);
     }
   } else {
-    printf("No pixel mapping loaded.\n");
+    asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s No pixel mapping loaded.\n", functionName);
   }
 }
 
@@ -918,6 +1292,128 @@ bool ADnED::matchTransFloat(int asynParam, epicsUInt32 &transIndex)
   return false;
 }
 
+/**
+ * Check if a parameter is used by the event handler, in which case
+ * the configuration snapshot needs rebuilding when it changes.
+ * @param asynParam - The asyn parameter to test
+ * @return true=match, false=no match
+ */
+bool ADnED::matchConfigParam(int asynParam)
+{
+  //Unfortunately can't use switch statement here
+  if ((asynParam == ADnEDNumDetParam) ||
+      (asynParam == ADnEDDetPixelNumStartParam) ||
+      (asynParam == ADnEDDetPixelNumEndParam) ||
+      (asynParam == ADnEDDetPixelNumSizeParam) ||
+      (asynParam == ADnEDDetTOFNumBinsParam) ||
+      (asynParam == ADnEDDet2DTypeParam) ||
+      (asynParam == ADnEDDetTOFROIStartParam) ||
+      (asynParam == ADnEDDetTOFROISizeParam) ||
+      (asynParam == ADnEDDetTOFROIEnableParam) ||
+      (asynParam == ADnEDDetTOFTransTypeParam) ||
+      (asynParam == ADnEDDetTOFTransOffsetParam) ||
+      (asynParam == ADnEDDetTOFTransScaleParam) ||
+      (asynParam == ADnEDDetPixelMapEnableParam) ||
+      (asynParam == ADnEDDetPixelROIStartXParam) ||
+      (asynParam == ADnEDDetPixelROISizeXParam) ||
+      (asynParam == ADnEDDetPixelROIStartYParam) ||
+      (asynParam == ADnEDDetPixelROISizeYParam) ||
+      (asynParam == ADnEDDetPixelSizeXParam) ||
+      (asynParam == ADnEDDetPixelROIEnableParam)) {
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Build a new configuration snapshot from the parameter library and publish
+ * it to the event handler. This must be called with the asyn port locked.
+ */
+void ADnED::buildConfig(void)
+{
+  const char* functionName = "ADnED::buildConfig";
+
+  ADnEDConfigSnapshot *pConfig = new ADnEDConfigSnapshot(m_maxDets);
+
+  int numDet = 0;
+  getIntegerParam(ADnEDNumDetParam, &numDet);
+  if (numDet > m_maxDets) {
+    numDet = m_maxDets;
+  }
+  pConfig->m_numDet = numDet;
+  pConfig->m_tofMax = m_tofMax;
+  pConfig->m_valid = true;
+
+  for (int det=1; det<=numDet; det++) {
+    ADnEDDetConfig *pDetConfig = &(pConfig->m_det[det]);
+    //The layout comes from allocArray rather than the params, so it always matches
+    //the pixel lookup and the data buffers (even if the params have changed since).
+    pDetConfig->detStart = m_DetState[det].startValue;
+    pDetConfig->detEnd = m_DetState[det].endValue;
+    pDetConfig->detSize = m_DetState[det].sizeValue;
+    getIntegerParam(det, ADnEDDetNDArrayStartParam, &pDetConfig->ndArrayStart);
+    getIntegerParam(det, ADnEDDetNDArrayTOFStartParam, &pDetConfig->ndArrayTOFStart);
+    //These two params are used to filter events based on a TOF ROI
+    getIntegerParam(det, ADnEDDetTOFROIStartParam, &pDetConfig->tofROIStart);
+    getIntegerParam(det, ADnEDDetTOFROISizeParam, &pDetConfig->tofROISize);
+    getIntegerParam(det, ADnEDDetTOFROIEnableParam, &pDetConfig->tofROIEnabled);
+    //Pixel ID mapping. The snapshot holds a reference to the map, so it is not freed while in use.
+    getIntegerParam(det, ADnEDDetPixelMapEnableParam, &pDetConfig->pixelMappingEnabled);
+    if ((m_DetState[det].pixelMapSize > 0) && (m_DetState[det].pixelMap)) {
+      pDetConfig->pixelMap = m_DetState[det].pixelMap;
+      pDetConfig->pPixelMap = m_DetState[det].pixelMap.get();
+      pDetConfig->pixelMapSize = m_DetState[det].pixelMapSize;
+    }
+    //TOF Transformation
+    getIntegerParam(det, ADnEDDetTOFTransTypeParam, &pDetConfig->tofTransType);
+    getDoubleParam(det, ADnEDDetTOFTransOffsetParam, &pDetConfig->tofTransOffset);
+    getDoubleParam(det, ADnEDDetTOFTransScaleParam, &pDetConfig->tofTransScale);
+    //Pixel ID XY filter
+    getIntegerParam(det, ADnEDDetPixelROIStartXParam, &pDetConfig->pixelROIStartX);
+    getIntegerParam(det, ADnEDDetPixelROIStartYParam, &pDetConfig->pixelROIStartY);
+    getIntegerParam(det, ADnEDDetPixelROISizeXParam, &pDetConfig->pixelROISizeX);
+    getIntegerParam(det, ADnEDDetPixelROISizeYParam, &pDetConfig->pixelROISizeY);
+    getIntegerParam(det, ADnEDDetPixelSizeXParam, &pDetConfig->pixelSizeX);
+    getIntegerParam(det, ADnEDDetPixelROIEnableParam, &pDetConfig->pixelROIEnable);
+    //Type of 2-D plot and TOF binning
+    getIntegerParam(det, ADnEDDet2DTypeParam, &pDetConfig->plotType);
+    getIntegerParam(det, ADnEDDetTOFNumBinsParam, &pDetConfig->tofBins);
+    if (pDetConfig->tofBins < 1) {
+      pDetConfig->tofBins = 1;
+    } else if (static_cast<epicsUInt32>(pDetConfig->tofBins) > m_tofMax) {
+      pDetConfig->tofBins = (m_tofMax > 0) ? m_tofMax : 1;
+    }
+    pDetConfig->tofBinWidth = m_tofMax / pDetConfig->tofBins;
+    if (pDetConfig->tofBinWidth == 0) {
+      pDetConfig->tofBinWidth = 1;
+    }
+    ADnEDSimd::initDivider(pDetConfig->tofBinWidth, &pDetConfig->tofBinDivider);
+
+    if (pDetConfig->pixelROISizeX <= 0) {
+      pConfig->m_valid = false;
+    }
+  }
+
+  //Pass the TOF rebinning to the transformations, so they can calculate integer TOF bins
+  //directly. This is done with the shards locked, so the histogramming threads see the
+  //new binning and the new configuration at the same time.
+  lockShards();
+  for (int det=1; det<=numDet; det++) {
+    const ADnEDDetConfig *pDetConfig = &(pConfig->m_det[det]);
+    if (pDetConfig->tofTransScale >= 0) {
+      p_Transform[det]->setBinning(pDetConfig->tofTransScale, pDetConfig->tofTransOffset, m_tofMax);
+    } else {
+      p_Transform[det]->setBinning(1.0, 0.0, m_tofMax);
+    }
+  }
+  m_ConfigManager.publish(pConfig);
+  unlockShards();
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Published configuration version %d.\n",
+            functionName, m_ConfigManager.current()->m_version);
+}
+
 /**
  * Check the newly loaded pixel map array. If any of the values are
  * outside the pre-defined range for that detector, then clear the array,
@@ -934,14 +1430,14 @@ asynStatus ADnED::checkPixelMap(epicsUInt32 det)
   int detSizeValue = 0;
   getIntegerParam(det, ADnEDDetPixelNumSizeParam, &detSizeValue);
 
-  if ((m_PixelMapSize[det] > 0) && (p_PixelMap[det])) {
-    for (epicsUInt32 index=0; index<m_PixelMapSize[det]; ++index) {
-      if ((p_PixelMap[det])[index] > static_cast<epicsUInt32>(detSizeValue)) {
+  if ((m_DetState[det].pixelMapSize > 0) && (m_DetState[det].pixelMap)) {
+    for (epicsUInt32 index=0; index<m_DetState[det].pixelMapSize; ++index) {
+      if ((m_DetState[det].pixelMap.get())[index] > static_cast<epicsUInt32>(detSizeValue)) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                   "%s Det: %d. Pixel ID %d in mapping array was out of allowed range. Must be less than %d.\n", 
                   functionName, det, index, detSizeValue);
-        memset(p_PixelMap[det], 0, m_PixelMapSize[det]);
-        m_PixelMapSize[det] = 0;
+        memset(m_DetState[det].pixelMap.get(), 0, m_DetState[det].pixelMapSize*sizeof(epicsUInt32));
+        m_DetState[det].pixelMapSize = 0;
         status = asynError;
       }
     }
@@ -966,39 +1462,393 @@ void ADnED::resetTOFArray(epicsUInt32 det)
 
   if (m_tofMax > 0) {
     getIntegerParam(det, ADnEDDetNDArrayTOFStartParam, &tofStart);
+    m_DataMutex.lock();
     if ((p_Data != NULL) && (tofStart > 0)) {
       p_tof = p_Data + tofStart;
       memset(p_tof, 0, (m_tofMax+1)*sizeof(epicsUInt32));
+      ADnEDShard::markPages(p_DataChanged, m_dataNumPages, tofStart, m_tofMax+1);
+      clearDelta(tofStart, m_tofMax+1);
+      //Also clear any events that have not been merged yet
+      for (int shard=0; shard<m_numShards; ++shard) {
+        p_Shard[shard].lock();
+        p_Shard[shard].clear(tofStart, m_tofMax+1);
+        p_Shard[shard].unlock();
+      }
     }
+    m_DataMutex.unlock();
   } else {
     printf("ADnED::resetTOFArray. Need to alloc memory first.\n");
   }
 }
 
 /**
- * Event handler callback for monitor
+ * Lock all the shards. This stops all histogramming, and is
+ * used when changing state that the channel threads read without the
+ * asyn port lock. If the asyn port lock is needed as well, it must be taken first.
+ * The channel shards are locked before the pool shards. A channel thread holds
+ * its shard while it waits for the pool, so the pool can finish its chunks.
+ */
+void ADnED::lockShards(void)
+{
+  for (int shard=0; shard<m_numShards; ++shard) {
+    p_Shard[shard].lock();
+  }
+}
+
+/**
+ * Unlock all the shards.
+ */
+void ADnED::unlockShards(void)
+{
+  for (int shard=m_numShards-1; shard>=0; --shard) {
+    p_Shard[shard].unlock();
+  }
+}
+
+/**
+ * Merge the channel and pool shards into the data buffer. Each shard is swapped (which only 
+ * holds the shard lock for a moment) and then the standby half is merged and cleared
+ * while the channel or pool thread carries on with the other half.
+ * This must be called with m_DataMutex locked, but does not need the asyn port lock.
+ * @param delta Also collect the merged counts in p_Delta (which is allocated if needed).
+ */
+void ADnED::mergeShards(bool delta)
+{
+  const char* functionName = "ADnED::mergeShards";
+
+  epicsUInt32 *pDelta = NULL;
+  if ((delta) && (m_dataNumPages > 0)) {
+    if (p_Delta == NULL) {
+      p_Delta = static_cast<epicsUInt32*>(calloc(m_bufferMaxSize, sizeof(epicsUInt32)));
+      p_DeltaPages = static_cast<epicsUInt8*>(calloc(m_dataNumPages, sizeof(epicsUInt8)));
+      if ((p_Delta == NULL) || (p_DeltaPages == NULL)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to allocate delta buffer.\n", functionName);
+        free(p_Delta);
+        free(p_DeltaPages);
+        p_Delta = NULL;
+        p_DeltaPages = NULL;
+      }
+    }
+    //Zero the pages that had counts last time.
+    if (p_Delta != NULL) {
+      for (epicsUInt32 page=0; page<m_dataNumPages; ++page) {
+        if (p_DeltaPages[page]) {
+          epicsUInt32 start = page * ADNED_SHARD_PAGE_SIZE;
+          epicsUInt32 size = std::min(static_cast<epicsUInt32>(ADNED_SHARD_PAGE_SIZE), m_bufferMaxSize - start);
+          memset(p_Delta + start, 0, size*sizeof(epicsUInt32));
+          p_DeltaPages[page] = 0;
+        }
+      }
+      pDelta = p_Delta;
+    }
+  }
+
+  for (int shard=0; shard<m_numShards; ++shard) {
+    p_Shard[shard].lock();
+    p_Shard[shard].swap();
+    p_Shard[shard].unlock();
+    if (p_Shard[shard].getSize() == m_bufferMaxSize) {
+      p_Shard[shard].mergeInto(p_Data, p_DataChanged, pDelta, p_DeltaPages);
+    }
+  }
+}
+
+/**
+ * Wait for the worker threads to histogram the packets queued in the rings.
+ * This must be called without the asyn port lock, which the workers need.
+ * @param timeout The longest time to wait (s)
+ * @return true if the rings are empty
+ */
+bool ADnED::drainRings(epicsFloat64 timeout)
+{
+  epicsTimeStamp startTime;
+  epicsTimeStamp nowTime;
+
+  epicsTimeGetCurrent(&startTime);
+  while (1) {
+    bool empty = true;
+    for (int chan=0; (chan<m_maxChannels) && (empty); ++chan) {
+      empty = (p_Ring[chan].getBacklog() == 0);
+    }
+    if (empty) {
+      return true;
+    }
+    epicsTimeGetCurrent(&nowTime);
+    if (epicsTimeDiffInSeconds(&nowTime, &startTime) >= timeout) {
+      return false;
+    }
+    epicsThreadSleep(0.001);
+  }
+}
+
+/**
+ * Zero part of the delta buffer, so the next delta frame does not have counts
+ * from before a clear or reset. The page flags are cleared for the pages that
+ * are wholly in the region. This must be called with m_DataMutex locked.
+ * @param start The first element
+ * @param size The number of elements
+ */
+void ADnED::clearDelta(epicsUInt32 start, epicsUInt32 size)
+{
+  if ((p_Delta == NULL) || (p_DeltaPages == NULL)) {
+    return;
+  }
+  ADnEDShard::clearPages(p_Delta, p_DeltaPages, m_bufferMaxSize, start, size);
+}
+
+/**
+ * Work out the memory used by the data buffer and the shards. The shards only
+ * count the pages that have been written to (up to the last merge), so this 
+ * changes during acquisition. This must be called with m_DataMutex locked.
+ * @param pMaxShard Returns the footprint of the biggest shard.
+ * @return The total number of bytes used.
+ */
+size_t ADnED::getAllocFootprint(size_t *pMaxShard)
+{
+  size_t footprint = ADnEDMemory::getFootprint(&m_DataBlock) + m_dataNumPages*sizeof(epicsUInt8);
+  size_t maxShard = 0;
+  if (p_Delta != NULL) {
+    footprint += m_bufferMaxSize*sizeof(epicsUInt32) + m_dataNumPages*sizeof(epicsUInt8);
+  }
+  for (int shard=0; shard<m_numShards; ++shard) {
+    size_t shardFootprint = p_Shard[shard].getFootprint();
+    footprint += shardFootprint;
+    maxShard = std::max(maxShard, shardFootprint);
+  }
+  if (pMaxShard != NULL) {
+    *pMaxShard = maxShard;
+  }
+  return footprint;
+}
+
+/**
+ * Clear the data buffer and the shards.
+ * This must be called with the asyn port locked.
+ */
+void ADnED::clearData(void)
+{
+  m_DataMutex.lock();
+  if (p_Data != NULL) {
+    memset(p_Data, 0, m_bufferMaxSize*sizeof(epicsUInt32));
+    ADnEDShard::markPages(p_DataChanged, m_dataNumPages, 0, m_bufferMaxSize);
+    clearDelta(0, m_bufferMaxSize);
+  }
+  for (int shard=0; shard<m_numShards; ++shard) {
+    p_Shard[shard].lock();
+    p_Shard[shard].clear();
+    p_Shard[shard].unlock();
+  }
+  m_DataMutex.unlock();
+}
+
+/**
+ * Event handler callback for monitor. This runs in the PVAccess monitor thread
+ * for the channel. It only picks out the fields we need and queues them for the
+ * channel worker thread, so the monitor element can be released quickly.
+ * The pixel ID and TOF arrays are not copied.
  */
 void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct, epicsUInt32 channelID)
 {
   int eventDebug = 0;
+  ADnEDPacket packet;
+  epics::pvData::PVTimeStamp pvTimeStamp;
+  const char* functionName = "ADnED::eventHandler";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Event Handler. Channel ID %d\n", functionName, channelID);
+
+  //Sanity check on channelID
+  if (channelID >= static_cast<epicsUInt32>(m_maxChannels)) { //0 based
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Invalid channel ID %d.\n", functionName, channelID);
+    return;
+  }
+
+  applyThreadConfig(ADNED_THREAD_INGEST, m_ChannelState[channelID].ingestThreadConfig);
+
+  //Errors are reported by the worker thread, so that they can be rate limited.
+  try {
+    if (!pvTimeStamp.attach(pv_struct->getSubField<epics::pvData::PVStructure>(ADNED_PV_TIMESTAMP))) {
+      packet.status = ADNED_PACKET_NO_TIMESTAMP;
+    } else {
+      pvTimeStamp.get(packet.timeStamp);
+      epics::pvData::PVDoublePtr pChargePtr = pv_struct->getSubField<epics::pvData::PVDouble>(ADNED_PV_PCHARGE);
+      epics::pvData::PVUIntArrayPtr pixelsPtr = pv_struct->getSubField<epics::pvData::PVUIntArray>(ADNED_PV_PIXELS);
+      epics::pvData::PVUIntArrayPtr tofPtr = pv_struct->getSubField<epics::pvData::PVUIntArray>(ADNED_PV_TOF);
+      if (!pChargePtr) {
+        packet.status = ADNED_PACKET_NO_PCHARGE;
+      } else if ((!pixelsPtr) || (!tofPtr)) {
+        packet.pCharge = pChargePtr->get();
+        packet.status = ADNED_PACKET_NO_EVENTS;
+      } else {
+        packet.pCharge = pChargePtr->get();
+        packet.pixels = pixelsPtr->view();
+        packet.tofs = tofPtr->view();
+        if (packet.pixels.size() != packet.tofs.size()) {
+          packet.status = ADNED_PACKET_BAD_LENGTH;
+        }
+      }
+    }
+  } catch (std::exception &e)  {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+              "%s: Failed to read packet. Exception: %s\n", functionName, e.what());
+    packet.status = ADNED_PACKET_NO_TIMESTAMP;
+  }
+
+  ingestPacket(packet, channelID);
+
+  getIntegerParam(ADnEDEventDebugParam, &eventDebug);
+  if (eventDebug != 0) {
+    cout << "channelID: " << channelID << endl;
+    pv_struct->dumpValue(cout);
+    cout << endl;
+  }
+  
+}
+
+/**
+ * Queue a packet for the worker thread of a channel. If the ring is full this
+ * blocks until the worker has caught up, which pushes back on the PVAccess queue.
+ * A packet from the PVAccess channels is dropped (and counted) if the ring stays
+ * full for ADNED_RING_FULL_TIMEOUT, so the monitor callback is not held up forever.
+ * Only one thread may call this for each channel.
+ * @param packet The packet to queue (this sets the ingest time)
+ * @param channelID The channel ID (0 based)
+ * @param live The packet came from the PVAccess channels. This is false for replayed and
+ *             generated packets, which are not recorded, and wait as long as needed.
+ */
+void ADnED::ingestPacket(ADnEDPacket &packet, epicsUInt32 channelID, bool live)
+{
+  epicsTimeStamp nowTime;
+
+  if (channelID >= static_cast<epicsUInt32>(m_maxChannels)) {
+    return;
+  }
+
+  epicsTimeGetCurrent(&packet.ingestTime);
+
+  //The recorder has its own ring, and drops packets rather than blocking.
+  if ((live) && (p_Recorder != NULL)) {
+    p_Recorder->record(packet, channelID);
+  }
+
+  while (!p_Ring[channelID].push(packet)) {
+    if (live) {
+      epicsTimeGetCurrent(&nowTime);
+      if (epicsTimeDiffInSeconds(&nowTime, &packet.ingestTime) >= ADNED_RING_FULL_TIMEOUT) {
+        epicsAtomicIncrIntT(&m_ChannelState[channelID].numDropped);
+        return;
+      }
+    }
+    p_Ring[channelID].waitForSpace();
+  }
+}
+
+/**
+ * Process one packet. This is called by the worker thread for the channel. 
+ * It does the timestamp, sequence ID and proton charge accounting, and
+ * histograms the events into the channel shard.
+ * @param packet The packet from the ring
+ * @param channelID The channel ID (0 based)
+ */
+void ADnED::processPacket(const ADnEDPacket &packet, epicsUInt32 channelID)
+{
+  ADnEDChannelState *pState = &m_ChannelState[channelID];
   bool eventUpdate = false;
   bool newPulse = false;
+  bool badTimeStamp = false;
+  bool missingSeq = false;
+  bool histogram = false;
   epicsFloat64 updatePeriod = 0.0;
+  epicsUInt32 missingSeqID = 0;
+  epicsUInt32 numMissing = 0;
   int numMissingPackets = 0;
   double timeDiffSecs = 0.0;
   epicsUInt32 eventRate = 0;
   int numChanOrDet = 0;
-  const char* functionName = "ADnED::eventHandler";
+  int numChan = 0;
+  int numDet = 0;
+  int histDets = 0;
+  bool configError = false;
+  bool histError = false;
+  epicsUInt32 pixelsLength = 0;
+  epicsUInt32 pulse = 0;
+  //The settings were read with the port lock held after the last packet (or when
+  //this thread woke up), so a change applies from the next packet.
+  const int paused = pState->paused;
+  const int eventMode = pState->eventMode;
+  const int eventBatchSize = pState->eventBatchSize;
+  const int chunkSize = pState->chunkSize;
+  const char* functionName = "ADnED::processPacket";
+
+  //The timestamp and sequence ID checks only use the state of this channel, which
+  //only this thread changes during an acquisition, so they don't need the asyn port lock.
+  //If we are paused, still do timestamp and seq number checks, 
+  //otherwise we will see missing packets.
+  ++pState->seqCounter;
+  if (packet.status != ADNED_PACKET_NO_TIMESTAMP) {
+    //Compare timeStamp to last timeStamp to detect a new pulse.
+    pState->timeStamp = packet.timeStamp;
+    //Only use channel ID 0 to integrate the proton charge
+    if ((channelID == 0) && (pState->timeStampLast != pState->timeStamp)) {
+      newPulse = true;
+    }
+    if (pState->timeStampLast > pState->timeStamp) {
+      badTimeStamp = true;
+    } else {
+      pState->timeStampLast.put(pState->timeStamp.getSecondsPastEpoch(), pState->timeStamp.getNanoseconds());
+      pState->seqID = static_cast<epicsUInt32>(pState->timeStamp.getUserTag());
+      //Detect missing packets
+      if (static_cast<epicsInt32>(pState->lastSeqID) != -1) {
+        if (pState->seqID != pState->lastSeqID+1) {
+          missingSeq = true;
+          missingSeqID = pState->lastSeqID+1;
+          numMissing = pState->seqID-pState->lastSeqID+1;
+        }
+      }
+      pState->lastSeqID = pState->seqID;
+    }
+  }
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Event Handler. Channel ID %d\n", functionName, channelID);
+  if ((packet.status == ADNED_PACKET_OK) && (!badTimeStamp)) {
+    pixelsLength = static_cast<epicsUInt32>(packet.pixels.size());
+    m_PacketStats.add(pixelsLength);
+    histogram = (!paused);
+  }
+
+  if (histogram) {
+    epicsUInt32 *detEvents = &(pState->detEvents[0]);
+    epicsUInt32 *detRejects = &(pState->detRejects[0]);
+    //Histogram into this channel's shard. This only needs the shard lock, not the asyn port lock.
+    //The configuration is picked up with the shard locked, so it matches the shard layout.
+    ADnEDShard *pShard = &p_Shard[channelID];
+    pShard->lock();
+    {
+      ADnEDConfigGuard configGuard(m_ConfigManager, channelID);
+      const ADnEDConfigSnapshot *pConfig = configGuard.get();
+      //Only the counts for the configured detectors (and detector 0 for the rejects) are used.
+      histDets = std::max(0, std::min(pConfig->m_numDet, m_maxDets));
+      std::fill(detEvents, detEvents+histDets+1, 0);
+      std::fill(detRejects, detRejects+((histDets+1)*ADNED_REJECT_NUM), 0);
+      if (!pConfig->m_valid) {
+        configError = true;
+      } else if (pShard->getData() != NULL) {
+        //Large packets are split into chunks and shared with the pool threads.
+        int histStatus = ADNED_HISTOGRAM_OK;
+        if ((p_Pool != NULL) && (chunkSize > 0) && (pixelsLength >= 2*static_cast<epicsUInt32>(chunkSize))) {
+          histStatus = histogramChunks(pConfig, channelID, packet, chunkSize, detEvents, detRejects);
+        } else {
+          histStatus = histogramEvents(pConfig, channelID, packet.pixels.data(), packet.tofs.data(), 
+                                       pixelsLength, detEvents, detRejects);
+        }
+        histError = (histStatus != ADNED_HISTOGRAM_OK);
+      }
+    }
+    pShard->unlock();
+  }
 
-  /* If we are paused, still do timestamp and seq number checks, 
-     otherwise we will see missing packets.*/
-  int paused = 0;
-  getIntegerParam(ADnEDPauseParam, &paused);
+  //Everything else for this packet is done in one go with the port lock held.
+  lockStats(m_WorkerLockStats);
 
   /* Get the time and decide if we update the PVs.*/
-  lock();
   getDoubleParam(ADnEDEventUpdatePeriodParam, &updatePeriod);
   epicsTimeGetCurrent(&m_nowTime);
   m_nowTimeSecs = m_nowTime.secPastEpoch + (m_nowTime.nsec / 1.e9);
@@ -1009,263 +1859,66 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
     timeDiffSecs = m_nowTimeSecs - m_lastTimeSecs;
     m_lastTimeSecs = m_nowTimeSecs;
   }
-  unlock();
+  readWorkerSettings(channelID);
 
-  //Sanity check on channelID
-  if (channelID >= static_cast<epicsUInt32>(s_ADNED_MAX_CHANNELS)) { //0 based
-    if (eventUpdate) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Invalid channel ID %d.\n", functionName, channelID);
-    }
-    return;
-  }
-
-  int numChan = 0;
-  getIntegerParam(ADnEDNumChannelsParam, &numChan);
-  if (numChan > s_ADNED_MAX_CHANNELS) {
-    numChan = s_ADNED_MAX_CHANNELS;
+  setIntegerParam(channelID, ADnEDSeqCounterParam, pState->seqCounter);
+  setIntegerParam(channelID, ADnEDSeqIDParam, pState->seqID);
+  if (missingSeq) {
+    setIntegerParam(channelID, ADnEDSeqIDMissingParam, missingSeqID);
+    getIntegerParam(channelID, ADnEDSeqIDNumMissingParam, &numMissingPackets);
+    setIntegerParam(channelID, ADnEDSeqIDNumMissingParam, numMissingPackets+numMissing);
   }
-  int numDet = 0;
-  getIntegerParam(ADnEDNumDetParam, &numDet);
-  if (numDet > s_ADNED_MAX_DETS) {
-    numDet = s_ADNED_MAX_DETS;
-  }
-  getIntegerParam(ADnEDEventDebugParam, &eventDebug);
-  for (int det=1; det<=numDet; det++) {
-    getIntegerParam(det, ADnEDDetPixelNumStartParam, &m_detStartValues[det]);
-    getIntegerParam(det, ADnEDDetPixelNumEndParam, &m_detEndValues[det]);
-    getIntegerParam(det, ADnEDDetPixelNumSizeParam, &m_detSizeValues[det]);
-    getIntegerParam(det, ADnEDDetNDArrayStartParam, &m_NDArrayStartValues[det]);
-    getIntegerParam(det, ADnEDDetNDArrayTOFStartParam, &m_NDArrayTOFStartValues[det]);
-    //These two params are used to filter events based on a TOF ROI
-    getIntegerParam(det, ADnEDDetTOFROIStartParam, &m_detTOFROIStartValues[det]);
-    getIntegerParam(det, ADnEDDetTOFROISizeParam, &m_detTOFROISizeValues[det]);
-    getIntegerParam(det, ADnEDDetTOFROIEnableParam, &m_detTOFROIEnabled[det]);
-    //Pixel ID mapping
-    getIntegerParam(det, ADnEDDetPixelMapEnableParam, &m_detPixelMappingEnabled[det]);
-    //TOF Transformation
-    getIntegerParam(det, ADnEDDetTOFTransTypeParam, &m_detTOFTransType[det]);
-    getDoubleParam(det, ADnEDDetTOFTransOffsetParam, &m_detTOFTransOffset[det]);
-    getDoubleParam(det, ADnEDDetTOFTransScaleParam, &m_detTOFTransScale[det]);
-    //Pixel ID XY filter
-    getIntegerParam(det, ADnEDDetPixelROIStartXParam, &m_detPixelROIStartX[det]);
-    getIntegerParam(det, ADnEDDetPixelROIStartYParam, &m_detPixelROIStartY[det]);
-    getIntegerParam(det, ADnEDDetPixelROISizeXParam, &m_detPixelROISizeX[det]);
-    getIntegerParam(det, ADnEDDetPixelROISizeYParam, &m_detPixelROISizeY[det]);
-    getIntegerParam(det, ADnEDDetPixelSizeXParam, &m_detPixelSizeX[det]);
-    getIntegerParam(det, ADnEDDetPixelROIEnableParam, &m_detPixelROIEnable[det]);
-
-    if (m_detPixelROISizeX[det] <= 0) {
-      if (eventUpdate) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Invalid Pixel ROI Size X.\n", functionName);
-      }
-      return;
-    } 
+  if (badTimeStamp) {
+    setIntegerParam(channelID, ADnEDBadTimeStampParam, 1);
   }
 
-  //Compare timeStamp to last timeStamp to detect a new pulse.
-  lock();
-  ++m_seqCounter[channelID];  
-  try {
-    if (!m_PVTimeStamp.attach(pv_struct->getSubField<epics::pvData::PVStructure>(ADNED_PV_TIMESTAMP))) {
-      if (eventUpdate) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to attach PVTimeStamp.\n", functionName);
-      }
-      unlock();
-      return;
-    }
-    m_PVTimeStamp.get(m_TimeStamp[channelID]);
-    //Only use channel ID 0 to integrate the proton charge
-    if (channelID == 0) {
-      if (m_TimeStampLast[0] != m_TimeStamp[0]) {
-        newPulse = true;
-      }
-    }
-    if (m_TimeStampLast[channelID] > m_TimeStamp[channelID]) {
-      if (eventUpdate) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Backwards timeStamp detected on channel %d.\n", functionName, channelID);
-      }
-      setIntegerParam(channelID, ADnEDBadTimeStampParam, 1);
-      unlock();
-      return;
-    }
-    m_TimeStampLast[channelID].put(m_TimeStamp[channelID].getSecondsPastEpoch(), m_TimeStamp[channelID].getNanoseconds());
-    
-    m_seqID[channelID] = static_cast<epicsUInt32>(m_TimeStamp[channelID].getUserTag());
-    //Detect missing packets
-    if (static_cast<epicsInt32>(m_lastSeqID[channelID]) != -1) {
-      if (m_seqID[channelID] != m_lastSeqID[channelID]+1) {
-        setIntegerParam(channelID, ADnEDSeqIDMissingParam, m_lastSeqID[channelID]+1);
-        getIntegerParam(channelID, ADnEDSeqIDNumMissingParam, &numMissingPackets);
-        setIntegerParam(channelID, ADnEDSeqIDNumMissingParam, numMissingPackets+(m_seqID[channelID]-m_lastSeqID[channelID]+1));
-        if (eventUpdate) {
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: Missing seq ID numbers on channel %d.\n", functionName, channelID);
-        }
-      }
+  if (eventUpdate) {
+    if (packet.status == ADNED_PACKET_NO_TIMESTAMP) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to attach PVTimeStamp.\n", functionName);
+    } else if (badTimeStamp) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Backwards timeStamp detected on channel %d.\n", functionName, channelID);
+    } else if (packet.status == ADNED_PACKET_NO_PCHARGE) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s No valid pCharge found.\n", functionName);
+    } else if (packet.status == ADNED_PACKET_BAD_LENGTH) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s pixelsLength != tofLength.\n", functionName);
     }
-    m_lastSeqID[channelID] = m_seqID[channelID];
-  } catch (std::exception &e)  {
-    if (eventUpdate) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s: Failed to deal with time stamp objects. Exception: %s\n", 
-                functionName, e.what());
+    if (missingSeq) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: Missing seq ID numbers on channel %d.\n", functionName, channelID);
     }
-    unlock();
-    return;
-  }
-  unlock();
-  
-  epics::pvData::PVDoublePtr pChargePtr = pv_struct->getSubField<epics::pvData::PVDouble>(ADNED_PV_PCHARGE);
-  if (!pChargePtr) {
-    if (eventUpdate) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s No valid pCharge found.\n", functionName);
+    if (configError) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Invalid Pixel ROI Size X.\n", functionName);
+    } else if (histError) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to histogram events.\n", functionName);
     }
-    return;
   }
 
-  if ((p_Data == NULL) || (m_dataMaxSize == 0)) {
-    return;
-  }
+  if ((packet.status == ADNED_PACKET_OK) && (!badTimeStamp)) {
 
-  epics::pvData::PVUIntArrayPtr pixelsPtr = pv_struct->getSubField<epics::pvData::PVUIntArray>(ADNED_PV_PIXELS);
-  epics::pvData::PVUIntArrayPtr tofPtr = pv_struct->getSubField<epics::pvData::PVUIntArray>(ADNED_PV_TOF);
-  if (pixelsPtr && tofPtr) {
-    
-    epics::pvData::uint32 pixelsLength = pixelsPtr->getLength();
-    epics::pvData::shared_vector<const epics::pvData::uint32> pixelsData = pixelsPtr->view();
-
-    epics::pvData::uint32 tofLength = tofPtr->getLength();
-    epics::pvData::shared_vector<const epics::pvData::uint32> tofData = tofPtr->view();
-
-    if (pixelsLength != tofLength) {
-      if (eventUpdate) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s pixelsLength != tofLength.\n", functionName);
-      }
-      return;
-    }
+    //The pulse index for event mode is the pulse counter after this packet is counted.
+    pulse = newPulse ? m_pulseCounter+1 : m_pulseCounter;
 
     //Count events to calculate event rate.
     m_eventsSinceLastUpdate += pixelsLength;
 
-    lock();
-
-    if (!paused) {
-
-    int mappedPixelIndex = 0;
-    epicsFloat64 tof = 0.0;
-    epicsUInt32 tofInt = 0;
-    int plotType = 0;
-    int tofBins = 0;
-    epicsUInt32 x_pos = 0;
-    epicsUInt32 y_pos = 0;
-    int tofIndex = 0;
-    for (size_t i=0; i<pixelsLength; ++i) {
-      for (int det=1; det<=numDet; det++) {
-        
-        //Dtermine if this pixel ID is in this DET range.
-        if ((pixelsData[i] >= static_cast<epicsUInt32>(m_detStartValues[det])) 
-            && (pixelsData[i] <= static_cast<epicsUInt32>(m_detEndValues[det]))) {
-          
-          //Offset pixel ID here so this detector pixel ID range starts at 0
-          mappedPixelIndex = pixelsData[i] - m_detStartValues[det];
-
-          tof = static_cast<epicsFloat64>(tofData[i]);
-          //If enabled, do TOF tranformation (to d-space for example).
-          if (m_detTOFTransType[det] != 0) {
-            tof = p_Transform[det]->calculate(m_detTOFTransType[det], mappedPixelIndex, tofData[i]);
-            //Apply scale and offset. This is used to rebin into the available TOF array.
-            if (m_detTOFTransScale[det] >=0) {
-              tof = (tof * m_detTOFTransScale[det]) + m_detTOFTransOffset[det];
-            }
-          }
-
-          //Do pixel ID mapping if enabled
-          if (m_detPixelMappingEnabled[det]) {
-            if ((m_PixelMapSize[det] > 0) && (p_PixelMap[det])) {
-              mappedPixelIndex = (p_PixelMap[det])[pixelsData[i] - m_detStartValues[det]];
-            }
-          }
-
-	  tofInt = static_cast<epicsUInt32>(floor(tof));
-
-	  //Read type of 2-D plot and TOF binning
-	  getIntegerParam(det, ADnEDDet2DTypeParam, &plotType);
-	  getIntegerParam(det, ADnEDDetTOFNumBinsParam, &tofBins);
-	  if (tofBins < 1) {
-	    tofBins = 1;
-	  } else if (static_cast<epicsUInt32>(tofBins) > m_tofMax) { 
-	    tofBins = m_tofMax;
-	  }
-
-          //Integrate Pixel ID Data, optionally filtering on TOF ROI filter (for X/Y plot only).
-          if (m_detTOFROIEnabled[det]) {
-            if ((tof >= static_cast<epicsFloat64>(m_detTOFROIStartValues[det])) 
-                && (tof < static_cast<epicsFloat64>(m_detTOFROIStartValues[det] + m_detTOFROISizeValues[det]))) {
-              p_Data[m_NDArrayStartValues[det]+mappedPixelIndex]++;
-            }
-          } else { //No TOF ROI filter enabled. Choose which 2-D plot to produce.
-	    if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_XY) {
-	      //Standard X/Y plot
-	      p_Data[m_NDArrayStartValues[det]+mappedPixelIndex]++;
-	    } else { 
-	      if ((tof <= m_tofMax) && (tof >= 0)) {
-		if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_XTOF) {
-		  // X/TOF plot
-		  x_pos = mappedPixelIndex % m_detPixelSizeX[det]; 
-		  tofIndex = (x_pos * tofBins) + int(floor(tof / (m_tofMax / tofBins))); 
-		} else if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_YTOF) {
-		  // Y/TOF plot
-		  y_pos = int(floor(mappedPixelIndex / m_detPixelSizeX[det]));
-		  tofIndex = (y_pos * tofBins) + int(floor(tof / (m_tofMax / tofBins)));
-		} else if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_PIXELIDTOF) {
-		  // PixelID/TOF plot
-		  tofIndex = (mappedPixelIndex * tofBins) + int(floor(tof / (m_tofMax / tofBins)));
-		}
-		if (tofIndex < (m_detSizeValues[det] - 1)) {
-		  p_Data[m_NDArrayStartValues[det] + tofIndex]++;
-		}
-	      }
-	    }
-          }
-
-          //Integrate TOF/D-Space, optionally filtering on Pixel ID X/Y ROI
-          if ((tof <= m_tofMax) && (tof >= 0)) {
-            if (m_detPixelROIEnable[det]) {
-              //If pixel mapping is not enabled, this is meaningless, so just integrate as normal.
-              if (!m_detPixelMappingEnabled[det]) { 
-                p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-              } else {
-                //Only integrate TOF if we are inside pixel ID XY ROI.
-                //ROI is assumed to start from 0,0 (not from whatever is the pixel ID range). 
-                //So we need to offset, but this has already been done by the pixel mapping above.
-		if (m_detPixelSizeX[det] > 0) {
-		  if (((mappedPixelIndex % m_detPixelSizeX[det]) >= m_detPixelROIStartX[det]) && 
-		      ((mappedPixelIndex % m_detPixelSizeX[det]) < (m_detPixelROIStartX[det] + m_detPixelROISizeX[det]))) {
-		    if ((mappedPixelIndex >= (m_detPixelROIStartY[det] * m_detPixelSizeX[det])) &&
-			((mappedPixelIndex < ((m_detPixelROIStartY[det] + m_detPixelROISizeY[det]) * m_detPixelSizeX[det])))) {
-		      p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-		    }
-		  }
-		}
-              }
-            } else {
-              p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-            }
-          }
-
-          //Count events to calculate event rate
-          m_detEventsSinceLastUpdate[det]++;
-          //Count total events
-          m_detTotalEvents[det]++;
+    if (histogram) {
+      const epicsUInt32 *detEvents = &(pState->detEvents[0]);
+      const epicsUInt32 *detRejects = &(pState->detRejects[0]);
+      for (int det=1; det<=histDets; det++) {
+        //Count events to calculate event rate
+        m_DetState[det].eventsSinceLastUpdate += detEvents[det];
+        //Count total events
+        m_DetState[det].totalEvents += detEvents[det];
+      }
+      //Count the events that were not histogrammed (detector 0 is for events not in any detector)
+      for (int det=0; det<=histDets; det++) {
+        for (int reason=0; reason<ADNED_REJECT_NUM; reason++) {
+          m_DetState[det].totalRejects[reason] += detRejects[(det*ADNED_REJECT_NUM)+reason];
         }
-
       }
+      if (newPulse) {
+        m_pChargeInt += packet.pCharge;
+        ++m_pulseCounter;
       }
-    
-    if (newPulse) {
-      m_pChargeInt += pChargePtr->get();
-      ++m_pulseCounter;
-    }
-
     }
 
     //Update params at slower rate.
@@ -1273,23 +1926,39 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
     //the timer and be responsible for posting the param updates. This is why we post 
     //the updates for all the channels and detectors each time.
     if (eventUpdate) {
-      //Channel params
+      getIntegerParam(ADnEDNumChannelsParam, &numChan);
+      if (numChan > m_maxChannels) {
+        numChan = m_maxChannels;
+      }
+      getIntegerParam(ADnEDNumDetParam, &numDet);
+      if (numDet > m_maxDets) {
+        numDet = m_maxDets;
+      }
+      //Channel params (each worker sets the sequence ID params for its own channel)
       for (int chan=0; chan<numChan; ++chan) {
-	setIntegerParam(chan, ADnEDSeqCounterParam, m_seqCounter[chan]);
-	setIntegerParam(chan, ADnEDSeqIDParam, m_seqID[chan]);
+	setIntegerParam(chan, ADnEDBacklogParam, p_Ring[chan].getBacklog());
+	setIntegerParam(chan, ADnEDDroppedParam, epicsAtomicGetIntT(&m_ChannelState[chan].numDropped));
+	publishStats(p_LatencyStats[chan], chan, ADnEDStatsLatencyHistParam, 
+	             ADnEDStatsLatencyMeanParam, ADnEDStatsLatencyMaxParam, 1.e-3);
       }
+      publishStats(m_PacketStats, 0, ADnEDStatsPacketHistParam, 
+                   ADnEDStatsPacketMeanParam, ADnEDStatsPacketMaxParam, 1.0);
+      publishStats(m_WorkerLockStats, 0, ADnEDStatsWorkerLockHistParam, 
+                   ADnEDStatsWorkerLockMeanParam, ADnEDStatsWorkerLockMaxParam, 1.e-3);
       //Other params
       setIntegerParam(ADnEDPulseCounterParam, m_pulseCounter);
       eventRate = static_cast<epicsUInt32>(floor(m_eventsSinceLastUpdate/timeDiffSecs));
       setIntegerParam(ADnEDEventRateParam, eventRate);
       m_eventsSinceLastUpdate = 0;
+      setRejectParams(0);
       for (int det=1; det<=numDet; det++) {
-        eventRate = static_cast<epicsUInt32>(floor(m_detEventsSinceLastUpdate[det]/timeDiffSecs));
+        eventRate = static_cast<epicsUInt32>(floor(m_DetState[det].eventsSinceLastUpdate/timeDiffSecs));
         setIntegerParam(det, ADnEDDetEventRateParam, eventRate);
-        m_detEventsSinceLastUpdate[det] = 0;
-        setDoubleParam(det, ADnEDDetEventTotalParam, m_detTotalEvents[det]);
+        m_DetState[det].eventsSinceLastUpdate = 0;
+        setDoubleParam(det, ADnEDDetEventTotalParam, m_DetState[det].totalEvents);
+        setRejectParams(det);
       }
-      setDoubleParam(ADnEDPChargeParam, pChargePtr->get());
+      setDoubleParam(ADnEDPChargeParam, packet.pCharge);
       setDoubleParam(ADnEDPChargeIntParam, m_pChargeInt);
       //Callbacks for channel and det related parameters (so start at 0 rather than 1)
       numChanOrDet = std::max(numChan, numDet);
@@ -1298,18 +1967,410 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
       }
       callParamCallbacks();
     }
-
-    unlock();
   }
 
-  if (eventDebug != 0) {
-    cout << "channelID: " << channelID << endl;
-    pv_struct->dumpValue(cout);
-    cout << endl;
+  unlock();
+
+  //Also pass on the raw events, if event mode is enabled.
+  if ((histogram) && (eventMode) && (pixelsLength > 0)) {
+    addEvents(packet, channelID, (eventBatchSize > 0) ? eventBatchSize : 1, pulse);
   }
   
 }
 
+
+/**
+ * Read the settings used by the worker thread for a channel while it processes
+ * packets, so it doesn't need the asyn port lock to look them up. This must be 
+ * called with the asyn port lock held.
+ * @param channelID The channel ID (0 based)
+ */
+void ADnED::readWorkerSettings(epicsUInt32 channelID)
+{
+  ADnEDChannelState *pState = &m_ChannelState[channelID];
+
+  getIntegerParam(ADnEDPauseParam, &pState->paused);
+  getIntegerParam(ADnEDEventModeEnableParam, &pState->eventMode);
+  getIntegerParam(ADnEDEventBatchSizeParam, &pState->eventBatchSize);
+  getIntegerParam(ADnEDPoolChunkSizeParam, &pState->chunkSize);
+}
+/**
+ * Check that an asyn address is a detector number (1 to m_maxDets), before it
+ * is used to index the per-detector objects. The asyn address range is wider 
+ * than this, because of the TOF, delta frame, event and channel addresses.
+ * @param addr The asyn address
+ * @param functionName The calling function, for the error message
+ * @return asynSuccess or asynError
+ */
+asynStatus ADnED::checkDetAddr(int addr, const char *functionName)
+{
+  if ((addr < 1) || (addr > m_maxDets)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s Asyn address %d is not a detector (1 to %d).\n", functionName, addr, m_maxDets);
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/**
+ * Set the reject count params for a detector. For detector 0 this is
+ * the number of events that were not in any detector. This must be 
+ * called with the asyn port lock held.
+ * @param det The detector number
+ */
+void ADnED::setRejectParams(int det)
+{
+  const epicsFloat64 *pRejects = m_DetState[det].totalRejects;
+
+  if (det == 0) {
+    setDoubleParam(ADnEDRejectNoDetParam, pRejects[ADNED_REJECT_NO_DET]);
+    return;
+  }
+  setDoubleParam(det, ADnEDDetRejectTOFRangeParam, pRejects[ADNED_REJECT_TOF_RANGE]);
+  setDoubleParam(det, ADnEDDetRejectTOFROIParam, pRejects[ADNED_REJECT_TOF_ROI]);
+  setDoubleParam(det, ADnEDDetRejectPixelROIParam, pRejects[ADNED_REJECT_PIXEL_ROI]);
+  setDoubleParam(det, ADnEDDetRejectTransformParam, pRejects[ADNED_REJECT_TRANSFORM]);
+  setDoubleParam(det, ADnEDDetRejectPlotRangeParam, pRejects[ADNED_REJECT_PLOT_RANGE]);
+}
+
+/**
+ * Take the asyn port lock, and count the time spent waiting for it.
+ * @param waitStats The stats to count the wait in
+ */
+void ADnED::lockStats(ADnEDStats &waitStats)
+{
+  epicsTimeStamp startTime;
+  epicsTimeStamp endTime;
+
+  epicsTimeGetCurrent(&startTime);
+  lock();
+  epicsTimeGetCurrent(&endTime);
+  waitStats.addTime(&startTime, &endTime);
+}
+
+/**
+ * Set the params for one set of stats. The histogram is sent as an array callback,
+ * and the mean and max cover the values since the last call. This must be called 
+ * with the asyn port lock held. The caller does the param callbacks.
+ * @param stats The stats
+ * @param addr The asyn address for the params
+ * @param histParam The Int32Array param for the histogram
+ * @param meanParam The Float64 param for the mean
+ * @param maxParam The Float64 param for the max
+ * @param scale Scale applied to the mean and max (eg. to convert microseconds to ms)
+ */
+void ADnED::publishStats(ADnEDStats &stats, int addr, int histParam, int meanParam, int maxParam, epicsFloat64 scale)
+{
+  epicsInt32 buckets[ADNED_STATS_NUM_BUCKETS];
+  epicsFloat64 mean = 0.0;
+  epicsFloat64 max = 0.0;
+
+  stats.getHistogram(buckets);
+  stats.getInterval(mean, max);
+  setDoubleParam(addr, meanParam, mean * scale);
+  setDoubleParam(addr, maxParam, max * scale);
+  doCallbacksInt32Array(buckets, ADNED_STATS_NUM_BUCKETS, histParam, addr);
+}
+
+/**
+ * Reset all the hot path stats, and publish the empty stats. 
+ * This must be called with the asyn port lock held.
+ */
+void ADnED::resetStats(void)
+{
+  for (int chan=0; chan<m_maxChannels; ++chan) {
+    p_LatencyStats[chan].reset();
+    publishStats(p_LatencyStats[chan], chan, ADnEDStatsLatencyHistParam, 
+                 ADnEDStatsLatencyMeanParam, ADnEDStatsLatencyMaxParam, 1.e-3);
+    callParamCallbacks(chan);
+  }
+  m_PacketStats.reset();
+  publishStats(m_PacketStats, 0, ADnEDStatsPacketHistParam, 
+               ADnEDStatsPacketMeanParam, ADnEDStatsPacketMaxParam, 1.0);
+  m_WorkerLockStats.reset();
+  publishStats(m_WorkerLockStats, 0, ADnEDStatsWorkerLockHistParam, 
+               ADnEDStatsWorkerLockMeanParam, ADnEDStatsWorkerLockMaxParam, 1.e-3);
+  m_FrameLockStats.reset();
+  publishStats(m_FrameLockStats, 0, ADnEDStatsFrameLockHistParam, 
+               ADnEDStatsFrameLockMeanParam, ADnEDStatsFrameLockMaxParam, 1.e-3);
+  m_CopyStats.reset();
+  publishStats(m_CopyStats, 0, ADnEDStatsCopyHistParam, 
+               ADnEDStatsCopyMeanParam, ADnEDStatsCopyMaxParam, 1.e-3);
+  m_CallbackStats.reset();
+  publishStats(m_CallbackStats, 0, ADnEDStatsCallbackHistParam, 
+               ADnEDStatsCallbackMeanParam, ADnEDStatsCallbackMaxParam, 1.e-3);
+  callParamCallbacks();
+}
+
+/**
+ * Apply the ADnEDThreadConfig settings for a group to the calling thread,
+ * if they have changed. Errors are only reported once for each change.
+ * @param group The thread group (ADNED_THREAD_EVENT, etc.)
+ * @param version The version of the settings the thread last applied (kept by the thread)
+ */
+void ADnED::applyThreadConfig(int group, int &version)
+{
+  const char* functionName = "ADnED::applyThreadConfig";
+
+  if (ADnEDThreadConfig::apply(group, version) != ADNED_THREAD_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to set the CPU affinity for %s thread %s.\n", 
+              functionName, ADnEDThreadConfig::getGroupName(group), epicsThreadGetNameSelf());
+  }
+}
+
+/**
+ * Pre-fault and lock a shard, if AllocPrefault or AllocLock are set, so that its
+ * memory is placed on the NUMA node of the calling thread. The owning thread calls 
+ * this when it is woken at the start of an acquisition, so it is done before the
+ * events arrive and without holding up a packet. It does nothing if the shard has
+ * already been touched since it was allocated.
+ * @param shard The shard index (channel ID, or m_maxChannels + pool thread index)
+ */
+void ADnED::touchShard(epicsUInt32 shard)
+{
+  const char* functionName = "ADnED::touchShard";
+
+  p_Shard[shard].lock();
+  if (p_Shard[shard].touch() != ADNED_SHARD_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to lock shard %d (check ulimit -l).\n", functionName, shard);
+  }
+  p_Shard[shard].unlock();
+}
+
+/**
+ * Histogram events into a shard. The kernels mark the shard pages that they
+ * write to, so only those are merged. The shard must be locked, and must 
+ * match the layout of the configuration.
+ * @param pConfig The configuration
+ * @param shard The shard index (channel ID, or m_maxChannels + pool thread index)
+ * @param pPixels The pixel IDs
+ * @param pTofs The TOF values
+ * @param numEvents The number of events
+ * @param pDetEvents Per-detector event counts (indexed by detector number). These are added to.
+ * @param pDetRejects Per-detector reject counts (see ADnEDHistogram::process). These are added to.
+ * @return ADNED_HISTOGRAM_OK or ADNED_HISTOGRAM_ERROR
+ */
+int ADnED::histogramEvents(const ADnEDConfigSnapshot *pConfig, epicsUInt32 shard, const epicsUInt32 *pPixels,
+                           const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pDetEvents, 
+                           epicsUInt32 *pDetRejects)
+{
+  ADnEDShard *pShard = &p_Shard[shard];
+  int status = ADNED_HISTOGRAM_OK;
+
+  //The owning thread normally touches the shard when it is woken at the start 
+  //of the acquisition. This only does anything if the events got here first.
+  if (pShard->touch() != ADNED_SHARD_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "ADnED::histogramEvents Failed to lock shard %d (check ulimit -l).\n", shard);
+  }
+
+  //The kernel for each detector is chosen by the configuration.
+  status = p_Histogram[shard].process(pConfig, &m_PixelLookup, &p_Transform[0], 
+                                      pPixels, pTofs, numEvents, pShard->getData(), pDetEvents, pDetRejects,
+                                      pShard->getDirty());
+
+  return status;
+}
+
+/**
+ * Split a packet into chunks, and histogram them with the pool threads. The 
+ * channel thread does the first chunk itself, into its own shard, then waits
+ * for the pool to do the rest. This is called with the channel shard locked
+ * and the configuration held, so neither can change until the pool has finished.
+ * @param pConfig The configuration
+ * @param channelID The channel ID (0 based)
+ * @param packet The packet
+ * @param chunkSize The target number of events in each chunk
+ * @param pDetEvents Per-detector event counts (indexed by detector number). These are added to.
+ * @param pDetRejects Per-detector reject counts (see ADnEDHistogram::process). These are added to.
+ * @return ADNED_HISTOGRAM_OK or ADNED_HISTOGRAM_ERROR
+ */
+int ADnED::histogramChunks(const ADnEDConfigSnapshot *pConfig, epicsUInt32 channelID, const ADnEDPacket &packet,
+                           epicsUInt32 chunkSize, epicsUInt32 *pDetEvents, epicsUInt32 *pDetRejects)
+{
+  ADnEDChannelState *pState = &m_ChannelState[channelID];
+  ADnEDPoolBatch *pBatch = &p_PoolBatch[channelID];
+  const epicsUInt32 *pPixels = packet.pixels.data();
+  const epicsUInt32 *pTofs = packet.tofs.data();
+  epicsUInt32 numEvents = static_cast<epicsUInt32>(packet.pixels.size());
+  epicsUInt32 detSize = m_maxDets+1;
+  epicsUInt32 rejectSize = detSize*ADNED_REJECT_NUM;
+  int status = ADNED_HISTOGRAM_OK;
+
+  epicsUInt32 numChunks = std::min((numEvents + chunkSize - 1) / chunkSize, 
+                                   static_cast<epicsUInt32>(ADNED_POOL_MAX_CHUNKS));
+  epicsUInt32 eventsPerChunk = (numEvents + numChunks - 1) / numChunks;
+  //Recalculate this so that no chunk is empty.
+  numChunks = (numEvents + eventsPerChunk - 1) / eventsPerChunk;
+  if (pState->chunks.size() < numChunks) {
+    pState->chunks.resize(numChunks);
+    pState->chunkDetEvents.resize(numChunks*detSize);
+    pState->chunkDetRejects.resize(numChunks*rejectSize);
+  }
+
+  //Chunk 0 is done by this thread.
+  for (epicsUInt32 chunk=1; chunk<numChunks; ++chunk) {
+    ADnEDChunk *pChunk = &pState->chunks[chunk];
+    epicsUInt32 first = chunk*eventsPerChunk;
+    pChunk->pConfig = pConfig;
+    pChunk->pPixels = pPixels + first;
+    pChunk->pTofs = pTofs + first;
+    pChunk->numEvents = std::min(eventsPerChunk, numEvents - first);
+    pChunk->pDetEvents = &pState->chunkDetEvents[chunk*detSize];
+    std::fill(pChunk->pDetEvents, pChunk->pDetEvents + detSize, 0);
+    pChunk->pDetRejects = &pState->chunkDetRejects[chunk*rejectSize];
+    std::fill(pChunk->pDetRejects, pChunk->pDetRejects + rejectSize, 0);
+    pChunk->status = ADNED_HISTOGRAM_OK;
+    pChunk->pBatch = pBatch;
+  }
+  pBatch->start(numChunks-1);
+  p_Pool->submit(&pState->chunks[1], numChunks-1);
+
+  status = histogramEvents(pConfig, channelID, pPixels, pTofs, std::min(eventsPerChunk, numEvents), 
+                           pDetEvents, pDetRejects);
+
+  pBatch->wait();
+
+  for (epicsUInt32 chunk=1; chunk<numChunks; ++chunk) {
+    const ADnEDChunk *pChunk = &pState->chunks[chunk];
+    for (epicsUInt32 det=1; det<detSize; ++det) {
+      pDetEvents[det] += pChunk->pDetEvents[det];
+    }
+    for (epicsUInt32 i=0; i<rejectSize; ++i) {
+      pDetRejects[i] += pChunk->pDetRejects[i];
+    }
+    if (pChunk->status != ADNED_HISTOGRAM_OK) {
+      status = pChunk->status;
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Histogram one chunk of a packet. This is called by the pool threads, and
+ * uses the shard for the pool thread.
+ * @param pChunk The chunk
+ * @param worker The pool thread index (0 based)
+ */
+void ADnED::processChunk(ADnEDChunk *pChunk, epicsUInt32 worker)
+{
+  epicsUInt32 shard = m_maxChannels + worker;
+  ADnEDShard *pShard = &p_Shard[shard];
+
+  applyThreadConfig(ADNED_THREAD_POOL, m_PoolThreadConfig[worker]);
+
+  pShard->lock();
+  if (pShard->getData() != NULL) {
+    pChunk->status = histogramEvents(pChunk->pConfig, shard, pChunk->pPixels, pChunk->pTofs, 
+                                     pChunk->numEvents, pChunk->pDetEvents, pChunk->pDetRejects);
+  } else {
+    pChunk->status = ADNED_HISTOGRAM_ERROR;
+  }
+  pShard->unlock();
+}
+
+static void ADnEDPoolTaskC(void *pPvt, ADnEDChunk *pChunk, epicsUInt32 worker)
+{
+  ADnED *pDriver = (ADnED *)pPvt;
+
+  pDriver->processChunk(pChunk, worker);
+}
+
+/**
+ * Called by each pool thread when the pool is woken at the start of an acquisition.
+ * The thread settings are applied first, so the shard is touched on the right CPUs.
+ * @param worker The pool thread index (0 based)
+ */
+void ADnED::wakePoolThread(epicsUInt32 worker)
+{
+  applyThreadConfig(ADNED_THREAD_POOL, m_PoolThreadConfig[worker]);
+  touchShard(m_maxChannels + worker);
+}
+
+static void ADnEDPoolWakeC(void *pPvt, epicsUInt32 worker)
+{
+  ADnED *pDriver = (ADnED *)pPvt;
+
+  pDriver->wakePoolThread(worker);
+}
+
+/**
+ * Copy the events from a packet into the event mode NDArray for the channel. Each
+ * NDArray is published when it is full. This is called by the worker thread for the 
+ * channel, without the asyn port lock.
+ * @param packet The packet from the ring
+ * @param channelID The channel ID (0 based)
+ * @param batchSize The number of events in each NDArray
+ * @param pulse The pulse index for these events
+ */
+void ADnED::addEvents(const ADnEDPacket &packet, epicsUInt32 channelID, epicsUInt32 batchSize, epicsUInt32 pulse)
+{
+  const epicsUInt32 *pPixels = packet.pixels.data();
+  const epicsUInt32 *pTofs = packet.tofs.data();
+  epicsUInt32 numEvents = static_cast<epicsUInt32>(packet.pixels.size());
+  epicsUInt32 event = 0;
+  const char* functionName = "ADnED::addEvents";
+
+  while (event < numEvents) {
+    if (m_ChannelState[channelID].pEventNDArray == NULL) {
+      size_t dims[2] = {ADNED_EVENT_NUM_FIELDS, batchSize};
+      if ((m_ChannelState[channelID].pEventNDArray = this->pNDArrayPool->alloc(2, dims, NDUInt32, 0, NULL)) == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed.\n", functionName);
+        return;
+      }
+      m_ChannelState[channelID].eventNDArrayCount = 0;
+    }
+    NDArray *pNDArray = m_ChannelState[channelID].pEventNDArray;
+    epicsUInt32 space = static_cast<epicsUInt32>(pNDArray->dims[1].size) - m_ChannelState[channelID].eventNDArrayCount;
+    epicsUInt32 num = std::min(space, numEvents - event);
+    epicsUInt32 *pOut = static_cast<epicsUInt32 *>(pNDArray->pData) + (m_ChannelState[channelID].eventNDArrayCount * ADNED_EVENT_NUM_FIELDS);
+    for (epicsUInt32 i=0; i<num; ++i) {
+      pOut[ADNED_EVENT_FIELD_PIXEL] = pPixels[event+i];
+      pOut[ADNED_EVENT_FIELD_TOF] = pTofs[event+i];
+      pOut[ADNED_EVENT_FIELD_PULSE] = pulse;
+      pOut += ADNED_EVENT_NUM_FIELDS;
+    }
+    m_ChannelState[channelID].eventNDArrayCount += num;
+    event += num;
+    if (m_ChannelState[channelID].eventNDArrayCount == pNDArray->dims[1].size) {
+      publishEvents(channelID);
+    }
+  }
+}
+
+/**
+ * Publish the event mode NDArray for a channel, if it has any events in it. 
+ * The NDArray is cut down to the number of events. This is called by the worker 
+ * thread for the channel, without the asyn port lock.
+ * @param channelID The channel ID (0 based)
+ */
+void ADnED::publishEvents(epicsUInt32 channelID)
+{
+  epicsTimeStamp nowTime;
+  epicsInt32 channel = static_cast<epicsInt32>(channelID);
+  NDArray *pNDArray = m_ChannelState[channelID].pEventNDArray;
+  const char* functionName = "ADnED::publishEvents";
+
+  if ((pNDArray == NULL) || (m_ChannelState[channelID].eventNDArrayCount == 0)) {
+    return;
+  }
+  m_ChannelState[channelID].pEventNDArray = NULL;
+  //The events are at the start of the array, so we only need to change the dims.
+  pNDArray->dims[1].size = m_ChannelState[channelID].eventNDArrayCount;
+  m_ChannelState[channelID].eventNDArrayCount = 0;
+
+  lock();
+  epicsTimeGetCurrent(&nowTime);
+  pNDArray->uniqueId = ++m_eventNDArrayCounter;
+  pNDArray->timeStamp = nowTime.secPastEpoch + nowTime.nsec / 1.e9;
+  pNDArray->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pNDArray->timeStamp));
+  pNDArray->pAttributeList->add("CHANNEL", "PVAccess channel of the events", NDAttrInt32, &channel);
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Calling NDArray callback for channel %d\n", functionName, channelID);
+  doCallbacksGenericPointer(pNDArray, NDArrayData, getEventAddr());
+  unlock();
+  pNDArray->release();
+}
+
 /**
  * Allocate local storage for event handler. This is only done when any of the detector
  * sizes or TOF range has changed. It then publishes the start and end points of
@@ -1331,8 +2392,16 @@ asynStatus ADnED::allocArray(void)
   int detEnd = 0;
   int detSize = 0;
   int tofMax = 0;
+  int allocMode = 0;
+  int allocPrefault = 0;
+  int allocLock = 0;
+  int allocShardMax = 0;
   getIntegerParam(ADnEDNumDetParam, &numDet);
   getIntegerParam(ADnEDTOFMaxParam, &tofMax);
+  getIntegerParam(ADnEDAllocModeParam, &allocMode);
+  getIntegerParam(ADnEDAllocPrefaultParam, &allocPrefault);
+  getIntegerParam(ADnEDAllocLockParam, &allocLock);
+  getIntegerParam(ADnEDAllocShardMaxParam, &allocShardMax);
   m_tofMax = tofMax;
 
   if (numDet == 0) {
@@ -1373,8 +2442,32 @@ asynStatus ADnED::allocArray(void)
     callParamCallbacks(det);
     
     m_dataMaxSize += detSize;
+
+    m_DetState[det].startValue = detStart;
+    m_DetState[det].endValue = detEnd;
+    m_DetState[det].sizeValue = detSize;
     
   }
+
+  //The channel threads may still be processing packets, and the frame thread may be
+  //copying the data, so stop them using the lookup and data buffers while we reallocate them.
+  m_DataMutex.lock();
+  lockShards();
+
+  //Build the pixel ID to detector lookup used by the event handler.
+  std::vector<int> detStartValues(numDet+1, 0);
+  std::vector<int> detEndValues(numDet+1, 0);
+  for (int det=1; det<=numDet; det++) {
+    detStartValues[det] = m_DetState[det].startValue;
+    detEndValues[det] = m_DetState[det].endValue;
+  }
+  if (m_PixelLookup.build(numDet, &detStartValues[0], &detEndValues[0]) != ADNED_PIXEL_LOOKUP_OK) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to build pixel ID lookup.\n", functionName);
+    setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_FAIL);
+    unlockShards();
+    m_DataMutex.unlock();
+    return asynError;
+  }
   
   printf("ADnED::allocArray: final m_dataMaxSize: %d\n", m_dataMaxSize);
   printf("ADnED::allocArray: TOF Size: %d\n", numDet * (tofMax+1));
@@ -1391,14 +2484,30 @@ asynStatus ADnED::allocArray(void)
   }
 
   if (p_Data) {
-    free(p_Data);
+    ADnEDMemory::release(&m_DataBlock);
     p_Data = NULL;
   }
+  //The delta buffer is allocated again by frameTask when it is needed.
+  free(p_Delta);
+  free(p_DeltaPages);
+  p_Delta = NULL;
+  p_DeltaPages = NULL;
   
   if (!p_Data) {
     if (m_dataMaxSize != 0) {
       m_bufferMaxSize = m_dataMaxSize+(numDet * (tofMax+1));
-      p_Data = static_cast<epicsUInt32*>(calloc(m_bufferMaxSize, sizeof(epicsUInt32)));
+      ADnEDMemory::alloc(&m_DataBlock, static_cast<size_t>(m_bufferMaxSize)*sizeof(epicsUInt32), allocMode);
+      p_Data = static_cast<epicsUInt32*>(m_DataBlock.pData);
+      if ((p_Data != NULL) && (m_DataBlock.mode != allocMode)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Could not use %s, using %s.\n", functionName, 
+                  ADnEDMemory::getModeName(allocMode), ADnEDMemory::getModeName(m_DataBlock.mode));
+      }
+      if ((p_Data != NULL) && (allocPrefault)) {
+        ADnEDMemory::prefault(&m_DataBlock);
+      }
+      if ((p_Data != NULL) && (allocLock) && (ADnEDMemory::lock(&m_DataBlock) != ADNED_MEMORY_OK)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to lock data buffer (check ulimit -l).\n", functionName);
+      }
     } else {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Not allocating zero sized array.\n", functionName);
       setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_FAIL);
@@ -1415,10 +2524,51 @@ asynStatus ADnED::allocArray(void)
     status = asynError;
   }
 
+  //Start with every page marked as changed, so the first frame is published.
+  if (status == asynSuccess) {
+    free(p_DataChanged);
+    m_dataNumPages = ADnEDShard::getNumPages(m_bufferMaxSize);
+    p_DataChanged = static_cast<epicsUInt8*>(malloc(m_dataNumPages*sizeof(epicsUInt8)));
+    if (p_DataChanged == NULL) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to allocate page flags.\n", functionName);
+      setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_FAIL);
+      m_dataNumPages = 0;
+      status = asynError;
+    } else {
+      memset(p_DataChanged, 1, m_dataNumPages*sizeof(epicsUInt8));
+    }
+  }
+
+  //Each channel thread and pool thread has a private shard of the same size.
+  //Only the pages that are written to use memory, and each shard is kept to
+  //AllocShardMax (unless it is pre-faulted or locked). The shards are pre-faulted
+  //and locked by their own threads (see touchShard), so they are on the right NUMA node.
+  size_t shardMax = static_cast<size_t>(std::max(allocShardMax, 0)) * 1024 * 1024;
+  if (status == asynSuccess) {
+    for (int shard=0; shard<m_numShards; ++shard) {
+      if (p_Shard[shard].alloc(m_bufferMaxSize, allocMode, (allocPrefault != 0), 
+                               (allocLock != 0), shardMax) != ADNED_SHARD_OK) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to allocate shard %d.\n", functionName, shard);
+        setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_FAIL);
+        status = asynError;
+      }
+    }
+  }
+  size_t shardFootprint = 0;
+  size_t footprint = getAllocFootprint(&shardFootprint);
+  setDoubleParam(ADnEDAllocMemoryParam, static_cast<epicsFloat64>(footprint)/(1024.0*1024.0));
+  setDoubleParam(ADnEDAllocShardMemoryParam, static_cast<epicsFloat64>(shardFootprint)/(1024.0*1024.0));
+
   if (status == asynSuccess) {
     m_dataAlloc = false;
     setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_OK);
   }
+
+  //Pick up the new NDArray offsets and TOF range.
+  buildConfig();
+
+  unlockShards();
+  m_DataMutex.unlock();
   
   return status;
 }
@@ -1438,30 +2588,34 @@ asynStatus ADnED::clearParams(void)
   m_pChargeInt = 0.0;
   m_pulseCounter = 0;
 
-  if (p_Data != NULL) {
-    memset(p_Data, 0, m_bufferMaxSize*sizeof(epicsUInt32));
-  }
+  clearData();
 
-  for (int chan=0; chan<s_ADNED_MAX_CHANNELS; ++chan) {
+  for (int chan=0; chan<m_maxChannels; ++chan) {
     status = ((setIntegerParam(chan, ADnEDSeqCounterParam, 0) == asynSuccess) && status);
     status = ((setIntegerParam(chan, ADnEDSeqIDParam, 0) == asynSuccess) && status);
     status = ((setIntegerParam(chan, ADnEDSeqIDMissingParam, 0) == asynSuccess) && status);
     status = ((setIntegerParam(chan, ADnEDSeqIDNumMissingParam, 0) == asynSuccess) && status);
     status = ((setIntegerParam(chan, ADnEDBadTimeStampParam, 0) == asynSuccess) && status);
-    m_seqCounter[chan] = 0;
-    m_seqID[chan] = 0;
-    m_lastSeqID[chan] = -1;  
-    m_TimeStamp[chan].put(0,0);
-    m_TimeStampLast[chan].put(0,0);
+    status = ((setIntegerParam(chan, ADnEDDroppedParam, 0) == asynSuccess) && status);
+    epicsAtomicSetIntT(&m_ChannelState[chan].numDropped, 0);
+    m_ChannelState[chan].seqCounter = 0;
+    m_ChannelState[chan].seqID = 0;
+    m_ChannelState[chan].lastSeqID = -1;  
+    m_ChannelState[chan].timeStamp.put(0,0);
+    m_ChannelState[chan].timeStampLast.put(0,0);
     callParamCallbacks(chan);
   }
 
-  for (int det=0; det<=s_ADNED_MAX_DETS; ++det) {
-    m_detTotalEvents[det] = 0.0;
-    setDoubleParam(det, ADnEDDetEventTotalParam, m_detTotalEvents[det]);
+  for (int det=0; det<=m_maxDets; ++det) {
+    m_DetState[det].totalEvents = 0.0;
+    std::fill(m_DetState[det].totalRejects, m_DetState[det].totalRejects+ADNED_REJECT_NUM, 0.0);
+    setDoubleParam(det, ADnEDDetEventTotalParam, m_DetState[det].totalEvents);
+    setRejectParams(det);
     callParamCallbacks(det);
   }
 
+  resetStats();
+
   if (!status) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: Failed to clear params.\n", functionName);
     return asynError;
@@ -1481,7 +2635,10 @@ void ADnED::eventTask(void)
   bool acquire = 0;
   bool error = true;
   int numChannels = 0;
-  char pvName[s_ADNED_MAX_CHANNELS][s_ADNED_MAX_STRING_SIZE] = {{0}};
+  int replayEnable = 0;
+  int genEnable = 0;
+  char pvName[s_ADNED_MAX_STRING_SIZE] = {0};
+  int threadConfig = 0;
   const char* functionName = "ADnED::eventTask";
  
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Event Thread.\n", functionName);
@@ -1490,6 +2647,8 @@ void ADnED::eventTask(void)
 
   while (1) {
 
+    applyThreadConfig(ADNED_THREAD_EVENT, threadConfig);
+
     //Wait for a stop event, with a short timeout, to catch any that were done after last one.
     eventStatus = epicsEventWaitWithTimeout(m_stopEvent, timeout);          
     if (eventStatus == epicsEventWaitOK) {
@@ -1515,8 +2674,15 @@ void ADnED::eventTask(void)
       //Get the number of required active PVAccess channels
       numChannels = 0;
       getIntegerParam(ADnEDNumChannelsParam, &numChannels);
-      if (numChannels > s_ADNED_MAX_CHANNELS) {
-        numChannels = s_ADNED_MAX_CHANNELS;
+      if (numChannels > m_maxChannels) {
+        numChannels = m_maxChannels;
+      }
+      //In replay mode the packets come from a file, and in generator mode they are
+      //made up, so the channels are not connected.
+      getIntegerParam(ADnEDReplayEnableParam, &replayEnable);
+      getIntegerParam(ADnEDGenEnableParam, &genEnable);
+      if (replayEnable || genEnable) {
+        numChannels = 0;
       }
         
       if (allocArray() != asynSuccess) {
@@ -1527,8 +2693,15 @@ void ADnED::eventTask(void)
       } else {
       
         //Clear arrays at start of acquire every time.
-        if (p_Data != NULL) {
-          memset(p_Data, 0, m_bufferMaxSize*sizeof(epicsUInt32));
+        clearData();
+
+        //Wake the channel and pool threads, so they can touch their own shards
+        //before the events arrive.
+        for (int chan=0; chan<m_maxChannels; ++chan) {
+          p_Ring[chan].wake();
+        }
+        if (p_Pool != NULL) {
+          p_Pool->wake();
         }
       
         setIntegerParam(ADStatus, ADStatusAcquire);
@@ -1538,17 +2711,13 @@ void ADnED::eventTask(void)
         epicsEventSignal(this->m_startFrame);
         callParamCallbacks();
 
-        //Read the PV names
-        for (int chan=0; chan<numChannels; ++chan) {
-          getStringParam(chan, ADnEDPVNameParam, sizeof(pvName[chan]), pvName[chan]);
-        }
-
         //Connect channel here      
         if (!error) {
           try {
             for (int channel=0; channel<numChannels; ++channel) {
-              if (pvName[channel][0] != '0') {
-                if (setupChannelMonitor(pvName[channel], channel) != asynSuccess) {
+              getStringParam(channel, ADnEDPVNameParam, sizeof(pvName), pvName);
+              if (pvName[0] != '0') {
+                if (setupChannelMonitor(pvName, channel) != asynSuccess) {
                   throw std::runtime_error("Unknown error from setupChannelMonitor.");
                 }
               }
@@ -1570,6 +2739,15 @@ void ADnED::eventTask(void)
               p_Monitor[channel]->start();
             }
           }
+          if (replayEnable) {
+            setStringParam(ADStatusMessage, "Replaying Events");
+            epicsAtomicSetIntT(&m_replayStop, 0);
+            epicsEventSignal(this->m_startReplay);
+          } else if (genEnable) {
+            setStringParam(ADStatusMessage, "Generating Events");
+            epicsAtomicSetIntT(&m_generatorStop, 0);
+            epicsEventSignal(this->m_startGenerator);
+          }
         } else {
           cout << "Send Stop Frame" << endl;
           epicsEventSignal(this->m_stopFrame);    
@@ -1591,6 +2769,7 @@ void ADnED::eventTask(void)
     unlock();
     
     while (acquire) {
+      applyThreadConfig(ADNED_THREAD_EVENT, threadConfig);
       //Wait for a stop event, with a short timeout.
       //eventStatus = epicsEventWaitWithTimeout(m_stopEvent, timeout);      
       eventStatus = epicsEventWaitWithTimeout(m_stopEvent, 0.1);      
@@ -1601,6 +2780,20 @@ void ADnED::eventTask(void)
       }
 
       if (!acquire) {
+        //The replay and generator threads stop at the next packet (they do not need the asyn port lock to see this).
+        epicsAtomicSetIntT(&m_replayStop, 1);
+        epicsAtomicSetIntT(&m_generatorStop, 1);
+        //Stop the monitors, then let the workers histogram the packets that are already 
+        //queued, so they are in the final frame. The workers need the asyn port lock.
+        for (int channel=0; channel<numChannels; ++channel) {
+          if (p_Monitor[channel]) {
+            p_Monitor[channel]->stop();
+          }
+        }
+        if (!drainRings(ADNED_RING_DRAIN_TIMEOUT)) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s Timed out waiting for the queued packets. They will not be in the final frame.\n", functionName);
+        }
         lock();
         setIntegerParam(ADStatus, ADStatusIdle);
         cout << "Send Stop Frame" << endl;
@@ -1609,7 +2802,7 @@ void ADnED::eventTask(void)
       
     } // End of while(acquire)
 
-    //Stop monitor here
+    //Stop monitor here (if we did not get as far as acquiring)
     for (int channel=0; channel<numChannels; ++channel) {
       if (p_Monitor[channel]) {
         p_Monitor[channel]->stop();
@@ -1646,6 +2839,360 @@ static void ADnEDEventTaskC(void *drvPvt)
   pPvt->eventTask();
 }
 
+/**
+ * Worker thread for a channel. This histograms the packets queued 
+ * by the monitor callback for the channel, in the order they arrived.
+ * @param channelID The channel ID (0 based)
+ */
+void ADnED::workerTask(epicsUInt32 channelID)
+{
+  ADnEDRing *pRing = &p_Ring[channelID];
+  ADnEDPacket *pPacket = NULL;
+  epicsTimeStamp doneTime;
+  int threadConfig = 0;
+  const char* functionName = "ADnED::workerTask";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started worker for channel %d.\n", functionName, channelID);
+
+  while (1) {
+    applyThreadConfig(ADNED_THREAD_WORKER, threadConfig);
+    pPacket = pRing->front();
+    if (pPacket == NULL) {
+      //Publish any partly filled batch of events before waiting, so they are not held up.
+      publishEvents(channelID);
+      pRing->waitForData();
+      //At the start of an acquisition we are woken to touch our new shard.
+      touchShard(channelID);
+      //processPacket reads the settings again after each packet, but the first packet
+      //after a wait needs them to be up to date.
+      lock();
+      readWorkerSettings(channelID);
+      unlock();
+      continue;
+    }
+    processPacket(*pPacket, channelID);
+    epicsTimeGetCurrent(&doneTime);
+    p_LatencyStats[channelID].addTime(&pPacket->ingestTime, &doneTime);
+    //This drops our references to the event arrays.
+    pRing->pop();
+  }
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: Exiting worker for channel %d.\n", functionName, channelID);
+}
+
+static void ADnEDWorkerTaskC(void *drvPvt)
+{
+  ADnEDWorkerArg *pArg = (ADnEDWorkerArg *)drvPvt;
+
+  pArg->pDriver->workerTask(pArg->channelID);
+}
+
+/**
+ * Replay thread. When an acquisition is started in replay mode, this reads
+ * the packets from a file recorded by ADnEDRecorder and queues them with
+ * ingestPacket, in the same way as the PVAccess monitor callbacks. The packets
+ * are paced by their timestamps (real time, or faster by the scale factor), 
+ * or queued as fast as the worker threads can take them. When the file is 
+ * finished, this waits for the workers to catch up and reports the sustained 
+ * event rate. The acquisition carries on until it is stopped.
+ */
+void ADnED::replayTask(void)
+{
+  ADnEDReplayFile replayFile;
+  ADnEDPacket packet;
+  epicsUInt32 channelID = 0;
+  char fileName[ADNED_MAX_STRING_SIZE] = {0};
+  int mode = ADNED_REPLAY_REAL_TIME;
+  epicsFloat64 scale = 1.0;
+  epicsUInt32 numPackets = 0;
+  epicsFloat64 numEvents = 0.0;
+  epicsFloat64 elapsed = 0.0;
+  epicsFloat64 rate = 0.0;
+  epicsTimeStamp startTime;
+  epicsTimeStamp nowTime;
+  epicsTimeStamp updateTime;
+  epics::pvData::TimeStamp firstPacketTime;
+  bool first = true;
+  int status = ADNED_REPLAY_OK;
+  const char* functionName = "ADnED::replayTask";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Replay Thread.\n", functionName);
+
+  while (1) {
+    epicsEventWait(m_startReplay);
+
+    lock();
+    getStringParam(ADnEDReplayFileParam, sizeof(fileName), fileName);
+    getIntegerParam(ADnEDReplayModeParam, &mode);
+    getDoubleParam(ADnEDReplayScaleParam, &scale);
+    if ((mode == ADNED_REPLAY_REAL_TIME) || (scale <= 0.0)) {
+      scale = 1.0;
+    }
+    setIntegerParam(ADnEDReplayBusyParam, 1);
+    setIntegerParam(ADnEDReplayPacketsParam, 0);
+    setDoubleParam(ADnEDReplayEventsParam, 0.0);
+    setDoubleParam(ADnEDReplayRateParam, 0.0);
+    callParamCallbacks();
+    unlock();
+
+    status = replayFile.open(fileName);
+    numPackets = 0;
+    numEvents = 0.0;
+    first = true;
+    epicsTimeGetCurrent(&startTime);
+    updateTime = startTime;
+
+    while ((status == ADNED_REPLAY_OK) && (!epicsAtomicGetIntT(&m_replayStop))) {
+      status = replayFile.read(packet, channelID);
+      if (status != ADNED_REPLAY_OK) {
+        break;
+      }
+      if (channelID >= static_cast<epicsUInt32>(m_maxChannels)) {
+        continue;
+      }
+      //Wait until it is time for this packet, in short sleeps so a stop is seen.
+      if ((mode != ADNED_REPLAY_FAST) && (packet.status != ADNED_PACKET_NO_TIMESTAMP)) {
+        if (first) {
+          firstPacketTime = packet.timeStamp;
+          first = false;
+        }
+        epicsFloat64 due = (static_cast<epicsFloat64>(packet.timeStamp.getSecondsPastEpoch() - firstPacketTime.getSecondsPastEpoch()) +
+                            (packet.timeStamp.getNanoseconds() - firstPacketTime.getNanoseconds()) / 1.e9) / scale;
+        epicsTimeGetCurrent(&nowTime);
+        epicsFloat64 wait = due - epicsTimeDiffInSeconds(&nowTime, &startTime);
+        while ((wait > 0.0) && (!epicsAtomicGetIntT(&m_replayStop))) {
+          epicsThreadSleep((wait < ADNED_REPLAY_SLEEP_MAX) ? wait : ADNED_REPLAY_SLEEP_MAX);
+          wait -= ADNED_REPLAY_SLEEP_MAX;
+        }
+      }
+      ingestPacket(packet, channelID, false);
+      ++numPackets;
+      numEvents += packet.pixels.size();
+
+      epicsTimeGetCurrent(&nowTime);
+      if (epicsTimeDiffInSeconds(&nowTime, &updateTime) >= ADNED_REPLAY_UPDATE_PERIOD) {
+        updateTime = nowTime;
+        elapsed = epicsTimeDiffInSeconds(&nowTime, &startTime);
+        lock();
+        setIntegerParam(ADnEDReplayPacketsParam, numPackets);
+        setDoubleParam(ADnEDReplayEventsParam, numEvents);
+        setDoubleParam(ADnEDReplayRateParam, (elapsed > 0.0) ? numEvents/elapsed : 0.0);
+        callParamCallbacks();
+        unlock();
+      }
+    }
+    replayFile.close();
+    //Drop our references to the last packet's event arrays.
+    packet = ADnEDPacket();
+
+    //The rate is only sustained if it includes the packets still queued for the workers.
+    for (int chan=0; chan<m_maxChannels; ++chan) {
+      while ((p_Ring[chan].getBacklog() > 0) && (!epicsAtomicGetIntT(&m_replayStop))) {
+        epicsThreadSleep(0.001);
+      }
+    }
+    epicsTimeGetCurrent(&nowTime);
+    elapsed = epicsTimeDiffInSeconds(&nowTime, &startTime);
+    rate = (elapsed > 0.0) ? numEvents/elapsed : 0.0;
+
+    lock();
+    if (status == ADNED_REPLAY_ERROR) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Replay of %s failed.\n", functionName, fileName);
+      setStringParam(ADStatusMessage, "Replay Failed");
+    } else if (status == ADNED_REPLAY_END) {
+      setStringParam(ADStatusMessage, "Replay Finished");
+    }
+    printf("%s Replayed %d packets, %.0f events in %.3f s (%.0f events/s).\n", 
+           functionName, numPackets, numEvents, elapsed, rate);
+    setIntegerParam(ADnEDReplayBusyParam, 0);
+    setIntegerParam(ADnEDReplayPacketsParam, numPackets);
+    setDoubleParam(ADnEDReplayEventsParam, numEvents);
+    setDoubleParam(ADnEDReplayRateParam, rate);
+    callParamCallbacks();
+    unlock();
+  }
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: Exiting replay thread.\n", functionName);
+}
+
+static void ADnEDReplayTaskC(void *drvPvt)
+{
+  ADnED *pPvt = (ADnED *)drvPvt;
+
+  pPvt->replayTask();
+}
+
+/**
+ * Generator thread. When an acquisition is started in generator mode, this 
+ * makes a packet for each channel of the generator (see ADnEDGenerator) at
+ * the pulse rate, and queues them with ingestPacket. The packets have the
+ * current time and the pulse number as the sequence ID, like real pulses. 
+ * A rate of 0 means as fast as the worker threads can take them.
+ * 
+ * If the workers can't keep up, ingestPacket blocks, and the pulses are late.
+ * Late pulses are counted, and the schedule restarts from the late pulse
+ * rather than trying to catch up. The event rate that was achieved is
+ * reported, so the rate can be pushed up until pulses start being late.
+ */
+void ADnED::generatorTask(void)
+{
+  ADnEDPacket packet;
+  epicsUInt32 numChannels = 0;
+  int eventsPerPulse = 0;
+  epicsFloat64 rate = 0.0;
+  epicsFloat64 newRate = 0.0;
+  epicsUInt32 pulse = 0;
+  epicsUInt32 basePulse = 0;
+  int numLate = 0;
+  epicsFloat64 numEvents = 0.0;
+  epicsFloat64 lastEvents = 0.0;
+  epicsFloat64 interval = 0.0;
+  epicsTimeStamp baseTime;
+  epicsTimeStamp pulseTime;
+  epicsTimeStamp nowTime;
+  epicsTimeStamp updateTime;
+  int threadConfig = 0;
+  const char* functionName = "ADnED::generatorTask";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Generator Thread.\n", functionName);
+
+  while (1) {
+    epicsEventWait(m_startGenerator);
+
+    lock();
+    getIntegerParam(ADnEDGenEventsParam, &eventsPerPulse);
+    getDoubleParam(ADnEDGenRateParam, &rate);
+    setIntegerParam(ADnEDGenPulsesParam, 0);
+    setIntegerParam(ADnEDGenLateParam, 0);
+    setDoubleParam(ADnEDGenEventRateParam, 0.0);
+    callParamCallbacks();
+    unlock();
+
+    numChannels = m_Generator.getNumChannels();
+    if (numChannels > static_cast<epicsUInt32>(m_maxChannels)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s Generator has %d channels, but the max is %d.\n", functionName, numChannels, m_maxChannels);
+      numChannels = m_maxChannels;
+    }
+    if (m_Generator.prepare((eventsPerPulse > 0) ? eventsPerPulse : 0) != ADNED_GEN_OK) {
+      lock();
+      setStringParam(ADStatusMessage, "Generator Failed");
+      callParamCallbacks();
+      unlock();
+      continue;
+    }
+
+    pulse = 0;
+    basePulse = 0;
+    numLate = 0;
+    numEvents = 0.0;
+    lastEvents = 0.0;
+    epicsTimeGetCurrent(&baseTime);
+    updateTime = baseTime;
+
+    while (!epicsAtomicGetIntT(&m_generatorStop)) {
+      applyThreadConfig(ADNED_THREAD_INGEST, threadConfig);
+      if (rate > 0.0) {
+        pulseTime = baseTime;
+        epicsTimeAddSeconds(&pulseTime, (pulse - basePulse) / rate);
+        epicsTimeGetCurrent(&nowTime);
+        epicsFloat64 wait = epicsTimeDiffInSeconds(&pulseTime, &nowTime);
+        if (wait < -1.0/rate) {
+          ++numLate;
+          baseTime = nowTime;
+          basePulse = pulse;
+          pulseTime = nowTime;
+        }
+        while ((wait > 0.0) && (!epicsAtomicGetIntT(&m_generatorStop))) {
+          epicsThreadSleep((wait < ADNED_GEN_SLEEP_MAX) ? wait : ADNED_GEN_SLEEP_MAX);
+          wait -= ADNED_GEN_SLEEP_MAX;
+        }
+      } else {
+        epicsTimeGetCurrent(&pulseTime);
+      }
+
+      //pvData timestamps use the POSIX epoch
+      for (epicsUInt32 chan=0; chan<numChannels; ++chan) {
+        m_Generator.getPacket(pulse, chan, packet);
+        packet.timeStamp.put(static_cast<epicsInt64>(pulseTime.secPastEpoch) + POSIX_TIME_AT_EPICS_EPOCH, pulseTime.nsec);
+        packet.timeStamp.setUserTag(static_cast<int>(pulse));
+        ingestPacket(packet, chan, false);
+        numEvents += packet.pixels.size();
+      }
+      ++pulse;
+
+      epicsTimeGetCurrent(&nowTime);
+      interval = epicsTimeDiffInSeconds(&nowTime, &updateTime);
+      if (interval >= ADNED_GEN_UPDATE_PERIOD) {
+        lock();
+        setIntegerParam(ADnEDGenPulsesParam, pulse);
+        setIntegerParam(ADnEDGenLateParam, numLate);
+        setDoubleParam(ADnEDGenEventRateParam, (numEvents - lastEvents) / interval);
+        callParamCallbacks();
+        //The rate can be changed while generating. The schedule restarts from this pulse.
+        getDoubleParam(ADnEDGenRateParam, &newRate);
+        unlock();
+        if (newRate != rate) {
+          rate = newRate;
+          baseTime = nowTime;
+          basePulse = pulse;
+        }
+        updateTime = nowTime;
+        lastEvents = numEvents;
+      }
+    }
+    //Drop our references to the last packet's event arrays.
+    packet = ADnEDPacket();
+
+    lock();
+    setIntegerParam(ADnEDGenPulsesParam, pulse);
+    setIntegerParam(ADnEDGenLateParam, numLate);
+    setDoubleParam(ADnEDGenEventRateParam, 0.0);
+    callParamCallbacks();
+    unlock();
+    printf("%s Generated %d pulses, %.0f events (%d pulses late).\n", functionName, pulse, numEvents, numLate);
+  }
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: Exiting generator thread.\n", functionName);
+}
+
+static void ADnEDGeneratorTaskC(void *drvPvt)
+{
+  ADnED *pPvt = (ADnED *)drvPvt;
+
+  pPvt->generatorTask();
+}
+
+/**
+ * Set the shape of the data made by the generator. See ADnEDGenerator::config.
+ * This can't be done during acquisition.
+ * @return asynSuccess or asynError
+ */
+asynStatus ADnED::configGenerator(int numChannels, int pixelStart, int pixelEnd, int tofMax, const char *distribution)
+{
+  int adStatus = 0;
+  asynStatus status = asynSuccess;
+  const char* functionName = "ADnED::configGenerator";
+
+  if ((numChannels <= 0) || (numChannels > m_maxChannels) || (pixelStart < 0) || (pixelEnd < pixelStart) || (tofMax <= 0)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s Channels must be 1 to %d, the pixel IDs must be in order, and the TOF max must be positive.\n", functionName, m_maxChannels);
+    return asynError;
+  }
+
+  lock();
+  getIntegerParam(ADStatus, &adStatus);
+  if (adStatus == ADStatusAcquire) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s. Cannot configure during acqusition.\n", functionName);
+    status = asynError;
+  } else if (m_Generator.config(numChannels, pixelStart, pixelEnd, tofMax, distribution) != ADNED_GEN_OK) {
+    status = asynError;
+  }
+  unlock();
+
+  return status;
+}
+
 /**
  * Set up a PVAccess channel and a associated monitor.
  * This function may throw an exception.
@@ -1662,11 +3209,11 @@ asynStatus ADnED::setupChannelMonitor(const char *pvName, int channel)
   
   cout << "PV Name: " << pvName << "  Channel: " << channel << endl;
 
-  if (channel >= s_ADNED_MAX_CHANNELS) {
-    throw std::runtime_error("channel >= s_ADNED_MAX_CHANNELS.");
+  if (channel >= m_maxChannels) {
+    throw std::runtime_error("channel >= m_maxChannels.");
   }
 
-  if ((!p_ChannelRequester) || (!p_MonitorRequester)) {
+  if ((!p_ChannelRequester) || (!p_MonitorRequester[channel])) {
     throw std::runtime_error("No Channel or Monitor Requester.");
   }
 
@@ -1722,7 +3269,45 @@ void ADnED::frameTask(void)
   int arrayCallbacks = 0;
   epicsFloat64 updatePeriod = 0.0;
   epicsTimeStamp nowTime;
+  epicsTimeStamp copyStartTime;
+  epicsTimeStamp copyEndTime;
+  epicsTimeStamp callbackStartTime;
+  bool callbacksDone = false;
   NDArray *pNDArray = NULL;
+  NDArray *pDeltaNDArray = NULL;
+  int deltaEnable = 0;
+  int sparseEnable = 0;
+  bool sparse = false;
+  bool deltaSent = false;
+  size_t allocFootprint = 0;
+  size_t shardFootprint = 0;
+  int deltaCounter = 0;
+  int fullArrayEnable = 1;
+  bool frameChanged = false;
+  bool framePublished = false;
+  bool copyFailed = false;
+  bool finalFrame = false;
+  epicsTimeStamp lastMergeTime;
+  epicsFloat64 deltaTime = 0.0;
+  std::vector<NDArray *> pDetNDArray(m_maxDets+1, static_cast<NDArray *>(NULL));
+  std::vector<NDArray *> pTOFNDArray(m_maxDets+1, static_cast<NDArray *>(NULL));
+  int numDet = 0;
+  std::vector<int> detArrayMode(m_maxDets+1, 0);
+  std::vector<int> detArrayNDims(m_maxDets+1, 0);
+  std::vector<size_t> detArrayDims(2*(m_maxDets+1), 0); //Two for each detector
+  std::vector<int> detStart(m_maxDets+1, 0);
+  std::vector<int> detSize(m_maxDets+1, 0);
+  std::vector<int> tofStart(m_maxDets+1, 0);
+  int shmEnable = 0;
+  char shmName[ADNED_MAX_STRING_SIZE] = {0};
+  bool shmPublished = false;
+  bool shmError = false;
+  int recordEnable = 0;
+  ADnEDShmFrame shmFrame;
+  std::vector<ADnEDShmDet> shmDets(m_maxDets);
+  int plotType = 0;
+  int rowSize = 0;
+  int threadConfig = 0;
   const char* functionName = "ADnED::frameTask";
  
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Started Frame Thread.\n", functionName);
@@ -1748,6 +3333,9 @@ void ADnED::frameTask(void)
       asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Got Start Frame Event.\n", functionName);
       acquire = true;
       arrayCounter = 0;
+      deltaCounter = 0;
+      deltaSent = false;
+      epicsTimeGetCurrent(&lastMergeTime);
       setIntegerParam(NDArrayCounter, arrayCounter);
       //setIntegerParam(ADnEDFrameStatus, ADStatusAcquire);
       //setStringParam(ADnEDFrameStatusMessage, "Acquiring Frames");
@@ -1756,6 +3344,8 @@ void ADnED::frameTask(void)
 
     while (acquire) {
 
+      applyThreadConfig(ADNED_THREAD_FRAME, threadConfig);
+
       //Get the update period.
       getDoubleParam(ADnEDFrameUpdatePeriodParam, &updatePeriod);
       timeout = updatePeriod / 1000.0;
@@ -1763,37 +3353,221 @@ void ADnED::frameTask(void)
       //Wait for a stop event
       unlock();
       eventStatus = epicsEventWaitWithTimeout(m_stopFrame, timeout);
-      lock();
+      lockStats(m_FrameLockStats);
       if (eventStatus == epicsEventWaitOK) {
         cout << "Got Stop Frame" << endl;
         asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Got Stop Frame Event.\n", functionName);
         acquire = false;
+        //The queued packets were histogrammed before the stop, so publish a final frame
+        //with all the counts (the next start clears them).
+        finalFrame = true;
       }
 
-      if (acquire) {
-        //Copy p_Data here into an NDArray of the same size. Do array callbacks.
+      if ((acquire) || (finalFrame)) {
+        finalFrame = false;
         getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-        if (arrayCallbacks) {
-          ++arrayCounter;
+        getIntegerParam(ADnEDDeltaEnableParam, &deltaEnable);
+        getIntegerParam(ADnEDFullArrayEnableParam, &fullArrayEnable);
+        getIntegerParam(ADnEDSparseEnableParam, &sparseEnable);
+        sparse = (sparseEnable != 0);
+        //Get the layout of the per detector arrays.
+        getIntegerParam(ADnEDNumDetParam, &numDet);
+        if (numDet > m_maxDets) {
+          numDet = m_maxDets;
+        }
+        for (int det=1; det<=numDet; det++) {
+          getIntegerParam(det, ADnEDDetNDArrayModeParam, &detArrayMode[det]);
+          getIntegerParam(det, ADnEDDetNDArrayStartParam, &detStart[det]);
+          getIntegerParam(det, ADnEDDetNDArraySizeParam, &detSize[det]);
+          getIntegerParam(det, ADnEDDetNDArrayTOFStartParam, &tofStart[det]);
+          getDetArrayDims(det, detArrayNDims[det], &detArrayDims[2*det]);
+        }
+        //Open, close or rename the shared memory export, and get the frame information for it.
+        getIntegerParam(ADnEDShmEnableParam, &shmEnable);
+        getStringParam(ADnEDShmNameParam, sizeof(shmName), shmName);
+        //The segment name always starts with a /, which can be left off the param.
+        if ((shmEnable) && ((!m_Shm.isOpen()) || (strcmp(m_Shm.getName()+1, shmName+(shmName[0] == '/')) != 0))) {
+          if (m_Shm.open(shmName, m_maxDets) != ADNED_SHM_OK) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to open shared memory %s.\n", functionName, shmName);
+            setIntegerParam(ADnEDShmEnableParam, 0);
+          }
+        } else if ((!shmEnable) && (m_Shm.isOpen())) {
+          m_Shm.close();
+        }
+        if (m_Shm.isOpen()) {
+          int pulseCounter = 0;
+          getIntegerParam(ADnEDPulseCounterParam, &pulseCounter);
+          getDoubleParam(ADnEDPChargeParam, &shmFrame.pCharge);
+          getDoubleParam(ADnEDPChargeIntParam, &shmFrame.pChargeInt);
+          shmFrame.pulseCounter = pulseCounter;
+          shmFrame.numDet = numDet;
+          shmFrame.pDets = &shmDets[0];
+          for (int det=1; det<=numDet; det++) {
+            getIntegerParam(det, ADnEDDet2DTypeParam, &plotType);
+            if (plotType == ADNED_2D_PLOT_XY) {
+              getIntegerParam(det, ADnEDDetPixelSizeXParam, &rowSize);
+            } else {
+              getIntegerParam(det, ADnEDDetTOFNumBinsParam, &rowSize);
+            }
+            shmDets[det-1].start = detStart[det];
+            shmDets[det-1].size = detSize[det];
+            shmDets[det-1].rowSize = (rowSize > 0) ? rowSize : 0;
+            shmDets[det-1].plotType = plotType;
+            shmDets[det-1].tofStart = tofStart[det];
+          }
+        }
+        //Merge the shards into the data buffer, and copy p_Data into an NDArray 
+        //of the same size. This is done without the asyn port lock, so the channel threads
+        //can carry on updating their params. The shards are double buffered, so they carry
+        //on histogramming too. The data mutex is taken before the asyn port lock is released, 
+        //so the layout can't change before we copy.
+        epicsTimeGetCurrent(&copyStartTime);
+        m_DataMutex.lock();
+        unlock();
+        mergeShards(deltaEnable != 0);
+        allocFootprint = getAllocFootprint(&shardFootprint);
+        deltaTime = epicsTimeDiffInSeconds(&copyStartTime, &lastMergeTime);
+        lastMergeTime = copyStartTime;
+        //The delta frame has the counts merged just now. It is published when it is not empty,
+        //and once more when the counts stop (so rates go back to zero).
+        pDeltaNDArray = NULL;
+        if ((arrayCallbacks) && (deltaEnable) && (p_Delta != NULL)) {
+          bool deltaEmpty = true;
+          for (epicsUInt32 page=0; (page<m_dataNumPages) && (deltaEmpty); ++page) {
+            deltaEmpty = (p_DeltaPages[page] == 0);
+          }
+          if ((!deltaEmpty) || (deltaSent)) {
+            size_t dims[1] = {m_bufferMaxSize};
+            pDeltaNDArray = copyData(p_Delta, 0, 1, dims, sparse);
+          }
+          deltaSent = !deltaEmpty;
+        }
+        pNDArray = NULL;
+        framePublished = false;
+        copyFailed = false;
+        //Nothing is published if the data has not changed since the last frame.
+        frameChanged = ((p_Data != NULL) && (dataChanged(0, m_bufferMaxSize)));
+        //The full array is optional, so clients that only use the per detector arrays
+        //don't pay for copying the whole buffer.
+        if ((arrayCallbacks) && (fullArrayEnable) && (frameChanged)) {
           size_t dims[1] = {m_bufferMaxSize};
-          if ((pNDArray = this->pNDArrayPool->alloc(1, dims, NDUInt32, 0, NULL)) == NULL) {
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed.\n", functionName);
-          } else {
-            epicsTimeGetCurrent(&nowTime);
+          pNDArray = copyData(p_Data, 0, 1, dims, sparse);
+          copyFailed = (pNDArray == NULL);
+          framePublished = (pNDArray != NULL);
+        }
+        //Each detector can also have its own 2-D plot and TOF arrays. Only the changed ones are copied.
+        for (int det=1; (det<=numDet) && (arrayCallbacks) && (frameChanged); det++) {
+          if (detArrayMode[det] != ADNED_DET_NDARRAY_NONE) {
+            size_t tofDims[1] = {m_tofMax+1};
+            if (dataChanged(detStart[det], detSize[det])) {
+              pDetNDArray[det] = copyData(p_Data, detStart[det], detArrayNDims[det], &detArrayDims[2*det], sparse);
+              copyFailed = ((copyFailed) || (pDetNDArray[det] == NULL));
+              framePublished = ((framePublished) || (pDetNDArray[det] != NULL));
+            }
+            if (dataChanged(tofStart[det], m_tofMax+1)) {
+              pTOFNDArray[det] = copyData(p_Data, tofStart[det], 1, tofDims, sparse);
+              copyFailed = ((copyFailed) || (pTOFNDArray[det] == NULL));
+              framePublished = ((framePublished) || (pTOFNDArray[det] != NULL));
+            }
+          }
+        }
+        //Copy the changed pages into the shared memory segment.
+        shmPublished = false;
+        if ((m_Shm.isOpen()) && (p_Data != NULL) && (dataChanged(0, m_bufferMaxSize))) {
+          shmFrame.tofMax = m_tofMax;
+          for (int det=1; det<=numDet; det++) {
+            shmDets[det-1].tofSize = m_tofMax+1;
+          }
+          shmPublished = (m_Shm.publish(p_Data, m_bufferMaxSize, p_DataChanged, m_dataNumPages, &shmFrame) == ADNED_SHM_OK);
+          shmError = !shmPublished;
+        }
+        //The page flags are cleared once everything that uses them has published. They are kept
+        //if a copy failed, so it is tried again next frame.
+        if ((frameChanged) && (!copyFailed) && ((arrayCallbacks) || (shmPublished))) {
+          memset(p_DataChanged, 0, m_dataNumPages*sizeof(epicsUInt8));
+        }
+        m_DataMutex.unlock();
+        epicsTimeGetCurrent(&copyEndTime);
+        m_CopyStats.addTime(&copyStartTime, &copyEndTime);
+        lockStats(m_FrameLockStats);
+        setDoubleParam(ADnEDFrameCopyTimeParam, epicsTimeDiffInSeconds(&copyEndTime, &copyStartTime) * 1000.0);
+        setDoubleParam(ADnEDAllocMemoryParam, static_cast<epicsFloat64>(allocFootprint)/(1024.0*1024.0));
+        setDoubleParam(ADnEDAllocShardMemoryParam, static_cast<epicsFloat64>(shardFootprint)/(1024.0*1024.0));
+        if (shmPublished) {
+          setIntegerParam(ADnEDShmFramesParam, m_Shm.getNumFrames());
+        }
+        //The recorder stops by itself if a write fails.
+        getIntegerParam(ADnEDRecordEnableParam, &recordEnable);
+        if ((recordEnable) && (p_Recorder != NULL) && (!p_Recorder->isRecording())) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Recording has stopped.\n", functionName);
+          setIntegerParam(ADnEDRecordEnableParam, 0);
+        }
+        updateRecordParams();
+        if (shmError) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s Failed to write shared memory %s.\n", functionName, shmName);
+          setIntegerParam(ADnEDShmEnableParam, 0);
+          shmError = false;
+        }
+
+        //Do array callbacks.
+        epicsTimeGetCurrent(&callbackStartTime);
+        callbacksDone = ((pDeltaNDArray != NULL) || (framePublished));
+        if (framePublished) {
+          ++arrayCounter;
+          epicsTimeGetCurrent(&nowTime);
+          if (pNDArray != NULL) {
             pNDArray->uniqueId = arrayCounter;
             pNDArray->timeStamp = nowTime.secPastEpoch + nowTime.nsec / 1.e9;
             pNDArray->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pNDArray->timeStamp));
-            lock();
-            memcpy(pNDArray->pData, p_Data, m_bufferMaxSize * sizeof(epicsUInt32));
             asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Calling NDArray callback\n", functionName);
             doCallbacksGenericPointer(pNDArray, NDArrayData, 0);
+            //Free the NDArray 
+            pNDArray->release();
+            pNDArray = NULL;
+          }
+          for (int det=1; det<=numDet; det++) {
+            if (pDetNDArray[det] != NULL) {
+              pDetNDArray[det]->uniqueId = arrayCounter;
+              pDetNDArray[det]->timeStamp = nowTime.secPastEpoch + nowTime.nsec / 1.e9;
+              pDetNDArray[det]->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pDetNDArray[det]->timeStamp));
+              doCallbacksGenericPointer(pDetNDArray[det], NDArrayData, det);
+              pDetNDArray[det]->release();
+              pDetNDArray[det] = NULL;
+            }
+            if (pTOFNDArray[det] != NULL) {
+              pTOFNDArray[det]->uniqueId = arrayCounter;
+              pTOFNDArray[det]->timeStamp = nowTime.secPastEpoch + nowTime.nsec / 1.e9;
+              pTOFNDArray[det]->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pTOFNDArray[det]->timeStamp));
+              doCallbacksGenericPointer(pTOFNDArray[det], NDArrayData, getDetTOFAddr(det));
+              pTOFNDArray[det]->release();
+              pTOFNDArray[det] = NULL;
+            }
           }
 
-          //Free the NDArray 
-          pNDArray->release();
           setIntegerParam(NDArrayCounter, arrayCounter);          
-          callParamCallbacks();
         }
+        if (pDeltaNDArray != NULL) {
+          ++deltaCounter;
+          epicsTimeGetCurrent(&nowTime);
+          pDeltaNDArray->uniqueId = deltaCounter;
+          pDeltaNDArray->timeStamp = nowTime.secPastEpoch + nowTime.nsec / 1.e9;
+          pDeltaNDArray->pAttributeList->add("TIMESTAMP", "Host Timestamp", NDAttrFloat64, &(pDeltaNDArray->timeStamp));
+          pDeltaNDArray->pAttributeList->add("DELTA_TIME", "Time covered by the delta frame (s)", NDAttrFloat64, &deltaTime);
+          doCallbacksGenericPointer(pDeltaNDArray, NDArrayData, getDeltaAddr());
+          pDeltaNDArray->release();
+          pDeltaNDArray = NULL;
+        }
+        if (callbacksDone) {
+          epicsTimeGetCurrent(&nowTime);
+          m_CallbackStats.addTime(&callbackStartTime, &nowTime);
+        }
+        publishStats(m_FrameLockStats, 0, ADnEDStatsFrameLockHistParam, 
+                     ADnEDStatsFrameLockMeanParam, ADnEDStatsFrameLockMaxParam, 1.e-3);
+        publishStats(m_CopyStats, 0, ADnEDStatsCopyHistParam, 
+                     ADnEDStatsCopyMeanParam, ADnEDStatsCopyMaxParam, 1.e-3);
+        publishStats(m_CallbackStats, 0, ADnEDStatsCallbackHistParam, 
+                     ADnEDStatsCallbackMeanParam, ADnEDStatsCallbackMaxParam, 1.e-3);
+        callParamCallbacks();
 
       }
       
@@ -1807,6 +3581,176 @@ void ADnED::frameTask(void)
 }
 
 
+/**
+ * Work out the dimensions of the 2-D plot NDArray for a detector. If the plot
+ * does not divide into rows (or ADNED_DET_NDARRAY_1D is selected) it is published 
+ * as a 1-D array of the whole region. Any partial last row is left off the 2-D array.
+ * This must be called with the asyn port locked.
+ * @param det The detector number (1 based)
+ * @param ndims Returns the number of dimensions
+ * @param dims Returns the dimensions (must have space for 2)
+ */
+void ADnED::getDetArrayDims(int det, int &ndims, size_t *dims)
+{
+  int mode = ADNED_DET_NDARRAY_NONE;
+  int detSize = 0;
+  int plotType = 0;
+  int rowSize = 0;
+
+  getIntegerParam(det, ADnEDDetNDArrayModeParam, &mode);
+  getIntegerParam(det, ADnEDDetNDArraySizeParam, &detSize);
+  getIntegerParam(det, ADnEDDet2DTypeParam, &plotType);
+  if (plotType == ADNED_2D_PLOT_XY) {
+    getIntegerParam(det, ADnEDDetPixelSizeXParam, &rowSize);
+  } else {
+    getIntegerParam(det, ADnEDDetTOFNumBinsParam, &rowSize);
+  }
+
+  ndims = 1;
+  dims[0] = (detSize > 0) ? detSize : 0;
+  dims[1] = 1;
+  if ((mode == ADNED_DET_NDARRAY_2D) && (rowSize > 0) && (rowSize <= detSize)) {
+    ndims = 2;
+    dims[0] = rowSize;
+    dims[1] = detSize / rowSize;
+  }
+}
+
+/**
+ * Copy the recorder counters into the params. This must be called with the asyn port locked.
+ */
+void ADnED::updateRecordParams(void)
+{
+  if (p_Recorder == NULL) {
+    return;
+  }
+  setIntegerParam(ADnEDRecordPacketsParam, p_Recorder->getNumPackets());
+  setIntegerParam(ADnEDRecordDroppedParam, p_Recorder->getNumDropped());
+  setIntegerParam(ADnEDRecordPulsesParam, p_Recorder->getNumPulses());
+  setDoubleParam(ADnEDRecordSizeParam, p_Recorder->getFileSize());
+}
+
+/**
+ * Check if any page covering part of the data buffer has changed since the last frame.
+ * This must be called with m_DataMutex locked.
+ * @param start The first element
+ * @param size The number of elements
+ * @return true if any of it has changed
+ */
+bool ADnED::dataChanged(epicsUInt32 start, epicsUInt32 size) const
+{
+  if ((p_DataChanged == NULL) || (size == 0)) {
+    return false;
+  }
+  epicsUInt32 firstPage = start / ADNED_SHARD_PAGE_SIZE;
+  epicsUInt32 lastPage = (start + size - 1) / ADNED_SHARD_PAGE_SIZE;
+  for (epicsUInt32 page=firstPage; (page<=lastPage) && (page<m_dataNumPages); ++page) {
+    if (p_DataChanged[page]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Copy part of the data buffer (or the delta buffer) into a new NDArray.
+ * This must be called with m_DataMutex locked.
+ * @param pSource The buffer to copy from (p_Data or p_Delta, which are both m_bufferMaxSize long)
+ * @param start The first element to copy
+ * @param ndims The number of dimensions
+ * @param dims The dimensions
+ * @param sparse Copy it as a sparse array (see copySparse)
+ * @return The NDArray, or NULL if it couldn't be allocated or the region is outside the data buffer.
+ */
+NDArray* ADnED::copyData(const epicsUInt32 *pSource, epicsUInt32 start, int ndims, size_t *dims, bool sparse)
+{
+  NDArray *pNDArray = NULL;
+  size_t numElements = 1;
+  const char* functionName = "ADnED::copyData";
+
+  for (int dim=0; dim<ndims; ++dim) {
+    numElements *= dims[dim];
+  }
+  if ((pSource == NULL) || (numElements == 0) || (start > m_bufferMaxSize) || (numElements > (m_bufferMaxSize - start))) {
+    return NULL;
+  }
+
+  if (sparse) {
+    if ((pNDArray = copySparse(pSource, start, ndims, dims)) != NULL) {
+      return pNDArray;
+    }
+  }
+
+  if ((pNDArray = this->pNDArrayPool->alloc(ndims, dims, NDUInt32, 0, NULL)) == NULL) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed.\n", functionName);
+    return NULL;
+  }
+  memcpy(pNDArray->pData, pSource + start, numElements * sizeof(epicsUInt32));
+
+  return pNDArray;
+}
+
+/**
+ * Copy part of the data buffer into a new sparse NDArray. This holds the (index, count) 
+ * pair for each non-zero element, with dims [2, number of pairs]. The dense shape is
+ * described by the ADNED_SPARSE_* attributes. If there are no counts there is a single 
+ * pair with a zero count, since an NDArray can't be empty.
+ * This must be called with m_DataMutex locked, and with a region that copyData has checked.
+ * @param pSource The buffer to copy from
+ * @param start The first element to copy
+ * @param ndims The number of dimensions of the dense array (1 or 2)
+ * @param dims The dimensions of the dense array
+ * @return The NDArray, or NULL if the sparse array would not be smaller than the dense array
+ * (or it couldn't be allocated).
+ */
+NDArray* ADnED::copySparse(const epicsUInt32 *pSource, epicsUInt32 start, int ndims, size_t *dims)
+{
+  NDArray *pNDArray = NULL;
+  size_t sparseDims[2] = {2, 1};
+  epicsUInt32 numElements = 1;
+  epicsUInt32 numPairs = 0;
+  epicsInt32 attrValue = 0;
+  epicsUInt32 attrDim = 0;
+  const char* functionName = "ADnED::copySparse";
+
+  if ((ndims < 1) || (ndims > 2)) {
+    return NULL;
+  }
+  for (int dim=0; dim<ndims; ++dim) {
+    numElements *= dims[dim];
+  }
+
+  const epicsUInt32 *pDense = pSource + start;
+  numPairs = ADnEDSparse::countPairs(pDense, numElements);
+  if (!ADnEDSparse::isSmaller(numPairs, numElements)) {
+    return NULL;
+  }
+
+  sparseDims[1] = (numPairs > 0) ? numPairs : 1;
+  if ((pNDArray = this->pNDArrayPool->alloc(2, sparseDims, NDUInt32, 0, NULL)) == NULL) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: ERROR: pNDArrayPool->alloc failed.\n", functionName);
+    return NULL;
+  }
+  epicsUInt32 *pPairs = static_cast<epicsUInt32 *>(pNDArray->pData);
+  pPairs[0] = 0;
+  pPairs[1] = 0;
+  ADnEDSparse::pack(pDense, numElements, pPairs);
+
+  attrValue = 1;
+  pNDArray->pAttributeList->add(ADNED_SPARSE_ATTR, "Sparse array of (index, count) pairs", NDAttrInt32, &attrValue);
+  pNDArray->pAttributeList->add(ADNED_SPARSE_NUM_PAIRS_ATTR, "Number of non-zero elements", NDAttrUInt32, &numPairs);
+  attrValue = ndims;
+  pNDArray->pAttributeList->add(ADNED_SPARSE_NDIMS_ATTR, "Dense number of dimensions", NDAttrInt32, &attrValue);
+  attrDim = static_cast<epicsUInt32>(dims[0]);
+  pNDArray->pAttributeList->add(ADNED_SPARSE_DIM0_ATTR, "Dense dimension 0", NDAttrUInt32, &attrDim);
+  if (ndims > 1) {
+    attrDim = static_cast<epicsUInt32>(dims[1]);
+    pNDArray->pAttributeList->add(ADNED_SPARSE_DIM1_ATTR, "Dense dimension 1", NDAttrUInt32, &attrDim);
+  }
+
+  return pNDArray;
+}
+
 //Global C utility functions to tie in with EPICS
 static void ADnEDFrameTaskC(void *drvPvt)
 {
@@ -1830,14 +3774,36 @@ extern "C" {
  * @param maxBuffers Used by asynPortDriver (set to -1 for unlimited)
  * @param maxMemory Used by asynPortDriver (set to -1 for unlimited)
  * @param debug This debug flag is passed to xsp3_config in the Xspress API (0 or 1)
+ * @param maxDets The max number of detectors (0 for the default, ADNED_MAX_DETS)
+ * @param maxChannels The max number of PVAccess channels (0 for the default, ADNED_MAX_CHANNELS)
+ * @param poolThreads The number of threads that help the channel threads with large packets (0 for no pool)
  */
-  asynStatus ADnEDConfig(const char *portName, int maxBuffers, size_t maxMemory, int debug)
+  asynStatus ADnEDConfig(const char *portName, int maxBuffers, size_t maxMemory, int debug, int maxDets, int maxChannels, int poolThreads)
   {
     asynStatus status = asynSuccess;
+
+    if (maxDets <= 0) {
+      maxDets = ADNED_MAX_DETS;
+    }
+    if (maxChannels <= 0) {
+      maxChannels = ADNED_MAX_CHANNELS;
+    }
+    if ((maxDets > ADNED_MAX_DETS_LIMIT) || (maxChannels > ADNED_MAX_CHANNELS_LIMIT)) {
+      cout << "ADnEDConfig: max detectors must be <= " << ADNED_MAX_DETS_LIMIT 
+           << " and max channels must be <= " << ADNED_MAX_CHANNELS_LIMIT << endl;
+      return asynError;
+    }
+    if (poolThreads < 0) {
+      poolThreads = 0;
+    }
+    if (poolThreads > ADNED_POOL_MAX_THREADS) {
+      cout << "ADnEDConfig: pool threads must be <= " << ADNED_POOL_MAX_THREADS << endl;
+      return asynError;
+    }
     
     /*Instantiate class.*/
     try {
-      new ADnED(portName, maxBuffers, maxMemory, debug);
+      new ADnED(portName, maxBuffers, maxMemory, debug, maxDets, maxChannels, poolThreads);
     } catch (...) {
       cout << "Unknown exception caught when trying to construct ADnED." << endl;
       status = asynError;
@@ -1855,6 +3821,43 @@ extern "C" {
     return ADnED::createFactory();
   }
 
+/**
+ * Config function for IOC shell. Sets the CPU affinity and priority for a group of
+ * threads, in every ADnED driver. See ADnEDThreadConfig.h.
+ * @param group The thread group (event, frame, worker, pool, ingest or record)
+ * @param cpus The CPU list (eg. 0-3,8 or node1), or an empty string to leave the affinity alone
+ * @param priority The EPICS thread priority (0 to 99), or -1 to leave the priority alone
+ */
+  asynStatus ADnEDSetThreadConfig(const char *group, const char *cpus, int priority)
+  {
+    if (ADnEDThreadConfig::set(group, cpus, priority) != ADNED_THREAD_OK) {
+      return asynError;
+    }
+    return asynSuccess;
+  }
+
+/**
+ * Config function for IOC shell. Sets the shape of the data made by the event 
+ * generator of an ADnED driver. The generator is used instead of the PVAccess 
+ * channels when GenEnable is set. See ADnEDGenerator.h.
+ * @param portName The Asyn port name of the driver
+ * @param numChannels The number of channels to generate packets for
+ * @param pixelStart The first pixel ID
+ * @param pixelEnd The last pixel ID (this is split evenly between the channels)
+ * @param tofMax The TOF values are from 0 to tofMax-1
+ * @param distribution The distribution (uniform, hotspot or bragg)
+ */
+  asynStatus ADnEDGeneratorConfig(const char *portName, int numChannels, int pixelStart, int pixelEnd, int tofMax, const char *distribution)
+  {
+    ADnED *pDriver = dynamic_cast<ADnED*>(static_cast<asynPortDriver*>(findAsynPortDriver(portName)));
+
+    if (pDriver == NULL) {
+      cout << "ADnEDGeneratorConfig: " << (portName ? portName : "") << " is not an ADnED port." << endl;
+      return asynError;
+    }
+    return pDriver->configGenerator(numChannels, pixelStart, pixelEnd, tofMax, distribution);
+  }
+
 
    
   /* Code for iocsh registration */
@@ -1864,15 +3867,55 @@ extern "C" {
   static const iocshArg ADnEDConfigArg1 = {"Max Buffers", iocshArgInt};
   static const iocshArg ADnEDConfigArg2 = {"Max Memory", iocshArgInt};
   static const iocshArg ADnEDConfigArg3 = {"Debug", iocshArgInt};
+  static const iocshArg ADnEDConfigArg4 = {"Max Detectors", iocshArgInt};
+  static const iocshArg ADnEDConfigArg5 = {"Max Channels", iocshArgInt};
+  static const iocshArg ADnEDConfigArg6 = {"Pool Threads", iocshArgInt};
   static const iocshArg * const ADnEDConfigArgs[] =  {&ADnEDConfigArg0,
                                                          &ADnEDConfigArg1,
                                                          &ADnEDConfigArg2,
-                                                         &ADnEDConfigArg3};
+                                                         &ADnEDConfigArg3,
+                                                         &ADnEDConfigArg4,
+                                                         &ADnEDConfigArg5,
+                                                         &ADnEDConfigArg6};
   
-  static const iocshFuncDef configADnED = {"ADnEDConfig", 4, ADnEDConfigArgs};
+  static const iocshFuncDef configADnED = {"ADnEDConfig", 7, ADnEDConfigArgs};
   static void configADnEDCallFunc(const iocshArgBuf *args)
   {
-    ADnEDConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+    ADnEDConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].ival, args[5].ival, args[6].ival);
+  }
+
+  /* ADnEDSetThreadConfig */
+  static const iocshArg ADnEDSetThreadConfigArg0 = {"Thread Group (event, frame, worker, pool, ingest or record)", iocshArgString};
+  static const iocshArg ADnEDSetThreadConfigArg1 = {"CPU List (eg. 0-3,8 or node1)", iocshArgString};
+  static const iocshArg ADnEDSetThreadConfigArg2 = {"Priority (-1 to leave alone)", iocshArgInt};
+  static const iocshArg * const ADnEDSetThreadConfigArgs[] =  {&ADnEDSetThreadConfigArg0,
+                                                                  &ADnEDSetThreadConfigArg1,
+                                                                  &ADnEDSetThreadConfigArg2};
+
+  static const iocshFuncDef configADnEDSetThreadConfig = {"ADnEDSetThreadConfig", 3, ADnEDSetThreadConfigArgs};
+  static void configADnEDSetThreadConfigCallFunc(const iocshArgBuf *args)
+  {
+    ADnEDSetThreadConfig(args[0].sval, args[1].sval, args[2].ival);
+  }
+
+  /* ADnEDGeneratorConfig */
+  static const iocshArg ADnEDGeneratorConfigArg0 = {"Port name", iocshArgString};
+  static const iocshArg ADnEDGeneratorConfigArg1 = {"Channels", iocshArgInt};
+  static const iocshArg ADnEDGeneratorConfigArg2 = {"Pixel ID Start", iocshArgInt};
+  static const iocshArg ADnEDGeneratorConfigArg3 = {"Pixel ID End", iocshArgInt};
+  static const iocshArg ADnEDGeneratorConfigArg4 = {"TOF Max", iocshArgInt};
+  static const iocshArg ADnEDGeneratorConfigArg5 = {"Distribution (uniform, hotspot or bragg)", iocshArgString};
+  static const iocshArg * const ADnEDGeneratorConfigArgs[] =  {&ADnEDGeneratorConfigArg0,
+                                                                  &ADnEDGeneratorConfigArg1,
+                                                                  &ADnEDGeneratorConfigArg2,
+                                                                  &ADnEDGeneratorConfigArg3,
+                                                                  &ADnEDGeneratorConfigArg4,
+                                                                  &ADnEDGeneratorConfigArg5};
+
+  static const iocshFuncDef configADnEDGeneratorConfig = {"ADnEDGeneratorConfig", 6, ADnEDGeneratorConfigArgs};
+  static void configADnEDGeneratorConfigCallFunc(const iocshArgBuf *args)
+  {
+    ADnEDGeneratorConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].ival, args[5].sval);
   }
 
   static const iocshFuncDef configADnEDCreateFactory = {"ADnEDCreateFactory", 0, NULL};
@@ -1886,6 +3929,8 @@ extern "C" {
   {
     iocshRegister(&configADnED, configADnEDCallFunc);
     iocshRegister(&configADnEDCreateFactory, configADnEDCreateFactoryCallFunc);
+    iocshRegister(&configADnEDSetThreadConfig, configADnEDSetThreadConfigCallFunc);
+    iocshRegister(&configADnEDGeneratorConfig, configADnEDGeneratorConfigCallFunc);
   }
   
   epicsExportRegistrar(ADnEDRegister);
@@ -20,6 +20,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 #include <epicsTime.h>
 #include <epicsTypes.h>
@@ -37,6 +38,20 @@
 #include "ADDriver.h"
 #include "nEDChannel.h"
 #include "ADnEDTransform.h"
+#include "ADnEDPixelLookup.h"
+#include "ADnEDDetConfig.h"
+#include "ADnEDHistogram.h"
+#include "ADnEDShard.h"
+#include "ADnEDRing.h"
+#include "ADnEDPool.h"
+#include "ADnEDThreadConfig.h"
+#include "ADnEDMemory.h"
+#include "ADnEDShm.h"
+#include "ADnEDRecorder.h"
+#include "ADnEDReplayFile.h"
+#include "ADnEDGenerator.h"
+#include "ADnEDStats.h"
+#include "ADnEDSparse.h"
 #include "ADnEDGlobals.h"
 
 /* These are the drvInfo strings that are used to identify the parameters.
@@ -55,10 +70,62 @@
 #define ADnEDSeqIDMissingParamString       "ADNED_SEQ_ID_MISSING"
 #define ADnEDSeqIDNumMissingParamString    "ADNED_SEQ_ID_NUM_MISSING"
 #define ADnEDBadTimeStampParamString       "ADNED_BAD_TIMESTAMP"
+#define ADnEDBacklogParamString            "ADNED_BACKLOG"
+#define ADnEDDroppedParamString            "ADNED_DROPPED"
 #define ADnEDPChargeParamString            "ADNED_PCHARGE"
 #define ADnEDPChargeIntParamString         "ADNED_PCHARGE_INT"
 #define ADnEDEventUpdatePeriodParamString  "ADNED_EVENT_UPDATE_PERIOD"
 #define ADnEDFrameUpdatePeriodParamString  "ADNED_FRAME_UPDATE_PERIOD"
+#define ADnEDFrameCopyTimeParamString      "ADNED_FRAME_COPY_TIME"
+#define ADnEDFullArrayEnableParamString    "ADNED_FULL_ARRAY_ENABLE"
+#define ADnEDDeltaEnableParamString        "ADNED_DELTA_ENABLE"
+#define ADnEDSparseEnableParamString       "ADNED_SPARSE_ENABLE"
+#define ADnEDEventModeEnableParamString    "ADNED_EVENT_MODE_ENABLE"
+#define ADnEDEventBatchSizeParamString     "ADNED_EVENT_BATCH_SIZE"
+#define ADnEDPoolThreadsParamString        "ADNED_POOL_THREADS"
+#define ADnEDPoolChunkSizeParamString      "ADNED_POOL_CHUNK_SIZE"
+#define ADnEDShmEnableParamString          "ADNED_SHM_ENABLE"
+#define ADnEDShmNameParamString            "ADNED_SHM_NAME"
+#define ADnEDShmFramesParamString          "ADNED_SHM_FRAMES"
+#define ADnEDRecordEnableParamString       "ADNED_RECORD_ENABLE"
+#define ADnEDRecordFileParamString         "ADNED_RECORD_FILE"
+#define ADnEDRecordPacketsParamString      "ADNED_RECORD_PACKETS"
+#define ADnEDRecordDroppedParamString      "ADNED_RECORD_DROPPED"
+#define ADnEDRecordPulsesParamString       "ADNED_RECORD_PULSES"
+#define ADnEDRecordSizeParamString         "ADNED_RECORD_SIZE"
+#define ADnEDReplayEnableParamString       "ADNED_REPLAY_ENABLE"
+#define ADnEDReplayFileParamString         "ADNED_REPLAY_FILE"
+#define ADnEDReplayModeParamString         "ADNED_REPLAY_MODE"
+#define ADnEDReplayScaleParamString        "ADNED_REPLAY_SCALE"
+#define ADnEDReplayBusyParamString         "ADNED_REPLAY_BUSY"
+#define ADnEDReplayPacketsParamString      "ADNED_REPLAY_PACKETS"
+#define ADnEDReplayEventsParamString       "ADNED_REPLAY_EVENTS"
+#define ADnEDReplayRateParamString         "ADNED_REPLAY_RATE"
+#define ADnEDGenEnableParamString          "ADNED_GEN_ENABLE"
+#define ADnEDGenRateParamString            "ADNED_GEN_RATE"
+#define ADnEDGenEventsParamString          "ADNED_GEN_EVENTS"
+#define ADnEDGenPulsesParamString          "ADNED_GEN_PULSES"
+#define ADnEDGenLateParamString            "ADNED_GEN_LATE"
+#define ADnEDGenEventRateParamString       "ADNED_GEN_EVENT_RATE"
+#define ADnEDStatsResetParamString         "ADNED_STATS_RESET"
+#define ADnEDStatsLatencyHistParamString   "ADNED_STATS_LATENCY_HIST"
+#define ADnEDStatsLatencyMeanParamString   "ADNED_STATS_LATENCY_MEAN"
+#define ADnEDStatsLatencyMaxParamString    "ADNED_STATS_LATENCY_MAX"
+#define ADnEDStatsPacketHistParamString    "ADNED_STATS_PACKET_HIST"
+#define ADnEDStatsPacketMeanParamString    "ADNED_STATS_PACKET_MEAN"
+#define ADnEDStatsPacketMaxParamString     "ADNED_STATS_PACKET_MAX"
+#define ADnEDStatsWorkerLockHistParamString "ADNED_STATS_WORKER_LOCK_HIST"
+#define ADnEDStatsWorkerLockMeanParamString "ADNED_STATS_WORKER_LOCK_MEAN"
+#define ADnEDStatsWorkerLockMaxParamString "ADNED_STATS_WORKER_LOCK_MAX"
+#define ADnEDStatsFrameLockHistParamString "ADNED_STATS_FRAME_LOCK_HIST"
+#define ADnEDStatsFrameLockMeanParamString "ADNED_STATS_FRAME_LOCK_MEAN"
+#define ADnEDStatsFrameLockMaxParamString  "ADNED_STATS_FRAME_LOCK_MAX"
+#define ADnEDStatsCopyHistParamString      "ADNED_STATS_COPY_HIST"
+#define ADnEDStatsCopyMeanParamString      "ADNED_STATS_COPY_MEAN"
+#define ADnEDStatsCopyMaxParamString       "ADNED_STATS_COPY_MAX"
+#define ADnEDStatsCallbackHistParamString  "ADNED_STATS_CALLBACK_HIST"
+#define ADnEDStatsCallbackMeanParamString  "ADNED_STATS_CALLBACK_MEAN"
+#define ADnEDStatsCallbackMaxParamString   "ADNED_STATS_CALLBACK_MAX"
 #define ADnEDNumChannelsParamString        "ADNED_NUM_CHANNELS"
 #define ADnEDPVNameParamString             "ADNED_PV_NAME"
 #define ADnEDNumDetParamString             "ADNED_NUM_DET"
@@ -74,10 +141,17 @@
 #define ADnEDDetNDArrayTOFEndParamString   "ADNED_DET_NDARRAY_TOF_END"
 #define ADnEDDetEventRateParamString       "ADNED_DET_EVENT_RATE"
 #define ADnEDDetEventTotalParamString      "ADNED_DET_EVENT_TOTAL"
+#define ADnEDRejectNoDetParamString        "ADNED_REJECT_NO_DET"
+#define ADnEDDetRejectTOFRangeParamString  "ADNED_DET_REJECT_TOF_RANGE"
+#define ADnEDDetRejectTOFROIParamString    "ADNED_DET_REJECT_TOF_ROI"
+#define ADnEDDetRejectPixelROIParamString  "ADNED_DET_REJECT_PIXEL_ROI"
+#define ADnEDDetRejectTransformParamString "ADNED_DET_REJECT_TRANSFORM"
+#define ADnEDDetRejectPlotRangeParamString "ADNED_DET_REJECT_PLOT_RANGE"
 #define ADnEDDetTOFROIStartParamString     "ADNED_DET_TOF_ROI_START"
 #define ADnEDDetTOFROISizeParamString      "ADNED_DET_TOF_ROI_SIZE"
 #define ADnEDDetTOFROIEnableParamString    "ADNED_DET_TOF_ROI_ENABLE"
 #define ADnEDDetTOFArrayResetParamString   "ADNED_DET_TOF_ARRAY_RESET"
+#define ADnEDDetNDArrayModeParamString     "ADNED_DET_NDARRAY_MODE"
 //Params to use with ADnEDTransform
 #define ADnEDDetTOFTransFile0ParamString   "ADNED_DET_TOF_TRANS_FILE0"
 #define ADnEDDetTOFTransFile1ParamString   "ADNED_DET_TOF_TRANS_FILE1"
@@ -115,10 +189,17 @@
 #define ADnEDTOFMaxParamString             "ADNED_TOF_MAX"
 #define ADnEDAllocSpaceParamString         "ADNED_ALLOC_SPACE"
 #define ADnEDAllocSpaceStatusParamString   "ADNED_ALLOC_SPACE_STATUS"
+#define ADnEDAllocModeParamString          "ADNED_ALLOC_MODE"
+#define ADnEDAllocPrefaultParamString      "ADNED_ALLOC_PREFAULT"
+#define ADnEDAllocLockParamString          "ADNED_ALLOC_LOCK"
+#define ADnEDAllocMemoryParamString        "ADNED_ALLOC_MEMORY"
+#define ADnEDAllocShardMaxParamString      "ADNED_ALLOC_SHARD_MAX"
+#define ADnEDAllocShardMemoryParamString   "ADNED_ALLOC_SHARD_MEMORY"
 
 extern "C" {
-  asynStatus ADnEDConfig(const char *portName, int maxBuffers, size_t maxMemory, int debug);
+  asynStatus ADnEDConfig(const char *portName, int maxBuffers, size_t maxMemory, int debug, int maxDets, int maxChannels, int poolThreads);
   asynStatus ADnEDCreateFactory();
+  asynStatus ADnEDSetThreadConfig(const char *group, const char *cpus, int priority);
 }
 
 namespace epics {
@@ -127,10 +208,60 @@ namespace epics {
   }
 }
 
+class ADnED;
+
+//Argument for each channel worker thread.
+struct ADnEDWorkerArg {
+  ADnED *pDriver;
+  epicsUInt32 channelID;
+};
+
+//Driver state for each detector. Indexed by detector number (1 based).
+struct ADnEDDetState {
+  int startValue;
+  int endValue;
+  int sizeValue;
+  std::tr1::shared_ptr<epicsUInt32> pixelMap;
+  epicsUInt32 pixelMapSize;
+  epicsUInt32 eventsSinceLastUpdate;
+  epicsFloat64 totalEvents;
+  //Events not histogrammed, for each ADNED_REJECT_* reason. Detector 0 has the events not in any detector.
+  epicsFloat64 totalRejects[ADNED_REJECT_NUM];
+};
+
+//Driver state for each PVAccess channel. Indexed by channel ID (0 based).
+struct ADnEDChannelState {
+  epicsUInt32 seqCounter;
+  epicsUInt32 seqID;
+  epicsUInt32 lastSeqID;
+  epics::pvData::TimeStamp timeStamp;
+  epics::pvData::TimeStamp timeStampLast;
+  //Events for each detector in the current packet (used by the worker thread)
+  std::vector<epicsUInt32> detEvents;
+  //Reject counts for each detector in the current packet, ADNED_REJECT_NUM for each detector.
+  std::vector<epicsUInt32> detRejects;
+  //Event mode NDArray being filled by the worker thread, and the number of events in it.
+  NDArray *pEventNDArray;
+  epicsUInt32 eventNDArrayCount;
+  //Chunks of the current packet given to the pool, and their per-detector event counts.
+  std::vector<ADnEDChunk> chunks;
+  std::vector<epicsUInt32> chunkDetEvents;
+  std::vector<epicsUInt32> chunkDetRejects;
+  //Version of the ADnEDThreadConfig settings applied to the monitor callback thread.
+  int ingestThreadConfig;
+  //Packets dropped by the monitor callback because the ring stayed full (atomic).
+  int numDropped;
+  //Settings used by the worker thread (see ADnED::readWorkerSettings).
+  int paused;
+  int eventMode;
+  int eventBatchSize;
+  int chunkSize;
+};
+
 class ADnED : public ADDriver {
 
  public:
-  ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug);
+  ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug, int maxDets, int maxChannels, int poolThreads);
   virtual ~ADnED();
 
   /* These are the methods that we override from asynPortDriver */
@@ -141,11 +272,19 @@ class ADnED : public ADDriver {
   virtual void report(FILE *fp, int details);
 
   static asynStatus createFactory();
+  static int getMaxAddr(int maxDets, int maxChannels);
 
   void eventTask(void);
   void frameTask(void);
+  void workerTask(epicsUInt32 channelID);
+  void replayTask(void);
+  void generatorTask(void);
+  void processChunk(ADnEDChunk *pChunk, epicsUInt32 worker);
+  void wakePoolThread(epicsUInt32 worker);
   void eventHandler(std::tr1::shared_ptr<epics::pvData::PVStructure> const &pv_struct, epicsUInt32 channelID);
+  void ingestPacket(ADnEDPacket &packet, epicsUInt32 channelID, bool live = true);
   asynStatus allocArray(void); 
+  asynStatus configGenerator(int numChannels, int pixelStart, int pixelEnd, int tofMax, const char *distribution);
   asynStatus clearParams(void);
 
  private:
@@ -159,68 +298,135 @@ class ADnED : public ADDriver {
   bool matchTransInt(const int asynParam, epicsUInt32 &transIndex);
   bool matchTransFloat(const int asynParam, epicsUInt32 &transIndex);
   void resetTOFArray(epicsUInt32 det);
+  void buildConfig(void);
+  void lockShards(void);
+  void unlockShards(void);
+  void mergeShards(bool delta);
+  bool drainRings(epicsFloat64 timeout);
+  void clearData(void);
+  void clearDelta(epicsUInt32 start, epicsUInt32 size);
+  size_t getAllocFootprint(size_t *pMaxShard);
+  void getDetArrayDims(int det, int &ndims, size_t *dims);
+  void lockStats(ADnEDStats &waitStats);
+  void resetStats(void);
+  void setRejectParams(int det);
+  void readWorkerSettings(epicsUInt32 channelID);
+  asynStatus checkDetAddr(int addr, const char *functionName);
+  void publishStats(ADnEDStats &stats, int addr, int histParam, int meanParam, int maxParam, epicsFloat64 scale);
+  bool dataChanged(epicsUInt32 start, epicsUInt32 size) const;
+  void updateRecordParams(void);
+  NDArray* copyData(const epicsUInt32 *pSource, epicsUInt32 start, int ndims, size_t *dims, bool sparse);
+  NDArray* copySparse(const epicsUInt32 *pSource, epicsUInt32 start, int ndims, size_t *dims);
+  bool matchConfigParam(const int asynParam);
+  void processPacket(const ADnEDPacket &packet, epicsUInt32 channelID);
+  void touchShard(epicsUInt32 shard);
+  int histogramEvents(const ADnEDConfigSnapshot *pConfig, epicsUInt32 shard, const epicsUInt32 *pPixels,
+                      const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pDetEvents, 
+                      epicsUInt32 *pDetRejects);
+  int histogramChunks(const ADnEDConfigSnapshot *pConfig, epicsUInt32 channelID, const ADnEDPacket &packet,
+                      epicsUInt32 chunkSize, epicsUInt32 *pDetEvents, epicsUInt32 *pDetRejects);
+  void addEvents(const ADnEDPacket &packet, epicsUInt32 channelID, epicsUInt32 batchSize, epicsUInt32 pulse);
+  void publishEvents(epicsUInt32 channelID);
+  void applyThreadConfig(int group, int &version);
+  inline int getDetTOFAddr(int det) const {return m_maxDets+det;}
+  inline int getDeltaAddr(void) const {return (2*m_maxDets)+1;}
+  inline int getEventAddr(void) const {return (2*m_maxDets)+2;}
  
   //Put private static data members here
   static const epicsInt32 s_ADNED_MAX_STRING_SIZE;
-  static const epicsInt32 s_ADNED_MAX_DETS;
-  static const epicsInt32 s_ADNED_MAX_CHANNELS;
   static const epicsUInt32 s_ADNED_ALLOC_STATUS_OK;
   static const epicsUInt32 s_ADNED_ALLOC_STATUS_REQ;
   static const epicsUInt32 s_ADNED_ALLOC_STATUS_FAIL;
-  static const epicsUInt32 s_ADNED_2D_PLOT_XY;
-  static const epicsUInt32 s_ADNED_2D_PLOT_XTOF;
-  static const epicsUInt32 s_ADNED_2D_PLOT_YTOF;
-  static const epicsUInt32 s_ADNED_2D_PLOT_PIXELIDTOF;
+
+  //Max number of detectors and channels, from ADnEDConfig. These size the per
+  //detector and per channel state below, and the number of asyn addresses.
+  const int m_maxDets;
+  const int m_maxChannels;
+  //Number of pool threads, from ADnEDConfig (0 if there is no pool).
+  const int m_poolThreads;
+  //One shard per channel thread, followed by one per pool thread.
+  const int m_numShards;
 
   //Put private dynamic here
   epicsUInt32 m_acquiring; 
-  epicsUInt32 m_seqCounter[ADNED_MAX_CHANNELS];
-  epicsUInt32 m_seqID[ADNED_MAX_CHANNELS];
-  epicsUInt32 m_lastSeqID[ADNED_MAX_CHANNELS];
+  std::vector<ADnEDChannelState> m_ChannelState;
+  std::vector<ADnEDDetState> m_DetState;
   epicsUInt32 m_pulseCounter;
   epicsFloat64 m_pChargeInt;
   epicsTimeStamp m_nowTime;
   double m_nowTimeSecs;
   double m_lastTimeSecs;
   epicsUInt32 *p_Data;
-  epicsUInt32 *p_PixelMap[ADNED_MAX_DETS+1];
-  epicsUInt32 m_PixelMapSize[ADNED_MAX_DETS+1];
+  ADnEDMemoryBlock m_DataBlock;
+  //Only used by the frame thread
+  ADnEDShm m_Shm;
   bool m_dataAlloc;
   epicsUInt32 m_dataMaxSize;
   epicsUInt32 m_bufferMaxSize;
   epicsUInt32 m_tofMax;
-  epics::pvData::PVTimeStamp m_PVTimeStamp;
-  epics::pvData::TimeStamp m_TimeStamp[ADNED_MAX_CHANNELS];
-  epics::pvData::TimeStamp m_TimeStampLast[ADNED_MAX_CHANNELS];
-  int m_detStartValues[ADNED_MAX_DETS+1];
-  int m_detEndValues[ADNED_MAX_DETS+1];
-  int m_detSizeValues[ADNED_MAX_DETS+1];
-  int m_NDArrayStartValues[ADNED_MAX_DETS+1];
-  int m_NDArrayTOFStartValues[ADNED_MAX_DETS+1];
-  int m_detTOFROIStartValues[ADNED_MAX_DETS+1];
-  int m_detTOFROISizeValues[ADNED_MAX_DETS+1];
-  int m_detTOFROIEnabled[ADNED_MAX_DETS+1];
-  int m_detPixelMappingEnabled[ADNED_MAX_DETS+1];
-  int m_detTOFTransType[ADNED_MAX_DETS+1];
-  double m_detTOFTransScale[ADNED_MAX_DETS+1];
-  double m_detTOFTransOffset[ADNED_MAX_DETS+1];
-  int m_detPixelROIStartX[ADNED_MAX_DETS+1];
-  int m_detPixelROIStartY[ADNED_MAX_DETS+1];
-  int m_detPixelROISizeX[ADNED_MAX_DETS+1];
-  int m_detPixelROISizeY[ADNED_MAX_DETS+1];
-  int m_detPixelSizeX[ADNED_MAX_DETS+1];
-  int m_detPixelROIEnable[ADNED_MAX_DETS+1];
   epicsUInt32 m_eventsSinceLastUpdate;
-  epicsUInt32 m_detEventsSinceLastUpdate[ADNED_MAX_DETS+1];
-  epicsFloat64 m_detTotalEvents[ADNED_MAX_DETS+1];
 
   epics::pvAccess::ChannelProvider::shared_pointer p_ChannelProvider;
   std::tr1::shared_ptr<nEDChannel::nEDChannelRequester> p_ChannelRequester;
-  std::tr1::shared_ptr<nEDChannel::nEDMonitorRequester> p_MonitorRequester[ADNED_MAX_CHANNELS];
-  epics::pvData::Monitor::shared_pointer p_Monitor[ADNED_MAX_CHANNELS];
-  epics::pvAccess::Channel::shared_pointer p_Channel[ADNED_MAX_CHANNELS];
+  std::vector<std::tr1::shared_ptr<nEDChannel::nEDMonitorRequester> > p_MonitorRequester;
+  std::vector<epics::pvData::Monitor::shared_pointer> p_Monitor;
+  std::vector<epics::pvAccess::Channel::shared_pointer> p_Channel;
+
+  //Indexed by detector number (1 based). This is passed to ADnEDHistogram as an array.
+  std::vector<ADnEDTransformBase *> p_Transform;
+
+  //Maps raw pixel IDs to detectors. Built in allocArray.
+  ADnEDPixelLookup m_PixelLookup;
+
+  //Detector configuration used by the event handler. Rebuilt by buildConfig.
+  ADnEDConfigManager m_ConfigManager;
+
+  //Histogram kernels and scratch space, one per shard.
+  ADnEDHistogram *p_Histogram;
+
+  //Private histogram buffers, one per channel thread and one per pool thread (m_numShards in
+  //total, channels first). Merged into p_Data by frameTask.
+  ADnEDShard *p_Shard;
+
+  //Flag for each page (ADNED_SHARD_PAGE_SIZE elements) of p_Data that has changed since the
+  //last frame was published. Protected by m_DataMutex.
+  epicsUInt8 *p_DataChanged;
+  epicsUInt32 m_dataNumPages;
+
+  //Counts merged in the last frame, and the pages of it that are not zero. These
+  //are only allocated when delta frames are enabled. Protected by m_DataMutex.
+  epicsUInt32 *p_Delta;
+  epicsUInt8 *p_DeltaPages;
+
+  //Protects p_Data, m_bufferMaxSize and the standby halves of the shards, so that frameTask
+  //can merge and copy the data without the asyn port lock. Lock order: asyn port lock, 
+  //then this, then the shards.
+  epicsMutex m_DataMutex;
+
+  //Packets waiting to be histogrammed, one ring and one worker thread per channel.
+  ADnEDRing *p_Ring;
+  ADnEDWorkerArg *p_WorkerArg;
+
+  //Threads that histogram chunks of large packets (NULL if there are no pool threads),
+  //and the completion count for the chunks of each channel.
+  ADnEDPool *p_Pool;
+  ADnEDPoolBatch *p_PoolBatch;
+  //The recorder is NULL if its thread could not be started
+  ADnEDRecorder *p_Recorder;
+  //Makes synthetic packets, in place of the PVAccess channels
+  ADnEDGenerator m_Generator;
+  //Hot path statistics. The latency (from ingestPacket to the end of the histogramming) 
+  //is kept for each channel. They are published and reset with the asyn port lock held.
+  ADnEDStats *p_LatencyStats;
+  ADnEDStats m_PacketStats;
+  ADnEDStats m_WorkerLockStats;
+  ADnEDStats m_FrameLockStats;
+  ADnEDStats m_CopyStats;
+  ADnEDStats m_CallbackStats;
+  //Version of the ADnEDThreadConfig settings applied to each pool thread.
+  std::vector<int> m_PoolThreadConfig;
 
-  ADnEDTransform *p_Transform[ADNED_MAX_DETS+1];
+  epicsUInt32 m_eventNDArrayCounter;
 
   //Constructor parameters.
   const epicsUInt32 m_debug;
@@ -229,6 +435,12 @@ class ADnED : public ADDriver {
   epicsEventId m_stopEvent;
   epicsEventId m_startFrame;
   epicsEventId m_stopFrame;
+  epicsEventId m_startReplay;
+  //Set to stop the replay thread. Read without the asyn port lock.
+  int m_replayStop;
+  epicsEventId m_startGenerator;
+  //Set to stop the generator thread. Read without the asyn port lock.
+  int m_generatorStop;
   
   //Values used for pasynUser->reason, and indexes into the parameter library.
   int ADnEDFirstParam;
@@ -245,10 +457,62 @@ class ADnED : public ADDriver {
   int ADnEDSeqIDMissingParam;
   int ADnEDSeqIDNumMissingParam;
   int ADnEDBadTimeStampParam;
+  int ADnEDBacklogParam;
+  int ADnEDDroppedParam;
   int ADnEDPChargeParam;
   int ADnEDPChargeIntParam;
   int ADnEDEventUpdatePeriodParam;
   int ADnEDFrameUpdatePeriodParam;
+  int ADnEDFrameCopyTimeParam;
+  int ADnEDFullArrayEnableParam;
+  int ADnEDDeltaEnableParam;
+  int ADnEDSparseEnableParam;
+  int ADnEDEventModeEnableParam;
+  int ADnEDEventBatchSizeParam;
+  int ADnEDPoolThreadsParam;
+  int ADnEDPoolChunkSizeParam;
+  int ADnEDShmEnableParam;
+  int ADnEDShmNameParam;
+  int ADnEDShmFramesParam;
+  int ADnEDRecordEnableParam;
+  int ADnEDRecordFileParam;
+  int ADnEDRecordPacketsParam;
+  int ADnEDRecordDroppedParam;
+  int ADnEDRecordPulsesParam;
+  int ADnEDRecordSizeParam;
+  int ADnEDReplayEnableParam;
+  int ADnEDReplayFileParam;
+  int ADnEDReplayModeParam;
+  int ADnEDReplayScaleParam;
+  int ADnEDReplayBusyParam;
+  int ADnEDReplayPacketsParam;
+  int ADnEDReplayEventsParam;
+  int ADnEDReplayRateParam;
+  int ADnEDGenEnableParam;
+  int ADnEDGenRateParam;
+  int ADnEDGenEventsParam;
+  int ADnEDGenPulsesParam;
+  int ADnEDGenLateParam;
+  int ADnEDGenEventRateParam;
+  int ADnEDStatsResetParam;
+  int ADnEDStatsLatencyHistParam;
+  int ADnEDStatsLatencyMeanParam;
+  int ADnEDStatsLatencyMaxParam;
+  int ADnEDStatsPacketHistParam;
+  int ADnEDStatsPacketMeanParam;
+  int ADnEDStatsPacketMaxParam;
+  int ADnEDStatsWorkerLockHistParam;
+  int ADnEDStatsWorkerLockMeanParam;
+  int ADnEDStatsWorkerLockMaxParam;
+  int ADnEDStatsFrameLockHistParam;
+  int ADnEDStatsFrameLockMeanParam;
+  int ADnEDStatsFrameLockMaxParam;
+  int ADnEDStatsCopyHistParam;
+  int ADnEDStatsCopyMeanParam;
+  int ADnEDStatsCopyMaxParam;
+  int ADnEDStatsCallbackHistParam;
+  int ADnEDStatsCallbackMeanParam;
+  int ADnEDStatsCallbackMaxParam;
   int ADnEDNumChannelsParam;
   int ADnEDPVNameParam;
   int ADnEDNumDetParam;
@@ -264,10 +528,17 @@ class ADnED : public ADDriver {
   int ADnEDDetNDArrayTOFEndParam;
   int ADnEDDetEventRateParam;
   int ADnEDDetEventTotalParam;
+  int ADnEDRejectNoDetParam;
+  int ADnEDDetRejectTOFRangeParam;
+  int ADnEDDetRejectTOFROIParam;
+  int ADnEDDetRejectPixelROIParam;
+  int ADnEDDetRejectTransformParam;
+  int ADnEDDetRejectPlotRangeParam;
   int ADnEDDetTOFROIStartParam;
   int ADnEDDetTOFROISizeParam;
   int ADnEDDetTOFROIEnableParam;
   int ADnEDDetTOFArrayResetParam;
+  int ADnEDDetNDArrayModeParam;
   //Params to use with ADnEDTransform
   int ADnEDDetTOFTransFile0Param;
   int ADnEDDetTOFTransFile1Param;
@@ -305,6 +576,12 @@ class ADnED : public ADDriver {
   int ADnEDTOFMaxParam;
   int ADnEDAllocSpaceParam;
   int ADnEDAllocSpaceStatusParam;
+  int ADnEDAllocModeParam;
+  int ADnEDAllocPrefaultParam;
+  int ADnEDAllocLockParam;
+  int ADnEDAllocMemoryParam;
+  int ADnEDAllocShardMaxParam;
+  int ADnEDAllocShardMemoryParam;
   int ADnEDLastParam;
   #define ADNED_LAST_DRIVER_COMMAND ADnEDLastParam
 
@@ -0,0 +1,390 @@
+/**
+ * Standalone benchmark of the event histogramming (ADnEDHistogram::process,
+ * which is the per-packet work of the channel worker threads). This links
+ * only the histogramming code and EPICS base, not asyn or pvAccess.
+ *
+ * The same synthetic events are histogrammed with a matrix of detector
+ * configurations: number of detectors, 2-D plot type, TOF ROI, pixel ID XY ROI,
+ * pixel mapping, TOF transformation and TOF max. For each one the event rate,
+ * the time per event and, where the kernel allows it (Linux perf events), the
+ * cache misses per event are printed.
+ *
+ * Usage: ADnEDBench [-e events per packet] [-p packets] [-x pixels]
+ *                   [-d detectors list] [-t TOF max list] [-c]
+ *
+ *   -e  Events in each packet (default 16384)
+ *   -p  Packets to time for each configuration (default 200)
+ *   -x  Total number of pixels, split evenly between the detectors (default 1048576)
+ *   -d  Comma separated list of the number of detectors (default 1,4,16)
+ *   -t  Comma separated list of TOF max values (default 1000,160000)
+ *   -c  Print CSV instead of a table
+ *
+ * The TOF ROI filter only applies to the X/Y plot (it replaces the other plot
+ * types), and the pixel ID XY ROI only has an effect with pixel mapping, as in
+ * the driver.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "epicsTypes.h"
+#include "epicsTime.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDDetConfig.h"
+#include "ADnEDPixelLookup.h"
+#include "ADnEDHistogram.h"
+#include "ADnEDTransform.h"
+
+#define ADNED_BENCH_TOF_BINS 100 //TOF bins for the X/TOF, Y/TOF and PixelID/TOF plots
+#define ADNED_BENCH_TYPE3_L1 20.0 //L1 (m)
+#define ADNED_BENCH_TYPE3_L2 1.5 //L2 (m), for every pixel
+#define ADNED_BENCH_TYPE3_EF 3.5 //Ef (meV), for every pixel
+#define ADNED_BENCH_TYPE3_RANGE 100.0 //deltaE (meV) that is scaled onto the TOF range
+
+static const char *s_plotNames[] = {"XY", "XTOF", "YTOF", "PIXELIDTOF"};
+static const int s_plotTypes[] = {ADNED_2D_PLOT_XY, ADNED_2D_PLOT_XTOF, ADNED_2D_PLOT_YTOF, ADNED_2D_PLOT_PIXELIDTOF};
+static const char *s_transNames[] = {"NONE", "TYPE1", "TYPE3"};
+static const int s_transTypes[] = {0, ADNED_TRANSFORM_TYPE1, ADNED_TRANSFORM_TYPE3};
+
+/**
+ * Hardware cache miss and cache reference counters for this thread.
+ * If perf events are not available (or not allowed, see
+ * /proc/sys/kernel/perf_event_paranoid), the counters are not valid.
+ */
+class ADnEDBenchCounters {
+
+ public:
+  ADnEDBenchCounters() : m_missFd(-1), m_refFd(-1) {
+#ifdef __linux__
+    m_missFd = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+    m_refFd = openCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+#endif
+  }
+  ~ADnEDBenchCounters() {
+    if (m_missFd >= 0) close(m_missFd);
+    if (m_refFd >= 0) close(m_refFd);
+  }
+  bool valid(void) const {return ((m_missFd >= 0) && (m_refFd >= 0));}
+  void start(void) {
+#ifdef __linux__
+    if (valid()) {
+      ioctl(m_missFd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_refFd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_missFd, PERF_EVENT_IOC_ENABLE, 0);
+      ioctl(m_refFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+  void stop(epicsUInt64 &misses, epicsUInt64 &refs) {
+    misses = 0;
+    refs = 0;
+#ifdef __linux__
+    if (valid()) {
+      ioctl(m_missFd, PERF_EVENT_IOC_DISABLE, 0);
+      ioctl(m_refFd, PERF_EVENT_IOC_DISABLE, 0);
+      if ((read(m_missFd, &misses, sizeof(misses)) != sizeof(misses)) ||
+          (read(m_refFd, &refs, sizeof(refs)) != sizeof(refs))) {
+        misses = 0;
+        refs = 0;
+      }
+    }
+#endif
+  }
+
+ private:
+#ifdef __linux__
+  static int openCounter(epicsUInt64 config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+#endif
+  int m_missFd;
+  int m_refFd;
+
+};
+
+/**
+ * xorshift32 pseudo random number generator, so every run uses the same events.
+ */
+static epicsUInt32 benchRandom(void)
+{
+  static epicsUInt32 state = 2463534242U;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/**
+ * Parse a comma separated list of positive integers.
+ * @return 0 on success, -1 if the list is empty or has a bad value
+ */
+static int parseList(const char *list, std::vector<int> &values)
+{
+  values.clear();
+  const char *pos = list;
+  while (*pos != '\0') {
+    char *end = NULL;
+    long value = strtol(pos, &end, 10);
+    if ((end == pos) || (value <= 0)) {
+      return -1;
+    }
+    values.push_back(static_cast<int>(value));
+    pos = (*end == ',') ? end+1 : end;
+    if ((*end != ',') && (*end != '\0')) {
+      return -1;
+    }
+  }
+  return values.empty() ? -1 : 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-e events per packet] [-p packets] [-x pixels] "
+          "[-d detectors list] [-t TOF max list] [-c]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  epicsUInt32 numEvents = 16384;
+  epicsUInt32 numPackets = 200;
+  epicsUInt32 numPixels = 1048576;
+  std::vector<int> detList;
+  std::vector<int> tofMaxList;
+  bool csv = false;
+  int opt = 0;
+
+  parseList("1,4,16", detList);
+  parseList("1000,160000", tofMaxList);
+
+  while ((opt = getopt(argc, argv, "e:p:x:d:t:c")) != -1) {
+    switch (opt) {
+    case 'e': numEvents = static_cast<epicsUInt32>(atoi(optarg)); break;
+    case 'p': numPackets = static_cast<epicsUInt32>(atoi(optarg)); break;
+    case 'x': numPixels = static_cast<epicsUInt32>(atoi(optarg)); break;
+    case 'd':
+      if (parseList(optarg, detList) != 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 't':
+      if (parseList(optarg, tofMaxList) != 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'c': csv = true; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  int maxDets = 0;
+  for (size_t i=0; i<detList.size(); ++i) {
+    maxDets = (detList[i] > maxDets) ? detList[i] : maxDets;
+  }
+  if ((numEvents == 0) || (numPackets == 0) || (static_cast<int>(numPixels) < maxDets) || (maxDets > ADNED_MAX_DETS_LIMIT)) {
+    fprintf(stderr, "%s: Need at least one event and packet, at least one pixel per detector, and at most %d detectors.\n",
+            argv[0], ADNED_MAX_DETS_LIMIT);
+    return 1;
+  }
+
+  ADnEDHistogram histogram;
+  ADnEDBenchCounters counters;
+  std::vector<ADnEDTransformBase *> transforms(maxDets+1, static_cast<ADnEDTransformBase *>(NULL));
+  for (int det=1; det<=maxDets; ++det) {
+    transforms[det] = new ADnEDTransform();
+  }
+  std::vector<epicsUInt32> pixels(numEvents);
+  std::vector<epicsUInt32> tofs(numEvents);
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    pixels[i] = benchRandom() % numPixels;
+  }
+
+  if (!counters.valid()) {
+    fprintf(stderr, "Cache miss counters are not available (check /proc/sys/kernel/perf_event_paranoid).\n");
+  }
+  printf("Event pre-pass implementation: %s. %d events per packet, %d packets, %d pixels.\n",
+         histogram.getSimdName(), numEvents, numPackets, numPixels);
+  if (csv) {
+    printf("dets,plot,tofroi,pixroi,map,trans,tofmax,events_per_s,ns_per_event,misses_per_event,refs_per_event\n");
+  } else {
+    printf("%4s %-10s %6s %6s %3s %5s %7s %12s %9s %12s\n",
+           "dets", "plot", "tofroi", "pixroi", "map", "trans", "tofmax", "events/s", "ns/event", "misses/event");
+  }
+
+  for (size_t d=0; d<detList.size(); ++d) {
+    int numDet = detList[d];
+    int detSize = numPixels / numDet;
+    int pixelSizeX = 1;
+    while ((pixelSizeX * pixelSizeX) < detSize) {
+      ++pixelSizeX;
+    }
+
+    std::vector<int> detStart(numDet+1, 0);
+    std::vector<int> detEnd(numDet+1, 0);
+    for (int det=1; det<=numDet; ++det) {
+      detStart[det] = (det-1)*detSize;
+      detEnd[det] = (det*detSize)-1;
+    }
+    ADnEDPixelLookup lookup;
+    if (lookup.build(numDet, &detStart[0], &detEnd[0]) != ADNED_PIXEL_LOOKUP_OK) {
+      fprintf(stderr, "Failed to build the pixel ID lookup for %d detectors.\n", numDet);
+      return 1;
+    }
+
+    //A random permutation of each detector, for the pixel mapping.
+    std::tr1::shared_ptr<epicsUInt32> pixelMap(static_cast<epicsUInt32*>(calloc(detSize, sizeof(epicsUInt32))), free);
+    for (int i=0; i<detSize; ++i) {
+      pixelMap.get()[i] = i;
+    }
+    for (int i=detSize-1; i>0; --i) {
+      int j = benchRandom() % (i+1);
+      epicsUInt32 tmp = pixelMap.get()[i];
+      pixelMap.get()[i] = pixelMap.get()[j];
+      pixelMap.get()[j] = tmp;
+    }
+
+    for (size_t t=0; t<tofMaxList.size(); ++t) {
+      epicsUInt32 tofMax = static_cast<epicsUInt32>(tofMaxList[t]);
+      for (epicsUInt32 i=0; i<numEvents; ++i) {
+        tofs[i] = benchRandom() % tofMax;
+      }
+      size_t bufferSize = static_cast<size_t>(numDet)*detSize + static_cast<size_t>(numDet)*(tofMax+1);
+      std::vector<epicsUInt32> data(bufferSize, 0);
+      std::vector<epicsUInt32> detEvents(numDet+1, 0);
+      //The reject counts are kept, as in the driver, so their cost is included.
+      std::vector<epicsUInt32> detRejects((numDet+1)*ADNED_REJECT_NUM, 0);
+      //The dirty page flags are set, as in the driver, so their cost is included.
+      std::vector<epicsUInt8> pages((bufferSize + ADNED_SHARD_PAGE_SIZE - 1) / ADNED_SHARD_PAGE_SIZE, 0);
+
+      for (int trans=0; trans<3; ++trans) {
+        //TYPE1 multiplies the TOF by a per pixel factor, which keeps it in range.
+        //TYPE3 is deltaE, with the first ADNED_BENCH_TYPE3_RANGE meV scaled onto the TOF range.
+        std::vector<epicsFloat64> array0(detSize, 0.0);
+        std::vector<epicsFloat64> array1(detSize, ADNED_BENCH_TYPE3_L2);
+        epicsFloat64 transScale = 1.0;
+        for (int i=0; i<detSize; ++i) {
+          array0[i] = (s_transTypes[trans] == ADNED_TRANSFORM_TYPE3) ? ADNED_BENCH_TYPE3_EF : 0.5 + (benchRandom() % 1000)/2000.0;
+        }
+        if (s_transTypes[trans] == ADNED_TRANSFORM_TYPE3) {
+          transScale = tofMax / ADNED_BENCH_TYPE3_RANGE;
+        }
+        for (int det=1; det<=numDet; ++det) {
+          transforms[det]->setDoubleParam(0, ADNED_BENCH_TYPE3_L1);
+          transforms[det]->setDoubleArray(0, &array0[0], detSize);
+          transforms[det]->setDoubleArray(1, &array1[0], detSize);
+          transforms[det]->setBinning(transScale, 0.0, tofMax);
+        }
+
+        for (int plot=0; plot<4; ++plot) {
+          for (int tofROI=0; tofROI<2; ++tofROI) {
+            if ((tofROI) && (s_plotTypes[plot] != ADNED_2D_PLOT_XY)) {
+              continue;
+            }
+            for (int pixROI=0; pixROI<2; ++pixROI) {
+              for (int map=0; map<2; ++map) {
+                ADnEDConfigSnapshot config(numDet);
+                config.m_numDet = numDet;
+                config.m_tofMax = tofMax;
+                config.m_valid = true;
+                for (int det=1; det<=numDet; ++det) {
+                  ADnEDDetConfig *pDetConfig = &config.m_det[det];
+                  pDetConfig->detStart = detStart[det];
+                  pDetConfig->detEnd = detEnd[det];
+                  pDetConfig->detSize = detSize;
+                  pDetConfig->ndArrayStart = (det-1)*detSize;
+                  pDetConfig->ndArrayTOFStart = numDet*detSize + (det-1)*(tofMax+1);
+                  pDetConfig->tofROIEnabled = tofROI;
+                  pDetConfig->tofROIStart = tofMax/4;
+                  pDetConfig->tofROISize = tofMax/2;
+                  pDetConfig->pixelMappingEnabled = map;
+                  pDetConfig->pixelMap = pixelMap;
+                  pDetConfig->pPixelMap = pixelMap.get();
+                  pDetConfig->pixelMapSize = detSize;
+                  pDetConfig->tofTransType = s_transTypes[trans];
+                  pDetConfig->tofTransScale = transScale;
+                  pDetConfig->tofTransOffset = 0.0;
+                  pDetConfig->pixelSizeX = pixelSizeX;
+                  pDetConfig->pixelROIEnable = pixROI;
+                  pDetConfig->pixelROIStartX = pixelSizeX/4;
+                  pDetConfig->pixelROISizeX = pixelSizeX/2;
+                  pDetConfig->pixelROIStartY = pixelSizeX/4;
+                  pDetConfig->pixelROISizeY = pixelSizeX/2;
+                  pDetConfig->plotType = s_plotTypes[plot];
+                  pDetConfig->tofBins = (tofMax < ADNED_BENCH_TOF_BINS) ? tofMax : ADNED_BENCH_TOF_BINS;
+                  pDetConfig->tofBinWidth = tofMax / pDetConfig->tofBins;
+                  ADnEDSimd::initDivider(pDetConfig->tofBinWidth, &pDetConfig->tofBinDivider);
+                }
+
+                //One untimed packet, to fault in the buffers.
+                std::fill(data.begin(), data.end(), 0);
+                histogram.process(&config, &lookup, &transforms[0], &pixels[0], &tofs[0], numEvents, &data[0], &detEvents[0], &detRejects[0], &pages[0]);
+
+                epicsTimeStamp startTime;
+                epicsTimeStamp endTime;
+                epicsUInt64 misses = 0;
+                epicsUInt64 refs = 0;
+                epicsTimeGetCurrent(&startTime);
+                counters.start();
+                for (epicsUInt32 packet=0; packet<numPackets; ++packet) {
+                  histogram.process(&config, &lookup, &transforms[0], &pixels[0], &tofs[0], numEvents, &data[0], &detEvents[0], &detRejects[0], &pages[0]);
+                }
+                counters.stop(misses, refs);
+                epicsTimeGetCurrent(&endTime);
+
+                epicsFloat64 elapsed = epicsTimeDiffInSeconds(&endTime, &startTime);
+                epicsFloat64 total = static_cast<epicsFloat64>(numEvents) * numPackets;
+                epicsFloat64 rate = (elapsed > 0.0) ? total/elapsed : 0.0;
+                epicsFloat64 nsPerEvent = elapsed * 1.e9 / total;
+                if (csv) {
+                  printf("%d,%s,%d,%d,%d,%s,%d,%.0f,%.3f,", numDet, s_plotNames[plot], tofROI, pixROI, map,
+                         s_transNames[trans], tofMax, rate, nsPerEvent);
+                  if (counters.valid()) {
+                    printf("%.4f,%.4f\n", misses/total, refs/total);
+                  } else {
+                    printf(",\n");
+                  }
+                } else {
+                  printf("%4d %-10s %6s %6s %3s %5s %7d %12.4g %9.3f ", numDet, s_plotNames[plot],
+                         tofROI ? "On" : "Off", pixROI ? "On" : "Off", map ? "On" : "Off",
+                         s_transNames[trans], tofMax, rate, nsPerEvent);
+                  if (counters.valid()) {
+                    printf("%12.4f\n", misses/total);
+                  } else {
+                    printf("%12s\n", "-");
+                  }
+                }
+                fflush(stdout);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  for (int det=1; det<=maxDets; ++det) {
+    delete transforms[det];
+  }
+
+  return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * Immutable snapshot of the detector configuration used by the event handler.
+ * See ADnEDDetConfig.h for a description.
+ */
+
+#include "stdlib.h"
+
+#include "ADnEDDetConfig.h"
+
+/**
+ * Constructor. All detectors are set to zero, and the snapshot is not valid.
+ * @param maxDets The max number of detectors
+ */
+ADnEDConfigSnapshot::ADnEDConfigSnapshot(int maxDets) : m_det(maxDets+1) {
+
+  m_version = 0;
+  m_numDet = 0;
+  m_tofMax = 0;
+  m_valid = false;
+
+  for (size_t det=0; det<m_det.size(); ++det) {
+    ADnEDDetConfig *pDet = &m_det[det];
+    pDet->detStart = 0;
+    pDet->detEnd = 0;
+    pDet->detSize = 0;
+    pDet->ndArrayStart = 0;
+    pDet->ndArrayTOFStart = 0;
+    pDet->tofROIStart = 0;
+    pDet->tofROISize = 0;
+    pDet->tofROIEnabled = 0;
+    pDet->pixelMappingEnabled = 0;
+    pDet->pPixelMap = NULL;
+    pDet->pixelMapSize = 0;
+    pDet->tofTransType = 0;
+    pDet->tofTransScale = 0;
+    pDet->tofTransOffset = 0;
+    pDet->pixelROIStartX = 0;
+    pDet->pixelROIStartY = 0;
+    pDet->pixelROISizeX = 0;
+    pDet->pixelROISizeY = 0;
+    pDet->pixelSizeX = 0;
+    pDet->pixelROIEnable = 0;
+    pDet->plotType = 0;
+    pDet->tofBins = 1;
+    pDet->tofBinWidth = 1;
+    ADnEDSimd::initDivider(1, &pDet->tofBinDivider);
+  }
+}
+
+/**
+ * Destructor.
+ */
+ADnEDConfigSnapshot::~ADnEDConfigSnapshot(void) {
+}
+
+/**
+ * Constructor. The current snapshot is an empty (invalid) configuration.
+ * @param numReaders The number of reader threads (each needs its own reader index)
+ * @param maxDets The max number of detectors
+ */
+ADnEDConfigManager::ADnEDConfigManager(epicsUInt32 numReaders, int maxDets) {
+
+  m_numReaders = numReaders;
+  m_version = 0;
+  p_Hazard = static_cast<EpicsAtomicPtrT *>(calloc(m_numReaders, sizeof(EpicsAtomicPtrT)));
+  m_current = new ADnEDConfigSnapshot(maxDets);
+}
+
+/**
+ * Destructor. Readers must have stopped before this is called.
+ */
+ADnEDConfigManager::~ADnEDConfigManager(void) {
+
+  for (size_t i=0; i<m_retired.size(); ++i) {
+    delete m_retired[i];
+  }
+  m_retired.clear();
+  delete static_cast<ADnEDConfigSnapshot *>(m_current);
+  free(p_Hazard);
+}
+
+/**
+ * Get the current snapshot for use by a reader. The snapshot remains valid
+ * until the reader calls release().
+ * @param reader The reader index (0 based)
+ * @return Pointer to the current snapshot
+ */
+const ADnEDConfigSnapshot* ADnEDConfigManager::acquire(epicsUInt32 reader) {
+
+  EpicsAtomicPtrT pConfig = NULL;
+  EpicsAtomicPtrT pHeld = NULL;
+
+  //Publish the snapshot we are about to use, then check it is still current. If it
+  //is, then the writer will see our hazard pointer before it tries to free it.
+  //The compare and swap is a full memory barrier.
+  while (true) {
+    pConfig = epicsAtomicGetPtrT(&m_current);
+    epicsAtomicCmpAndSwapPtrT(&p_Hazard[reader], pHeld, pConfig);
+    pHeld = pConfig;
+    if (epicsAtomicGetPtrT(&m_current) == pConfig) {
+      break;
+    }
+  }
+
+  return static_cast<const ADnEDConfigSnapshot *>(pConfig);
+}
+
+/**
+ * Release the snapshot obtained by acquire().
+ * @param reader The reader index (0 based)
+ */
+void ADnEDConfigManager::release(epicsUInt32 reader) {
+  epicsAtomicSetPtrT(&p_Hazard[reader], NULL);
+}
+
+/**
+ * Get the current snapshot. This is for use by the writer.
+ */
+const ADnEDConfigSnapshot* ADnEDConfigManager::current(void) const {
+  return static_cast<const ADnEDConfigSnapshot *>(epicsAtomicGetPtrT(&m_current));
+}
+
+/**
+ * Publish a new snapshot. The manager takes ownership of it, and sets the version.
+ * The previous snapshot is freed once no reader is using it.
+ * @param pConfig The new snapshot
+ */
+void ADnEDConfigManager::publish(ADnEDConfigSnapshot *pConfig) {
+
+  EpicsAtomicPtrT pOld = epicsAtomicGetPtrT(&m_current);
+
+  pConfig->m_version = ++m_version;
+  //Compare and swap so that there is a full memory barrier before we scan the hazard pointers.
+  epicsAtomicCmpAndSwapPtrT(&m_current, pOld, pConfig);
+  m_retired.push_back(static_cast<ADnEDConfigSnapshot *>(pOld));
+
+  reclaim();
+}
+
+/**
+ * Free any retired snapshots that are not being used by a reader.
+ */
+void ADnEDConfigManager::reclaim(void) {
+
+  std::vector<ADnEDConfigSnapshot *> inUse;
+
+  for (size_t i=0; i<m_retired.size(); ++i) {
+    bool hazard = false;
+    for (epicsUInt32 reader=0; reader<m_numReaders; ++reader) {
+      if (epicsAtomicGetPtrT(&p_Hazard[reader]) == m_retired[i]) {
+        hazard = true;
+        break;
+      }
+    }
+    if (hazard) {
+      inUse.push_back(m_retired[i]);
+    } else {
+      delete m_retired[i];
+    }
+  }
+
+  m_retired.swap(inUse);
+}
+
+/**
+ * Return the number of retired snapshots that are still waiting to be freed.
+ */
+epicsUInt32 ADnEDConfigManager::getNumRetired(void) const {
+  return m_retired.size();
+}
@@ -0,0 +1,139 @@
+/**
+ * @brief Immutable snapshot of the detector configuration used by the event handler.
+ *
+ *        ADnED builds a new ADnEDConfigSnapshot whenever a parameter that affects
+ *        event processing changes (in writeInt32, writeFloat64, writeOctet and allocArray),
+ *        and publishes it through an ADnEDConfigManager. The event handler picks up the
+ *        current snapshot with a single atomic pointer load at the start of each packet,
+ *        rather than reading the asyn parameter library.
+ *
+ *        A snapshot is never modified once published. Old snapshots are freed by
+ *        the manager once no reader holds them (each reader publishes the snapshot it
+ *        is using in its own hazard pointer slot).
+ */
+
+#ifndef ADNED_DET_CONFIG_H
+#define ADNED_DET_CONFIG_H
+
+#include <vector>
+#include <tr1/memory>
+
+#include "epicsTypes.h"
+#include "epicsAtomic.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDSimd.h"
+
+/**
+ * Configuration for a single detector.
+ */
+struct ADnEDDetConfig {
+  //Pixel ID range, and location of this detector in the data buffer
+  int detStart;
+  int detEnd;
+  int detSize;
+  int ndArrayStart;
+  int ndArrayTOFStart;
+  //TOF ROI filter (for the 2-D plot)
+  int tofROIStart;
+  int tofROISize;
+  int tofROIEnabled;
+  //Pixel ID mapping
+  int pixelMappingEnabled;
+  const epicsUInt32 *pPixelMap;
+  epicsUInt32 pixelMapSize;
+  std::tr1::shared_ptr<epicsUInt32> pixelMap;
+  //TOF Transformation
+  int tofTransType;
+  double tofTransScale;
+  double tofTransOffset;
+  //Pixel ID XY filter (for the TOF spectrum)
+  int pixelROIStartX;
+  int pixelROIStartY;
+  int pixelROISizeX;
+  int pixelROISizeY;
+  int pixelSizeX;
+  int pixelROIEnable;
+  //Type of 2-D plot and TOF binning for the X/TOF, Y/TOF and PixelID/TOF plots
+  int plotType;
+  int tofBins;
+  epicsUInt32 tofBinWidth;
+  ADnEDDivider tofBinDivider;
+};
+
+/**
+ * Configuration for all the detectors.
+ */
+class ADnEDConfigSnapshot {
+
+ public:
+  ADnEDConfigSnapshot(int maxDets);
+  virtual ~ADnEDConfigSnapshot();
+
+  epicsUInt32 m_version;
+  int m_numDet;
+  epicsUInt32 m_tofMax;
+  //False if the event handler should not process events with this configuration
+  bool m_valid;
+  //Indexed by detector number (1 based), so there are max dets + 1 of these.
+  std::vector<ADnEDDetConfig> m_det;
+
+};
+
+/**
+ * Publishes configuration snapshots to a fixed number of reader threads.
+ * publish() and current() must only be called by one thread at a time (ADnED
+ * calls them with the asyn port locked). Each reader index must only be used
+ * by one thread at a time.
+ */
+class ADnEDConfigManager {
+
+ public:
+  ADnEDConfigManager(epicsUInt32 numReaders, int maxDets);
+  virtual ~ADnEDConfigManager();
+
+  const ADnEDConfigSnapshot* acquire(epicsUInt32 reader);
+  void release(epicsUInt32 reader);
+  const ADnEDConfigSnapshot* current(void) const;
+  void publish(ADnEDConfigSnapshot *pConfig);
+  epicsUInt32 getNumRetired(void) const;
+
+ private:
+  void reclaim(void);
+
+  EpicsAtomicPtrT m_current;
+  EpicsAtomicPtrT *p_Hazard;
+  epicsUInt32 m_numReaders;
+  epicsUInt32 m_version;
+  std::vector<ADnEDConfigSnapshot *> m_retired;
+
+};
+
+/**
+ * Holds a snapshot for the lifetime of the guard object (like epicsGuard),
+ * so that it is released on every return path.
+ */
+class ADnEDConfigGuard {
+
+ public:
+  ADnEDConfigGuard(ADnEDConfigManager &manager, epicsUInt32 reader) :
+    m_manager(manager), m_reader(reader) {
+    p_Config = m_manager.acquire(m_reader);
+  }
+  ~ADnEDConfigGuard() {
+    m_manager.release(m_reader);
+  }
+  inline const ADnEDConfigSnapshot* get(void) const {
+    return p_Config;
+  }
+
+ private:
+  ADnEDConfigGuard(const ADnEDConfigGuard &);
+  ADnEDConfigGuard & operator=(const ADnEDConfigGuard &);
+
+  ADnEDConfigManager &m_manager;
+  epicsUInt32 m_reader;
+  const ADnEDConfigSnapshot *p_Config;
+
+};
+
+#endif //ADNED_DET_CONFIG_H
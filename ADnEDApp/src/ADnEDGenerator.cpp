@@ -0,0 +1,242 @@
+/**
+ * Synthetic neutron event generator.
+ * See ADnEDGenerator.h for a description.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "ADnEDGenerator.h"
+
+static const char *s_distributionNames[] = {"uniform", "hotspot", "bragg"};
+static const int s_numDistributions = sizeof(s_distributionNames)/sizeof(s_distributionNames[0]);
+
+/**
+ * Constructor. The generator has the default config until config() is called.
+ */
+ADnEDGenerator::ADnEDGenerator(void) {
+  m_numChannels = ADNED_GEN_DEFAULT_CHANNELS;
+  m_pixelStart = ADNED_GEN_DEFAULT_PIXEL_START;
+  m_pixelEnd = ADNED_GEN_DEFAULT_PIXEL_END;
+  m_tofMax = ADNED_GEN_DEFAULT_TOF_MAX;
+  m_distribution = ADNED_GEN_UNIFORM;
+  m_seed = 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * Destructor.
+ */
+ADnEDGenerator::~ADnEDGenerator(void) {
+}
+
+/**
+ * Set the shape of the generated data. This discards any prepared pulses.
+ * @param numChannels The number of channels to generate packets for
+ * @param pixelStart The first pixel ID
+ * @param pixelEnd The last pixel ID (this is split evenly between the channels)
+ * @param tofMax The TOF values are from 0 to tofMax-1
+ * @param distribution The distribution name (uniform, hotspot or bragg)
+ * @return ADNED_GEN_OK or ADNED_GEN_ERROR
+ */
+int ADnEDGenerator::config(epicsUInt32 numChannels, epicsUInt32 pixelStart, epicsUInt32 pixelEnd,
+                           epicsUInt32 tofMax, const char *distribution) {
+  int dist = parseDistribution(distribution);
+
+  if (dist < 0) {
+    fprintf(stderr, "ADnEDGenerator::config Unknown distribution %s.\n", distribution ? distribution : "");
+    return ADNED_GEN_ERROR;
+  }
+  if ((numChannels == 0) || (pixelEnd < pixelStart) || (tofMax == 0) ||
+      ((pixelEnd - pixelStart) < (numChannels - 1))) {
+    fprintf(stderr, "ADnEDGenerator::config Invalid config. Need at least one channel, one pixel per channel and a TOF max > 0.\n");
+    return ADNED_GEN_ERROR;
+  }
+
+  m_mutex.lock();
+  m_numChannels = numChannels;
+  m_pixelStart = pixelStart;
+  m_pixelEnd = pixelEnd;
+  m_tofMax = tofMax;
+  m_distribution = dist;
+  m_pixels.clear();
+  m_tofs.clear();
+  m_mutex.unlock();
+
+  return ADNED_GEN_OK;
+}
+
+/**
+ * Make the pulses for each channel. This takes a while for large pulses, so it
+ * is done once at the start of an acquisition rather than for each pulse.
+ * @param eventsPerPulse The number of events in each pulse, over all channels
+ * @return ADNED_GEN_OK or ADNED_GEN_ERROR
+ */
+int ADnEDGenerator::prepare(epicsUInt32 eventsPerPulse) {
+  if (eventsPerPulse > ADNED_GEN_MAX_EVENTS) {
+    fprintf(stderr, "ADnEDGenerator::prepare Too many events per pulse (max %d).\n", ADNED_GEN_MAX_EVENTS);
+    return ADNED_GEN_ERROR;
+  }
+
+  m_mutex.lock();
+  m_pixels.assign(m_numChannels*ADNED_GEN_NUM_PATTERNS, epics::pvData::shared_vector<const epics::pvData::uint32>());
+  m_tofs.assign(m_numChannels*ADNED_GEN_NUM_PATTERNS, epics::pvData::shared_vector<const epics::pvData::uint32>());
+
+  epicsUInt32 channelSize = (m_pixelEnd - m_pixelStart + 1) / m_numChannels;
+  epicsUInt32 tofPeakWidth = static_cast<epicsUInt32>(m_tofMax * ADNED_GEN_PEAK_WIDTH) + 1;
+  epicsUInt32 signalLimit = static_cast<epicsUInt32>(ADNED_GEN_SIGNAL_FRACTION * 4294967295.0);
+
+  for (epicsUInt32 chan=0; chan<m_numChannels; ++chan) {
+    epicsUInt32 numEvents = eventsPerPulse / m_numChannels;
+    if (chan < (eventsPerPulse % m_numChannels)) {
+      ++numEvents;
+    }
+    //The last channel also gets any pixels left over.
+    epicsUInt32 pixelStart = m_pixelStart + chan*channelSize;
+    epicsUInt32 pixelSize = (chan == m_numChannels-1) ? (m_pixelEnd - pixelStart + 1) : channelSize;
+    epicsUInt32 hotspotWidth = static_cast<epicsUInt32>(pixelSize * ADNED_GEN_HOTSPOT_WIDTH) + 1;
+    //The hotspots stay in the same place for every pulse.
+    epicsUInt32 hotspots[ADNED_GEN_NUM_HOTSPOTS];
+    for (int spot=0; spot<ADNED_GEN_NUM_HOTSPOTS; ++spot) {
+      hotspots[spot] = uniform(pixelStart, pixelSize);
+    }
+
+    for (int pattern=0; pattern<ADNED_GEN_NUM_PATTERNS; ++pattern) {
+      epics::pvData::shared_vector<epics::pvData::uint32> pixels(numEvents);
+      epics::pvData::shared_vector<epics::pvData::uint32> tofs(numEvents);
+      epics::pvData::uint32 *pPixels = pixels.data();
+      epics::pvData::uint32 *pTofs = tofs.data();
+      for (epicsUInt32 event=0; event<numEvents; ++event) {
+        bool signal = (random() < signalLimit);
+        if ((m_distribution == ADNED_GEN_HOTSPOT) && (signal)) {
+          pPixels[event] = gaussian(hotspots[random() % ADNED_GEN_NUM_HOTSPOTS], hotspotWidth, pixelStart, pixelSize);
+        } else {
+          pPixels[event] = uniform(pixelStart, pixelSize);
+        }
+        if ((m_distribution == ADNED_GEN_BRAGG) && (signal)) {
+          epicsUInt32 peak = (random() % ADNED_GEN_NUM_PEAKS) + 1;
+          pTofs[event] = gaussian((m_tofMax / (ADNED_GEN_NUM_PEAKS+1)) * peak, tofPeakWidth, 0, m_tofMax);
+        } else {
+          pTofs[event] = uniform(0, m_tofMax);
+        }
+      }
+      m_pixels[chan*ADNED_GEN_NUM_PATTERNS + pattern] = epics::pvData::freeze(pixels);
+      m_tofs[chan*ADNED_GEN_NUM_PATTERNS + pattern] = epics::pvData::freeze(tofs);
+    }
+  }
+  m_mutex.unlock();
+
+  return ADNED_GEN_OK;
+}
+
+/**
+ * Get a packet for one channel of a pulse. This only copies references to
+ * the prepared event arrays. The caller sets the timestamp.
+ * @param pulse The pulse number (this picks which prepared pulse is used)
+ * @param channelID The channel ID (0 based)
+ * @param packet The packet
+ */
+void ADnEDGenerator::getPacket(epicsUInt32 pulse, epicsUInt32 channelID, ADnEDPacket &packet) {
+  size_t index = channelID*ADNED_GEN_NUM_PATTERNS + (pulse % ADNED_GEN_NUM_PATTERNS);
+
+  packet.pCharge = ADNED_GEN_PCHARGE;
+  packet.status = ADNED_PACKET_OK;
+  m_mutex.lock();
+  if ((channelID < m_numChannels) && (index < m_pixels.size())) {
+    packet.pixels = m_pixels[index];
+    packet.tofs = m_tofs[index];
+  } else {
+    packet.pixels = epics::pvData::shared_vector<const epics::pvData::uint32>();
+    packet.tofs = epics::pvData::shared_vector<const epics::pvData::uint32>();
+  }
+  m_mutex.unlock();
+}
+
+/**
+ * @return The number of channels to generate packets for.
+ */
+epicsUInt32 ADnEDGenerator::getNumChannels(void) {
+  m_mutex.lock();
+  epicsUInt32 numChannels = m_numChannels;
+  m_mutex.unlock();
+  return numChannels;
+}
+
+/**
+ * Print the config.
+ * @param fp The output stream
+ */
+void ADnEDGenerator::report(FILE *fp) {
+  m_mutex.lock();
+  fprintf(fp, "Generator: %s, channels: %d, pixel IDs: %d to %d, TOF max: %d, prepared packets: %lu\n",
+          getDistributionName(m_distribution), m_numChannels, m_pixelStart, m_pixelEnd, m_tofMax,
+          static_cast<unsigned long>(m_pixels.size()));
+  m_mutex.unlock();
+}
+
+/**
+ * @param distribution The distribution name (uniform, hotspot or bragg)
+ * @return One of ADNED_GEN_UNIFORM, etc., or -1 if the name is not known
+ */
+int ADnEDGenerator::parseDistribution(const char *distribution) {
+  if ((distribution == NULL) || (distribution[0] == '\0')) {
+    return ADNED_GEN_UNIFORM;
+  }
+  for (int dist=0; dist<s_numDistributions; ++dist) {
+    if (strcmp(distribution, s_distributionNames[dist]) == 0) {
+      return dist;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @param distribution One of ADNED_GEN_UNIFORM, etc.
+ * @return The distribution name
+ */
+const char* ADnEDGenerator::getDistributionName(int distribution) {
+  if ((distribution < 0) || (distribution >= s_numDistributions)) {
+    return "unknown";
+  }
+  return s_distributionNames[distribution];
+}
+
+/**
+ * xorshift64* pseudo random number generator. This must be called with the mutex locked.
+ * @return A random 32 bit number
+ */
+epicsUInt32 ADnEDGenerator::random(void) {
+  m_seed ^= m_seed >> 12;
+  m_seed ^= m_seed << 25;
+  m_seed ^= m_seed >> 27;
+  return static_cast<epicsUInt32>((m_seed * 2685821657736338717ULL) >> 32);
+}
+
+/**
+ * @return A random number from start to start+size-1.
+ */
+epicsUInt32 ADnEDGenerator::uniform(epicsUInt32 start, epicsUInt32 size) {
+  return start + static_cast<epicsUInt32>((static_cast<epicsUInt64>(random()) * size) >> 32);
+}
+
+/**
+ * Approximately normal random number (the sum of four uniform numbers), clipped to a range.
+ * @param centre The mean
+ * @param width The standard deviation
+ * @param start The start of the range
+ * @param size The size of the range
+ * @return A random number from start to start+size-1.
+ */
+epicsUInt32 ADnEDGenerator::gaussian(epicsUInt32 centre, epicsUInt32 width, epicsUInt32 start, epicsUInt32 size) {
+  double sum = 0.0;
+  for (int i=0; i<4; ++i) {
+    sum += random() / 4294967296.0;
+  }
+  //The sum has a mean of 2 and a standard deviation of 1/sqrt(3)
+  double value = centre + (sum - 2.0) * sqrt(3.0) * width;
+  if (value < start) {
+    return start;
+  } else if (value >= static_cast<double>(start) + size) {
+    return start + size - 1;
+  }
+  return static_cast<epicsUInt32>(value);
+}
@@ -0,0 +1,68 @@
+/**
+ * @brief Synthetic neutron event generator, for load testing without a real
+ *        data acquisition system.
+ *
+ *        The shape of the data (number of channels, pixel ID range, TOF range
+ *        and distribution) is set by the iocsh command ADnEDGeneratorConfig.
+ *        The pixel ID range is split evenly between the channels, as if each
+ *        channel were a detector bank. The distributions are:
+ *
+ *        uniform - pixel IDs and TOFs uniform over their ranges.
+ *        hotspot - most events in a few small pixel ID regions on each channel,
+ *                  on a uniform background. TOFs are uniform.
+ *        bragg   - pixel IDs are uniform, and most TOFs are in a few narrow peaks
+ *                  (like Bragg peaks from a powder sample), on a uniform background.
+ *
+ *        prepare() makes ADNED_GEN_NUM_PATTERNS different pulses for each channel,
+ *        and getPacket() hands them out in turn. The packets only hold references
+ *        to the event arrays, so the generator costs almost nothing per pulse and
+ *        the driver is the bottleneck, not the generator.
+ */
+
+#ifndef ADNED_GENERATOR_H
+#define ADNED_GENERATOR_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "epicsTypes.h"
+#include "epicsMutex.h"
+#include "ADnEDRing.h"
+#include "ADnEDGlobals.h"
+
+class ADnEDGenerator {
+
+ public:
+  ADnEDGenerator();
+  virtual ~ADnEDGenerator();
+
+  int config(epicsUInt32 numChannels, epicsUInt32 pixelStart, epicsUInt32 pixelEnd,
+             epicsUInt32 tofMax, const char *distribution);
+  int prepare(epicsUInt32 eventsPerPulse);
+  void getPacket(epicsUInt32 pulse, epicsUInt32 channelID, ADnEDPacket &packet);
+  epicsUInt32 getNumChannels(void);
+  void report(FILE *fp);
+
+  static int parseDistribution(const char *distribution);
+  static const char* getDistributionName(int distribution);
+
+ private:
+  inline epicsUInt32 random(void);
+  inline epicsUInt32 uniform(epicsUInt32 start, epicsUInt32 size);
+  inline epicsUInt32 gaussian(epicsUInt32 centre, epicsUInt32 width, epicsUInt32 start, epicsUInt32 size);
+
+  //Protects everything below. The config is set from iocsh, and the patterns by the generator thread.
+  epicsMutex m_mutex;
+  epicsUInt32 m_numChannels;
+  epicsUInt32 m_pixelStart;
+  epicsUInt32 m_pixelEnd;
+  epicsUInt32 m_tofMax;
+  int m_distribution;
+  epicsUInt64 m_seed;
+  //ADNED_GEN_NUM_PATTERNS pulses for each channel, indexed by (channel*ADNED_GEN_NUM_PATTERNS)+pattern
+  std::vector<epics::pvData::shared_vector<const epics::pvData::uint32> > m_pixels;
+  std::vector<epics::pvData::shared_vector<const epics::pvData::uint32> > m_tofs;
+
+};
+
+#endif //ADNED_GENERATOR_H
@@ -1,7 +1,9 @@
 
 #define ADNED_MAX_STRING_SIZE 256
-#define ADNED_MAX_DETS 4
-#define ADNED_MAX_CHANNELS 4
+#define ADNED_MAX_DETS 4 //Default max number of detectors, if it is not given to ADnEDConfig
+#define ADNED_MAX_CHANNELS 4 //Default max number of PVAccess channels, if it is not given to ADnEDConfig
+#define ADNED_MAX_DETS_LIMIT 256 //Largest max number of detectors that can be given to ADnEDConfig
+#define ADNED_MAX_CHANNELS_LIMIT 64 //Largest max number of PVAccess channels that can be given to ADnEDConfig
 
 //ADnEDTransform params.
 #define ADNED_MAX_TRANSFORM_PARAMS 6
@@ -11,6 +13,10 @@
 #define ADNED_TRANSFORM_TYPE3 3
 #define ADNED_TRANSFORM_ERROR -9999
 #define ADNED_TRANSFORM_OK 0
+#define ADNED_TRANSFORM_INVALID_BIN 0xFFFFFFFF
+#define ADNED_TRANSFORM_ERROR_BIN 0xFFFFFFFE //Transformation error from ADnEDTransform::calculateBins
+#define ADNED_TRANSFORM_BIN_MAX 0x3FFFFFFF //Largest TOF bin, factor or offset for ADnEDTransform::calculateBins
+#define ADNED_TRANSFORM_BIN_GUARD 0x4000 //Fixed point values this close to a bin edge are checked in floating point
 
 //ADnEDTransform constants
 #define ADNED_TRANSFORM_MN 1.674954e-27 //Mass of the neutron in Kg
@@ -18,6 +24,160 @@
 #define ADNED_TRANSFORM_TOF_TO_S 1e-7 // The TOF is in units of 100ns
 #define ADNED_TRANSFORM_EV_TO_mEV 1e3 // 1eV = 1e3 meV
 
+//ADnEDPixelLookup params.
+#define ADNED_PIXEL_LOOKUP_OK 0
+#define ADNED_PIXEL_LOOKUP_ERROR -1
+#define ADNED_PIXEL_LOOKUP_MAX_SEGMENTS 65535
+#define ADNED_PIXEL_LOOKUP_DENSE_MIN 65536 //Always use a dense table below this pixel ID span
+#define ADNED_PIXEL_LOOKUP_DENSE_MAX 16777216 //Never use a dense table above this pixel ID span
+#define ADNED_PIXEL_LOOKUP_DENSE_RATIO 4 //Max ratio of pixel ID span to number of detector pixels
+
+//ADnEDHistogram params.
+#define ADNED_HISTOGRAM_OK 0
+#define ADNED_HISTOGRAM_ERROR -1
+//Reasons for events not being histogrammed. These index the per-detector reject counts, which
+//are ADNED_REJECT_NUM long for each detector. Detector 0 only uses ADNED_REJECT_NO_DET.
+#define ADNED_REJECT_TOF_RANGE 0 //TOF (or transformed TOF) outside 0 to tofMax
+#define ADNED_REJECT_TOF_ROI 1 //Outside the TOF ROI for the X/Y plot
+#define ADNED_REJECT_PIXEL_ROI 2 //Outside the pixel ID X/Y ROI for the TOF spectrum
+#define ADNED_REJECT_TRANSFORM 3 //The TOF transformation failed
+#define ADNED_REJECT_PLOT_RANGE 4 //Past the end of the 2-D plot
+#define ADNED_REJECT_NO_DET 5 //Pixel ID not in any detector range
+#define ADNED_REJECT_NUM 6
+//These 2D plot options need to match the mbbo record that uses ADNED_DET_2D_TYPE parameter.
+#define ADNED_2D_PLOT_XY 0
+#define ADNED_2D_PLOT_XTOF 1
+#define ADNED_2D_PLOT_YTOF 2
+#define ADNED_2D_PLOT_PIXELIDTOF 3
+
+//ADnEDSimd params.
+#define ADNED_SIMD_MAX_RANGES 8 //Max pixel ID ranges for the vector classification
+#define ADNED_SIMD_DIVIDE_MAX 0x7FFFFFFF //Largest numerator for ADnEDDivider
+#define ADNED_SIMD_INVALID 0xFFFFFFFF
+
+//ADnEDShard params.
+#define ADNED_SHARD_OK 0
+#define ADNED_SHARD_ERROR -1
+#define ADNED_SHARD_PAGE_SHIFT 10
+#define ADNED_SHARD_PAGE_SIZE (1 << ADNED_SHARD_PAGE_SHIFT) //Elements per page, for the dirty page tracking
+#define ADNED_SHARD_DEFAULT_MAX 256 //MB of written pages each shard can keep (0 for no limit)
+
+//ADnEDRing params.
+#define ADNED_RING_SIZE 1024 //Packets per channel. Rounded up to a power of two.
+#define ADNED_RING_SPACE_TIMEOUT 0.1 //Time for the monitor callback to wait for a full ring (s)
+#define ADNED_RING_FULL_TIMEOUT 1.0 //Longest time the monitor callback waits for a full ring before dropping the packet (s)
+#define ADNED_RING_DRAIN_TIMEOUT 5.0 //Longest time to wait at stop for the queued packets to be histogrammed (s)
+#define ADNED_CACHE_LINE_SIZE 64
+//ADnEDPacket status
+#define ADNED_PACKET_OK 0
+#define ADNED_PACKET_NO_TIMESTAMP 1
+#define ADNED_PACKET_NO_PCHARGE 2
+#define ADNED_PACKET_NO_EVENTS 3
+#define ADNED_PACKET_BAD_LENGTH 4
+
+//ADnEDPool params.
+#define ADNED_POOL_MAX_THREADS 64 //Largest number of pool threads that can be given to ADnEDConfig
+#define ADNED_POOL_MAX_CHUNKS 256 //Max number of chunks a packet is split into
+#define ADNED_POOL_CHUNK_SIZE 16384 //Default number of events in each chunk
+
+//ADnEDMemory params. The modes need to match the mbbo record that uses ADNED_ALLOC_MODE.
+#define ADNED_MEMORY_DEFAULT 0 //Normal pages (mmap, or calloc if that is not available)
+#define ADNED_MEMORY_HUGE_TRANSPARENT 1 //mmap, with madvise(MADV_HUGEPAGE)
+#define ADNED_MEMORY_HUGE_EXPLICIT 2 //mmap with MAP_HUGETLB, from the reserved huge page pool
+#define ADNED_MEMORY_OK 0
+#define ADNED_MEMORY_ERROR -1
+#define ADNED_MEMORY_HUGE_PAGE_SIZE 2097152 //Mappings are rounded up to, and aligned on, this size
+#define ADNED_MEMORY_PAGE_SIZE 4096 //Stride used to pre-fault memory
+
+//ADnEDShm params. The segment layout is described in ADnEDShm.h.
+#define ADNED_SHM_MAGIC 0x444e4441 //"ADND", written last when the segment is created
+#define ADNED_SHM_VERSION 1 //Incremented if the segment layout changes
+#define ADNED_SHM_OK 0
+#define ADNED_SHM_ERROR -1
+#define ADNED_SHM_ALIGN 4096 //The histogram data starts on this boundary
+
+//ADnEDRecorder params. The file layout is described in ADnEDRecorder.h.
+#define ADNED_RECORD_FILE_MAGIC "ADNEDREC" //8 characters, at the start of the data file
+#define ADNED_RECORD_PACKET_MAGIC 0x544b5041 //"APKT", at the start of each packet record
+#define ADNED_RECORD_VERSION 1 //Incremented if the file layout changes
+#define ADNED_RECORD_OK 0
+#define ADNED_RECORD_ERROR -1
+#define ADNED_RECORD_INDEX_SUFFIX ".idx" //Appended to the data file name for the pulse index
+#define ADNED_RECORD_BUFFER_SIZE 1048576 //stdio buffer for the data file (bytes)
+#define ADNED_RECORD_FLUSH_PERIOD 0.5 //The files are flushed when the recorder has been idle this long (s)
+
+//ADnEDReplay params. The modes need to match the mbbo record that uses ADNED_REPLAY_MODE.
+#define ADNED_REPLAY_REAL_TIME 0 //Packets are ingested at the times they were recorded
+#define ADNED_REPLAY_SCALED 1 //As real time, but faster by the replay scale factor
+#define ADNED_REPLAY_FAST 2 //As fast as the worker threads can take them
+#define ADNED_REPLAY_OK 0
+#define ADNED_REPLAY_END 1
+#define ADNED_REPLAY_ERROR -1
+#define ADNED_REPLAY_MAX_EVENTS 100000000 //Sanity check on the number of events in a recorded packet
+#define ADNED_REPLAY_SLEEP_MAX 0.1 //Longest sleep while pacing, so that a stop is seen quickly (s)
+#define ADNED_REPLAY_UPDATE_PERIOD 1.0 //How often the replay params are updated (s)
+
+//ADnEDGenerator params. The distributions are given by name to ADnEDGeneratorConfig.
+#define ADNED_GEN_UNIFORM 0
+#define ADNED_GEN_HOTSPOT 1
+#define ADNED_GEN_BRAGG 2
+#define ADNED_GEN_OK 0
+#define ADNED_GEN_ERROR -1
+#define ADNED_GEN_NUM_PATTERNS 16 //Different pulses made for each channel, which are then reused
+#define ADNED_GEN_MAX_EVENTS 10000000 //Largest number of events per pulse (over all channels)
+#define ADNED_GEN_NUM_HOTSPOTS 4 //Hotspots on each channel
+#define ADNED_GEN_HOTSPOT_WIDTH 0.01 //Standard deviation of a hotspot, as a fraction of the channel pixel ID range
+#define ADNED_GEN_NUM_PEAKS 5 //TOF peaks for the bragg distribution
+#define ADNED_GEN_PEAK_WIDTH 0.002 //Standard deviation of a TOF peak, as a fraction of the TOF range
+#define ADNED_GEN_SIGNAL_FRACTION 0.8 //Fraction of events in the hotspots or peaks (the rest are background)
+#define ADNED_GEN_DEFAULT_CHANNELS 1
+#define ADNED_GEN_DEFAULT_PIXEL_START 0
+#define ADNED_GEN_DEFAULT_PIXEL_END 65535
+#define ADNED_GEN_DEFAULT_TOF_MAX 166667 //One 60Hz frame, in units of 100ns
+#define ADNED_GEN_PCHARGE 1.0 //Proton charge of each generated pulse
+#define ADNED_GEN_SLEEP_MAX 0.1 //Longest sleep while pacing, so that a stop is seen quickly (s)
+#define ADNED_GEN_UPDATE_PERIOD 1.0 //How often the generator params are updated (s)
+
+//ADnEDStats params. Bucket 0 counts values of 0, bucket N counts values from 2^(N-1) to 2^N-1,
+//and the last bucket counts everything larger. Times are in microseconds.
+#define ADNED_STATS_NUM_BUCKETS 24
+
+//ADnEDThreadConfig params. These are the groups of threads that can be given
+//their own CPU affinity and priority.
+#define ADNED_THREAD_EVENT 0 //Starts and stops acquisition
+#define ADNED_THREAD_FRAME 1 //Merges the shards and publishes the NDArrays
+#define ADNED_THREAD_WORKER 2 //Channel worker threads, that histogram the packets
+#define ADNED_THREAD_POOL 3 //Pool threads, that histogram chunks of large packets
+#define ADNED_THREAD_INGEST 4 //PVAccess monitor callback threads, that queue the packets
+#define ADNED_THREAD_RECORD 5 //Recorder thread, that writes the raw events to file
+#define ADNED_THREAD_NUM_GROUPS 6
+#define ADNED_THREAD_OK 0
+#define ADNED_THREAD_ERROR -1
+#define ADNED_THREAD_NODE_CPULIST "/sys/devices/system/node/node%d/cpulist" //Linux NUMA node CPU list
+
+//Per detector NDArrays. These need to match the mbbo record that uses ADNED_DET_NDARRAY_MODE.
+#define ADNED_DET_NDARRAY_NONE 0
+#define ADNED_DET_NDARRAY_1D 1
+#define ADNED_DET_NDARRAY_2D 2
+//The 2-D plot for each detector is published on asyn address det, and the TOF array on 
+//address (max dets)+det. The delta frames are on (2*max dets)+1 and the event mode NDArrays
+//on (2*max dets)+2. See ADnED::getDetTOFAddr, getDeltaAddr and getEventAddr.
+//Event mode NDArrays are NDUInt32 with dims [ADNED_EVENT_NUM_FIELDS, number of events].
+//Each event is the pixel ID, the TOF and the pulse index (the value of the pulse counter).
+#define ADNED_EVENT_NUM_FIELDS 3
+#define ADNED_EVENT_FIELD_PIXEL 0
+#define ADNED_EVENT_FIELD_TOF 1
+#define ADNED_EVENT_FIELD_PULSE 2
+#define ADNED_EVENT_BATCH_SIZE 65536 //Default number of events in each NDArray
+
+//Sparse NDArrays. These are NDUInt32 arrays of (index, count) pairs, with dims [2, number of pairs].
+//The attributes describe the dense array, so that NDPluginDensify can rebuild it.
+#define ADNED_SPARSE_ATTR "ADNED_SPARSE" //1 on sparse NDArrays
+#define ADNED_SPARSE_NUM_PAIRS_ATTR "ADNED_SPARSE_NUM_PAIRS" //Number of non-zero elements
+#define ADNED_SPARSE_NDIMS_ATTR "ADNED_SPARSE_NDIMS" //Number of dimensions of the dense array
+#define ADNED_SPARSE_DIM0_ATTR "ADNED_SPARSE_DIM0"
+#define ADNED_SPARSE_DIM1_ATTR "ADNED_SPARSE_DIM1" //Only for 2-D dense arrays
+
 //PVAccess related params. Used in ADnED.cpp.
 #define ADNED_PV_TIMEOUT 2.0
 #define ADNED_PV_PRIORITY epics::pvAccess::ChannelProvider::PRIORITY_DEFAULT
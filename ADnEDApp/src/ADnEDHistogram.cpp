@@ -0,0 +1,497 @@
+/**
+ * Histogramming of neutron events into the ADnED data buffer.
+ * See ADnEDHistogram.h for a description.
+ */
+
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include <algorithm>
+
+#include "ADnEDHistogram.h"
+
+/**
+ * Set the flag for the page of the data buffer that an element is in.
+ */
+static inline void markPage(epicsUInt8 *pPages, epicsUInt32 index)
+{
+  if (pPages != NULL) {
+    pPages[index >> ADNED_SHARD_PAGE_SHIFT] = 1;
+  }
+}
+
+/**
+ * Histogram a batch of events for one detector. The template parameters select
+ * which options are compiled in, so the loop body has no option branches.
+ * The reject counts are kept in local variables and only added to pRejects
+ * at the end, so they cost an add per event. Each reason is counted on its own, 
+ * so an event can be counted for more than one reason.
+ * See ADnEDHistogramKernel for the function parameters.
+ */
+template <int TRANS, int MAP, int PLOT, int TOF>
+static void histogramKernel(const ADnEDDetConfig *pDetConfig,
+                            epicsUInt32 tofMax,
+                            const epicsUInt32 *pPixels,
+                            const epicsUInt32 *pTofs,
+                            const epicsUInt32 *pBins,
+                            const epicsFloat64 *pValues,
+                            epicsUInt32 numEvents,
+                            epicsUInt32 *pData,
+                            epicsUInt8 *pPages,
+                            epicsUInt32 *pRejects)
+{
+  const int detStart = pDetConfig->detStart;
+  const epicsUInt32 *pPixelMap = pDetConfig->pPixelMap;
+  const epicsFloat64 transScale = pDetConfig->tofTransScale;
+  const epicsFloat64 transOffset = pDetConfig->tofTransOffset;
+  const epicsUInt32 start2D = static_cast<epicsUInt32>(pDetConfig->ndArrayStart);
+  const epicsUInt32 startTOF = static_cast<epicsUInt32>(pDetConfig->ndArrayTOFStart);
+  epicsUInt32 *pData2D = pData + start2D;
+  epicsUInt32 *pDataTOF = pData + startTOF;
+  const epicsInt64 tofROIStart = pDetConfig->tofROIStart;
+  const epicsInt64 tofROIEnd = tofROIStart + pDetConfig->tofROISize;
+  const int pixelSizeX = pDetConfig->pixelSizeX;
+  const int tofBins = pDetConfig->tofBins;
+  const epicsUInt32 tofBinWidth = pDetConfig->tofBinWidth;
+  const int tofIndexMax = pDetConfig->detSize - 1;
+  const int pixelROIStartX = pDetConfig->pixelROIStartX;
+  const int pixelROIEndX = pDetConfig->pixelROIStartX + pDetConfig->pixelROISizeX;
+  const int pixelROIStartY = pDetConfig->pixelROIStartY * pixelSizeX;
+  const int pixelROIEndY = (pDetConfig->pixelROIStartY + pDetConfig->pixelROISizeY) * pixelSizeX;
+  //The TOF range only matters if the TOF is used (the X/Y plots on their own don't use it).
+  const bool useTof = ((TOF != ADnEDHistogram::TOF_NONE) || 
+                       ((PLOT != ADnEDHistogram::PLOT_NONE) && (PLOT != ADnEDHistogram::PLOT_XY) && 
+                        (PLOT != ADnEDHistogram::PLOT_XY_TOFROI)));
+  epicsUInt32 rejectTofRange = 0;
+  epicsUInt32 rejectTofROI = 0;
+  epicsUInt32 rejectPixelROI = 0;
+  epicsUInt32 rejectTransform = 0;
+  epicsUInt32 rejectPlotRange = 0;
+
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+
+    //Offset pixel ID here so this detector pixel ID range starts at 0
+    int mappedPixelIndex = static_cast<int>(pPixels[i] - detStart);
+
+    //Without a transformation the TOF is an integer, so we can avoid floating point.
+    epicsFloat64 tof = 0.0;
+    epicsUInt32 tofInt = 0;
+    bool tofInRange = false;
+    bool transformError = false;
+    if ((TRANS == ADnEDHistogram::TRANS_NONE) || (TRANS == ADnEDHistogram::TRANS_BINS)) {
+      tofInt = pTofs[i];
+      tofInRange = (tofInt <= tofMax);
+      if (TRANS == ADnEDHistogram::TRANS_BINS) {
+        //Already transformed into TOF bins for the whole batch.
+        transformError = (tofInt == ADNED_TRANSFORM_ERROR_BIN);
+        rejectTransform += transformError;
+      }
+    } else {
+      //Already transformed for the whole batch.
+      tof = pValues[i];
+      transformError = (tof == ADNED_TRANSFORM_ERROR);
+      rejectTransform += transformError;
+      //Apply scale and offset. This is used to rebin into the available TOF array.
+      if (TRANS == ADnEDHistogram::TRANS_SCALED) {
+        tof = (tof * transScale) + transOffset;
+      }
+      tofInRange = ((tof <= tofMax) && (tof >= 0));
+      if (tofInRange) {
+        tofInt = static_cast<epicsUInt32>(floor(tof));
+      }
+    }
+    if (useTof) {
+      rejectTofRange += ((!tofInRange) && (!transformError));
+    }
+
+    //Do pixel ID mapping
+    if (MAP == ADnEDHistogram::MAP_ENABLED) {
+      mappedPixelIndex = pPixelMap[mappedPixelIndex];
+    }
+
+    //Integrate the 2-D plot
+    if (PLOT == ADnEDHistogram::PLOT_XY) {
+      pData2D[mappedPixelIndex]++;
+      markPage(pPages, start2D + mappedPixelIndex);
+    } else if (PLOT == ADnEDHistogram::PLOT_XY_TOFROI) {
+      if ((TRANS == ADnEDHistogram::TRANS_NONE) || (TRANS == ADnEDHistogram::TRANS_BINS)) {
+        if ((static_cast<epicsInt64>(tofInt) >= tofROIStart) && (static_cast<epicsInt64>(tofInt) < tofROIEnd)) {
+          pData2D[mappedPixelIndex]++;
+          markPage(pPages, start2D + mappedPixelIndex);
+        } else {
+          ++rejectTofROI;
+        }
+      } else {
+        if ((tof >= static_cast<epicsFloat64>(tofROIStart)) && (tof < static_cast<epicsFloat64>(tofROIEnd))) {
+          pData2D[mappedPixelIndex]++;
+          markPage(pPages, start2D + mappedPixelIndex);
+        } else {
+          ++rejectTofROI;
+        }
+      }
+    } else if (PLOT != ADnEDHistogram::PLOT_NONE) {
+      if (tofInRange) {
+        int tofBin = 0;
+        if ((TRANS == ADnEDHistogram::TRANS_NONE) || (TRANS == ADnEDHistogram::TRANS_BINS)) {
+          //Already calculated for the whole batch.
+          tofBin = pBins[i];
+        } else {
+          tofBin = int(floor(tof / tofBinWidth));
+        }
+        int tofIndex = 0;
+        if (PLOT == ADnEDHistogram::PLOT_XTOF) {
+          epicsUInt32 x_pos = mappedPixelIndex % pixelSizeX;
+          tofIndex = (x_pos * tofBins) + tofBin;
+        } else if (PLOT == ADnEDHistogram::PLOT_YTOF) {
+          epicsUInt32 y_pos = mappedPixelIndex / pixelSizeX;
+          tofIndex = (y_pos * tofBins) + tofBin;
+        } else {
+          tofIndex = (mappedPixelIndex * tofBins) + tofBin;
+        }
+        if (tofIndex < tofIndexMax) {
+          pData2D[tofIndex]++;
+          markPage(pPages, start2D + tofIndex);
+        } else {
+          ++rejectPlotRange;
+        }
+      }
+    }
+
+    //Integrate TOF/D-Space, optionally filtering on Pixel ID X/Y ROI.
+    //ROI is assumed to start from 0,0 (not from whatever is the pixel ID range).
+    if (TOF == ADnEDHistogram::TOF_ALL) {
+      if (tofInRange) {
+        pDataTOF[tofInt]++;
+        markPage(pPages, startTOF + tofInt);
+      }
+    } else if (TOF == ADnEDHistogram::TOF_PIXELROI) {
+      if (tofInRange) {
+        int x_pos = mappedPixelIndex % pixelSizeX;
+        if ((x_pos >= pixelROIStartX) && (x_pos < pixelROIEndX) &&
+            (mappedPixelIndex >= pixelROIStartY) && (mappedPixelIndex < pixelROIEndY)) {
+          pDataTOF[tofInt]++;
+          markPage(pPages, startTOF + tofInt);
+        } else {
+          ++rejectPixelROI;
+        }
+      }
+    }
+
+  }
+
+  pRejects[ADNED_REJECT_TOF_RANGE] += rejectTofRange;
+  pRejects[ADNED_REJECT_TOF_ROI] += rejectTofROI;
+  pRejects[ADNED_REJECT_PIXEL_ROI] += rejectPixelROI;
+  pRejects[ADNED_REJECT_TRANSFORM] += rejectTransform;
+  pRejects[ADNED_REJECT_PLOT_RANGE] += rejectPlotRange;
+}
+
+//Fill in the dispatch table with every combination of kernel options.
+#define ADNED_KERNEL_TOF(T,M,P) \
+  m_kernels[T][M][P][TOF_NONE] = &histogramKernel<T,M,P,TOF_NONE>; \
+  m_kernels[T][M][P][TOF_ALL] = &histogramKernel<T,M,P,TOF_ALL>; \
+  m_kernels[T][M][P][TOF_PIXELROI] = &histogramKernel<T,M,P,TOF_PIXELROI>;
+#define ADNED_KERNEL_PLOT(T,M) \
+  ADNED_KERNEL_TOF(T,M,PLOT_NONE) \
+  ADNED_KERNEL_TOF(T,M,PLOT_XY) \
+  ADNED_KERNEL_TOF(T,M,PLOT_XY_TOFROI) \
+  ADNED_KERNEL_TOF(T,M,PLOT_XTOF) \
+  ADNED_KERNEL_TOF(T,M,PLOT_YTOF) \
+  ADNED_KERNEL_TOF(T,M,PLOT_PIXELIDTOF)
+#define ADNED_KERNEL_MAP(T) \
+  ADNED_KERNEL_PLOT(T,MAP_NONE) \
+  ADNED_KERNEL_PLOT(T,MAP_ENABLED)
+
+/**
+ * Constructor. Builds the kernel dispatch table.
+ */
+ADnEDHistogram::ADnEDHistogram(void) {
+
+  ADNED_KERNEL_MAP(TRANS_NONE)
+  ADNED_KERNEL_MAP(TRANS_RAW)
+  ADNED_KERNEL_MAP(TRANS_SCALED)
+  ADNED_KERNEL_MAP(TRANS_BINS)
+
+  p_Seg = NULL;
+  m_segSize = 0;
+  p_BatchPixels = NULL;
+  p_BatchTofs = NULL;
+  p_BatchBins = NULL;
+  p_BatchIndex = NULL;
+  p_BatchTofBins = NULL;
+  p_BatchValues = NULL;
+  m_batchSize = 0;
+  std::fill(m_rejects, m_rejects+ADNED_REJECT_NUM, 0);
+}
+
+#undef ADNED_KERNEL_TOF
+#undef ADNED_KERNEL_PLOT
+#undef ADNED_KERNEL_MAP
+
+/**
+ * Destructor.
+ */
+ADnEDHistogram::~ADnEDHistogram(void) {
+  free(p_Seg);
+  free(p_BatchPixels);
+  free(p_BatchTofs);
+  free(p_BatchBins);
+  free(p_BatchIndex);
+  free(p_BatchTofBins);
+  free(p_BatchValues);
+}
+
+/**
+ * Choose the kernel for a detector, based on its configuration.
+ * @param pDetConfig The detector configuration
+ * @return The kernel function
+ */
+ADnEDHistogramKernel ADnEDHistogram::selectKernel(const ADnEDDetConfig *pDetConfig) const {
+
+  int trans = TRANS_NONE;
+  int map = MAP_NONE;
+  int plot = PLOT_NONE;
+  int tof = TOF_ALL;
+
+  selectVariant(pDetConfig, trans, map, plot, tof);
+
+  return m_kernels[trans][map][plot][tof];
+}
+
+/**
+ * Work out the kernel options for a detector.
+ * @param pDetConfig The detector configuration
+ * @param trans Returns the TRANS_* option
+ * @param map Returns the MAP_* option
+ * @param plot Returns the PLOT_* option
+ * @param tof Returns the TOF_* option
+ */
+void ADnEDHistogram::selectVariant(const ADnEDDetConfig *pDetConfig, int &trans, int &map, int &plot, int &tof) const {
+
+  trans = TRANS_NONE;
+  map = MAP_NONE;
+  plot = PLOT_NONE;
+  tof = TOF_ALL;
+
+  if (pDetConfig->tofTransType != 0) {
+    trans = (pDetConfig->tofTransScale >= 0) ? TRANS_SCALED : TRANS_RAW;
+  }
+
+  if ((pDetConfig->pixelMappingEnabled) && (pDetConfig->pPixelMap != NULL)) {
+    map = MAP_ENABLED;
+  }
+
+  //The TOF ROI filter only applies to the X/Y plot
+  if (pDetConfig->tofROIEnabled) {
+    plot = PLOT_XY_TOFROI;
+  } else if (pDetConfig->plotType == ADNED_2D_PLOT_XY) {
+    plot = PLOT_XY;
+  } else if (pDetConfig->plotType == ADNED_2D_PLOT_XTOF) {
+    plot = (pDetConfig->pixelSizeX > 0) ? PLOT_XTOF : PLOT_NONE;
+  } else if (pDetConfig->plotType == ADNED_2D_PLOT_YTOF) {
+    plot = (pDetConfig->pixelSizeX > 0) ? PLOT_YTOF : PLOT_NONE;
+  } else if (pDetConfig->plotType == ADNED_2D_PLOT_PIXELIDTOF) {
+    plot = PLOT_PIXELIDTOF;
+  }
+
+  //If pixel mapping is not enabled the pixel ROI filter is meaningless, so just integrate as normal.
+  if ((pDetConfig->pixelROIEnable) && (pDetConfig->pixelMappingEnabled)) {
+    tof = (pDetConfig->pixelSizeX > 0) ? TOF_PIXELROI : TOF_NONE;
+  }
+}
+
+/**
+ * Make sure the scratch space is big enough.
+ * @param numEvents The number of events in the packet
+ * @param numBatchEvents The number of events summed over all the detector batches
+ * @return ADNED_HISTOGRAM_OK or ADNED_HISTOGRAM_ERROR
+ */
+int ADnEDHistogram::reserve(epicsUInt32 numEvents, epicsUInt32 numBatchEvents) {
+
+  if (numEvents > m_segSize) {
+    epicsUInt16 *pSeg = static_cast<epicsUInt16 *>(realloc(p_Seg, numEvents*sizeof(epicsUInt16)));
+    if (pSeg == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_Seg = pSeg;
+    m_segSize = numEvents;
+  }
+
+  if (numBatchEvents > m_batchSize) {
+    epicsUInt32 *pPixels = static_cast<epicsUInt32 *>(realloc(p_BatchPixels, numBatchEvents*sizeof(epicsUInt32)));
+    if (pPixels == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchPixels = pPixels;
+    epicsUInt32 *pTofs = static_cast<epicsUInt32 *>(realloc(p_BatchTofs, numBatchEvents*sizeof(epicsUInt32)));
+    if (pTofs == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchTofs = pTofs;
+    epicsUInt32 *pBins = static_cast<epicsUInt32 *>(realloc(p_BatchBins, numBatchEvents*sizeof(epicsUInt32)));
+    if (pBins == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchBins = pBins;
+    epicsUInt32 *pIndex = static_cast<epicsUInt32 *>(realloc(p_BatchIndex, numBatchEvents*sizeof(epicsUInt32)));
+    if (pIndex == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchIndex = pIndex;
+    epicsUInt32 *pTofBins = static_cast<epicsUInt32 *>(realloc(p_BatchTofBins, numBatchEvents*sizeof(epicsUInt32)));
+    if (pTofBins == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchTofBins = pTofBins;
+    epicsFloat64 *pValues = static_cast<epicsFloat64 *>(realloc(p_BatchValues, numBatchEvents*sizeof(epicsFloat64)));
+    if (pValues == NULL) {
+      return ADNED_HISTOGRAM_ERROR;
+    }
+    p_BatchValues = pValues;
+    m_batchSize = numBatchEvents;
+  }
+
+  return ADNED_HISTOGRAM_OK;
+}
+
+/**
+ * Histogram a packet of events.
+ * @param pConfig The detector configuration snapshot
+ * @param pLookup The pixel ID to detector lookup
+ * @param pTransform Array of TOF transformation objects (indexed by detector number, 1 based)
+ * @param pPixels The raw pixel IDs
+ * @param pTofs The raw TOF values
+ * @param numEvents The number of events
+ * @param pData The data buffer to histogram into
+ * @param pDetEvents Array of per-detector event counts (indexed by detector number, 1 based).
+ *                   The number of events for each detector is added to this.
+ * @param pDetRejects Array of per-detector reject counts, ADNED_REJECT_NUM for each detector 
+ *                    (indexed by (detector number * ADNED_REJECT_NUM) + ADNED_REJECT_*). These
+ *                    are added to. Events not in any detector are counted for detector 0. May be NULL.
+ * @param pPages Flags for the pages (ADNED_SHARD_PAGE_SIZE elements) of pData. The flag is set
+ *               for each page that is written to, so only those need to be merged. May be NULL.
+ * @return ADNED_HISTOGRAM_OK or ADNED_HISTOGRAM_ERROR
+ */
+int ADnEDHistogram::process(const ADnEDConfigSnapshot *pConfig, const ADnEDPixelLookup *pLookup,
+                            ADnEDTransformBase * const *pTransform,
+                            const epicsUInt32 *pPixels, const epicsUInt32 *pTofs, epicsUInt32 numEvents,
+                            epicsUInt32 *pData, epicsUInt32 *pDetEvents, epicsUInt32 *pDetRejects,
+                            epicsUInt8 *pPages) {
+
+  if ((pConfig == NULL) || (pLookup == NULL) || (pData == NULL)) {
+    return ADNED_HISTOGRAM_ERROR;
+  }
+
+  if (reserve(numEvents, 0) != ADNED_HISTOGRAM_OK) {
+    return ADNED_HISTOGRAM_ERROR;
+  }
+
+  //Find the segment for each pixel ID. Use vector compares if there are only a few pixel ID ranges.
+  const ADnEDSimdRanges *pRanges = pLookup->getRanges();
+  if (pRanges != NULL) {
+    m_Simd.classify(pRanges, pPixels, numEvents, p_Seg);
+  } else {
+    for (epicsUInt32 i=0; i<numEvents; ++i) {
+      p_Seg[i] = static_cast<epicsUInt16>(pLookup->segment(pPixels[i]));
+    }
+  }
+
+  //Count the events for each detector.
+  const int maxDets = static_cast<int>(pConfig->m_det.size()) - 1;
+  if (m_batchCount.size() != pConfig->m_det.size()) {
+    m_batchCount.resize(maxDets+1);
+    m_batchOffset.resize(maxDets+2);
+    m_batchPos.resize(maxDets+1);
+  }
+  std::fill(m_batchCount.begin(), m_batchCount.end(), 0);
+  epicsUInt32 noDet = 0;
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    epicsUInt32 seg = p_Seg[i];
+    noDet += (pLookup->detBegin(seg) == pLookup->detEnd(seg));
+    for (const epicsUInt32 *pDet=pLookup->detBegin(seg); pDet!=pLookup->detEnd(seg); ++pDet) {
+      m_batchCount[*pDet]++;
+    }
+  }
+  if (pDetRejects != NULL) {
+    pDetRejects[ADNED_REJECT_NO_DET] += noDet;
+  }
+
+  m_batchOffset[0] = 0;
+  for (int det=0; det<=maxDets; ++det) {
+    m_batchOffset[det+1] = m_batchOffset[det] + m_batchCount[det];
+  }
+  if (reserve(numEvents, m_batchOffset[maxDets+1]) != ADNED_HISTOGRAM_OK) {
+    return ADNED_HISTOGRAM_ERROR;
+  }
+
+  //Sort the events into a batch per detector.
+  std::copy(m_batchOffset.begin(), m_batchOffset.begin()+maxDets+1, m_batchPos.begin());
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    epicsUInt32 seg = p_Seg[i];
+    for (const epicsUInt32 *pDet=pLookup->detBegin(seg); pDet!=pLookup->detEnd(seg); ++pDet) {
+      epicsUInt32 pos = m_batchPos[*pDet]++;
+      p_BatchPixels[pos] = pPixels[i];
+      p_BatchTofs[pos] = pTofs[i];
+    }
+  }
+
+  //Run the selected kernel for each detector.
+  for (int det=1; det<=maxDets; ++det) {
+    if (m_batchCount[det] == 0) {
+      continue;
+    }
+    const ADnEDDetConfig *pDetConfig = &(pConfig->m_det[det]);
+    int trans = TRANS_NONE;
+    int map = MAP_NONE;
+    int plot = PLOT_NONE;
+    int tof = TOF_ALL;
+    selectVariant(pDetConfig, trans, map, plot, tof);
+    const epicsUInt32 *pBatchTofs = p_BatchTofs + m_batchOffset[det];
+    //Transform the TOF for the whole batch, with one virtual call. The transformation
+    //uses the pixel ID offset so the detector starts at 0.
+    if (trans != TRANS_NONE) {
+      const epicsUInt32 *pPixels = p_BatchPixels + m_batchOffset[det];
+      epicsUInt32 *pIndex = p_BatchIndex + m_batchOffset[det];
+      epicsFloat64 *pValues = p_BatchValues + m_batchOffset[det];
+      epicsUInt32 *pTofBins = p_BatchTofBins + m_batchOffset[det];
+      const epicsUInt32 detStart = static_cast<epicsUInt32>(pDetConfig->detStart);
+      for (epicsUInt32 i=0; i<m_batchCount[det]; ++i) {
+        pIndex[i] = pPixels[i] - detStart;
+      }
+      if ((pTransform == NULL) || (pTransform[det] == NULL)) {
+        for (epicsUInt32 i=0; i<m_batchCount[det]; ++i) {
+          pValues[i] = ADNED_TRANSFORM_ERROR;
+        }
+      } else if ((plot != PLOT_XY_TOFROI) && 
+                 (pTransform[det]->calculateBins(pDetConfig->tofTransType, pIndex, 
+                                                 pBatchTofs, pTofBins, m_batchCount[det]))) {
+        //The transformation gave integer TOF bins (with the scale and offset applied), so
+        //the rest is the same as with no transformation. The TOF ROI plot is left out
+        //because it also counts events outside the TOF range. Transformation errors
+        //are still counted as such (ADNED_TRANSFORM_ERROR_BIN).
+        trans = TRANS_BINS;
+        pBatchTofs = pTofBins;
+      } else {
+        pTransform[det]->calculateBatch(pDetConfig->tofTransType, pIndex, 
+                                        pBatchTofs, pValues, m_batchCount[det]);
+      }
+    }
+    //With integer TOFs the TOF plot bins can be calculated for the whole batch.
+    //The invalid and error bins are above tofMax, so they get no plot bin.
+    if (((trans == TRANS_NONE) || (trans == TRANS_BINS)) && ((plot == PLOT_XTOF) || (plot == PLOT_YTOF) || (plot == PLOT_PIXELIDTOF))) {
+      m_Simd.tofBins(&pDetConfig->tofBinDivider, pConfig->m_tofMax, 
+                     pBatchTofs, m_batchCount[det], p_BatchBins + m_batchOffset[det]);
+    }
+    ADnEDHistogramKernel kernel = m_kernels[trans][map][plot][tof];
+    kernel(pDetConfig, pConfig->m_tofMax,
+           p_BatchPixels + m_batchOffset[det], pBatchTofs, 
+           p_BatchBins + m_batchOffset[det], p_BatchValues + m_batchOffset[det], 
+           m_batchCount[det], pData, pPages,
+           (pDetRejects != NULL) ? &pDetRejects[det*ADNED_REJECT_NUM] : m_rejects);
+    if (pDetEvents != NULL) {
+      pDetEvents[det] += m_batchCount[det];
+    }
+  }
+
+  return ADNED_HISTOGRAM_OK;
+}
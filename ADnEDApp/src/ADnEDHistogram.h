@@ -0,0 +1,106 @@
+/**
+ * @brief Histogramming of neutron events into the ADnED data buffer.
+ *
+ *        Events in a packet are first sorted into a batch per detector (using the
+ *        ADnEDPixelLookup). Each batch is then histogrammed by a kernel that is
+ *        specialised at compile time on the detector options (TOF transformation,
+ *        pixel mapping, 2-D plot type and TOF ROI, pixel ID XY ROI). The kernel is
+ *        chosen once per detector per packet from a dispatch table, so the
+ *        per-event loop has no option branches.
+ *
+ *        Work that can be done on a whole packet at once (finding the detector
+ *        for each pixel ID, and the TOF bin for each event) is done first with
+ *        the vectorised functions in ADnEDSimd.
+ *
+ *        This has no dependency on asyn or pvAccess. One object should be used by
+ *        each thread that processes events, because it holds the scratch space
+ *        for the per-detector batches.
+ */
+
+#ifndef ADNED_HISTOGRAM_H
+#define ADNED_HISTOGRAM_H
+
+#include <vector>
+
+#include "epicsTypes.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDDetConfig.h"
+#include "ADnEDPixelLookup.h"
+#include "ADnEDTransformBase.h"
+#include "ADnEDSimd.h"
+
+/**
+ * Histogram kernel. Processes a batch of events for one detector.
+ * @param pDetConfig The detector configuration
+ * @param tofMax The maximum TOF (or transformed TOF) bin
+ * @param pPixels The raw pixel IDs for the batch
+ * @param pTofs The raw TOF values for the batch
+ * @param pBins The TOF bin for each event in the batch (from ADnEDSimd::tofBins). This is
+ *              only set for kernels without a TOF transformation that do a TOF plot.
+ * @param pValues The transformed TOF for each event in the batch (from 
+ *                ADnEDTransformBase::calculateBatch). Only set for kernels with a TOF transformation.
+ * @param numEvents The number of events in the batch
+ * @param pData The data buffer (not offset for this detector)
+ * @param pPages Flags for the pages (ADNED_SHARD_PAGE_SIZE elements) of pData. The page of
+ *               each element that is written to is set. Can be NULL.
+ * @param pRejects The reject counts for this detector (ADNED_REJECT_NUM long). These are added to.
+ */
+typedef void (*ADnEDHistogramKernel)(const ADnEDDetConfig *pDetConfig,
+                                     epicsUInt32 tofMax,
+                                     const epicsUInt32 *pPixels,
+                                     const epicsUInt32 *pTofs,
+                                     const epicsUInt32 *pBins,
+                                     const epicsFloat64 *pValues,
+                                     epicsUInt32 numEvents,
+                                     epicsUInt32 *pData,
+                                     epicsUInt8 *pPages,
+                                     epicsUInt32 *pRejects);
+
+class ADnEDHistogram {
+
+ public:
+  ADnEDHistogram();
+  virtual ~ADnEDHistogram();
+
+  int process(const ADnEDConfigSnapshot *pConfig, const ADnEDPixelLookup *pLookup,
+              ADnEDTransformBase * const *pTransform,
+              const epicsUInt32 *pPixels, const epicsUInt32 *pTofs, epicsUInt32 numEvents,
+              epicsUInt32 *pData, epicsUInt32 *pDetEvents, epicsUInt32 *pDetRejects = NULL,
+              epicsUInt8 *pPages = NULL);
+  ADnEDHistogramKernel selectKernel(const ADnEDDetConfig *pDetConfig) const;
+  inline const char* getSimdName(void) const {return m_Simd.getName();}
+
+  //Kernel variants. These index the dispatch table.
+  enum {TRANS_NONE=0, TRANS_RAW, TRANS_SCALED, TRANS_BINS, TRANS_NUM};
+  enum {MAP_NONE=0, MAP_ENABLED, MAP_NUM};
+  enum {PLOT_NONE=0, PLOT_XY, PLOT_XY_TOFROI, PLOT_XTOF, PLOT_YTOF, PLOT_PIXELIDTOF, PLOT_NUM};
+  enum {TOF_NONE=0, TOF_ALL, TOF_PIXELROI, TOF_NUM};
+
+ private:
+  int reserve(epicsUInt32 numEvents, epicsUInt32 numBatchEvents);
+  void selectVariant(const ADnEDDetConfig *pDetConfig, int &trans, int &map, int &plot, int &tof) const;
+
+  ADnEDHistogramKernel m_kernels[TRANS_NUM][MAP_NUM][PLOT_NUM][TOF_NUM];
+
+  //Scratch space. Segment of each event, and the events sorted by detector.
+  epicsUInt16 *p_Seg;
+  epicsUInt32 m_segSize;
+  epicsUInt32 *p_BatchPixels;
+  epicsUInt32 *p_BatchTofs;
+  epicsUInt32 *p_BatchBins;
+  epicsUInt32 *p_BatchIndex;
+  epicsUInt32 *p_BatchTofBins;
+  epicsFloat64 *p_BatchValues;
+  epicsUInt32 m_batchSize;
+  //Sized from the configuration snapshot (max dets + 1, indexed by detector number).
+  std::vector<epicsUInt32> m_batchCount;
+  std::vector<epicsUInt32> m_batchOffset;
+  std::vector<epicsUInt32> m_batchPos;
+  //Reject counts for when the caller does not want them.
+  epicsUInt32 m_rejects[ADNED_REJECT_NUM];
+
+  ADnEDSimd m_Simd;
+
+};
+
+#endif //ADNED_HISTOGRAM_H
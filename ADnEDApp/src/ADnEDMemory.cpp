@@ -0,0 +1,261 @@
+/**
+ * Allocation of the large histogram buffers.
+ * See ADnEDMemory.h for a description.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "ADnEDMemory.h"
+
+/**
+ * Set a block to empty.
+ * @param pBlock The block
+ */
+void ADnEDMemory::init(ADnEDMemoryBlock *pBlock)
+{
+  pBlock->pData = NULL;
+  pBlock->size = 0;
+  pBlock->pMap = NULL;
+  pBlock->mapSize = 0;
+  pBlock->mode = ADNED_MEMORY_DEFAULT;
+  pBlock->locked = false;
+}
+
+/**
+ * Make an anonymous mapping. For the huge page modes the mapping is rounded
+ * up to a whole number of huge pages, and the buffer is aligned on a huge page.
+ * @param size The size of the buffer
+ * @param mode ADNED_MEMORY_DEFAULT, ADNED_MEMORY_HUGE_TRANSPARENT or ADNED_MEMORY_HUGE_EXPLICIT
+ * @param ppMap The start of the mapping
+ * @param pMapSize The size of the mapping
+ * @return The buffer, or NULL if the mapping failed
+ */
+void* ADnEDMemory::map(size_t size, int mode, void **ppMap, size_t *pMapSize)
+{
+#ifdef __linux__
+  const size_t hugePageSize = ADNED_MEMORY_HUGE_PAGE_SIZE;
+  size_t mapSize = ((size + hugePageSize - 1) / hugePageSize) * hugePageSize;
+
+  if (mode == ADNED_MEMORY_DEFAULT) {
+    mapSize = ((size + ADNED_MEMORY_PAGE_SIZE - 1) / ADNED_MEMORY_PAGE_SIZE) * ADNED_MEMORY_PAGE_SIZE;
+    void *pMap = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pMap != MAP_FAILED) {
+      *ppMap = pMap;
+      *pMapSize = mapSize;
+      return pMap;
+    }
+    return NULL;
+  }
+
+  if (mode == ADNED_MEMORY_HUGE_EXPLICIT) {
+#ifdef MAP_HUGETLB
+    //Huge TLB mappings are always aligned on a huge page.
+    void *pMap = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pMap != MAP_FAILED) {
+      *ppMap = pMap;
+      *pMapSize = mapSize;
+      return pMap;
+    }
+#endif
+    return NULL;
+  }
+
+  if (mode == ADNED_MEMORY_HUGE_TRANSPARENT) {
+    //Map an extra huge page, so the buffer can be aligned, then unmap the ends.
+    char *pMap = static_cast<char *>(mmap(NULL, mapSize + hugePageSize, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (pMap == MAP_FAILED) {
+      return NULL;
+    }
+    size_t head = (hugePageSize - (reinterpret_cast<size_t>(pMap) % hugePageSize)) % hugePageSize;
+    char *pAligned = pMap + head;
+    if (head > 0) {
+      munmap(pMap, head);
+    }
+    if ((hugePageSize - head) > 0) {
+      munmap(pAligned + mapSize, hugePageSize - head);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(pAligned, mapSize, MADV_HUGEPAGE);
+#endif
+    *ppMap = pAligned;
+    *pMapSize = mapSize;
+    return pAligned;
+  }
+#endif
+
+  return NULL;
+}
+
+/**
+ * Allocate a zeroed buffer. If the mode can't be used, the next mode down is
+ * tried (explicit huge pages, then transparent huge pages, then normal pages).
+ * Normal pages are mapped if possible, or else come from calloc. Any
+ * buffer already in the block is released first.
+ * @param pBlock The block. The mode that was used is in pBlock->mode.
+ * @param size The size in bytes
+ * @param mode ADNED_MEMORY_DEFAULT, ADNED_MEMORY_HUGE_TRANSPARENT or ADNED_MEMORY_HUGE_EXPLICIT
+ * @return ADNED_MEMORY_OK or ADNED_MEMORY_ERROR
+ */
+int ADnEDMemory::alloc(ADnEDMemoryBlock *pBlock, size_t size, int mode)
+{
+  release(pBlock);
+
+  if (size == 0) {
+    return ADNED_MEMORY_ERROR;
+  }
+
+  if ((mode < ADNED_MEMORY_DEFAULT) || (mode > ADNED_MEMORY_HUGE_EXPLICIT)) {
+    mode = ADNED_MEMORY_DEFAULT;
+  }
+
+  for (; mode >= ADNED_MEMORY_DEFAULT; --mode) {
+    pBlock->pData = map(size, mode, &pBlock->pMap, &pBlock->mapSize);
+    if (pBlock->pData != NULL) {
+      pBlock->size = size;
+      pBlock->mode = mode;
+      return ADNED_MEMORY_OK;
+    }
+  }
+
+  pBlock->pData = calloc(size, 1);
+  if (pBlock->pData == NULL) {
+    return ADNED_MEMORY_ERROR;
+  }
+  pBlock->size = size;
+  pBlock->mode = ADNED_MEMORY_DEFAULT;
+
+  return ADNED_MEMORY_OK;
+}
+
+/**
+ * Free the buffer in a block (if there is one), and set the block to empty.
+ * @param pBlock The block
+ */
+void ADnEDMemory::release(ADnEDMemoryBlock *pBlock)
+{
+  if (pBlock->pData == NULL) {
+    init(pBlock);
+    return;
+  }
+
+#ifdef __linux__
+  if (pBlock->locked) {
+    munlock(pBlock->pData, pBlock->size);
+  }
+  if (pBlock->pMap != NULL) {
+    munmap(pBlock->pMap, pBlock->mapSize);
+    init(pBlock);
+    return;
+  }
+#endif
+
+  free(pBlock->pData);
+  init(pBlock);
+}
+
+/**
+ * Fault in every page of a buffer, by writing to it. The buffer is already
+ * zero, so this writes zero. On NUMA machines, the pages are placed on the
+ * node of the calling thread.
+ * @param pBlock The block
+ */
+void ADnEDMemory::prefault(ADnEDMemoryBlock *pBlock)
+{
+  volatile char *pData = static_cast<volatile char *>(pBlock->pData);
+
+  if (pData == NULL) {
+    return;
+  }
+  for (size_t offset=0; offset<pBlock->size; offset+=ADNED_MEMORY_PAGE_SIZE) {
+    pData[offset] = 0;
+  }
+}
+
+/**
+ * Lock a buffer into RAM. This faults in the pages (in the calling thread) if
+ * they have not already been faulted in. It fails if the locked memory limit
+ * (ulimit -l) is too small.
+ * @param pBlock The block
+ * @return ADNED_MEMORY_OK or ADNED_MEMORY_ERROR
+ */
+int ADnEDMemory::lock(ADnEDMemoryBlock *pBlock)
+{
+  if ((pBlock->pData == NULL) || (pBlock->locked)) {
+    return ADNED_MEMORY_OK;
+  }
+#ifdef __linux__
+  if (mlock(pBlock->pData, pBlock->size) == 0) {
+    pBlock->locked = true;
+    return ADNED_MEMORY_OK;
+  }
+#endif
+  return ADNED_MEMORY_ERROR;
+}
+
+/**
+ * Set part of a buffer to zero, giving the memory back to the OS where that
+ * can be done. The whole OS pages in the part of a mapped buffer (that is not 
+ * locked, and not from the huge page pool) are dropped, and are faulted in 
+ * again (as zero) when they are next written. The rest is set to zero.
+ * For transparent huge pages, this splits the huge pages that it drops part of.
+ * @param pBlock The block
+ * @param offset The start of the part, in bytes
+ * @param size The size of the part, in bytes
+ * @return true if the OS pages were dropped, false if the part was just set to zero
+ */
+bool ADnEDMemory::discard(ADnEDMemoryBlock *pBlock, size_t offset, size_t size)
+{
+  char *pStart = static_cast<char *>(pBlock->pData) + offset;
+  char *pEnd = pStart + size;
+
+  if ((pBlock->pData == NULL) || (size == 0)) {
+    return false;
+  }
+#if defined(__linux__) && defined(MADV_DONTNEED)
+  if ((pBlock->pMap != NULL) && (!pBlock->locked) && (pBlock->mode != ADNED_MEMORY_HUGE_EXPLICIT)) {
+    const size_t pageSize = ADNED_MEMORY_PAGE_SIZE;
+    char *pFirst = reinterpret_cast<char *>(((reinterpret_cast<size_t>(pStart) + pageSize - 1) / pageSize) * pageSize);
+    char *pLast = reinterpret_cast<char *>((reinterpret_cast<size_t>(pEnd) / pageSize) * pageSize);
+    if ((pFirst < pLast) && (madvise(pFirst, pLast - pFirst, MADV_DONTNEED) == 0)) {
+      memset(pStart, 0, pFirst - pStart);
+      memset(pLast, 0, pEnd - pLast);
+      return true;
+    }
+  }
+#endif
+  memset(pStart, 0, size);
+  return false;
+}
+
+/**
+ * @param pBlock The block
+ * @return The number of bytes of memory used by the block.
+ */
+size_t ADnEDMemory::getFootprint(const ADnEDMemoryBlock *pBlock)
+{
+  if (pBlock->pData == NULL) {
+    return 0;
+  }
+  return (pBlock->pMap != NULL) ? pBlock->mapSize : pBlock->size;
+}
+
+/**
+ * @param mode The allocation mode
+ * @return A name for the mode, for printing.
+ */
+const char* ADnEDMemory::getModeName(int mode)
+{
+  switch (mode) {
+  case ADNED_MEMORY_HUGE_TRANSPARENT:
+    return "transparent huge pages";
+  case ADNED_MEMORY_HUGE_EXPLICIT:
+    return "explicit huge pages";
+  default:
+    return "default";
+  }
+}
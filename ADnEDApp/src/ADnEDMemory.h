@@ -0,0 +1,59 @@
+/**
+ * @brief Allocation of the large histogram buffers.
+ *
+ *        The data buffer and the shards can be larger than 1GB (for example
+ *        PixelID/TOF plots), and are updated at scattered addresses, so they
+ *        suffer from TLB misses with normal pages. They can be allocated with
+ *        transparent huge pages (mmap and madvise), or from the reserved huge page
+ *        pool (mmap with MAP_HUGETLB). If huge pages can't be used, the allocation
+ *        falls back to the next mode (explicit, then transparent, then normal pages).
+ *        On Linux the normal pages are an anonymous mapping, otherwise calloc is used.
+ *        Huge pages are only supported on Linux.
+ *
+ *        The memory is always zero. It can be pre-faulted, so the page faults
+ *        don't happen when the first events arrive, and locked into RAM. Otherwise
+ *        the OS only provides the pages that are written to, and parts of a mapped 
+ *        buffer can be given back with discard().
+ */
+
+#ifndef ADNED_MEMORY_H
+#define ADNED_MEMORY_H
+
+#include <stddef.h>
+
+#include "epicsTypes.h"
+#include "ADnEDGlobals.h"
+
+/**
+ * An allocated buffer. Use ADnEDMemory::init before first use.
+ */
+struct ADnEDMemoryBlock {
+  //The buffer, and the size that was asked for
+  void *pData;
+  size_t size;
+  //The mapping (for the huge page modes), which may be larger than the buffer
+  void *pMap;
+  size_t mapSize;
+  //The mode that was used (ADNED_MEMORY_DEFAULT, etc.)
+  int mode;
+  bool locked;
+};
+
+class ADnEDMemory {
+
+ public:
+  static void init(ADnEDMemoryBlock *pBlock);
+  static int alloc(ADnEDMemoryBlock *pBlock, size_t size, int mode);
+  static void release(ADnEDMemoryBlock *pBlock);
+  static void prefault(ADnEDMemoryBlock *pBlock);
+  static int lock(ADnEDMemoryBlock *pBlock);
+  static bool discard(ADnEDMemoryBlock *pBlock, size_t offset, size_t size);
+  static size_t getFootprint(const ADnEDMemoryBlock *pBlock);
+  static const char* getModeName(int mode);
+
+ private:
+  static void* map(size_t size, int mode, void **ppMap, size_t *pMapSize);
+
+};
+
+#endif //ADNED_MEMORY_H
@@ -0,0 +1,302 @@
+/**
+ * Lookup from a raw pixel ID to the detector(s) whose pixel ID range contains it.
+ * See ADnEDPixelLookup.h for a description.
+ */
+
+#include "string.h"
+
+#include "ADnEDPixelLookup.h"
+
+static int compareUInt64(const void *a, const void *b);
+
+/**
+ * Constructor. The lookup is empty until build() is called.
+ */
+ADnEDPixelLookup::ADnEDPixelLookup(void) {
+
+  p_Table = NULL;
+  m_tableStart = 0;
+  m_tableSize = 0;
+  p_Bounds = NULL;
+  p_BoundSeg = NULL;
+  m_numBounds = 0;
+  p_SegIndex = NULL;
+  p_SegDets = NULL;
+  m_numSeg = 0;
+
+  m_emptyIndex[0] = 0;
+  m_emptyIndex[1] = 0;
+  m_emptyDets[0] = 0;
+
+  clear();
+}
+
+/**
+ * Destructor.
+ */
+ADnEDPixelLookup::~ADnEDPixelLookup(void) {
+  clear();
+}
+
+/**
+ * Free the lookup storage. Every pixel ID will then map to segment 0 (no detector).
+ */
+void ADnEDPixelLookup::clear(void) {
+
+  if (p_Table) {
+    free(p_Table);
+    p_Table = NULL;
+  }
+  if (p_Bounds) {
+    free(p_Bounds);
+    p_Bounds = NULL;
+  }
+  if (p_BoundSeg) {
+    free(p_BoundSeg);
+    p_BoundSeg = NULL;
+  }
+  if ((p_SegIndex) && (p_SegIndex != m_emptyIndex)) {
+    free(p_SegIndex);
+  }
+  if ((p_SegDets) && (p_SegDets != m_emptyDets)) {
+    free(p_SegDets);
+  }
+
+  m_tableStart = 0;
+  m_tableSize = 0;
+  m_numBounds = 0;
+  m_ranges.numRanges = 0;
+  p_SegIndex = m_emptyIndex;
+  p_SegDets = m_emptyDets;
+  m_numSeg = 1;
+}
+
+/**
+ * Build the lookup from the detector pixel ID ranges.
+ * @param numDet The number of detectors
+ * @param pDetStart Array of first pixel ID for each detector (indexed by detector number, 1 based)
+ * @param pDetEnd Array of last pixel ID for each detector (indexed by detector number, 1 based)
+ * @return ADNED_PIXEL_LOOKUP_OK or ADNED_PIXEL_LOOKUP_ERROR
+ */
+int ADnEDPixelLookup::build(epicsUInt32 numDet, const int *pDetStart, const int *pDetEnd) {
+
+  epicsUInt64 *pEdges = NULL;
+  epicsUInt32 numEdges = 0;
+  epicsUInt64 covered = 0;
+  epicsUInt64 span = 0;
+  epicsUInt32 numIntervals = 0;
+  epicsUInt16 *pIntervalSeg = NULL;
+  epicsUInt32 *pSegDets = NULL;
+  epicsUInt32 numSegDets = 0;
+  epicsUInt32 *pScratch = NULL;
+
+  clear();
+
+  if ((numDet == 0) || (pDetStart == NULL) || (pDetEnd == NULL)) {
+    return ADNED_PIXEL_LOOKUP_ERROR;
+  }
+
+  //Every detector range adds two edges, the start and one past the end.
+  //Use 64 bits so that one past the end of pixel ID 0xFFFFFFFF is representable.
+  pEdges = static_cast<epicsUInt64 *>(calloc(2*numDet, sizeof(epicsUInt64)));
+  pScratch = static_cast<epicsUInt32 *>(calloc(numDet, sizeof(epicsUInt32)));
+  if ((pEdges == NULL) || (pScratch == NULL)) {
+    free(pEdges);
+    free(pScratch);
+    return ADNED_PIXEL_LOOKUP_ERROR;
+  }
+  for (epicsUInt32 det=1; det<=numDet; ++det) {
+    if (static_cast<epicsUInt32>(pDetStart[det]) <= static_cast<epicsUInt32>(pDetEnd[det])) {
+      pEdges[numEdges++] = static_cast<epicsUInt32>(pDetStart[det]);
+      pEdges[numEdges++] = static_cast<epicsUInt64>(static_cast<epicsUInt32>(pDetEnd[det])) + 1;
+    }
+  }
+  if (numEdges == 0) {
+    free(pEdges);
+    free(pScratch);
+    return ADNED_PIXEL_LOOKUP_ERROR;
+  }
+  qsort(pEdges, numEdges, sizeof(epicsUInt64), compareUInt64);
+  epicsUInt32 numUnique = 1;
+  for (epicsUInt32 i=1; i<numEdges; ++i) {
+    if (pEdges[i] != pEdges[numUnique-1]) {
+      pEdges[numUnique++] = pEdges[i];
+    }
+  }
+  numEdges = numUnique;
+
+  //Interval i is [pEdges[i], pEdges[i+1]). Work out which detectors cover each interval,
+  //and give each distinct set of detectors its own segment. Segment 0 is the empty set.
+  numIntervals = numEdges - 1;
+  pIntervalSeg = static_cast<epicsUInt16 *>(calloc(numIntervals+1, sizeof(epicsUInt16)));
+  p_SegIndex = static_cast<epicsUInt32 *>(calloc(numIntervals+2, sizeof(epicsUInt32)));
+  pSegDets = static_cast<epicsUInt32 *>(calloc((numIntervals*numDet)+1, sizeof(epicsUInt32)));
+  if ((pIntervalSeg == NULL) || (p_SegIndex == NULL) || (pSegDets == NULL)) {
+    free(pEdges);
+    free(pScratch);
+    free(pIntervalSeg);
+    free(pSegDets);
+    free(p_SegIndex);
+    p_SegIndex = m_emptyIndex;
+    return ADNED_PIXEL_LOOKUP_ERROR;
+  }
+  p_SegIndex[0] = 0;
+  p_SegIndex[1] = 0;
+  m_numSeg = 1;
+
+  for (epicsUInt32 i=0; i<numIntervals; ++i) {
+    epicsUInt32 numCover = 0;
+    for (epicsUInt32 det=1; det<=numDet; ++det) {
+      if ((static_cast<epicsUInt32>(pDetStart[det]) <= pEdges[i])
+          && (static_cast<epicsUInt32>(pDetEnd[det]) >= pEdges[i])) {
+        pScratch[numCover++] = det;
+      }
+    }
+    if (numCover == 0) {
+      pIntervalSeg[i] = 0;
+      continue;
+    }
+    covered += pEdges[i+1] - pEdges[i];
+    //Reuse an existing segment if it has the same set of detectors.
+    epicsUInt32 seg = 0;
+    for (epicsUInt32 s=1; s<m_numSeg; ++s) {
+      if ((p_SegIndex[s+1] - p_SegIndex[s] == numCover)
+          && (memcmp(pSegDets + p_SegIndex[s], pScratch, numCover*sizeof(epicsUInt32)) == 0)) {
+        seg = s;
+        break;
+      }
+    }
+    if (seg == 0) {
+      if (m_numSeg >= ADNED_PIXEL_LOOKUP_MAX_SEGMENTS) {
+        free(pEdges);
+        free(pScratch);
+        free(pIntervalSeg);
+        free(pSegDets);
+        free(p_SegIndex);
+        p_SegIndex = m_emptyIndex;
+        m_numSeg = 1;
+        return ADNED_PIXEL_LOOKUP_ERROR;
+      }
+      seg = m_numSeg++;
+      memcpy(pSegDets + numSegDets, pScratch, numCover*sizeof(epicsUInt32));
+      numSegDets += numCover;
+      p_SegIndex[m_numSeg] = numSegDets;
+    }
+    pIntervalSeg[i] = static_cast<epicsUInt16>(seg);
+  }
+  p_SegDets = pSegDets;
+  free(pScratch);
+
+  //Keep the non-empty intervals as ranges, if there are few enough of them.
+  for (epicsUInt32 i=0; i<numIntervals; ++i) {
+    if (pIntervalSeg[i] == 0) {
+      continue;
+    }
+    if ((m_ranges.numRanges >= ADNED_SIMD_MAX_RANGES) || ((pEdges[i+1] - pEdges[i]) > 0xFFFFFFFFULL)) {
+      m_ranges.numRanges = 0;
+      break;
+    }
+    m_ranges.start[m_ranges.numRanges] = static_cast<epicsUInt32>(pEdges[i]);
+    m_ranges.size[m_ranges.numRanges] = static_cast<epicsUInt32>(pEdges[i+1] - pEdges[i]);
+    m_ranges.seg[m_ranges.numRanges] = pIntervalSeg[i];
+    ++m_ranges.numRanges;
+  }
+
+  //Decide between a dense table and a sorted range index.
+  span = pEdges[numEdges-1] - pEdges[0];
+  if ((span <= ADNED_PIXEL_LOOKUP_DENSE_MIN)
+      || ((span <= ADNED_PIXEL_LOOKUP_DENSE_MAX) && (span <= ADNED_PIXEL_LOOKUP_DENSE_RATIO*covered))) {
+    p_Table = static_cast<epicsUInt16 *>(calloc(span, sizeof(epicsUInt16)));
+  }
+
+  if (p_Table != NULL) {
+    m_tableStart = static_cast<epicsUInt32>(pEdges[0]);
+    m_tableSize = static_cast<epicsUInt32>(span);
+    for (epicsUInt32 i=0; i<numIntervals; ++i) {
+      for (epicsUInt64 id=pEdges[i]; id<pEdges[i+1]; ++id) {
+        p_Table[id - pEdges[0]] = pIntervalSeg[i];
+      }
+    }
+  } else {
+    //The last edge starts an empty interval that runs to the end of the pixel ID space,
+    //unless it is past the largest possible pixel ID.
+    p_Bounds = static_cast<epicsUInt32 *>(calloc(numEdges, sizeof(epicsUInt32)));
+    p_BoundSeg = static_cast<epicsUInt16 *>(calloc(numEdges, sizeof(epicsUInt16)));
+    if ((p_Bounds == NULL) || (p_BoundSeg == NULL)) {
+      free(pEdges);
+      free(pIntervalSeg);
+      clear();
+      return ADNED_PIXEL_LOOKUP_ERROR;
+    }
+    for (epicsUInt32 i=0; i<numEdges; ++i) {
+      if (pEdges[i] > 0xFFFFFFFFULL) {
+        break;
+      }
+      p_Bounds[m_numBounds] = static_cast<epicsUInt32>(pEdges[i]);
+      p_BoundSeg[m_numBounds] = (i < numIntervals) ? pIntervalSeg[i] : 0;
+      ++m_numBounds;
+    }
+  }
+
+  free(pEdges);
+  free(pIntervalSeg);
+
+  return ADNED_PIXEL_LOOKUP_OK;
+}
+
+/**
+ * Binary search of the sorted range index. Used when there is no dense table.
+ * @param pixelID The raw pixel ID
+ * @return The segment index (0 if not in any detector)
+ */
+epicsUInt32 ADnEDPixelLookup::searchSegment(epicsUInt32 pixelID) const {
+
+  if ((m_numBounds == 0) || (pixelID < p_Bounds[0])) {
+    return 0;
+  }
+
+  //Find the last bound that is <= pixelID.
+  epicsUInt32 lo = 0;
+  epicsUInt32 hi = m_numBounds;
+  while (hi - lo > 1) {
+    epicsUInt32 mid = lo + ((hi - lo) / 2);
+    if (p_Bounds[mid] <= pixelID) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return p_BoundSeg[lo];
+}
+
+/**
+ * Print a summary of the lookup.
+ * @param fp File pointer to print to
+ */
+void ADnEDPixelLookup::report(FILE *fp) const {
+
+  fprintf(fp, "ADnEDPixelLookup: segments: %d\n", m_numSeg);
+  if (p_Table != NULL) {
+    fprintf(fp, "  Dense table. Start pixel ID: %d, Size: %d\n", m_tableStart, m_tableSize);
+  } else {
+    fprintf(fp, "  Range index. Number of ranges: %d\n", m_numBounds);
+  }
+  if (m_ranges.numRanges > 0) {
+    fprintf(fp, "  Vector classification. Number of ranges: %d\n", m_ranges.numRanges);
+  }
+  for (epicsUInt32 seg=1; seg<m_numSeg; ++seg) {
+    fprintf(fp, "  Segment %d detectors:", seg);
+    for (const epicsUInt32 *pDet=detBegin(seg); pDet!=detEnd(seg); ++pDet) {
+      fprintf(fp, " %d", *pDet);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+static int compareUInt64(const void *a, const void *b)
+{
+  epicsUInt64 lhs = *static_cast<const epicsUInt64 *>(a);
+  epicsUInt64 rhs = *static_cast<const epicsUInt64 *>(b);
+  return (lhs > rhs) - (lhs < rhs);
+}
@@ -0,0 +1,102 @@
+/**
+ * @brief Lookup from a raw pixel ID to the detector(s) whose pixel ID range contains it.
+ *
+ *        The detector pixel ID ranges are split into segments. A segment is a
+ *        run of pixel IDs that belong to the same set of detectors (normally
+ *        just one, but detector ranges are allowed to overlap). Segment 0 is
+ *        reserved for pixel IDs that are not in any detector.
+ *
+ *        If the pixel ID space is compact enough a dense table is used, which
+ *        maps a pixel ID to a segment with a single load. For sparse pixel ID
+ *        spaces a sorted range index is used instead (binary search).
+ *
+ *        If there are only a few pixel ID ranges, they are also kept in a
+ *        form that ADnEDSimd can use to classify a whole packet with vector compares.
+ *
+ *        The lookup is built by ADnED::allocArray, and is read-only during an
+ *        acquisition.
+ */
+
+#ifndef ADNED_PIXEL_LOOKUP_H
+#define ADNED_PIXEL_LOOKUP_H
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "epicsTypes.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDSimd.h"
+
+class ADnEDPixelLookup {
+
+ public:
+  ADnEDPixelLookup();
+  virtual ~ADnEDPixelLookup();
+
+  int build(epicsUInt32 numDet, const int *pDetStart, const int *pDetEnd);
+  void clear(void);
+  void report(FILE *fp) const;
+
+  /**
+   * Return the segment index for a raw pixel ID.
+   * Segment 0 means the pixel ID is not in any detector.
+   */
+  inline epicsUInt32 segment(epicsUInt32 pixelID) const {
+    if (p_Table != NULL) {
+      //Unsigned wrap means pixel IDs below the table start also fail this check.
+      epicsUInt32 index = pixelID - m_tableStart;
+      return (index < m_tableSize) ? p_Table[index] : 0;
+    }
+    return searchSegment(pixelID);
+  }
+
+  /**
+   * Return the pixel ID ranges for ADnEDSimd::classify, or NULL if
+   * there are too many ranges.
+   */
+  inline const ADnEDSimdRanges* getRanges(void) const {
+    return (m_ranges.numRanges > 0) ? &m_ranges : NULL;
+  }
+
+  /**
+   * Return the first detector number (1 based) in a segment.
+   */
+  inline const epicsUInt32* detBegin(epicsUInt32 seg) const {
+    return p_SegDets + p_SegIndex[seg];
+  }
+
+  /**
+   * Return one past the last detector number in a segment.
+   */
+  inline const epicsUInt32* detEnd(epicsUInt32 seg) const {
+    return p_SegDets + p_SegIndex[seg+1];
+  }
+
+ private:
+  epicsUInt32 searchSegment(epicsUInt32 pixelID) const;
+
+  //Dense table (pixel ID - m_tableStart) -> segment
+  epicsUInt16 *p_Table;
+  epicsUInt32 m_tableStart;
+  epicsUInt32 m_tableSize;
+
+  //Sorted range index. Pixel IDs in [p_Bounds[i], p_Bounds[i+1]) map to p_BoundSeg[i].
+  epicsUInt32 *p_Bounds;
+  epicsUInt16 *p_BoundSeg;
+  epicsUInt32 m_numBounds;
+
+  //Detectors in each segment. Segment s has detectors
+  //p_SegDets[p_SegIndex[s]] to p_SegDets[p_SegIndex[s+1]-1].
+  epicsUInt32 *p_SegIndex;
+  epicsUInt32 *p_SegDets;
+  epicsUInt32 m_numSeg;
+
+  //The non-empty segment ranges, for the vector classification.
+  ADnEDSimdRanges m_ranges;
+
+  //Empty segment 0, used before anything has been built.
+  epicsUInt32 m_emptyIndex[2];
+  epicsUInt32 m_emptyDets[1];
+
+};
+
+#endif //ADNED_PIXEL_LOOKUP_H
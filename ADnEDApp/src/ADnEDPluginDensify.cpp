@@ -0,0 +1,264 @@
+/*
+ * NDPluginDensify.cpp
+ *
+ * Densify plugin for the sparse NDArray objects from ADnED
+ *
+ * When sparse arrays are enabled, ADnED publishes NDUInt32 arrays
+ * of (index, count) pairs (dims [2, number of pairs]), with attributes
+ * describing the dense array. This plugin rebuilds the dense array, so
+ * it can be put in front of plugins that need it (eg. ROI, Stats, PVA).
+ * Arrays that are already dense are passed on as they are.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <iocsh.h>
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDSparse.h"
+#include "ADnEDPluginDensify.h"
+
+/**
+ * Rebuild the dense array from a sparse array. This is called with
+ * the mutex locked, and unlocks it to fill in the dense array.
+ * \param[in] pArray The sparse NDArray.
+ * \param[out] numPairs The number of (index, count) pairs.
+ * \return The dense NDArray, or NULL if pArray is not a valid sparse array
+ * or the dense array could not be allocated.
+ */
+NDArray* NDPluginDensify::densify(NDArray *pArray, epicsUInt32 &numPairs)
+{
+  epicsInt32 ndims = 0;
+  epicsUInt32 dim = 0;
+  size_t dims[2] = {0, 1};
+  size_t denseSize = 1;
+  NDAttribute *pAttribute = NULL;
+  NDArray *pOutput = NULL;
+  static const char* functionName = "NDPluginDensify::densify";
+
+  numPairs = 0;
+  if ((pArray->dataType != NDUInt32) || (pArray->ndims != 2) || (pArray->dims[0].size != 2)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s error. The sparse array must be NDUInt32 with dims [2, number of pairs].\n",
+              functionName);
+    return NULL;
+  }
+
+  if ((pAttribute = pArray->pAttributeList->find(ADNED_SPARSE_NDIMS_ATTR)) != NULL) {
+    pAttribute->getValue(NDAttrInt32, &ndims);
+  }
+  if ((ndims < 1) || (ndims > 2)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s error. Invalid number of dense dimensions (%d).\n",
+              functionName, ndims);
+    return NULL;
+  }
+  for (int i=0; i<ndims; ++i) {
+    dim = 0;
+    if ((pAttribute = pArray->pAttributeList->find((i == 0) ? ADNED_SPARSE_DIM0_ATTR : ADNED_SPARSE_DIM1_ATTR)) != NULL) {
+      pAttribute->getValue(NDAttrUInt32, &dim);
+    }
+    dims[i] = dim;
+    denseSize *= dim;
+  }
+  if (denseSize == 0) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s error. The dense array is empty.\n",
+              functionName);
+    return NULL;
+  }
+  if ((pAttribute = pArray->pAttributeList->find(ADNED_SPARSE_NUM_PAIRS_ATTR)) != NULL) {
+    pAttribute->getValue(NDAttrUInt32, &numPairs);
+  }
+  if (numPairs > pArray->dims[1].size) {
+    numPairs = static_cast<epicsUInt32>(pArray->dims[1].size);
+  }
+
+  if ((pOutput = this->pNDArrayPool->alloc(ndims, dims, NDUInt32, 0, NULL)) == NULL) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s error. Could not allocate array via pNDArrayPool->alloc.\n",
+              functionName);
+    return NULL;
+  }
+  pOutput->uniqueId = pArray->uniqueId;
+  pOutput->timeStamp = pArray->timeStamp;
+  pOutput->epicsTS = pArray->epicsTS;
+  pArray->pAttributeList->copy(pOutput->pAttributeList);
+  pOutput->pAttributeList->remove(ADNED_SPARSE_ATTR);
+  pOutput->pAttributeList->remove(ADNED_SPARSE_NUM_PAIRS_ATTR);
+  pOutput->pAttributeList->remove(ADNED_SPARSE_NDIMS_ATTR);
+  pOutput->pAttributeList->remove(ADNED_SPARSE_DIM0_ATTR);
+  pOutput->pAttributeList->remove(ADNED_SPARSE_DIM1_ATTR);
+
+  /* The arrays are not shared with other threads, so we don't need the mutex to fill in the data. */
+  this->unlock();
+  epicsUInt32 *pDense = static_cast<epicsUInt32 *>(pOutput->pData);
+  const epicsUInt32 *pPairs = static_cast<const epicsUInt32 *>(pArray->pData);
+  ADnEDSparse::unpack(pPairs, numPairs, pDense, static_cast<epicsUInt32>(denseSize));
+  this->lock();
+
+  return pOutput;
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * Converts sparse arrays into dense arrays.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginDensify::processCallbacks(NDArray *pArray)
+{
+  /*
+   * This function is called with the mutex already locked.
+   * It unlocks it during long calculations when private
+   * structures don't need to be protected.
+   */
+
+  epicsInt32 sparse = 0;
+  epicsUInt32 numPairs = 0;
+  NDAttribute *pAttribute = NULL;
+  NDArray *pOutput = NULL;
+  NDArrayInfo arrayInfo;
+  static const char* functionName = "NDPluginDensify::processCallbacks";
+
+  /* Call the base class method */
+  NDPluginDriver::beginProcessCallbacks(pArray);
+
+  if ((pAttribute = pArray->pAttributeList->find(ADNED_SPARSE_ATTR)) != NULL) {
+    pAttribute->getValue(NDAttrInt32, &sparse);
+  }
+
+  if (sparse) {
+    pOutput = this->densify(pArray, numPairs);
+    if (pOutput == NULL) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s error. Could not densify array %d.\n",
+                functionName, pArray->uniqueId);
+      callParamCallbacks();
+      return;
+    }
+  } else {
+    /* Dense arrays are passed on as they are */
+    pArray->reserve();
+    pOutput = pArray;
+  }
+  setIntegerParam(NDPluginDensifyNumPairs, static_cast<int>(numPairs));
+
+  /* We always keep the last array so read() can use it.
+   * Release previous one. */
+  if (this->pArrays[0]) {
+    this->pArrays[0]->release();
+  }
+  this->pArrays[0] = pOutput;
+
+  /* Set the size of the output array. NDArrayCounter has already been
+   * incremented for this array by NDPluginDriver::beginProcessCallbacks. */
+  pOutput->getInfo(&arrayInfo);
+  setIntegerParam(NDArraySize, static_cast<int>(arrayInfo.totalBytes));
+  setIntegerParam(NDArraySizeX, 0);
+  setIntegerParam(NDArraySizeY, 0);
+  setIntegerParam(NDArraySizeZ, 0);
+  if (pOutput->ndims > 0) setIntegerParam(NDArraySizeX, (int)pOutput->dims[0].size);
+  if (pOutput->ndims > 1) setIntegerParam(NDArraySizeY, (int)pOutput->dims[1].size);
+  if (pOutput->ndims > 2) setIntegerParam(NDArraySizeZ, (int)pOutput->dims[2].size);
+
+  /* Get the attributes for this driver */
+  this->getAttributes(this->pArrays[0]->pAttributeList);
+  /* Call any clients who have registered for NDArray callbacks */
+  doCallbacksGenericPointer(this->pArrays[0], NDArrayData, 0);
+  callParamCallbacks();
+}
+
+
+/** Constructor for NDPluginDensify
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginDensify::NDPluginDensify(const char *portName, int queueSize, int blockingCallbacks,
+                                 const char *NDArrayPort, int NDArrayAddr,
+                                 int maxBuffers, size_t maxMemory,
+                                 int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   0, 1, priority, stackSize, 1)
+{
+    createParam(NDPluginDensifyNumPairsString,   asynParamInt32, &NDPluginDensifyNumPairs);
+
+    setIntegerParam(NDPluginDensifyNumPairs, 0);
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginDensify");
+
+    // Enable ArrayCallbacks by default
+    setIntegerParam(NDArrayCallbacks, 1);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+}
+
+/**
+ * IOC shell command
+ */
+extern "C" int NDDensifyConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                  const char *NDArrayPort, int NDArrayAddr,
+                                  int maxBuffers, size_t maxMemory,
+                                  int priority, int stackSize)
+{
+    new NDPluginDensify(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                        maxBuffers, maxMemory, priority, stackSize);
+    return(asynSuccess);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8};
+static const iocshFuncDef initFuncDef = {"NDDensifyConfigure",9,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDDensifyConfigure(args[0].sval, args[1].ival, args[2].ival,
+                       args[3].sval, args[4].ival, args[5].ival,
+                       args[6].ival, args[7].ival, args[8].ival);
+}
+
+extern "C" void NDDensifyRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDDensifyRegister);
+}
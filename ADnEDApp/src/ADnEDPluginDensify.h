@@ -0,0 +1,31 @@
+/**
+ * See .cpp file for more documentation.
+ */
+
+#ifndef NDPluginDensify_H
+#define NDPluginDensify_H
+
+#include <epicsTypes.h>
+#include <asynStandardInterfaces.h>
+
+#include "NDPluginDriver.h"
+
+#define NDPluginDensifyNumPairsString  "DENSIFY_NUM_PAIRS"  /* Number of (index, count) pairs in the last sparse array */
+
+class epicsShareClass NDPluginDensify : public NDPluginDriver {
+public:
+    NDPluginDensify(const char *portName, int queueSize, int blockingCallbacks,
+                    const char *NDArrayPort, int NDArrayAddr,
+                    int maxBuffers, size_t maxMemory,
+                    int priority, int stackSize);
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    NDArray* densify(NDArray *pArray, epicsUInt32 &numPairs);
+
+protected:
+    int NDPluginDensifyNumPairs;
+    #define FIRST_NDPLUGIN_DENSIFY_PARAM NDPluginDensifyNumPairs
+};
+
+#endif //NDPluginDensify_H
@@ -0,0 +1,242 @@
+/**
+ * Work-stealing thread pool for histogramming large packets.
+ * See ADnEDPool.h for a description.
+ */
+
+#include "stdio.h"
+
+#include "epicsThread.h"
+#include "epicsAtomic.h"
+#include "epicsStdio.h"
+
+#include "ADnEDPool.h"
+
+/**
+ * Constructor.
+ */
+ADnEDPoolBatch::ADnEDPoolBatch(void) {
+  m_pending = 0;
+  m_doneEvent = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/**
+ * Destructor. A pool thread may still be signalling the event just after
+ * wait() returns, so a batch should live as long as the pool.
+ */
+ADnEDPoolBatch::~ADnEDPoolBatch(void) {
+  epicsEventDestroy(m_doneEvent);
+}
+
+/**
+ * Set the number of chunks to wait for. Call this before submitting them.
+ * @param numChunks The number of chunks
+ */
+void ADnEDPoolBatch::start(epicsUInt32 numChunks) {
+  epicsAtomicSetIntT(&m_pending, static_cast<int>(numChunks));
+}
+
+/**
+ * Count a finished chunk. This is called by the pool threads.
+ */
+void ADnEDPoolBatch::done(void) {
+  if (epicsAtomicDecrIntT(&m_pending) == 0) {
+    epicsEventSignal(m_doneEvent);
+  }
+}
+
+/**
+ * Block until all the chunks have been processed. The event may have been
+ * left signalled by an earlier batch, so the count is checked each time.
+ */
+void ADnEDPoolBatch::wait(void) {
+  while (epicsAtomicGetIntT(&m_pending) > 0) {
+    epicsEventWait(m_doneEvent);
+  }
+}
+
+/**
+ * Constructor. The threads are created by start().
+ * @param numThreads The number of pool threads
+ * @param func The function to call for each chunk
+ * @param pPvt Pointer passed to func
+ * @param wakeFunc Optional function each thread calls when woken by wake()
+ */
+ADnEDPool::ADnEDPool(epicsUInt32 numThreads, ADnEDPoolFunc func, void *pPvt, ADnEDPoolWakeFunc wakeFunc) {
+  m_numThreads = numThreads;
+  m_func = func;
+  m_wakeFunc = wakeFunc;
+  p_Pvt = pPvt;
+  m_next = 0;
+  m_numChunks = 0;
+  m_numStolen = 0;
+  p_Queues = new Queue[m_numThreads];
+  p_WorkerArg = new ADnEDPoolWorkerArg[m_numThreads];
+  for (epicsUInt32 worker=0; worker<m_numThreads; ++worker) {
+    p_Queues[worker].woken = false;
+    p_Queues[worker].event = epicsEventMustCreate(epicsEventEmpty);
+    p_WorkerArg[worker].pPool = this;
+    p_WorkerArg[worker].worker = worker;
+  }
+}
+
+/**
+ * Destructor. The pool threads never exit, so this should never be called
+ * once start() has been called.
+ */
+ADnEDPool::~ADnEDPool(void) {
+  for (epicsUInt32 worker=0; worker<m_numThreads; ++worker) {
+    epicsEventDestroy(p_Queues[worker].event);
+  }
+  delete [] p_Queues;
+  delete [] p_WorkerArg;
+}
+
+static void ADnEDPoolTaskC(void *drvPvt)
+{
+  ADnEDPoolWorkerArg *pArg = (ADnEDPoolWorkerArg *)drvPvt;
+
+  pArg->pPool->workerTask(pArg->worker);
+}
+
+/**
+ * Create the pool threads.
+ * @param name Base name for the threads (the thread index is appended)
+ * @return 0 on success, or -1 if a thread could not be created
+ */
+int ADnEDPool::start(const char *name) {
+  char threadName[ADNED_MAX_STRING_SIZE] = {0};
+
+  for (epicsUInt32 worker=0; worker<m_numThreads; ++worker) {
+    epicsSnprintf(threadName, ADNED_MAX_STRING_SIZE-1, "%s%d", name, worker);
+    if (epicsThreadCreate(threadName,
+                          epicsThreadPriorityHigh,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)ADnEDPoolTaskC,
+                          &p_WorkerArg[worker]) == NULL) {
+      fprintf(stderr, "ADnEDPool::start epicsThreadCreate failure for %s.\n", threadName);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Queue chunks for the pool threads. They are spread over the thread queues,
+ * starting at a different queue each time. Every thread is woken, so idle
+ * threads can steal chunks from the others straight away.
+ * This can be called from several threads at once.
+ * @param pChunks Array of chunks, which must stay valid until they have been processed
+ * @param numChunks The number of chunks
+ */
+void ADnEDPool::submit(ADnEDChunk *pChunks, epicsUInt32 numChunks) {
+  if ((m_numThreads == 0) || (numChunks == 0)) {
+    return;
+  }
+
+  epicsUInt32 first = static_cast<epicsUInt32>(epicsAtomicIncrIntT(&m_next)) % m_numThreads;
+  for (epicsUInt32 chunk=0; chunk<numChunks; ++chunk) {
+    Queue *pQueue = &p_Queues[(first + chunk) % m_numThreads];
+    pQueue->mutex.lock();
+    pQueue->chunks.push_back(&pChunks[chunk]);
+    pQueue->mutex.unlock();
+  }
+  epicsAtomicAddIntT(&m_numChunks, static_cast<int>(numChunks));
+
+  for (epicsUInt32 worker=0; worker<m_numThreads; ++worker) {
+    epicsEventSignal(p_Queues[worker].event);
+  }
+}
+
+/**
+ * Make every pool thread call the wake function (given to the constructor),
+ * before it takes any more chunks. This can be used to set up per thread 
+ * state in the thread that owns it.
+ */
+void ADnEDPool::wake(void) {
+  if (m_wakeFunc == NULL) {
+    return;
+  }
+  for (epicsUInt32 worker=0; worker<m_numThreads; ++worker) {
+    p_Queues[worker].mutex.lock();
+    p_Queues[worker].woken = true;
+    p_Queues[worker].mutex.unlock();
+    epicsEventSignal(p_Queues[worker].event);
+  }
+}
+
+/**
+ * Get the next chunk for a pool thread. This is the newest chunk on its own
+ * queue, or else the oldest chunk on one of the other queues.
+ * @param worker The pool thread index
+ * @return The chunk, or NULL if all the queues are empty
+ */
+ADnEDChunk* ADnEDPool::take(epicsUInt32 worker) {
+  ADnEDChunk *pChunk = NULL;
+
+  Queue *pQueue = &p_Queues[worker];
+  pQueue->mutex.lock();
+  if (!pQueue->chunks.empty()) {
+    pChunk = pQueue->chunks.back();
+    pQueue->chunks.pop_back();
+  }
+  pQueue->mutex.unlock();
+
+  for (epicsUInt32 i=1; (pChunk == NULL) && (i<m_numThreads); ++i) {
+    pQueue = &p_Queues[(worker + i) % m_numThreads];
+    pQueue->mutex.lock();
+    if (!pQueue->chunks.empty()) {
+      pChunk = pQueue->chunks.front();
+      pQueue->chunks.pop_front();
+      epicsAtomicIncrIntT(&m_numStolen);
+    }
+    pQueue->mutex.unlock();
+  }
+
+  return pChunk;
+}
+
+/**
+ * Pool thread. Processes chunks until all the queues are empty, then waits
+ * to be woken by submit() or wake(). Chunks submitted while the thread is busy leave the
+ * event signalled, so they are not missed.
+ * @param worker The pool thread index
+ */
+void ADnEDPool::workerTask(epicsUInt32 worker) {
+  ADnEDChunk *pChunk = NULL;
+  Queue *pQueue = &p_Queues[worker];
+  bool woken = false;
+
+  while (1) {
+    pQueue->mutex.lock();
+    woken = pQueue->woken;
+    pQueue->woken = false;
+    pQueue->mutex.unlock();
+    if (woken) {
+      m_wakeFunc(p_Pvt, worker);
+    }
+    pChunk = take(worker);
+    if (pChunk == NULL) {
+      epicsEventWait(pQueue->event);
+      continue;
+    }
+    //The chunk belongs to the submitter once the batch is done, so don't use it after that.
+    ADnEDPoolBatch *pBatch = pChunk->pBatch;
+    m_func(p_Pvt, pChunk, worker);
+    pBatch->done();
+  }
+}
+
+/**
+ * @return The total number of chunks submitted.
+ */
+epicsUInt32 ADnEDPool::getNumChunks(void) const {
+  return static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numChunks));
+}
+
+/**
+ * @return The total number of chunks taken from another thread's queue.
+ */
+epicsUInt32 ADnEDPool::getNumStolen(void) const {
+  return static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numStolen));
+}
@@ -0,0 +1,137 @@
+/**
+ * @brief Work-stealing thread pool for histogramming large packets.
+ *
+ *        Without the pool, each packet is histogrammed by the worker thread for
+ *        its channel, so a single busy channel can only use one core. With the pool,
+ *        the channel worker splits a large packet into chunks, submits them to the
+ *        pool, processes one chunk itself and waits for the rest. Each pool thread
+ *        histograms into its own shard, and the shards are merged at frame time
+ *        like the channel shards.
+ *
+ *        Each pool thread has its own queue of chunks. Submitted chunks are spread
+ *        over the queues, and a thread takes chunks from the back of its own queue.
+ *        When that is empty it steals from the front of the other queues, so threads
+ *        that finish early take work from busy ones.
+ *
+ *        The chunks and their results belong to the submitting thread, which must
+ *        keep them (and the event data and configuration they point to) valid
+ *        until ADnEDPoolBatch::wait() returns. The pool threads run for the
+ *        life of the IOC.
+ */
+
+#ifndef ADNED_POOL_H
+#define ADNED_POOL_H
+
+#include <deque>
+
+#include "epicsTypes.h"
+#include "epicsEvent.h"
+#include "epicsMutex.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDDetConfig.h"
+
+class ADnEDPool;
+
+/**
+ * Completion count for the chunks of one packet.
+ */
+class ADnEDPoolBatch {
+
+ public:
+  ADnEDPoolBatch();
+  virtual ~ADnEDPoolBatch();
+
+  void start(epicsUInt32 numChunks);
+  void done(void);
+  void wait(void);
+
+ private:
+  ADnEDPoolBatch(const ADnEDPoolBatch &);
+  ADnEDPoolBatch & operator=(const ADnEDPoolBatch &);
+
+  int m_pending;
+  epicsEventId m_doneEvent;
+
+};
+
+/**
+ * A range of events from one packet.
+ */
+struct ADnEDChunk {
+  const ADnEDConfigSnapshot *pConfig;
+  const epicsUInt32 *pPixels;
+  const epicsUInt32 *pTofs;
+  epicsUInt32 numEvents;
+  //Per-detector event counts for this chunk (indexed by detector number, 1 based). Zeroed by the submitter.
+  epicsUInt32 *pDetEvents;
+  //Per-detector reject counts for this chunk (see ADnEDHistogram::process). Zeroed by the submitter.
+  epicsUInt32 *pDetRejects;
+  //Set by the pool function (ADNED_HISTOGRAM_OK or ADNED_HISTOGRAM_ERROR).
+  int status;
+  ADnEDPoolBatch *pBatch;
+};
+
+/**
+ * Function run by the pool threads for each chunk.
+ * @param pPvt The pointer given to the ADnEDPool constructor
+ * @param pChunk The chunk to process
+ * @param worker The pool thread index (0 based)
+ */
+typedef void (*ADnEDPoolFunc)(void *pPvt, ADnEDChunk *pChunk, epicsUInt32 worker);
+
+/**
+ * Function run by each pool thread when the pool is woken with wake().
+ * @param pPvt The pointer given to the ADnEDPool constructor
+ * @param worker The pool thread index (0 based)
+ */
+typedef void (*ADnEDPoolWakeFunc)(void *pPvt, epicsUInt32 worker);
+
+//Argument for each pool thread.
+struct ADnEDPoolWorkerArg {
+  ADnEDPool *pPool;
+  epicsUInt32 worker;
+};
+
+class ADnEDPool {
+
+ public:
+  ADnEDPool(epicsUInt32 numThreads, ADnEDPoolFunc func, void *pPvt, ADnEDPoolWakeFunc wakeFunc = NULL);
+  virtual ~ADnEDPool();
+
+  int start(const char *name);
+  void submit(ADnEDChunk *pChunks, epicsUInt32 numChunks);
+  void wake(void);
+  void workerTask(epicsUInt32 worker);
+
+  inline epicsUInt32 getNumThreads(void) const {return m_numThreads;}
+  epicsUInt32 getNumChunks(void) const;
+  epicsUInt32 getNumStolen(void) const;
+
+ private:
+  ADnEDPool(const ADnEDPool &);
+  ADnEDPool & operator=(const ADnEDPool &);
+
+  ADnEDChunk* take(epicsUInt32 worker);
+
+  //Queue of chunks for one pool thread. Padded so the queues are on different cache lines.
+  struct Queue {
+    epicsMutex mutex;
+    std::deque<ADnEDChunk *> chunks;
+    bool woken;
+    epicsEventId event;
+    char pad[ADNED_CACHE_LINE_SIZE];
+  };
+
+  Queue *p_Queues;
+  ADnEDPoolWorkerArg *p_WorkerArg;
+  epicsUInt32 m_numThreads;
+  ADnEDPoolFunc m_func;
+  ADnEDPoolWakeFunc m_wakeFunc;
+  void *p_Pvt;
+  int m_next;
+  int m_numChunks;
+  int m_numStolen;
+
+};
+
+#endif //ADNED_POOL_H
@@ -0,0 +1,306 @@
+/**
+ * Recorder of the raw event packets, to an append-only binary file.
+ * See ADnEDRecorder.h for a description.
+ */
+
+#include <string.h>
+
+#include "epicsThread.h"
+#include "epicsAtomic.h"
+
+#include "ADnEDRecorder.h"
+#include "ADnEDThreadConfig.h"
+
+/**
+ * Constructor. The thread is created by start().
+ * @param numChannels The number of channels (one ring each)
+ */
+ADnEDRecorder::ADnEDRecorder(epicsUInt32 numChannels) {
+  m_numChannels = numChannels;
+  p_Rings = new ADnEDRing[m_numChannels];
+  m_dataEvent = epicsEventMustCreate(epicsEventEmpty);
+  p_File = NULL;
+  p_Index = NULL;
+  m_offset = 0;
+  m_dirty = false;
+  m_recording = 0;
+  m_numPackets = 0;
+  m_numDropped = 0;
+  m_numPulses = 0;
+}
+
+/**
+ * Destructor. The recorder thread never exits, so this should never be
+ * called once start() has been called.
+ */
+ADnEDRecorder::~ADnEDRecorder(void) {
+  closeFiles();
+  delete [] p_Rings;
+  epicsEventDestroy(m_dataEvent);
+}
+
+static void ADnEDRecorderTaskC(void *drvPvt)
+{
+  ADnEDRecorder *pRecorder = (ADnEDRecorder *)drvPvt;
+
+  pRecorder->recorderTask();
+}
+
+/**
+ * Create the recorder thread.
+ * @param name The thread name
+ * @return ADNED_RECORD_OK or ADNED_RECORD_ERROR
+ */
+int ADnEDRecorder::start(const char *name) {
+  if (epicsThreadCreate(name,
+                        epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)ADnEDRecorderTaskC,
+                        this) == NULL) {
+    fprintf(stderr, "ADnEDRecorder::start epicsThreadCreate failure for %s.\n", name);
+    return ADNED_RECORD_ERROR;
+  }
+  return ADNED_RECORD_OK;
+}
+
+/**
+ * Start recording to a file. If the file already exists, the recording is
+ * appended to it. The packet counters are reset.
+ * @param fileName The data file name
+ * @return ADNED_RECORD_OK or ADNED_RECORD_ERROR
+ */
+int ADnEDRecorder::open(const char *fileName) {
+  int status = ADNED_RECORD_OK;
+
+  if ((fileName == NULL) || (fileName[0] == '\0')) {
+    fprintf(stderr, "ADnEDRecorder::open No file name.\n");
+    return ADNED_RECORD_ERROR;
+  }
+
+  m_mutex.lock();
+  closeFiles();
+  m_fileName = fileName;
+  p_File = fopen(m_fileName.c_str(), "ab");
+  p_Index = fopen((m_fileName + ADNED_RECORD_INDEX_SUFFIX).c_str(), "ab");
+  if ((p_File == NULL) || (p_Index == NULL)) {
+    fprintf(stderr, "ADnEDRecorder::open Failed to open %s (or its index) for writing.\n", m_fileName.c_str());
+    status = ADNED_RECORD_ERROR;
+  }
+
+  if (status == ADNED_RECORD_OK) {
+    setvbuf(p_File, NULL, _IOFBF, ADNED_RECORD_BUFFER_SIZE);
+    fseek(p_File, 0, SEEK_END);
+    fseek(p_Index, 0, SEEK_END);
+    m_offset = static_cast<epicsUInt64>(ftell(p_File));
+    epicsAtomicSetIntT(&m_numPulses, static_cast<int>(ftell(p_Index) / sizeof(ADnEDRecordIndexEntry)));
+    //A new file gets a header. An existing file is just appended to.
+    if (m_offset == 0) {
+      ADnEDRecordFileHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, ADNED_RECORD_FILE_MAGIC, sizeof(header.magic));
+      header.version = ADNED_RECORD_VERSION;
+      header.fileHeaderSize = sizeof(ADnEDRecordFileHeader);
+      header.packetHeaderSize = sizeof(ADnEDRecordPacketHeader);
+      header.indexEntrySize = sizeof(ADnEDRecordIndexEntry);
+      if (fwrite(&header, sizeof(header), 1, p_File) != 1) {
+        fprintf(stderr, "ADnEDRecorder::open Failed to write the header to %s.\n", m_fileName.c_str());
+        status = ADNED_RECORD_ERROR;
+      }
+      m_offset = sizeof(header);
+    }
+  }
+
+  if (status == ADNED_RECORD_OK) {
+    m_lastPulse = epics::pvData::TimeStamp();
+    m_dirty = true;
+    epicsAtomicSetIntT(&m_numPackets, 0);
+    epicsAtomicSetIntT(&m_numDropped, 0);
+    epicsAtomicSetIntT(&m_recording, 1);
+  } else {
+    closeFiles();
+  }
+  m_mutex.unlock();
+
+  return status;
+}
+
+/**
+ * Stop recording, and close the files. Packets that are still queued are discarded.
+ */
+void ADnEDRecorder::close(void) {
+  m_mutex.lock();
+  closeFiles();
+  m_mutex.unlock();
+}
+
+/**
+ * Close the files. This must be called with the mutex locked.
+ */
+void ADnEDRecorder::closeFiles(void) {
+  epicsAtomicSetIntT(&m_recording, 0);
+  if (p_File != NULL) {
+    fclose(p_File);
+    p_File = NULL;
+  }
+  if (p_Index != NULL) {
+    fclose(p_Index);
+    p_Index = NULL;
+  }
+  m_dirty = false;
+}
+
+/**
+ * Queue a packet to be recorded. This never blocks. If the ring for the
+ * channel is full, the packet is dropped. Only one thread may call this
+ * for each channel (the same thread that queues it for histogramming).
+ * @param packet The packet to copy (this copies references to the event arrays).
+ * @param channelID The channel ID (0 based)
+ */
+void ADnEDRecorder::record(const ADnEDPacket &packet, epicsUInt32 channelID) {
+  if ((!isRecording()) || (channelID >= m_numChannels)) {
+    return;
+  }
+  if (p_Rings[channelID].push(packet)) {
+    epicsEventSignal(m_dataEvent);
+  } else {
+    epicsAtomicIncrIntT(&m_numDropped);
+  }
+}
+
+/**
+ * Recorder thread. Takes a packet from each channel ring in turn, so the channels
+ * stay roughly in time order in the file. The files are flushed when there is
+ * nothing to do.
+ */
+void ADnEDRecorder::recorderTask(void) {
+  int threadConfig = 0;
+
+  while (1) {
+    ADnEDThreadConfig::apply(ADNED_THREAD_RECORD, threadConfig);
+    bool idle = true;
+    for (epicsUInt32 chan=0; chan<m_numChannels; ++chan) {
+      ADnEDPacket *pPacket = p_Rings[chan].front();
+      if (pPacket != NULL) {
+        writePacket(*pPacket, chan);
+        //This drops our references to the event arrays.
+        p_Rings[chan].pop();
+        idle = false;
+      }
+    }
+    if (idle) {
+      m_mutex.lock();
+      if ((m_dirty) && (p_File != NULL)) {
+        fflush(p_File);
+        fflush(p_Index);
+        m_dirty = false;
+      }
+      m_mutex.unlock();
+      epicsEventWaitWithTimeout(m_dataEvent, ADNED_RECORD_FLUSH_PERIOD);
+    }
+  }
+}
+
+/**
+ * Write one packet, and an index entry if it starts a new pulse. If a write
+ * fails, the files are closed and recording stops.
+ * @param packet The packet
+ * @param channelID The channel ID (0 based)
+ * @return ADNED_RECORD_OK or ADNED_RECORD_ERROR
+ */
+int ADnEDRecorder::writePacket(const ADnEDPacket &packet, epicsUInt32 channelID) {
+  int status = ADNED_RECORD_OK;
+  ADnEDRecordPacketHeader header;
+  epicsUInt32 numEvents = 0;
+
+  if (packet.status == ADNED_PACKET_OK) {
+    numEvents = static_cast<epicsUInt32>(packet.pixels.size());
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = ADNED_RECORD_PACKET_MAGIC;
+  header.channelID = channelID;
+  header.seqID = static_cast<epicsUInt32>(packet.timeStamp.getUserTag());
+  header.status = packet.status;
+  header.secondsPastEpoch = packet.timeStamp.getSecondsPastEpoch();
+  header.nanoseconds = packet.timeStamp.getNanoseconds();
+  header.numEvents = numEvents;
+  header.pCharge = packet.pCharge;
+
+  m_mutex.lock();
+  if (p_File == NULL) {
+    m_mutex.unlock();
+    return ADNED_RECORD_OK;
+  }
+
+  //Packets with no timestamp can't start a pulse.
+  if ((packet.status != ADNED_PACKET_NO_TIMESTAMP) && (packet.timeStamp > m_lastPulse)) {
+    ADnEDRecordIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.secondsPastEpoch = header.secondsPastEpoch;
+    entry.nanoseconds = header.nanoseconds;
+    entry.pulse = static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numPulses));
+    entry.offset = m_offset;
+    if (fwrite(&entry, sizeof(entry), 1, p_Index) != 1) {
+      status = ADNED_RECORD_ERROR;
+    }
+    m_lastPulse = packet.timeStamp;
+    epicsAtomicIncrIntT(&m_numPulses);
+  }
+
+  if (fwrite(&header, sizeof(header), 1, p_File) != 1) {
+    status = ADNED_RECORD_ERROR;
+  }
+  if ((numEvents > 0) &&
+      ((fwrite(packet.pixels.data(), sizeof(epicsUInt32), numEvents, p_File) != numEvents) ||
+       (fwrite(packet.tofs.data(), sizeof(epicsUInt32), numEvents, p_File) != numEvents))) {
+    status = ADNED_RECORD_ERROR;
+  }
+
+  if (status == ADNED_RECORD_OK) {
+    m_offset += sizeof(header) + 2*static_cast<epicsUInt64>(numEvents)*sizeof(epicsUInt32);
+    m_dirty = true;
+    epicsAtomicIncrIntT(&m_numPackets);
+  } else {
+    fprintf(stderr, "ADnEDRecorder::writePacket Failed to write to %s. Recording stopped.\n", m_fileName.c_str());
+    closeFiles();
+  }
+  m_mutex.unlock();
+
+  return status;
+}
+
+/**
+ * @return true if a file is open for recording.
+ */
+bool ADnEDRecorder::isRecording(void) const {
+  return (epicsAtomicGetIntT(&m_recording) != 0);
+}
+
+/**
+ * @return The number of packets written since the file was opened.
+ */
+epicsUInt32 ADnEDRecorder::getNumPackets(void) const {
+  return static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numPackets));
+}
+
+/**
+ * @return The number of packets dropped (because the recorder could not keep up) since the file was opened.
+ */
+epicsUInt32 ADnEDRecorder::getNumDropped(void) const {
+  return static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numDropped));
+}
+
+/**
+ * @return The number of pulses in the index (including earlier recordings in the same file).
+ */
+epicsUInt32 ADnEDRecorder::getNumPulses(void) const {
+  return static_cast<epicsUInt32>(epicsAtomicGetIntT(&m_numPulses));
+}
+
+/**
+ * @return The size of the data file, in MB.
+ */
+epicsFloat64 ADnEDRecorder::getFileSize(void) const {
+  //m_offset is only written with the mutex held, but this is only for display.
+  return static_cast<epicsFloat64>(m_offset)/(1024.0*1024.0);
+}
@@ -0,0 +1,111 @@
+/**
+ * @brief Recorder of the raw event packets, to an append-only binary file.
+ *
+ *        The packets are queued as they are ingested (see ADnED::ingestPacket),
+ *        on a ring per channel, and written by the recorder thread. Queuing only
+ *        copies references to the event arrays, and if a ring is full the packet
+ *        is dropped (and counted), so recording never holds up the histogramming.
+ *
+ *        The data file starts with an ADnEDRecordFileHeader. Each packet is then
+ *        an ADnEDRecordPacketHeader, followed by numEvents pixel IDs then numEvents
+ *        TOF values (all epicsUInt32). Packets from different channels are interleaved
+ *        in the order they were written. The file is always appended to, so one
+ *        file can hold several recordings. Everything is in native byte order.
+ *
+ *        The pulse index is a separate file (the data file name with
+ *        ADNED_RECORD_INDEX_SUFFIX appended), which is an array of ADnEDRecordIndexEntry.
+ *        There is an entry for each packet with a newer timestamp than any before it
+ *        in the recording, which gives the offset of the first packet of each pulse.
+ *        If a channel lags, packets of a pulse can come after packets of newer pulses,
+ *        so a reader looking for a pulse should scan on a little from the offset.
+ */
+
+#ifndef ADNED_RECORDER_H
+#define ADNED_RECORDER_H
+
+#include <stdio.h>
+#include <string>
+
+#include "epicsTypes.h"
+#include "epicsMutex.h"
+#include "epicsEvent.h"
+#include "ADnEDRing.h"
+#include "ADnEDGlobals.h"
+
+/**
+ * Data file header.
+ */
+struct ADnEDRecordFileHeader {
+  char magic[8]; //ADNED_RECORD_FILE_MAGIC, not null terminated
+  epicsUInt32 version; //ADNED_RECORD_VERSION
+  epicsUInt32 fileHeaderSize; //sizeof(ADnEDRecordFileHeader)
+  epicsUInt32 packetHeaderSize; //sizeof(ADnEDRecordPacketHeader)
+  epicsUInt32 indexEntrySize; //sizeof(ADnEDRecordIndexEntry)
+};
+
+/**
+ * Header for each packet.
+ */
+struct ADnEDRecordPacketHeader {
+  epicsUInt32 magic; //ADNED_RECORD_PACKET_MAGIC
+  epicsUInt32 channelID; //0 based
+  epicsUInt32 seqID; //The timestamp user tag
+  epicsUInt32 status; //One of ADNED_PACKET_*
+  epicsInt64 secondsPastEpoch; //pvData timestamp (POSIX epoch)
+  epicsInt32 nanoseconds;
+  epicsUInt32 numEvents; //Zero unless status is ADNED_PACKET_OK
+  epicsFloat64 pCharge;
+};
+
+/**
+ * Pulse index entry.
+ */
+struct ADnEDRecordIndexEntry {
+  epicsInt64 secondsPastEpoch;
+  epicsInt32 nanoseconds;
+  epicsUInt32 pulse; //Counts up from 0 over the whole file
+  epicsUInt64 offset; //Byte offset of the packet header in the data file
+};
+
+class ADnEDRecorder {
+
+ public:
+  ADnEDRecorder(epicsUInt32 numChannels);
+  virtual ~ADnEDRecorder();
+
+  int start(const char *name);
+  int open(const char *fileName);
+  void close(void);
+  void record(const ADnEDPacket &packet, epicsUInt32 channelID);
+  void recorderTask(void);
+
+  bool isRecording(void) const;
+  epicsUInt32 getNumPackets(void) const;
+  epicsUInt32 getNumDropped(void) const;
+  epicsUInt32 getNumPulses(void) const;
+  epicsFloat64 getFileSize(void) const;
+
+ private:
+  int writePacket(const ADnEDPacket &packet, epicsUInt32 channelID);
+  void closeFiles(void);
+
+  epicsUInt32 m_numChannels;
+  ADnEDRing *p_Rings;
+  epicsEventId m_dataEvent;
+  //Protects the files and the pulse state
+  epicsMutex m_mutex;
+  FILE *p_File;
+  FILE *p_Index;
+  std::string m_fileName;
+  epicsUInt64 m_offset;
+  epics::pvData::TimeStamp m_lastPulse;
+  bool m_dirty;
+  //These are read without the mutex
+  int m_recording;
+  int m_numPackets;
+  int m_numDropped;
+  int m_numPulses;
+
+};
+
+#endif //ADNED_RECORDER_H
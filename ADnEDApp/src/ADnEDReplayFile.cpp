@@ -0,0 +1,115 @@
+/**
+ * Reader for the raw event files written by ADnEDRecorder.
+ * See ADnEDReplayFile.h for a description.
+ */
+
+#include <string.h>
+
+#include "ADnEDReplayFile.h"
+
+/**
+ * Constructor. The file is opened by open().
+ */
+ADnEDReplayFile::ADnEDReplayFile(void) {
+  p_File = NULL;
+  memset(&m_header, 0, sizeof(m_header));
+}
+
+/**
+ * Destructor.
+ */
+ADnEDReplayFile::~ADnEDReplayFile(void) {
+  close();
+}
+
+/**
+ * Open a file and check its header.
+ * @param fileName The data file name (not the index)
+ * @return ADNED_REPLAY_OK or ADNED_REPLAY_ERROR
+ */
+int ADnEDReplayFile::open(const char *fileName) {
+  close();
+
+  if ((fileName == NULL) || (fileName[0] == '\0')) {
+    fprintf(stderr, "ADnEDReplayFile::open No file name.\n");
+    return ADNED_REPLAY_ERROR;
+  }
+  m_fileName = fileName;
+
+  p_File = fopen(m_fileName.c_str(), "rb");
+  if (p_File == NULL) {
+    fprintf(stderr, "ADnEDReplayFile::open Failed to open %s.\n", m_fileName.c_str());
+    return ADNED_REPLAY_ERROR;
+  }
+  setvbuf(p_File, NULL, _IOFBF, ADNED_RECORD_BUFFER_SIZE);
+
+  if ((fread(&m_header, sizeof(m_header), 1, p_File) != 1) ||
+      (memcmp(m_header.magic, ADNED_RECORD_FILE_MAGIC, sizeof(m_header.magic)) != 0)) {
+    fprintf(stderr, "ADnEDReplayFile::open %s is not an ADnED event file.\n", m_fileName.c_str());
+    close();
+    return ADNED_REPLAY_ERROR;
+  }
+  if ((m_header.version != ADNED_RECORD_VERSION) ||
+      (m_header.fileHeaderSize != sizeof(ADnEDRecordFileHeader)) ||
+      (m_header.packetHeaderSize != sizeof(ADnEDRecordPacketHeader))) {
+    fprintf(stderr, "ADnEDReplayFile::open %s has an unsupported version (%d).\n", m_fileName.c_str(), m_header.version);
+    close();
+    return ADNED_REPLAY_ERROR;
+  }
+
+  return ADNED_REPLAY_OK;
+}
+
+/**
+ * Close the file.
+ */
+void ADnEDReplayFile::close(void) {
+  if (p_File != NULL) {
+    fclose(p_File);
+    p_File = NULL;
+  }
+}
+
+/**
+ * Read the next packet. The event arrays are newly allocated for each packet.
+ * @param packet The packet, as ADnED::eventHandler would have made it.
+ * @param channelID The channel the packet was recorded from (0 based)
+ * @return ADNED_REPLAY_OK, ADNED_REPLAY_END at the end of the file, or ADNED_REPLAY_ERROR
+ */
+int ADnEDReplayFile::read(ADnEDPacket &packet, epicsUInt32 &channelID) {
+  ADnEDRecordPacketHeader header;
+
+  if (p_File == NULL) {
+    return ADNED_REPLAY_ERROR;
+  }
+
+  size_t numRead = fread(&header, sizeof(header), 1, p_File);
+  if (numRead != 1) {
+    return feof(p_File) ? ADNED_REPLAY_END : ADNED_REPLAY_ERROR;
+  }
+  if ((header.magic != ADNED_RECORD_PACKET_MAGIC) || (header.numEvents > ADNED_REPLAY_MAX_EVENTS)) {
+    fprintf(stderr, "ADnEDReplayFile::read Bad packet header in %s.\n", m_fileName.c_str());
+    return ADNED_REPLAY_ERROR;
+  }
+
+  packet = ADnEDPacket();
+  packet.timeStamp.put(header.secondsPastEpoch, header.nanoseconds);
+  packet.timeStamp.setUserTag(static_cast<int>(header.seqID));
+  packet.pCharge = header.pCharge;
+  packet.status = header.status;
+  channelID = header.channelID;
+
+  if (header.numEvents > 0) {
+    epics::pvData::shared_vector<epics::pvData::uint32> pixels(header.numEvents);
+    epics::pvData::shared_vector<epics::pvData::uint32> tofs(header.numEvents);
+    if ((fread(pixels.data(), sizeof(epicsUInt32), header.numEvents, p_File) != header.numEvents) ||
+        (fread(tofs.data(), sizeof(epicsUInt32), header.numEvents, p_File) != header.numEvents)) {
+      fprintf(stderr, "ADnEDReplayFile::read Truncated packet in %s.\n", m_fileName.c_str());
+      return ADNED_REPLAY_ERROR;
+    }
+    packet.pixels = epics::pvData::freeze(pixels);
+    packet.tofs = epics::pvData::freeze(tofs);
+  }
+
+  return ADNED_REPLAY_OK;
+}
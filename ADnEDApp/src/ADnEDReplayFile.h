@@ -0,0 +1,37 @@
+/**
+ * @brief Reader for the raw event files written by ADnEDRecorder.
+ *
+ *        Each call to read() returns the next packet in the file, in the form
+ *        the PVAccess monitor callback produces, so it can be passed to
+ *        ADnED::ingestPacket. Files holding several appended recordings are
+ *        read straight through.
+ */
+
+#ifndef ADNED_REPLAY_FILE_H
+#define ADNED_REPLAY_FILE_H
+
+#include <stdio.h>
+#include <string>
+
+#include "epicsTypes.h"
+#include "ADnEDRecorder.h"
+#include "ADnEDGlobals.h"
+
+class ADnEDReplayFile {
+
+ public:
+  ADnEDReplayFile();
+  virtual ~ADnEDReplayFile();
+
+  int open(const char *fileName);
+  void close(void);
+  int read(ADnEDPacket &packet, epicsUInt32 &channelID);
+
+ private:
+  FILE *p_File;
+  std::string m_fileName;
+  ADnEDRecordFileHeader m_header;
+
+};
+
+#endif //ADNED_REPLAY_FILE_H
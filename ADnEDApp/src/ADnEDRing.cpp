@@ -0,0 +1,126 @@
+/**
+ * Single producer, single consumer queue of event packets.
+ * See ADnEDRing.h for a description.
+ */
+
+#include "epicsAtomic.h"
+
+#include "ADnEDRing.h"
+
+/**
+ * Constructor.
+ * @param size The number of packets the ring can hold. This is rounded up to a power of two.
+ */
+ADnEDRing::ADnEDRing(epicsUInt32 size) {
+  m_size = 1;
+  while (m_size < size) {
+    m_size <<= 1;
+  }
+  m_mask = m_size - 1;
+  m_head = 0;
+  m_tail = 0;
+  p_Packets = new ADnEDPacket[m_size];
+  m_dataEvent = epicsEventMustCreate(epicsEventEmpty);
+  m_spaceEvent = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/**
+ * Destructor.
+ */
+ADnEDRing::~ADnEDRing(void) {
+  delete [] p_Packets;
+  epicsEventDestroy(m_dataEvent);
+  epicsEventDestroy(m_spaceEvent);
+}
+
+/**
+ * Add a packet to the back of the ring. Only call this from the producer thread.
+ * @param packet The packet to copy (this copies references to the event arrays).
+ * @return false if the ring is full
+ */
+bool ADnEDRing::push(const ADnEDPacket &packet) {
+
+  size_t tail = m_tail;
+  size_t head = epicsAtomicGetSizeT(&m_head);
+  epicsAtomicReadMemoryBarrier();
+
+  if ((tail - head) >= m_size) {
+    return false;
+  }
+
+  p_Packets[tail & m_mask] = packet;
+
+  //Make the packet visible before the consumer can see the new tail.
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&m_tail, tail+1);
+  epicsEventSignal(m_dataEvent);
+
+  return true;
+}
+
+/**
+ * Block until the consumer has removed a packet. Only call this from the producer thread.
+ */
+void ADnEDRing::waitForSpace(void) {
+  epicsEventWaitWithTimeout(m_spaceEvent, ADNED_RING_SPACE_TIMEOUT);
+}
+
+/**
+ * Get the packet at the front of the ring, without removing it.
+ * Only call this from the consumer thread.
+ * @return A pointer to the packet, or NULL if the ring is empty.
+ */
+ADnEDPacket* ADnEDRing::front(void) {
+
+  size_t head = m_head;
+  size_t tail = epicsAtomicGetSizeT(&m_tail);
+  epicsAtomicReadMemoryBarrier();
+
+  if (head == tail) {
+    return NULL;
+  }
+
+  return &p_Packets[head & m_mask];
+}
+
+/**
+ * Remove the packet at the front of the ring. This drops the references
+ * to the event arrays. Only call this from the consumer thread, after front()
+ * has returned a packet.
+ */
+void ADnEDRing::pop(void) {
+
+  size_t head = m_head;
+
+  p_Packets[head & m_mask] = ADnEDPacket();
+
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&m_head, head+1);
+  epicsEventSignal(m_spaceEvent);
+}
+
+/**
+ * Block until the producer has added a packet. Only call this from the consumer thread.
+ * Because the event is only signalled after the tail is updated, a packet added between
+ * front() returning NULL and this call is not missed.
+ */
+void ADnEDRing::waitForData(void) {
+  epicsEventWait(m_dataEvent);
+}
+
+/**
+ * Wake the consumer from waitForData() without adding a packet.
+ */
+void ADnEDRing::wake(void) {
+  epicsEventSignal(m_dataEvent);
+}
+
+/**
+ * @return The number of packets waiting to be processed.
+ */
+epicsUInt32 ADnEDRing::getBacklog(void) const {
+  //Read the head first. The tail can only move forwards, so it can't be behind the head we read.
+  size_t head = epicsAtomicGetSizeT(&m_head);
+  size_t tail = epicsAtomicGetSizeT(&m_tail);
+  return static_cast<epicsUInt32>(tail - head);
+}
@@ -0,0 +1,75 @@
+/**
+ * @brief Single producer, single consumer queue of event packets.
+ *
+ *        The PVAccess monitor callback for a channel is the producer. It copies
+ *        references to the pixel ID and TOF arrays (the pvData shared_vector views,
+ *        so the event data itself is not copied) into the next free slot and
+ *        returns, so the monitor element can be released straight away. The
+ *        worker thread for the channel is the consumer, and does the histogramming.
+ *
+ *        The head and tail counters are only ever written by one thread each,
+ *        so no lock is needed. Holding the shared_vector views keeps the data
+ *        valid after the monitor element is released (pvData does a copy on
+ *        write if the element is reused while we still hold a reference).
+ */
+
+#ifndef ADNED_RING_H
+#define ADNED_RING_H
+
+#include "epicsTypes.h"
+#include "epicsEvent.h"
+#include "epicsTime.h"
+#include <pv/pvData.h>
+#include <pv/pvTimeStamp.h>
+#include "ADnEDGlobals.h"
+
+/**
+ * One update from a PVAccess channel.
+ */
+struct ADnEDPacket {
+  ADnEDPacket() : pCharge(0.0), status(ADNED_PACKET_OK) {ingestTime.secPastEpoch = 0; ingestTime.nsec = 0;}
+  epics::pvData::shared_vector<const epics::pvData::uint32> pixels;
+  epics::pvData::shared_vector<const epics::pvData::uint32> tofs;
+  epics::pvData::TimeStamp timeStamp;
+  epicsFloat64 pCharge;
+  epicsUInt32 status; //One of ADNED_PACKET_*
+  epicsTimeStamp ingestTime; //When the packet was queued, for the latency stats
+};
+
+class ADnEDRing {
+
+ public:
+  ADnEDRing(epicsUInt32 size = ADNED_RING_SIZE);
+  virtual ~ADnEDRing();
+
+  //Producer functions
+  bool push(const ADnEDPacket &packet);
+  void waitForSpace(void);
+
+  //Consumer functions
+  ADnEDPacket* front(void);
+  void pop(void);
+  void waitForData(void);
+
+  //These can be called from any thread.
+  void wake(void);
+  epicsUInt32 getBacklog(void) const;
+  inline epicsUInt32 getSize(void) const {return m_size;}
+
+ private:
+  ADnEDPacket *p_Packets;
+  epicsUInt32 m_size;
+  size_t m_mask;
+  epicsEventId m_dataEvent;
+  epicsEventId m_spaceEvent;
+
+  //Keep the consumer and producer counters on different cache lines.
+  char m_pad0[ADNED_CACHE_LINE_SIZE];
+  size_t m_head; //Written by the consumer
+  char m_pad1[ADNED_CACHE_LINE_SIZE];
+  size_t m_tail; //Written by the producer
+  char m_pad2[ADNED_CACHE_LINE_SIZE];
+
+};
+
+#endif //ADNED_RING_H
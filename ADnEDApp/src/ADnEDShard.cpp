@@ -0,0 +1,367 @@
+/**
+ * Private histogram buffer for one event processing thread.
+ * See ADnEDShard.h for a description.
+ */
+
+#include "stdlib.h"
+#include "string.h"
+#include <algorithm>
+
+#include "ADnEDShard.h"
+
+/**
+ * Constructor. The shard is empty until alloc() is called.
+ */
+ADnEDShard::ADnEDShard(void) {
+  for (int half=0; half<2; ++half) {
+    p_Data[half] = NULL;
+    p_Dirty[half] = NULL;
+    p_Resident[half] = NULL;
+    m_numResident[half] = 0;
+    ADnEDMemory::init(&m_Block[half]);
+  }
+  m_maxResident = 0;
+  m_canRelease = false;
+  m_size = 0;
+  m_numPages = 0;
+  m_active = 0;
+  m_touched = false;
+  m_prefault = false;
+  m_lockMemory = false;
+}
+
+/**
+ * Destructor.
+ */
+ADnEDShard::~ADnEDShard(void) {
+  freeHalves();
+}
+
+/**
+ * Free both halves and their page flags.
+ */
+void ADnEDShard::freeHalves(void) {
+  for (int half=0; half<2; ++half) {
+    ADnEDMemory::release(&m_Block[half]);
+    free(p_Dirty[half]);
+    free(p_Resident[half]);
+    p_Data[half] = NULL;
+    p_Dirty[half] = NULL;
+    p_Resident[half] = NULL;
+    m_numResident[half] = 0;
+  }
+}
+
+/**
+ * Allocate (or reallocate) both halves of the shard. The contents are set to zero.
+ * The memory is not used until it is written to, unless it is pre-faulted or locked
+ * (by touch()).
+ * @param size The number of elements (the same as the published data buffer)
+ * @param mode The ADnEDMemory allocation mode (ADNED_MEMORY_DEFAULT, etc.)
+ * @param prefault Fault in the halves when the shard is touched
+ * @param lockMemory Lock the halves into RAM when the shard is touched
+ * @param maxFootprint The most memory (in bytes) the pages that have been written to 
+ *                     should use, over both halves. 0 means no limit. This can't 
+ *                     be kept to if the halves are pre-faulted or locked, or come 
+ *                     from the huge page pool.
+ * @return ADNED_SHARD_OK or ADNED_SHARD_ERROR
+ */
+int ADnEDShard::alloc(epicsUInt32 size, int mode, bool prefault, bool lockMemory, size_t maxFootprint) {
+
+  freeHalves();
+  m_size = 0;
+  m_numPages = 0;
+  m_active = 0;
+  m_touched = false;
+  m_prefault = prefault;
+  m_lockMemory = lockMemory;
+  m_maxResident = static_cast<epicsUInt32>(std::min(maxFootprint / (ADNED_SHARD_PAGE_SIZE*sizeof(epicsUInt32)),
+                                                    static_cast<size_t>(0xFFFFFFFF)));
+  if ((maxFootprint > 0) && (m_maxResident == 0)) {
+    m_maxResident = 1;
+  }
+  m_canRelease = false;
+
+  if (size == 0) {
+    return ADNED_SHARD_ERROR;
+  }
+
+  epicsUInt32 numPages = getNumPages(size);
+  m_canRelease = ((!prefault) && (!lockMemory));
+  for (int half=0; half<2; ++half) {
+    ADnEDMemory::alloc(&m_Block[half], static_cast<size_t>(size)*sizeof(epicsUInt32), mode);
+    p_Data[half] = static_cast<epicsUInt32 *>(m_Block[half].pData);
+    p_Dirty[half] = static_cast<epicsUInt8 *>(calloc(numPages, sizeof(epicsUInt8)));
+    p_Resident[half] = static_cast<epicsUInt8 *>(calloc(numPages, sizeof(epicsUInt8)));
+    if ((p_Data[half] == NULL) || (p_Dirty[half] == NULL) || (p_Resident[half] == NULL)) {
+      freeHalves();
+      m_canRelease = false;
+      return ADNED_SHARD_ERROR;
+    }
+    //Only normal mappings can be given back a page at a time.
+    if ((m_Block[half].pMap == NULL) || (m_Block[half].mode == ADNED_MEMORY_HUGE_EXPLICIT)) {
+      m_canRelease = false;
+    }
+  }
+  m_size = size;
+  m_numPages = numPages;
+
+  return ADNED_SHARD_OK;
+}
+
+/**
+ * Pre-fault and lock both halves, if that was asked for in alloc(), the first 
+ * time this is called after alloc(). The owning thread calls this before it
+ * first histograms into the shard, so that the memory is placed on its NUMA node.
+ * Otherwise this does nothing, and the pages are placed when the owning thread 
+ * first writes to them.
+ * @return ADNED_SHARD_OK, or ADNED_SHARD_ERROR if the memory could not be locked
+ */
+int ADnEDShard::touch(void) {
+  int status = ADNED_SHARD_OK;
+
+  if (m_touched) {
+    return status;
+  }
+  for (int half=0; half<2; ++half) {
+    if (p_Data[half] != NULL) {
+      if (m_prefault) {
+        ADnEDMemory::prefault(&m_Block[half]);
+      }
+      if ((m_lockMemory) && (ADnEDMemory::lock(&m_Block[half]) != ADNED_MEMORY_OK)) {
+        status = ADNED_SHARD_ERROR;
+      }
+    }
+  }
+  m_touched = true;
+
+  return status;
+}
+
+/**
+ * The memory used by the shard. If pages can be given back to the OS, this is the 
+ * pages that have been written to (up to the last merge), otherwise it is the size 
+ * of both halves. The page flags are included.
+ * @return The number of bytes of memory used.
+ */
+size_t ADnEDShard::getFootprint(void) const {
+  size_t footprint = 0;
+  for (int half=0; half<2; ++half) {
+    if (p_Data[half] == NULL) {
+      continue;
+    }
+    if (m_canRelease) {
+      footprint += static_cast<size_t>(m_numResident[half])*ADNED_SHARD_PAGE_SIZE*sizeof(epicsUInt32);
+    } else {
+      footprint += ADnEDMemory::getFootprint(&m_Block[half]);
+    }
+    footprint += 2*m_numPages*sizeof(epicsUInt8);
+  }
+  return footprint;
+}
+
+/**
+ * Give the pages of one half that have been written to back to the OS. They
+ * must be zero (merged) already. Pages that can't be given back are left flagged.
+ * @param half The half (0 or 1)
+ */
+void ADnEDShard::release(epicsUInt32 half) {
+  epicsUInt8 *pResident = p_Resident[half];
+  epicsUInt32 page = 0;
+
+  while (page < m_numPages) {
+    if (!pResident[page]) {
+      ++page;
+      continue;
+    }
+    epicsUInt32 first = page;
+    while ((page < m_numPages) && (pResident[page])) {
+      ++page;
+    }
+    epicsUInt32 start = first * ADNED_SHARD_PAGE_SIZE;
+    epicsUInt32 end = std::min(page * ADNED_SHARD_PAGE_SIZE, m_size);
+    if (ADnEDMemory::discard(&m_Block[half], start*sizeof(epicsUInt32), (end-start)*sizeof(epicsUInt32))) {
+      memset(pResident+first, 0, (page-first)*sizeof(epicsUInt8));
+      m_numResident[half] -= (page-first);
+    }
+  }
+}
+
+/**
+ * Set the whole shard (both halves) to zero. Only the dirty pages can have
+ * counts in them (the merged pages are set to zero), so only these are written.
+ * The pages that have been written to are then given back to the OS, if possible.
+ * This needs the driver data buffer mutex as well as the shard lock.
+ */
+void ADnEDShard::clear(void) {
+  for (epicsUInt32 half=0; half<2; ++half) {
+    if (p_Data[half] == NULL) {
+      continue;
+    }
+    for (epicsUInt32 page=0; page<m_numPages; ++page) {
+      if (p_Dirty[half][page]) {
+        epicsUInt32 start = page * ADNED_SHARD_PAGE_SIZE;
+        epicsUInt32 end = std::min(start + ADNED_SHARD_PAGE_SIZE, m_size);
+        memset(p_Data[half]+start, 0, (end-start)*sizeof(epicsUInt32));
+        p_Dirty[half][page] = 0;
+        if (!p_Resident[half][page]) {
+          p_Resident[half][page] = 1;
+          ++m_numResident[half];
+        }
+      }
+    }
+    if (m_canRelease) {
+      release(half);
+    }
+  }
+}
+
+/**
+ * Set part of the shard (in both halves) to zero. Like clear(), only the
+ * dirty pages are written.
+ * @param start The first element
+ * @param size The number of elements
+ */
+void ADnEDShard::clear(epicsUInt32 start, epicsUInt32 size) {
+  if ((start >= m_size) || (size == 0)) {
+    return;
+  }
+  if (size > (m_size - start)) {
+    size = m_size - start;
+  }
+  epicsUInt32 end = start + size;
+  for (int half=0; half<2; ++half) {
+    if (p_Data[half] == NULL) {
+      continue;
+    }
+    for (epicsUInt32 page=start/ADNED_SHARD_PAGE_SIZE; (page<m_numPages) && (page*ADNED_SHARD_PAGE_SIZE<end); ++page) {
+      if (p_Dirty[half][page]) {
+        epicsUInt32 first = std::max(page * ADNED_SHARD_PAGE_SIZE, start);
+        epicsUInt32 last = std::min((page+1) * ADNED_SHARD_PAGE_SIZE, end);
+        memset(p_Data[half]+first, 0, (last-first)*sizeof(epicsUInt32));
+      }
+    }
+  }
+}
+
+/**
+ * Swap the active and standby halves. The standby half must have been
+ * merged (so it is zero) before this is called again.
+ */
+void ADnEDShard::swap(void) {
+  m_active ^= 1;
+}
+
+/**
+ * Set the flags for the pages that cover part of a buffer.
+ * @param pPages The page flags
+ * @param numPages The number of page flags
+ * @param start The first element
+ * @param size The number of elements
+ */
+void ADnEDShard::markPages(epicsUInt8 *pPages, epicsUInt32 numPages, epicsUInt32 start, epicsUInt32 size) {
+  if ((pPages == NULL) || (size == 0)) {
+    return;
+  }
+  epicsUInt32 firstPage = start / ADNED_SHARD_PAGE_SIZE;
+  epicsUInt32 lastPage = (start + size - 1) / ADNED_SHARD_PAGE_SIZE;
+  if (lastPage >= numPages) {
+    lastPage = numPages - 1;
+  }
+  if (firstPage <= lastPage) {
+    memset(pPages+firstPage, 1, (lastPage-firstPage+1)*sizeof(epicsUInt8));
+  }
+}
+
+/**
+ * Zero part of a buffer that has page flags (such as the delta buffer). The flags
+ * are cleared for the pages that are wholly in the region, and kept for the
+ * pages that are only partly in it, as these can still have counts.
+ * @param pBuffer The buffer
+ * @param pPages The page flags for the buffer
+ * @param bufferSize The number of elements in the buffer
+ * @param start The first element
+ * @param size The number of elements
+ */
+void ADnEDShard::clearPages(epicsUInt32 *pBuffer, epicsUInt8 *pPages, epicsUInt32 bufferSize, 
+                            epicsUInt32 start, epicsUInt32 size) {
+  if ((pBuffer == NULL) || (pPages == NULL) || (size == 0) || (start >= bufferSize)) {
+    return;
+  }
+  size = std::min(size, bufferSize - start);
+  memset(pBuffer + start, 0, size*sizeof(epicsUInt32));
+  epicsUInt32 end = start + size;
+  epicsUInt32 numPages = getNumPages(bufferSize);
+  for (epicsUInt32 page = (start + ADNED_SHARD_PAGE_SIZE - 1) / ADNED_SHARD_PAGE_SIZE; page<numPages; ++page) {
+    epicsUInt32 pageEnd = std::min((page+1) * ADNED_SHARD_PAGE_SIZE, bufferSize);
+    if (pageEnd > end) {
+      break;
+    }
+    pPages[page] = 0;
+  }
+}
+
+/**
+ * Add the dirty pages of the standby half into a destination buffer of the 
+ * same size, then set them to zero. The standby half holds the counts since the 
+ * last swap, so they can also be added into a delta buffer. If the pages that
+ * have been written to are over the limit, the standby half is given back to the OS.
+ * This needs the driver data buffer mutex.
+ * @param pDest The destination buffer
+ * @param pChanged Page flags for the destination buffer. The merged pages are set (can be NULL).
+ * @param pDelta Optional delta buffer, of the same size. The merged pages are added into this too.
+ * @param pDeltaPages Page flags for the delta buffer. The merged pages are set (can be NULL).
+ * @return The number of pages merged
+ */
+epicsUInt32 ADnEDShard::mergeInto(epicsUInt32 *pDest, epicsUInt8 *pChanged, 
+                                  epicsUInt32 *pDelta, epicsUInt8 *pDeltaPages) {
+
+  const epicsUInt32 standby = m_active ^ 1;
+  epicsUInt32 *pStandby = p_Data[standby];
+  epicsUInt8 *pDirty = p_Dirty[standby];
+  epicsUInt8 *pResident = p_Resident[standby];
+  epicsUInt32 numMerged = 0;
+
+  if ((pStandby == NULL) || (pDest == NULL)) {
+    return 0;
+  }
+
+  for (epicsUInt32 page=0; page<m_numPages; ++page) {
+    if (!pDirty[page]) {
+      continue;
+    }
+    epicsUInt32 start = page * ADNED_SHARD_PAGE_SIZE;
+    epicsUInt32 end = start + ADNED_SHARD_PAGE_SIZE;
+    if (end > m_size) {
+      end = m_size;
+    }
+    for (epicsUInt32 i=start; i<end; ++i) {
+      pDest[i] += pStandby[i];
+    }
+    if (pDelta != NULL) {
+      for (epicsUInt32 i=start; i<end; ++i) {
+        pDelta[i] += pStandby[i];
+      }
+      if (pDeltaPages != NULL) {
+        pDeltaPages[page] = 1;
+      }
+    }
+    memset(pStandby+start, 0, (end-start)*sizeof(epicsUInt32));
+    pDirty[page] = 0;
+    if (!pResident[page]) {
+      pResident[page] = 1;
+      ++m_numResident[standby];
+    }
+    if (pChanged != NULL) {
+      pChanged[page] = 1;
+    }
+    ++numMerged;
+  }
+
+  //Keep the memory within the limit, by giving back the half that was just merged.
+  if ((m_canRelease) && (m_maxResident > 0) && ((m_numResident[0] + m_numResident[1]) > m_maxResident)) {
+    release(standby);
+  }
+
+  return numMerged;
+}
@@ -0,0 +1,98 @@
+/**
+ * @brief Private histogram buffer for one event processing thread.
+ *
+ *        Each channel thread histograms into its own shard, protected by the
+ *        shard mutex rather than the asyn port lock. The shard has the same layout 
+ *        as the published data buffer.
+ *
+ *        The shard is double buffered. The channel thread only uses the active half.
+ *        The frame thread swaps the halves (which only needs the shard mutex for a moment),
+ *        then merges the standby half into the published data buffer without the shard
+ *        mutex, so the channel thread can carry on histogramming during the merge. The
+ *        standby half must only be used by code holding the driver data buffer mutex.
+ *
+ *        Each half has a dirty flag per page of ADNED_SHARD_PAGE_SIZE elements. The
+ *        histogram kernel sets the flag for each page it writes to (see getDirty()), 
+ *        and only the dirty pages are merged.
+ *
+ *        The halves are allocated with ADnEDMemory, so they can use huge pages. The
+ *        OS only provides the pages that are written to, and these are first written 
+ *        by the owning thread, so on NUMA machines they are placed on the node the
+ *        thread runs on. So a shard only uses memory for the parts of the data buffer 
+ *        that its thread has histogrammed into. The pages that have been written to 
+ *        are tracked (they are flagged when they are merged), and if they add up to more 
+ *        than the limit given to alloc(), the standby half is given back to the OS after 
+ *        it is merged. The halves can instead be pre-faulted, or locked into RAM, when
+ *        they are touched, in which case they always use their full size.
+ *
+ *        Code that needs to change state used by every channel thread (for example
+ *        the TOF transformation objects) can lock every shard to exclude all histogramming.
+ *        Locks must always be taken in the order: asyn port lock, then shards in index order.
+ */
+
+#ifndef ADNED_SHARD_H
+#define ADNED_SHARD_H
+
+#include "epicsTypes.h"
+#include "epicsMutex.h"
+#include "ADnEDGlobals.h"
+#include "ADnEDMemory.h"
+
+class ADnEDShard {
+
+ public:
+  ADnEDShard();
+  virtual ~ADnEDShard();
+
+  inline void lock(void) {m_mutex.lock();}
+  inline void unlock(void) {m_mutex.unlock();}
+
+  //The functions below require the shard to be locked.
+  int alloc(epicsUInt32 size, int mode = ADNED_MEMORY_DEFAULT, bool prefault = false, 
+            bool lockMemory = false, size_t maxFootprint = 0);
+  int touch(void);
+  void clear(void);
+  void clear(epicsUInt32 start, epicsUInt32 size);
+  void swap(void);
+  inline epicsUInt32* getData(void) const {return p_Data[m_active];}
+  inline epicsUInt8* getDirty(void) const {return p_Dirty[m_active];}
+  inline epicsUInt32 getSize(void) const {return m_size;}
+  inline int getMode(void) const {return m_Block[0].mode;}
+
+  //This only uses the standby half, so does not need the shard lock.
+  epicsUInt32 mergeInto(epicsUInt32 *pDest, epicsUInt8 *pChanged, 
+                        epicsUInt32 *pDelta = NULL, epicsUInt8 *pDeltaPages = NULL);
+  //This needs the driver data buffer mutex, rather than the shard lock.
+  size_t getFootprint(void) const;
+
+  static void markPages(epicsUInt8 *pPages, epicsUInt32 numPages, epicsUInt32 start, epicsUInt32 size);
+  static void clearPages(epicsUInt32 *pBuffer, epicsUInt8 *pPages, epicsUInt32 bufferSize, 
+                         epicsUInt32 start, epicsUInt32 size);
+  static inline epicsUInt32 getNumPages(epicsUInt32 size) {
+    return (size + ADNED_SHARD_PAGE_SIZE - 1) / ADNED_SHARD_PAGE_SIZE;
+  }
+
+ private:
+  void release(epicsUInt32 half);
+  void freeHalves(void);
+
+  epicsMutex m_mutex;
+  epicsUInt32 *p_Data[2];
+  epicsUInt8 *p_Dirty[2];
+  //Pages that have been written to, so are using memory (set when they are merged).
+  epicsUInt8 *p_Resident[2];
+  epicsUInt32 m_numResident[2];
+  //The most resident pages (0 for no limit), and whether they can be given back.
+  epicsUInt32 m_maxResident;
+  bool m_canRelease;
+  ADnEDMemoryBlock m_Block[2];
+  epicsUInt32 m_size;
+  epicsUInt32 m_numPages;
+  epicsUInt32 m_active;
+  bool m_touched;
+  bool m_prefault;
+  bool m_lockMemory;
+
+};
+
+#endif //ADNED_SHARD_H
@@ -0,0 +1,235 @@
+/**
+ * Export of the published histogram in a POSIX shared memory segment.
+ * See ADnEDShm.h for a description.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "ADnEDShm.h"
+#include "ADnEDShard.h"
+
+/**
+ * Constructor. The segment is created by open().
+ */
+ADnEDShm::ADnEDShm(void) {
+  m_fd = -1;
+  p_Map = NULL;
+  m_mapSize = 0;
+  p_Header = NULL;
+  p_Dets = NULL;
+  p_Data = NULL;
+  m_maxDets = 0;
+  m_dataSize = 0;
+  m_numFrames = 0;
+  m_full = true;
+}
+
+/**
+ * Destructor. Unlinks the segment.
+ */
+ADnEDShm::~ADnEDShm(void) {
+  close();
+}
+
+/**
+ * @param maxDets The number of entries in the detector table
+ * @return The size of the header and detector table, rounded up to ADNED_SHM_ALIGN.
+ */
+epicsUInt32 ADnEDShm::getHeaderSize(epicsUInt32 maxDets) {
+  size_t size = sizeof(ADnEDShmHeader) + maxDets*sizeof(ADnEDShmDet);
+  return static_cast<epicsUInt32>(((size + ADNED_SHM_ALIGN - 1) / ADNED_SHM_ALIGN) * ADNED_SHM_ALIGN);
+}
+
+/**
+ * Create the segment, with room for the header but no data yet. Any old segment
+ * of the same name (for example from an IOC that crashed) is unlinked first, so
+ * readers still using it are not affected.
+ * @param name The segment name. A leading / is added if it is missing.
+ * @param maxDets The number of entries in the detector table
+ * @return ADNED_SHM_OK or ADNED_SHM_ERROR
+ */
+int ADnEDShm::open(const char *name, epicsUInt32 maxDets) {
+  close();
+
+  if ((name == NULL) || (name[0] == '\0')) {
+    fprintf(stderr, "ADnEDShm::open No segment name.\n");
+    return ADNED_SHM_ERROR;
+  }
+  m_name = (name[0] == '/') ? name : std::string("/") + name;
+  m_maxDets = maxDets;
+
+#ifdef __linux__
+  shm_unlink(m_name.c_str());
+  m_fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (m_fd < 0) {
+    fprintf(stderr, "ADnEDShm::open shm_open failed for %s: %s\n", m_name.c_str(), strerror(errno));
+    m_name.clear();
+    return ADNED_SHM_ERROR;
+  }
+  if (map(getHeaderSize(m_maxDets)) != ADNED_SHM_OK) {
+    close();
+    return ADNED_SHM_ERROR;
+  }
+
+  //The segment is zero filled, so only the fixed fields need setting.
+  p_Header->version = ADNED_SHM_VERSION;
+  p_Header->headerSize = getHeaderSize(m_maxDets);
+  p_Header->maxDets = m_maxDets;
+  epicsAtomicWriteMemoryBarrier();
+  p_Header->magic = ADNED_SHM_MAGIC;
+  m_dataSize = 0;
+  m_numFrames = 0;
+  m_full = true;
+
+  return ADNED_SHM_OK;
+#else
+  fprintf(stderr, "ADnEDShm::open Shared memory export is only supported on Linux.\n");
+  m_name.clear();
+  return ADNED_SHM_ERROR;
+#endif
+}
+
+/**
+ * Unmap and unlink the segment. Readers that still have it mapped can
+ * carry on reading the last frame.
+ */
+void ADnEDShm::close(void) {
+#ifdef __linux__
+  if (p_Map != NULL) {
+    munmap(p_Map, m_mapSize);
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    shm_unlink(m_name.c_str());
+  }
+#endif
+  m_fd = -1;
+  p_Map = NULL;
+  m_mapSize = 0;
+  p_Header = NULL;
+  p_Dets = NULL;
+  p_Data = NULL;
+  m_dataSize = 0;
+  m_name.clear();
+}
+
+/**
+ * Grow the segment, and map it again.
+ * @param size The new size in bytes. This must be larger than the current size.
+ * @return ADNED_SHM_OK or ADNED_SHM_ERROR
+ */
+int ADnEDShm::map(size_t size) {
+#ifdef __linux__
+  if (ftruncate(m_fd, static_cast<off_t>(size)) != 0) {
+    fprintf(stderr, "ADnEDShm::map ftruncate failed for %s: %s\n", m_name.c_str(), strerror(errno));
+    return ADNED_SHM_ERROR;
+  }
+  if (p_Map != NULL) {
+    munmap(p_Map, m_mapSize);
+    p_Map = NULL;
+    m_mapSize = 0;
+  }
+  void *pMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (pMap == MAP_FAILED) {
+    fprintf(stderr, "ADnEDShm::map mmap failed for %s: %s\n", m_name.c_str(), strerror(errno));
+    p_Header = NULL;
+    p_Dets = NULL;
+    p_Data = NULL;
+    return ADNED_SHM_ERROR;
+  }
+  p_Map = pMap;
+  m_mapSize = size;
+  p_Header = static_cast<ADnEDShmHeader *>(p_Map);
+  p_Dets = reinterpret_cast<ADnEDShmDet *>(p_Header + 1);
+  p_Data = reinterpret_cast<epicsUInt32 *>(static_cast<char *>(p_Map) + getHeaderSize(m_maxDets));
+  return ADNED_SHM_OK;
+#else
+  return ADNED_SHM_ERROR;
+#endif
+}
+
+/**
+ * Write a frame to the segment. Only the pages flagged in pChanged are copied,
+ * unless the whole data needs to be written (the first frame, or after the
+ * size changed). This is called by the frame thread with the data buffer mutex held.
+ * @param pData The published data buffer
+ * @param dataSize The number of elements in pData
+ * @param pChanged Page flags (of ADNED_SHARD_PAGE_SIZE elements) for pData, or NULL to copy everything
+ * @param numPages The number of page flags
+ * @param pFrame The frame information and detector layout
+ * @return ADNED_SHM_OK or ADNED_SHM_ERROR
+ */
+int ADnEDShm::publish(const epicsUInt32 *pData, epicsUInt32 dataSize,
+                      const epicsUInt8 *pChanged, epicsUInt32 numPages, const ADnEDShmFrame *pFrame) {
+  epicsTimeStamp nowTime;
+
+  if ((p_Header == NULL) || (pData == NULL) || (pFrame == NULL)) {
+    return ADNED_SHM_ERROR;
+  }
+
+  //Grow the segment first. Readers see the old frame, and remap when they see the new size.
+  size_t size = getHeaderSize(m_maxDets) + static_cast<size_t>(dataSize)*sizeof(epicsUInt32);
+  if (size > m_mapSize) {
+    if (map(size) != ADNED_SHM_OK) {
+      close();
+      return ADNED_SHM_ERROR;
+    }
+    m_full = true;
+  }
+  if (dataSize != m_dataSize) {
+    m_full = true;
+  }
+
+  epicsTimeGetCurrent(&nowTime);
+
+  epicsAtomicIncrIntT(&p_Header->sequence);
+  epicsAtomicWriteMemoryBarrier();
+
+  p_Header->numDet = (pFrame->numDet < m_maxDets) ? pFrame->numDet : m_maxDets;
+  p_Header->dataSize = dataSize;
+  p_Header->tofMax = pFrame->tofMax;
+  p_Header->frameCounter = m_numFrames + 1;
+  p_Header->pulseCounter = pFrame->pulseCounter;
+  p_Header->timeStampSec = nowTime.secPastEpoch;
+  p_Header->timeStampNsec = nowTime.nsec;
+  p_Header->pCharge = pFrame->pCharge;
+  p_Header->pChargeInt = pFrame->pChargeInt;
+  if ((pFrame->pDets != NULL) && (p_Header->numDet > 0)) {
+    memcpy(p_Dets, pFrame->pDets, p_Header->numDet*sizeof(ADnEDShmDet));
+  }
+
+  if ((m_full) || (pChanged == NULL)) {
+    memcpy(p_Data, pData, dataSize*sizeof(epicsUInt32));
+  } else {
+    for (epicsUInt32 page=0; page<numPages; ++page) {
+      if (!pChanged[page]) {
+        continue;
+      }
+      epicsUInt32 start = page * ADNED_SHARD_PAGE_SIZE;
+      epicsUInt32 end = start + ADNED_SHARD_PAGE_SIZE;
+      if (start >= dataSize) {
+        break;
+      }
+      if (end > dataSize) {
+        end = dataSize;
+      }
+      memcpy(p_Data+start, pData+start, (end-start)*sizeof(epicsUInt32));
+    }
+  }
+
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicIncrIntT(&p_Header->sequence);
+
+  m_dataSize = dataSize;
+  m_full = false;
+  ++m_numFrames;
+
+  return ADNED_SHM_OK;
+}
@@ -0,0 +1,142 @@
+/**
+ * @brief Export of the published histogram in a POSIX shared memory segment.
+ *
+ *        Local analysis processes can map the segment (shm_open and mmap, read only)
+ *        and read the histogram in place, rather than subscribing through the NDArray
+ *        plugins. The frame thread updates the segment each time it publishes a frame.
+ *        Only the pages that changed since the last frame are copied in.
+ *
+ *        The segment holds an ADnEDShmHeader, then an ADnEDShmDet for each detector
+ *        (maxDets of them), then the histogram data (dataSize epicsUInt32) at byte
+ *        offset headerSize. The data has the same layout as the main NDArray.
+ *
+ *        The header and data are protected by a sequence lock. The writer makes the
+ *        sequence number odd while it is updating the segment, and even again when
+ *        it is finished. A reader does:
+ *
+ *          do {
+ *            seq = ADnEDShm::readBegin(pHeader);
+ *            ...read the header fields, detector table and data...
+ *          } while (ADnEDShm::readRetry(pHeader, seq));
+ *
+ *        and must not act on what it read until readRetry returns false. Readers never
+ *        block the IOC. The segment only grows. If dataSize*4 + headerSize is larger
+ *        than the reader's mapping, it should map the segment again (use fstat for
+ *        the new size). The segment is unlinked when the export is disabled, and is
+ *        created again (as a new segment) when it is enabled.
+ */
+
+#ifndef ADNED_SHM_H
+#define ADNED_SHM_H
+
+#include <stddef.h>
+#include <string>
+
+#include "epicsTypes.h"
+#include "epicsTime.h"
+#include "epicsAtomic.h"
+#include "ADnEDGlobals.h"
+
+/**
+ * Segment header. All the fields are 4 or 8 bytes, so there is no padding.
+ */
+struct ADnEDShmHeader {
+  epicsUInt32 magic; //ADNED_SHM_MAGIC once the segment is ready
+  epicsUInt32 version; //ADNED_SHM_VERSION
+  int sequence; //Sequence lock. Odd while the writer is updating the segment.
+  epicsUInt32 headerSize; //Byte offset of the data
+  epicsUInt32 maxDets; //Number of entries in the detector table
+  epicsUInt32 numDet; //Number of entries in use
+  epicsUInt32 dataSize; //Number of epicsUInt32 elements in the data
+  epicsUInt32 tofMax; //Each TOF spectrum has tofMax+1 elements
+  epicsUInt32 frameCounter; //Incremented for each frame written
+  epicsUInt32 pulseCounter; //Number of pulses in this acquisition
+  epicsUInt32 timeStampSec; //Host time the frame was written (EPICS epoch)
+  epicsUInt32 timeStampNsec;
+  epicsFloat64 pCharge; //Proton charge of the last pulse
+  epicsFloat64 pChargeInt; //Integrated proton charge
+};
+
+/**
+ * Layout of one detector in the data. Entry 0 is detector 1.
+ */
+struct ADnEDShmDet {
+  epicsUInt32 start; //First element of the 2-D plot
+  epicsUInt32 size; //Number of elements in the 2-D plot
+  epicsUInt32 rowSize; //Elements in each row of the 2-D plot (X size or TOF bins), or 0
+  epicsUInt32 plotType; //ADNED_2D_PLOT_XY, etc.
+  epicsUInt32 tofStart; //First element of the TOF spectrum
+  epicsUInt32 tofSize; //Number of elements in the TOF spectrum
+  epicsUInt32 spare[2];
+};
+
+/**
+ * Frame information passed to ADnEDShm::publish.
+ */
+struct ADnEDShmFrame {
+  epicsUInt32 pulseCounter;
+  epicsFloat64 pCharge;
+  epicsFloat64 pChargeInt;
+  epicsUInt32 tofMax;
+  epicsUInt32 numDet;
+  const ADnEDShmDet *pDets; //numDet entries
+};
+
+class ADnEDShm {
+
+ public:
+  ADnEDShm();
+  virtual ~ADnEDShm();
+
+  int open(const char *name, epicsUInt32 maxDets);
+  void close(void);
+  inline bool isOpen(void) const {return (p_Header != NULL);}
+  inline const char* getName(void) const {return m_name.c_str();}
+  inline epicsUInt32 getNumFrames(void) const {return m_numFrames;}
+  int publish(const epicsUInt32 *pData, epicsUInt32 dataSize,
+              const epicsUInt8 *pChanged, epicsUInt32 numPages, const ADnEDShmFrame *pFrame);
+
+  /**
+   * Start reading a consistent snapshot. Waits while the writer is updating the segment.
+   * @param pHeader The mapped segment
+   * @return The sequence number to pass to readRetry
+   */
+  static inline int readBegin(const ADnEDShmHeader *pHeader) {
+    int seq = 0;
+    while ((seq = epicsAtomicGetIntT(&pHeader->sequence)) & 1) {}
+    epicsAtomicReadMemoryBarrier();
+    return seq;
+  }
+
+  /**
+   * Finish reading a snapshot.
+   * @param pHeader The mapped segment
+   * @param seq The sequence number from readBegin
+   * @return true if the writer changed the segment during the read, so it must be read again
+   */
+  static inline bool readRetry(const ADnEDShmHeader *pHeader, int seq) {
+    epicsAtomicReadMemoryBarrier();
+    return (epicsAtomicGetIntT(&pHeader->sequence) != seq);
+  }
+
+  static epicsUInt32 getHeaderSize(epicsUInt32 maxDets);
+
+ private:
+  int map(size_t size);
+
+  std::string m_name;
+  int m_fd;
+  void *p_Map;
+  size_t m_mapSize;
+  ADnEDShmHeader *p_Header;
+  ADnEDShmDet *p_Dets;
+  epicsUInt32 *p_Data;
+  epicsUInt32 m_maxDets;
+  epicsUInt32 m_dataSize;
+  epicsUInt32 m_numFrames;
+  //Set when the whole data must be copied (after open or a resize)
+  bool m_full;
+
+};
+
+#endif //ADNED_SHM_H
@@ -0,0 +1,259 @@
+/**
+ * Vectorised pre-pass over the event arrays.
+ * See ADnEDSimd.h for a description.
+ */
+
+#include "string.h"
+
+#include "ADnEDSimd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+  && ((defined(__clang__) && (__clang_major__ >= 4)) \
+      || (!defined(__clang__) && defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))))
+#define ADNED_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+//Scalar versions. These are always available.
+
+static void classifyScalar(const ADnEDSimdRanges *pRanges, const epicsUInt32 *pPixels,
+                           epicsUInt32 numEvents, epicsUInt16 *pSeg)
+{
+  const epicsUInt32 numRanges = pRanges->numRanges;
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    epicsUInt32 seg = 0;
+    for (epicsUInt32 r=0; r<numRanges; ++r) {
+      //Unsigned wrap means pixel IDs below the range start also fail this check.
+      if ((pPixels[i] - pRanges->start[r]) < pRanges->size[r]) {
+        seg = pRanges->seg[r];
+      }
+    }
+    pSeg[i] = static_cast<epicsUInt16>(seg);
+  }
+}
+
+static void tofBinsScalar(const ADnEDDivider *pDivider, epicsUInt32 tofMax,
+                          const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pBins)
+{
+  if (tofMax > ADNED_SIMD_DIVIDE_MAX) {
+    for (epicsUInt32 i=0; i<numEvents; ++i) {
+      pBins[i] = (pTofs[i] <= tofMax) ? (pTofs[i] / pDivider->divisor) : ADNED_SIMD_INVALID;
+    }
+    return;
+  }
+
+  const epicsUInt64 magic = pDivider->magic;
+  const epicsUInt32 shift = pDivider->shift;
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    epicsUInt32 bin = static_cast<epicsUInt32>((pTofs[i] * magic) >> shift);
+    pBins[i] = (pTofs[i] <= tofMax) ? bin : ADNED_SIMD_INVALID;
+  }
+}
+
+#ifdef ADNED_SIMD_X86
+
+//SSE4.1 versions. These do 4 events at a time.
+//There are no unsigned 32 bit compares, so flip the sign bit and use a signed compare.
+
+__attribute__((target("sse4.1")))
+static void classifySSE41(const ADnEDSimdRanges *pRanges, const epicsUInt32 *pPixels,
+                          epicsUInt32 numEvents, epicsUInt16 *pSeg)
+{
+  const epicsUInt32 numRanges = pRanges->numRanges;
+  const __m128i sign = _mm_set1_epi32(static_cast<int>(0x80000000));
+  __m128i start[ADNED_SIMD_MAX_RANGES];
+  __m128i size[ADNED_SIMD_MAX_RANGES];
+  __m128i seg[ADNED_SIMD_MAX_RANGES];
+  for (epicsUInt32 r=0; r<numRanges; ++r) {
+    start[r] = _mm_set1_epi32(static_cast<int>(pRanges->start[r]));
+    size[r] = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(pRanges->size[r])), sign);
+    seg[r] = _mm_set1_epi32(static_cast<int>(pRanges->seg[r]));
+  }
+
+  epicsUInt32 i = 0;
+  for (; i+4<=numEvents; i+=4) {
+    __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pPixels+i));
+    __m128i result = _mm_setzero_si128();
+    for (epicsUInt32 r=0; r<numRanges; ++r) {
+      __m128i offset = _mm_xor_si128(_mm_sub_epi32(pixels, start[r]), sign);
+      __m128i inRange = _mm_cmpgt_epi32(size[r], offset);
+      result = _mm_or_si128(result, _mm_and_si128(inRange, seg[r]));
+    }
+    result = _mm_packus_epi32(result, result);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(pSeg+i), result);
+  }
+
+  classifyScalar(pRanges, pPixels+i, numEvents-i, pSeg+i);
+}
+
+__attribute__((target("sse4.1")))
+static void tofBinsSSE41(const ADnEDDivider *pDivider, epicsUInt32 tofMax,
+                         const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pBins)
+{
+  if (tofMax > ADNED_SIMD_DIVIDE_MAX) {
+    tofBinsScalar(pDivider, tofMax, pTofs, numEvents, pBins);
+    return;
+  }
+
+  const __m128i sign = _mm_set1_epi32(static_cast<int>(0x80000000));
+  const __m128i max = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(tofMax)), sign);
+  const __m128i magic = _mm_set1_epi32(static_cast<int>(pDivider->magic));
+  const __m128i shift = _mm_cvtsi32_si128(static_cast<int>(pDivider->shift));
+
+  epicsUInt32 i = 0;
+  for (; i+4<=numEvents; i+=4) {
+    __m128i tofs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pTofs+i));
+    //64 bit products of the even and odd elements. The quotient is in the low 32 bits.
+    __m128i even = _mm_srl_epi64(_mm_mul_epu32(tofs, magic), shift);
+    __m128i odd = _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(tofs, 32), magic), shift);
+    __m128i bins = _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xCC);
+    __m128i invalid = _mm_cmpgt_epi32(_mm_xor_si128(tofs, sign), max);
+    bins = _mm_or_si128(bins, invalid);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pBins+i), bins);
+  }
+
+  tofBinsScalar(pDivider, tofMax, pTofs+i, numEvents-i, pBins+i);
+}
+
+//AVX2 versions. These do 8 events at a time.
+
+__attribute__((target("avx2")))
+static void classifyAVX2(const ADnEDSimdRanges *pRanges, const epicsUInt32 *pPixels,
+                         epicsUInt32 numEvents, epicsUInt16 *pSeg)
+{
+  const epicsUInt32 numRanges = pRanges->numRanges;
+  const __m256i sign = _mm256_set1_epi32(static_cast<int>(0x80000000));
+  __m256i start[ADNED_SIMD_MAX_RANGES];
+  __m256i size[ADNED_SIMD_MAX_RANGES];
+  __m256i seg[ADNED_SIMD_MAX_RANGES];
+  for (epicsUInt32 r=0; r<numRanges; ++r) {
+    start[r] = _mm256_set1_epi32(static_cast<int>(pRanges->start[r]));
+    size[r] = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(pRanges->size[r])), sign);
+    seg[r] = _mm256_set1_epi32(static_cast<int>(pRanges->seg[r]));
+  }
+
+  epicsUInt32 i = 0;
+  for (; i+8<=numEvents; i+=8) {
+    __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pPixels+i));
+    __m256i result = _mm256_setzero_si256();
+    for (epicsUInt32 r=0; r<numRanges; ++r) {
+      __m256i offset = _mm256_xor_si256(_mm256_sub_epi32(pixels, start[r]), sign);
+      __m256i inRange = _mm256_cmpgt_epi32(size[r], offset);
+      result = _mm256_or_si256(result, _mm256_and_si256(inRange, seg[r]));
+    }
+    //The pack works within each 128 bit lane, so gather the low half of each lane.
+    result = _mm256_packus_epi32(result, result);
+    result = _mm256_permute4x64_epi64(result, 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pSeg+i), _mm256_castsi256_si128(result));
+  }
+
+  classifyScalar(pRanges, pPixels+i, numEvents-i, pSeg+i);
+}
+
+__attribute__((target("avx2")))
+static void tofBinsAVX2(const ADnEDDivider *pDivider, epicsUInt32 tofMax,
+                        const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pBins)
+{
+  if (tofMax > ADNED_SIMD_DIVIDE_MAX) {
+    tofBinsScalar(pDivider, tofMax, pTofs, numEvents, pBins);
+    return;
+  }
+
+  const __m256i sign = _mm256_set1_epi32(static_cast<int>(0x80000000));
+  const __m256i max = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(tofMax)), sign);
+  const __m256i magic = _mm256_set1_epi32(static_cast<int>(pDivider->magic));
+  const __m128i shift = _mm_cvtsi32_si128(static_cast<int>(pDivider->shift));
+
+  epicsUInt32 i = 0;
+  for (; i+8<=numEvents; i+=8) {
+    __m256i tofs = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pTofs+i));
+    __m256i even = _mm256_srl_epi64(_mm256_mul_epu32(tofs, magic), shift);
+    __m256i odd = _mm256_srl_epi64(_mm256_mul_epu32(_mm256_srli_epi64(tofs, 32), magic), shift);
+    __m256i bins = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    __m256i invalid = _mm256_cmpgt_epi32(_mm256_xor_si256(tofs, sign), max);
+    bins = _mm256_or_si256(bins, invalid);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(pBins+i), bins);
+  }
+
+  tofBinsScalar(pDivider, tofMax, pTofs+i, numEvents-i, pBins+i);
+}
+
+#endif //ADNED_SIMD_X86
+
+/**
+ * Constructor. Picks the best implementation for this CPU.
+ */
+ADnEDSimd::ADnEDSimd(void) {
+
+  m_classify = &classifyScalar;
+  m_tofBins = &tofBinsScalar;
+  m_name = "scalar";
+
+  if (!select("avx2")) {
+    select("sse4.1");
+  }
+}
+
+/**
+ * Destructor.
+ */
+ADnEDSimd::~ADnEDSimd(void) {
+}
+
+/**
+ * Use a particular implementation, rather than the best one for this CPU.
+ * This is for testing that they all give the same results.
+ * @param name "avx2", "sse4.1" or "scalar"
+ * @return false if the implementation is not built or this CPU does not support it
+ */
+bool ADnEDSimd::select(const char *name) {
+
+  if (strcmp(name, "scalar") == 0) {
+    m_classify = &classifyScalar;
+    m_tofBins = &tofBinsScalar;
+    m_name = "scalar";
+    return true;
+  }
+
+#ifdef ADNED_SIMD_X86
+  __builtin_cpu_init();
+  if ((strcmp(name, "avx2") == 0) && (__builtin_cpu_supports("avx2"))) {
+    m_classify = &classifyAVX2;
+    m_tofBins = &tofBinsAVX2;
+    m_name = "avx2";
+    return true;
+  }
+  if ((strcmp(name, "sse4.1") == 0) && (__builtin_cpu_supports("sse4.1"))) {
+    m_classify = &classifySSE41;
+    m_tofBins = &tofBinsSSE41;
+    m_name = "sse4.1";
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+/**
+ * Work out the multiplier and shift to divide by a constant. This uses the
+ * round up method (Granlund and Montgomery), which is exact for 31 bit numerators:
+ * with l = ceil(log2(divisor)), magic = floor(2^(31+l) / divisor) + 1 fits in 32 bits
+ * and n / divisor = (n * magic) >> (31+l).
+ * @param divisor The divisor (0 is treated as 1)
+ * @param pDivider The divider to fill in
+ */
+void ADnEDSimd::initDivider(epicsUInt32 divisor, ADnEDDivider *pDivider) {
+
+  if (divisor == 0) {
+    divisor = 1;
+  }
+
+  epicsUInt32 l = 0;
+  while ((static_cast<epicsUInt64>(1) << l) < divisor) {
+    ++l;
+  }
+
+  pDivider->divisor = divisor;
+  pDivider->magic = static_cast<epicsUInt32>(((static_cast<epicsUInt64>(1) << (31+l)) / divisor) + 1);
+  pDivider->shift = 31 + l;
+}
@@ -0,0 +1,81 @@
+/**
+ * @brief Vectorised pre-pass over the event arrays.
+ *
+ *        These functions work on a whole packet (or detector batch) at a time,
+ *        so that the histogram kernels are left with a simple scatter loop.
+ *        The implementation is chosen at runtime from the CPU features
+ *        (AVX2, then SSE4.1, then plain C++). The vector versions are only
+ *        built with GCC on x86, otherwise the scalar versions are always used.
+ *
+ *        Every implementation gives exactly the same results.
+ */
+
+#ifndef ADNED_SIMD_H
+#define ADNED_SIMD_H
+
+#include "epicsTypes.h"
+#include "ADnEDGlobals.h"
+
+/**
+ * Division by a constant, using a multiply and a shift.
+ * Exact for numerators up to ADNED_SIMD_DIVIDE_MAX.
+ */
+struct ADnEDDivider {
+  epicsUInt32 divisor;
+  epicsUInt32 magic;
+  epicsUInt32 shift;
+};
+
+/**
+ * Pixel ID ranges used to classify events. Pixel IDs in
+ * [start[i], start[i]+size[i]) belong to segment seg[i].
+ * The ranges must not overlap.
+ */
+struct ADnEDSimdRanges {
+  epicsUInt32 numRanges;
+  epicsUInt32 start[ADNED_SIMD_MAX_RANGES];
+  epicsUInt32 size[ADNED_SIMD_MAX_RANGES];
+  epicsUInt32 seg[ADNED_SIMD_MAX_RANGES];
+};
+
+typedef void (*ADnEDSimdClassifyFunc)(const ADnEDSimdRanges *pRanges, const epicsUInt32 *pPixels,
+                                      epicsUInt32 numEvents, epicsUInt16 *pSeg);
+typedef void (*ADnEDSimdTofBinsFunc)(const ADnEDDivider *pDivider, epicsUInt32 tofMax,
+                                     const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pBins);
+
+class ADnEDSimd {
+
+ public:
+  ADnEDSimd();
+  virtual ~ADnEDSimd();
+
+  static void initDivider(epicsUInt32 divisor, ADnEDDivider *pDivider);
+  bool select(const char *name);
+
+  /**
+   * Find the segment for each pixel ID (0 if it is not in any range).
+   */
+  inline void classify(const ADnEDSimdRanges *pRanges, const epicsUInt32 *pPixels,
+                       epicsUInt32 numEvents, epicsUInt16 *pSeg) const {
+    m_classify(pRanges, pPixels, numEvents, pSeg);
+  }
+
+  /**
+   * Calculate the TOF bin (TOF / divisor) for each event. Events with a TOF
+   * greater than tofMax are given the bin ADNED_SIMD_INVALID.
+   */
+  inline void tofBins(const ADnEDDivider *pDivider, epicsUInt32 tofMax,
+                      const epicsUInt32 *pTofs, epicsUInt32 numEvents, epicsUInt32 *pBins) const {
+    m_tofBins(pDivider, tofMax, pTofs, numEvents, pBins);
+  }
+
+  inline const char* getName(void) const {return m_name;}
+
+ private:
+  ADnEDSimdClassifyFunc m_classify;
+  ADnEDSimdTofBinsFunc m_tofBins;
+  const char *m_name;
+
+};
+
+#endif //ADNED_SIMD_H
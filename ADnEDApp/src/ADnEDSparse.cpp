@@ -0,0 +1,69 @@
+/**
+ * Conversion between dense arrays and sparse arrays of (index, count) pairs.
+ * See ADnEDSparse.h for a description.
+ */
+
+#include <string.h>
+
+#include "ADnEDSparse.h"
+
+/**
+ * Count the non-zero elements of a dense array.
+ * @param pDense The dense array
+ * @param numElements The number of elements
+ * @return The number of (index, count) pairs needed
+ */
+epicsUInt32 ADnEDSparse::countPairs(const epicsUInt32 *pDense, epicsUInt32 numElements) {
+  epicsUInt32 numPairs = 0;
+
+  for (epicsUInt32 index=0; index<numElements; ++index) {
+    if (pDense[index] != 0) {
+      ++numPairs;
+    }
+  }
+
+  return numPairs;
+}
+
+/**
+ * Decide whether the sparse array is smaller than the dense array.
+ * @param numPairs The number of (index, count) pairs
+ * @param numElements The number of elements in the dense array
+ * @return true if the sparse array should be used
+ */
+bool ADnEDSparse::isSmaller(epicsUInt32 numPairs, epicsUInt32 numElements) {
+  return ((static_cast<epicsUInt64>(numPairs) * 2) < numElements);
+}
+
+/**
+ * Write the (index, count) pairs for the non-zero elements of a dense array, in index order.
+ * @param pDense The dense array
+ * @param numElements The number of elements
+ * @param pPairs The pairs. This must have space for 2*countPairs() elements.
+ */
+void ADnEDSparse::pack(const epicsUInt32 *pDense, epicsUInt32 numElements, epicsUInt32 *pPairs) {
+  for (epicsUInt32 index=0; index<numElements; ++index) {
+    if (pDense[index] != 0) {
+      *pPairs++ = index;
+      *pPairs++ = pDense[index];
+    }
+  }
+}
+
+/**
+ * Rebuild a dense array from (index, count) pairs. Pairs with an index past
+ * the end of the dense array are ignored.
+ * @param pPairs The pairs
+ * @param numPairs The number of pairs
+ * @param pDense The dense array (this is zeroed first)
+ * @param numElements The number of elements in the dense array
+ */
+void ADnEDSparse::unpack(const epicsUInt32 *pPairs, epicsUInt32 numPairs, epicsUInt32 *pDense, epicsUInt32 numElements) {
+  memset(pDense, 0, numElements * sizeof(epicsUInt32));
+  for (epicsUInt32 pair=0; pair<numPairs; ++pair) {
+    epicsUInt32 index = pPairs[2*pair];
+    if (index < numElements) {
+      pDense[index] = pPairs[(2*pair)+1];
+    }
+  }
+}
@@ -0,0 +1,27 @@
+/**
+ * @brief Conversion between dense arrays and sparse arrays of (index, count) pairs.
+ *
+ *        ADnED can publish an NDArray as the (index, count) pairs of its non-zero
+ *        elements, which is much smaller for a mostly empty plot. The pairs take
+ *        two elements each, so this is only done when there are fewer than half
+ *        as many pairs as elements (see isSmaller()), otherwise the dense array is
+ *        published. NDPluginDensify rebuilds the dense array. The NDArray attributes
+ *        that describe the dense array are in ADnEDGlobals.h (ADNED_SPARSE_*).
+ */
+
+#ifndef ADNED_SPARSE_H
+#define ADNED_SPARSE_H
+
+#include "epicsTypes.h"
+
+class ADnEDSparse {
+
+ public:
+  static epicsUInt32 countPairs(const epicsUInt32 *pDense, epicsUInt32 numElements);
+  static bool isSmaller(epicsUInt32 numPairs, epicsUInt32 numElements);
+  static void pack(const epicsUInt32 *pDense, epicsUInt32 numElements, epicsUInt32 *pPairs);
+  static void unpack(const epicsUInt32 *pPairs, epicsUInt32 numPairs, epicsUInt32 *pDense, epicsUInt32 numElements);
+
+};
+
+#endif //ADNED_SPARSE_H
@@ -0,0 +1,132 @@
+/**
+ * Hot path statistics.
+ * See ADnEDStats.h for a description.
+ */
+
+#include <epicsAtomic.h>
+
+#include "ADnEDStats.h"
+
+/**
+ * Constructor.
+ */
+ADnEDStats::ADnEDStats(void) {
+  m_lastCount = 0;
+  m_lastSum = 0;
+  reset();
+}
+
+/**
+ * Destructor.
+ */
+ADnEDStats::~ADnEDStats(void) {
+}
+
+/**
+ * Count a value. This can be called from any thread.
+ * @param value The value (a time in microseconds, or a size)
+ */
+void ADnEDStats::add(epicsUInt32 value) {
+  epicsAtomicIncrSizeT(&m_buckets[getBucket(value)]);
+  epicsAtomicAddSizeT(&m_sum, value);
+  epicsAtomicIncrSizeT(&m_count);
+  size_t max = epicsAtomicGetSizeT(&m_max);
+  while (value > max) {
+    size_t prev = epicsAtomicCmpAndSwapSizeT(&m_max, max, value);
+    if (prev == max) {
+      break;
+    }
+    max = prev;
+  }
+}
+
+/**
+ * Count the time between two timestamps, in microseconds.
+ * @param pStart The start time
+ * @param pEnd The end time
+ */
+void ADnEDStats::addTime(const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd) {
+  epicsFloat64 diff = epicsTimeDiffInSeconds(pEnd, pStart) * 1.e6;
+  if (diff < 0.0) {
+    diff = 0.0;
+  } else if (diff > 4294967295.0) {
+    diff = 4294967295.0;
+  }
+  add(static_cast<epicsUInt32>(diff));
+}
+
+/**
+ * Clear the histogram and the interval. This must not be called at the same 
+ * time as getInterval(). Values added at the same time may be lost.
+ */
+void ADnEDStats::reset(void) {
+  for (int bucket=0; bucket<ADNED_STATS_NUM_BUCKETS; ++bucket) {
+    epicsAtomicSetSizeT(&m_buckets[bucket], 0);
+  }
+  epicsAtomicSetSizeT(&m_count, 0);
+  epicsAtomicSetSizeT(&m_sum, 0);
+  epicsAtomicSetSizeT(&m_max, 0);
+  m_lastCount = 0;
+  m_lastSum = 0;
+}
+
+/**
+ * Copy the histogram. Counts too large for an epicsInt32 are clipped.
+ * @param pBuckets Array of ADNED_STATS_NUM_BUCKETS elements
+ */
+void ADnEDStats::getHistogram(epicsInt32 *pBuckets) const {
+  for (int bucket=0; bucket<ADNED_STATS_NUM_BUCKETS; ++bucket) {
+    size_t count = epicsAtomicGetSizeT(&m_buckets[bucket]);
+    pBuckets[bucket] = (count > 2147483647U) ? 2147483647 : static_cast<epicsInt32>(count);
+  }
+}
+
+/**
+ * Get the mean and max of the values added since the last call. 
+ * This must not be called by two threads at the same time.
+ * @param mean The mean (0 if there were no values)
+ * @param max The max (0 if there were no values)
+ */
+void ADnEDStats::getInterval(epicsFloat64 &mean, epicsFloat64 &max) {
+  size_t count = epicsAtomicGetSizeT(&m_count);
+  size_t sum = epicsAtomicGetSizeT(&m_sum);
+  //Swap the max for 0, so that none are lost.
+  size_t lastMax = epicsAtomicGetSizeT(&m_max);
+  size_t prev = 0;
+  while ((prev = epicsAtomicCmpAndSwapSizeT(&m_max, lastMax, 0)) != lastMax) {
+    lastMax = prev;
+  }
+  mean = (count > m_lastCount) ? static_cast<epicsFloat64>(sum - m_lastSum) / (count - m_lastCount) : 0.0;
+  max = static_cast<epicsFloat64>(lastMax);
+  m_lastCount = count;
+  m_lastSum = sum;
+}
+
+/**
+ * Print the number of values and the mean since the last reset.
+ * @param fp The output stream
+ * @param name Name to print for these stats
+ */
+void ADnEDStats::report(FILE *fp, const char *name) const {
+  size_t count = epicsAtomicGetSizeT(&m_count);
+  size_t sum = epicsAtomicGetSizeT(&m_sum);
+  fprintf(fp, "  %s: count: %lu, mean: %.1f\n", name, static_cast<unsigned long>(count), 
+          (count > 0) ? static_cast<double>(sum) / count : 0.0);
+}
+
+/**
+ * @param value The value
+ * @return The bucket for a value (the number of bits needed to hold it, up to the last bucket)
+ */
+int ADnEDStats::getBucket(epicsUInt32 value) {
+  int bucket = 0;
+#ifdef __GNUC__
+  bucket = (value == 0) ? 0 : (32 - __builtin_clz(value));
+#else
+  while (value != 0) {
+    ++bucket;
+    value >>= 1;
+  }
+#endif
+  return (bucket < ADNED_STATS_NUM_BUCKETS) ? bucket : ADNED_STATS_NUM_BUCKETS-1;
+}
@@ -0,0 +1,51 @@
+/**
+ * @brief Low overhead statistics for the hot path (latencies, lock waits and packet sizes).
+ *
+ *        Each value is counted in a fixed power of two bucket (see ADNED_STATS_NUM_BUCKETS),
+ *        and added to a running sum and maximum. Everything is updated with atomic operations,
+ *        so several threads can add values without a lock, and the values are read by
+ *        another thread when the params are published. Values are added once per packet
+ *        or frame, not once per event, so the cost is a few atomic operations per packet.
+ *
+ *        The histogram covers everything since the last reset. The mean and max
+ *        returned by getInterval() only cover the values added since the last call.
+ */
+
+#ifndef ADNED_STATS_H
+#define ADNED_STATS_H
+
+#include <stdio.h>
+
+#include "epicsTypes.h"
+#include "epicsTime.h"
+#include "ADnEDGlobals.h"
+
+class ADnEDStats {
+
+ public:
+  ADnEDStats();
+  virtual ~ADnEDStats();
+
+  void add(epicsUInt32 value);
+  void addTime(const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd);
+  void reset(void);
+  void getHistogram(epicsInt32 *pBuckets) const;
+  void getInterval(epicsFloat64 &mean, epicsFloat64 &max);
+  void report(FILE *fp, const char *name) const;
+
+  static int getBucket(epicsUInt32 value);
+
+ private:
+  size_t m_buckets[ADNED_STATS_NUM_BUCKETS];
+  size_t m_count;
+  size_t m_sum;
+  size_t m_max; //Max since the last getInterval()
+  //Only used by the thread that calls getInterval()
+  size_t m_lastCount;
+  size_t m_lastSum;
+  //The stats for each channel are in an array, so keep them on different cache lines.
+  char m_pad[ADNED_CACHE_LINE_SIZE];
+
+};
+
+#endif //ADNED_STATS_H
@@ -0,0 +1,237 @@
+/**
+ * CPU affinity and scheduling priority for the ADnED threads.
+ * See ADnEDThreadConfig.h for a description.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "epicsThread.h"
+#include "epicsAtomic.h"
+#include "epicsStdio.h"
+
+#include "ADnEDThreadConfig.h"
+
+epicsMutexId ADnEDThreadConfig::s_mutex = NULL;
+ADnEDThreadConfig::Settings ADnEDThreadConfig::s_settings[ADNED_THREAD_NUM_GROUPS];
+int ADnEDThreadConfig::s_version[ADNED_THREAD_NUM_GROUPS] = {0};
+
+static epicsThreadOnceId s_threadConfigOnce = EPICS_THREAD_ONCE_INIT;
+
+static const char *s_groupNames[ADNED_THREAD_NUM_GROUPS] = {"event", "frame", "worker", "pool", "ingest", "record"};
+
+/**
+ * Create the mutex. Called once, by epicsThreadOnce.
+ */
+void ADnEDThreadConfig::init(void *pArg)
+{
+  s_mutex = epicsMutexMustCreate();
+}
+
+/**
+ * @param group The thread group (ADNED_THREAD_EVENT, etc.)
+ * @return The name of the group, as used by set().
+ */
+const char* ADnEDThreadConfig::getGroupName(int group)
+{
+  if ((group < 0) || (group >= ADNED_THREAD_NUM_GROUPS)) {
+    return "unknown";
+  }
+  return s_groupNames[group];
+}
+
+/**
+ * Set the CPU affinity and priority for a group of threads. The threads
+ * pick up the new settings the next time they run.
+ * @param groupName One of event, frame, worker, pool, ingest or record
+ * @param cpus The CPU list (see ADnEDThreadConfig.h), or an empty string to leave the affinity alone
+ * @param priority The EPICS thread priority, or -1 to leave the priority alone
+ * @return ADNED_THREAD_OK or ADNED_THREAD_ERROR
+ */
+int ADnEDThreadConfig::set(const char *groupName, const char *cpus, int priority)
+{
+  int group = -1;
+  std::vector<int> cpuList;
+
+  epicsThreadOnce(&s_threadConfigOnce, init, NULL);
+
+  for (int i=0; (groupName != NULL) && (i<ADNED_THREAD_NUM_GROUPS); ++i) {
+    if (strcmp(groupName, s_groupNames[i]) == 0) {
+      group = i;
+    }
+  }
+  if (group < 0) {
+    fprintf(stderr, "ADnEDThreadConfig::set Unknown thread group. Use one of: event, frame, worker, pool, ingest, record.\n");
+    return ADNED_THREAD_ERROR;
+  }
+  if (priority > epicsThreadPriorityMax) {
+    fprintf(stderr, "ADnEDThreadConfig::set Priority must be <= %d.\n", epicsThreadPriorityMax);
+    return ADNED_THREAD_ERROR;
+  }
+  if (parseCpus(cpus, cpuList) != ADNED_THREAD_OK) {
+    fprintf(stderr, "ADnEDThreadConfig::set Invalid CPU list: %s\n", cpus);
+    return ADNED_THREAD_ERROR;
+  }
+#ifndef __linux__
+  if (!cpuList.empty()) {
+    fprintf(stderr, "ADnEDThreadConfig::set CPU affinity is only supported on Linux.\n");
+    return ADNED_THREAD_ERROR;
+  }
+#endif
+
+  epicsMutexMustLock(s_mutex);
+  s_settings[group].priority = (priority < 0) ? -1 : priority;
+  s_settings[group].cpus = cpuList;
+  epicsAtomicIncrIntT(&s_version[group]);
+  epicsMutexUnlock(s_mutex);
+
+  return ADNED_THREAD_OK;
+}
+
+/**
+ * Apply the settings for a group to the calling thread, if they have changed.
+ * @param group The thread group (ADNED_THREAD_EVENT, etc.)
+ * @param version The version of the settings the thread last applied. This is
+ *        kept by the thread (starting at 0), and is updated by this function.
+ * @return ADNED_THREAD_OK, or ADNED_THREAD_ERROR if the settings could not be applied
+ */
+int ADnEDThreadConfig::apply(int group, int &version)
+{
+  int status = ADNED_THREAD_OK;
+  int priority = -1;
+  std::vector<int> cpuList;
+
+  if ((group < 0) || (group >= ADNED_THREAD_NUM_GROUPS)) {
+    return ADNED_THREAD_ERROR;
+  }
+  if (epicsAtomicGetIntT(&s_version[group]) == version) {
+    return ADNED_THREAD_OK;
+  }
+
+  //The version is only changed after the mutex is created.
+  epicsMutexMustLock(s_mutex);
+  version = s_version[group];
+  priority = s_settings[group].priority;
+  cpuList = s_settings[group].cpus;
+  epicsMutexUnlock(s_mutex);
+
+  if (priority >= 0) {
+    epicsThreadSetPriority(epicsThreadGetIdSelf(), static_cast<unsigned int>(priority));
+  }
+
+#ifdef __linux__
+  if (!cpuList.empty()) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (size_t i=0; i<cpuList.size(); ++i) {
+      if (cpuList[i] < CPU_SETSIZE) {
+        CPU_SET(cpuList[i], &cpuSet);
+      }
+    }
+    //Zero means the calling thread.
+    if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0) {
+      status = ADNED_THREAD_ERROR;
+    }
+  }
+#endif
+
+  return status;
+}
+
+/**
+ * Parse a CPU list, like 0-3,8,node1.
+ * @param cpus The CPU list (NULL or an empty string gives an empty list)
+ * @param cpuList The CPUs, in the order they were given (there may be duplicates)
+ * @return ADNED_THREAD_OK or ADNED_THREAD_ERROR
+ */
+int ADnEDThreadConfig::parseCpus(const char *cpus, std::vector<int> &cpuList)
+{
+  const char *pos = cpus;
+  char *end = NULL;
+
+  cpuList.clear();
+  if (cpus == NULL) {
+    return ADNED_THREAD_OK;
+  }
+
+  while (*pos != '\0') {
+    while (isspace(*pos) || (*pos == ',')) {
+      ++pos;
+    }
+    if (*pos == '\0') {
+      break;
+    }
+    if (strncmp(pos, "node", 4) == 0) {
+      //Read the CPU list for the NUMA node
+      char fileName[ADNED_MAX_STRING_SIZE] = {0};
+      char nodeCpus[ADNED_MAX_STRING_SIZE] = {0};
+      std::vector<int> nodeList;
+      long node = strtol(pos+4, &end, 10);
+      if ((end == pos+4) || (node < 0)) {
+        return ADNED_THREAD_ERROR;
+      }
+      epicsSnprintf(fileName, ADNED_MAX_STRING_SIZE-1, ADNED_THREAD_NODE_CPULIST, static_cast<int>(node));
+      FILE *fp = fopen(fileName, "r");
+      if (fp == NULL) {
+        return ADNED_THREAD_ERROR;
+      }
+      if (fgets(nodeCpus, ADNED_MAX_STRING_SIZE, fp) == NULL) {
+        fclose(fp);
+        return ADNED_THREAD_ERROR;
+      }
+      fclose(fp);
+      if ((strncmp(nodeCpus, "node", 4) == 0) || (parseCpus(nodeCpus, nodeList) != ADNED_THREAD_OK)) {
+        return ADNED_THREAD_ERROR;
+      }
+      cpuList.insert(cpuList.end(), nodeList.begin(), nodeList.end());
+    } else {
+      long first = strtol(pos, &end, 10);
+      long last = first;
+      if ((end == pos) || (first < 0)) {
+        return ADNED_THREAD_ERROR;
+      }
+      if (*end == '-') {
+        pos = end+1;
+        last = strtol(pos, &end, 10);
+        if ((end == pos) || (last < first)) {
+          return ADNED_THREAD_ERROR;
+        }
+      }
+      for (long cpu=first; cpu<=last; ++cpu) {
+        cpuList.push_back(static_cast<int>(cpu));
+      }
+    }
+    pos = end;
+    if ((*pos != '\0') && (*pos != ',') && !isspace(*pos)) {
+      return ADNED_THREAD_ERROR;
+    }
+  }
+
+  return ADNED_THREAD_OK;
+}
+
+/**
+ * Print the settings for each group.
+ * @param fp The file to print to
+ */
+void ADnEDThreadConfig::report(FILE *fp)
+{
+  epicsThreadOnce(&s_threadConfigOnce, init, NULL);
+
+  epicsMutexMustLock(s_mutex);
+  for (int group=0; group<ADNED_THREAD_NUM_GROUPS; ++group) {
+    fprintf(fp, "Thread group %s: priority %d, CPUs:", s_groupNames[group], s_settings[group].priority);
+    if (s_settings[group].cpus.empty()) {
+      fprintf(fp, " any");
+    }
+    for (size_t i=0; i<s_settings[group].cpus.size(); ++i) {
+      fprintf(fp, " %d", s_settings[group].cpus[i]);
+    }
+    fprintf(fp, "\n");
+  }
+  epicsMutexUnlock(s_mutex);
+}
@@ -0,0 +1,57 @@
+/**
+ * @brief CPU affinity and scheduling priority for the ADnED threads.
+ *
+ *        The threads are split into groups (ADNED_THREAD_EVENT, etc.). The settings
+ *        for a group are given by the iocsh command ADnEDSetThreadConfig, and apply
+ *        to every ADnED driver in the IOC. They can be given before or after ADnEDConfig.
+ *
+ *        Each thread applies the settings for its group to itself, the next time
+ *        it runs, if they have changed. This means threads we don't create (the
+ *        PVAccess monitor callback threads) can be managed too. Checking for a
+ *        change is a single atomic load.
+ *
+ *        The CPU list is a comma separated list of CPUs, CPU ranges (eg. 0-7)
+ *        or NUMA nodes (eg. node1, which uses the CPUs in
+ *        /sys/devices/system/node/node1/cpulist). CPU affinity is only supported
+ *        on Linux. The priority is an EPICS thread priority (0 to 99). This is
+ *        only a real-time priority if EPICS base is built with
+ *        USE_POSIX_THREAD_PRIORITY_SCHEDULING and the IOC is allowed to use it.
+ */
+
+#ifndef ADNED_THREAD_CONFIG_H
+#define ADNED_THREAD_CONFIG_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "epicsTypes.h"
+#include "epicsMutex.h"
+#include "ADnEDGlobals.h"
+
+class ADnEDThreadConfig {
+
+ public:
+  static int set(const char *groupName, const char *cpus, int priority);
+  static int apply(int group, int &version);
+  static void report(FILE *fp);
+  static int parseCpus(const char *cpus, std::vector<int> &cpuList);
+  static const char* getGroupName(int group);
+
+ private:
+  static void init(void *pArg);
+
+  //Settings for one group. An empty CPU list, or a negative priority, means don't change it.
+  struct Settings {
+    Settings() : priority(-1) {}
+    int priority;
+    std::vector<int> cpus;
+  };
+
+  static epicsMutexId s_mutex;
+  static Settings s_settings[ADNED_THREAD_NUM_GROUPS];
+  //Incremented each time the settings for a group change. Read without the mutex.
+  static int s_version[ADNED_THREAD_NUM_GROUPS];
+
+};
+
+#endif //ADNED_THREAD_CONFIG_H
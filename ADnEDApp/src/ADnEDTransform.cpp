@@ -1,11 +1,18 @@
 
-#include <ADnED.h>
+#include <math.h>
 #include <ADnEDTransform.h>
 
 /**
  * Constructor.  
  */
 ADnEDTransform::ADnEDTransform(void) {
+  p_EfJoules = NULL;
+  p_L2Time = NULL;
+  m_deltaESize = 0;
+  p_BinFactor = NULL;
+  p_BinLimit = NULL;
+  m_binSize = 0;
+  m_binOffsetFixed = 0;
   printf("ADnEDTransform::ADnEDTransform: Created OK\n");
 }
 
@@ -13,6 +20,10 @@ ADnEDTransform::ADnEDTransform(void) {
  * Destructor.  
  */
 ADnEDTransform::~ADnEDTransform(void) {
+  free(p_EfJoules);
+  free(p_L2Time);
+  free(p_BinFactor);
+  free(p_BinLimit);
   printf("Transform::~Transform\n");
 }
 
@@ -116,7 +127,7 @@ epicsFloat64 ADnEDTransform::calc_dspace_dynamic(epicsUInt32 pixelID, epicsUInt3
  *   p_Array[1] - L2 in meters (indexed by pixel ID)
  *
  * The equation uses SI units. So the input parameters are converted internally. 
- *   
+ * The per pixel parts of the equation are precomputed in paramsChanged.
  */
 epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) const {
   
@@ -130,13 +141,13 @@ epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) c
   }
 
   //Checks
-  if ((p_Array[0] == NULL) || (p_Array[1] == NULL)) {
+  if ((p_EfJoules == NULL) || (pixelID >= m_deltaESize)) {
     if (m_debug) {
-      printf("  Arrays are NULL.\n");
+      printf("  Arrays are NULL or too small.\n");
     }
     return ADNED_TRANSFORM_ERROR;
   } 
-  if ((p_Array[0][pixelID] <= 0) || (p_Array[1][pixelID] <= 0)) {
+  if (p_EfJoules[pixelID] <= 0) {
     if (m_debug) {
       printf("  Array elements are zero.\n");
     }
@@ -149,8 +160,7 @@ epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) c
     return ADNED_TRANSFORM_ERROR;
   }
 
-  //Convert Ef (in meV) to Joules
-  Ef = (p_Array[0][pixelID] / ADNED_TRANSFORM_EV_TO_mEV) * ADNED_TRANSFORM_EV_TO_J;  
+  Ef = p_EfJoules[pixelID];
   //Convert TOF to seconds
   tof_s = static_cast<epicsFloat64>(tof) * ADNED_TRANSFORM_TOF_TO_S;
 
@@ -159,7 +169,8 @@ epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) c
     printf("  TOF in seconds: %g\n", tof_s);
   }
   
-  Ei = 0.5 * ADNED_TRANSFORM_MN * pow(m_doubleParam[0] / (tof_s - (p_Array[1][pixelID] * sqrt(ADNED_TRANSFORM_MN/(2*Ef))) ),2);
+  Ei = m_doubleParam[0] / (tof_s - p_L2Time[pixelID]);
+  Ei = 0.5 * ADNED_TRANSFORM_MN * Ei * Ei;
   if (m_debug) {
     printf("  Ei in Joules: %g\n", Ei);
   }
@@ -167,7 +178,7 @@ epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) c
   deltaE = Ei - Ef;
   
   //Convert back to meV
-  deltaE = (deltaE / ADNED_TRANSFORM_EV_TO_J) * ADNED_TRANSFORM_EV_TO_mEV;
+  deltaE = deltaE * (ADNED_TRANSFORM_EV_TO_mEV / ADNED_TRANSFORM_EV_TO_J);
 
   if (m_debug) {
     printf("  deltaE: %f.\n", deltaE);
@@ -177,3 +188,211 @@ epicsFloat64 ADnEDTransform::calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) c
 
 }
 
+/**
+ * Transform a batch of events. This gives the same results as calling calculate() 
+ * for each event, but only checks the type once per batch. With debug enabled
+ * it calls calculate() for each event, so the intermediate steps are printed.
+ * See ADnEDTransformBase::calculateBatch for the parameters.
+ */
+void ADnEDTransform::calculateBatch(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                                    epicsFloat64 *pResults, epicsUInt32 numEvents) const {
+
+  if (m_debug) {
+    ADnEDTransformBase::calculateBatch(type, pPixelIDs, pTofs, pResults, numEvents);
+    return;
+  }
+
+  if ((type == ADNED_TRANSFORM_TYPE1) && (p_Array[0] != NULL)) {
+    const epicsFloat64 *pFactor = p_Array[0];
+    const epicsUInt32 size = m_ArraySize[0];
+    for (epicsUInt32 i=0; i<numEvents; ++i) {
+      epicsUInt32 pixelID = pPixelIDs[i];
+      pResults[i] = (pixelID < size) ? (pTofs[i]*pFactor[pixelID]) : ADNED_TRANSFORM_ERROR;
+    }
+  } else if ((type == ADNED_TRANSFORM_TYPE3) && (p_EfJoules != NULL)) {
+    const epicsFloat64 L1 = m_doubleParam[0];
+    const epicsUInt32 size = m_deltaESize;
+    for (epicsUInt32 i=0; i<numEvents; ++i) {
+      epicsUInt32 pixelID = pPixelIDs[i];
+      epicsUInt32 tof = pTofs[i];
+      if ((pixelID >= size) || (p_EfJoules[pixelID] <= 0) || (tof == 0)) {
+        pResults[i] = ADNED_TRANSFORM_ERROR;
+        continue;
+      }
+      epicsFloat64 Ei = L1 / ((static_cast<epicsFloat64>(tof) * ADNED_TRANSFORM_TOF_TO_S) - p_L2Time[pixelID]);
+      Ei = 0.5 * ADNED_TRANSFORM_MN * Ei * Ei;
+      pResults[i] = (Ei - p_EfJoules[pixelID]) * (ADNED_TRANSFORM_EV_TO_mEV / ADNED_TRANSFORM_EV_TO_J);
+    }
+  } else {
+    for (epicsUInt32 i=0; i<numEvents; ++i) {
+      pResults[i] = ADNED_TRANSFORM_ERROR;
+    }
+  }
+
+}
+
+/**
+ * Calculate the TOF bin for a batch of events in fixed point. Only ADNED_TRANSFORM_TYPE1 
+ * is supported. Values close enough to a bin edge that the fixed point rounding could 
+ * matter are done again in floating point, so the result is always the same as
+ * floor((calculate() * scale) + offset). See ADnEDTransformBase::calculateBins
+ * for the parameters.
+ */
+bool ADnEDTransform::calculateBins(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                                   epicsUInt32 *pBins, epicsUInt32 numEvents) const {
+
+  if ((m_debug) || (type != ADNED_TRANSFORM_TYPE1) || (p_BinFactor == NULL)) {
+    return false;
+  }
+
+  const epicsUInt32 size = m_binSize;
+  const epicsInt64 offset = m_binOffsetFixed;
+  const epicsInt64 tofMax = static_cast<epicsInt64>(m_binTofMax) << 32;
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    epicsUInt32 pixelID = pPixelIDs[i];
+    epicsUInt32 tof = pTofs[i];
+    epicsUInt32 bin = ADNED_TRANSFORM_INVALID_BIN;
+    //Pixel IDs past the end of the array are a transformation error.
+    if (pixelID >= size) {
+      bin = ADNED_TRANSFORM_ERROR_BIN;
+    } else if (tof <= p_BinLimit[pixelID]) {
+      epicsInt64 value = static_cast<epicsInt64>(tof * p_BinFactor[pixelID]) + offset;
+      //The rounding error is at most half a unit per TOF count, plus a bit for the floating point.
+      epicsUInt32 fraction = static_cast<epicsUInt32>(value & 0xFFFFFFFF);
+      epicsUInt32 guard = (tof >> 1) + ADNED_TRANSFORM_BIN_GUARD;
+      if ((fraction < guard) || (fraction > (0xFFFFFFFF - guard))) {
+        bin = calc_bin(pixelID, tof);
+      } else if ((value >= 0) && (value <= tofMax)) {
+        bin = static_cast<epicsUInt32>(value >> 32);
+      }
+    }
+    pBins[i] = bin;
+  }
+
+  return true;
+}
+
+/**
+ * Calculate one TOF bin in floating point, the same way as the histogramming
+ * does for the result of calculate().
+ */
+epicsUInt32 ADnEDTransform::calc_bin(epicsUInt32 pixelID, epicsUInt32 tof) const {
+  epicsFloat64 value = (calc_dspace_static(pixelID, tof) * m_binScale) + m_binOffset;
+  if ((value <= m_binTofMax) && (value >= 0)) {
+    return static_cast<epicsUInt32>(floor(value));
+  }
+  return ADNED_TRANSFORM_INVALID_BIN;
+}
+
+/**
+ * Rebuild all the precomputed tables.
+ */
+void ADnEDTransform::paramsChanged(void) {
+  buildDeltaETables();
+  buildBinTables();
+}
+
+/**
+ * Precompute the per pixel values for ADNED_TRANSFORM_TYPE3 from p_Array[0] (Ef in meV)
+ * and p_Array[1] (L2 in meters). Pixels with Ef or L2 <= 0 are marked as invalid (Ef = 0).
+ * If the tables can't be allocated, TYPE3 returns ADNED_TRANSFORM_ERROR.
+ */
+void ADnEDTransform::buildDeltaETables(void) {
+
+  free(p_EfJoules);
+  free(p_L2Time);
+  p_EfJoules = NULL;
+  p_L2Time = NULL;
+  m_deltaESize = 0;
+
+  if ((p_Array[0] == NULL) || (p_Array[1] == NULL)) {
+    return;
+  }
+
+  epicsUInt32 size = (m_ArraySize[0] < m_ArraySize[1]) ? m_ArraySize[0] : m_ArraySize[1];
+  if (size == 0) {
+    return;
+  }
+  p_EfJoules = static_cast<epicsFloat64 *>(calloc(size, sizeof(epicsFloat64)));
+  p_L2Time = static_cast<epicsFloat64 *>(calloc(size, sizeof(epicsFloat64)));
+  if ((p_EfJoules == NULL) || (p_L2Time == NULL)) {
+    free(p_EfJoules);
+    free(p_L2Time);
+    p_EfJoules = NULL;
+    p_L2Time = NULL;
+    return;
+  }
+
+  for (epicsUInt32 pixelID=0; pixelID<size; ++pixelID) {
+    if ((p_Array[0][pixelID] > 0) && (p_Array[1][pixelID] > 0)) {
+      //Convert Ef (in meV) to Joules
+      p_EfJoules[pixelID] = (p_Array[0][pixelID] / ADNED_TRANSFORM_EV_TO_mEV) * ADNED_TRANSFORM_EV_TO_J;
+      p_L2Time[pixelID] = p_Array[1][pixelID] * sqrt(ADNED_TRANSFORM_MN/(2*p_EfJoules[pixelID]));
+    }
+  }
+  m_deltaESize = size;
+
+}
+
+/**
+ * Precompute the per pixel values for calculateBins with ADNED_TRANSFORM_TYPE1. 
+ * The factor in p_Array[0] is multiplied by the scale and converted to fixed point. 
+ * If any factor is negative or too big for fixed point (or the offset or TOF range
+ * is too big), the tables are not built and calculateBins is not used.
+ */
+void ADnEDTransform::buildBinTables(void) {
+
+  const epicsFloat64 fixedOne = 4294967296.0; //2^32
+  
+  free(p_BinFactor);
+  free(p_BinLimit);
+  p_BinFactor = NULL;
+  p_BinLimit = NULL;
+  m_binSize = 0;
+  m_binOffsetFixed = 0;
+
+  if ((p_Array[0] == NULL) || (m_ArraySize[0] == 0)) {
+    return;
+  }
+  if ((m_binTofMax >= ADNED_TRANSFORM_BIN_MAX) || !(fabs(m_binOffset) < ADNED_TRANSFORM_BIN_MAX)) {
+    return;
+  }
+
+  epicsUInt32 size = m_ArraySize[0];
+  p_BinFactor = static_cast<epicsUInt64 *>(calloc(size, sizeof(epicsUInt64)));
+  p_BinLimit = static_cast<epicsUInt32 *>(calloc(size, sizeof(epicsUInt32)));
+  if ((p_BinFactor == NULL) || (p_BinLimit == NULL)) {
+    free(p_BinFactor);
+    free(p_BinLimit);
+    p_BinFactor = NULL;
+    p_BinLimit = NULL;
+    return;
+  }
+
+  m_binOffsetFixed = static_cast<epicsInt64>(floor((m_binOffset * fixedOne) + 0.5));
+  //Limit the TOF so the product tof * factor is at least one bin past the range
+  //before it is ignored. This also means it can't overflow.
+  epicsInt64 maxProduct = (static_cast<epicsInt64>(m_binTofMax + 1) << 32) - m_binOffsetFixed;
+
+  for (epicsUInt32 pixelID=0; pixelID<size; ++pixelID) {
+    epicsFloat64 factor = p_Array[0][pixelID] * m_binScale;
+    if (!((factor >= 0) && (factor < ADNED_TRANSFORM_BIN_MAX))) {
+      free(p_BinFactor);
+      free(p_BinLimit);
+      p_BinFactor = NULL;
+      p_BinLimit = NULL;
+      return;
+    }
+    p_BinFactor[pixelID] = static_cast<epicsUInt64>(floor((factor * fixedOne) + 0.5));
+    if (maxProduct <= 0) {
+      p_BinLimit[pixelID] = 0;
+    } else if (p_BinFactor[pixelID] == 0) {
+      p_BinLimit[pixelID] = 0xFFFFFFFF;
+    } else {
+      epicsUInt64 limit = static_cast<epicsUInt64>(maxProduct) / p_BinFactor[pixelID];
+      p_BinLimit[pixelID] = (limit > 0xFFFFFFFFULL) ? 0xFFFFFFFF : static_cast<epicsUInt32>(limit);
+    }
+  }
+  m_binSize = size;
+
+}
@@ -19,6 +19,12 @@
  *
  *        The documentation for each calculation type will specify which parameter is used.
  *
+ *        Per pixel values that only depend on the parameters are precomputed whenever
+ *        a parameter changes, so the per event calculation is just a few arithmetic operations.
+ *        calculateBatch() does the same calculation as calculate() for a whole batch of events.
+ *        For ADNED_TRANSFORM_TYPE1, calculateBins() gives the TOF bin directly in fixed point, 
+ *        using a per pixel factor with the scale already applied.
+ *
  * @author Matt Pearson
  * @date April 2015
  */
@@ -39,12 +45,36 @@ class ADnEDTransform : public ADnEDTransformBase {
   //Call this to transform the TOF using a particular calculation (specified by type)
   //This is the only public function that you need to define in a derived class.
   epicsFloat64 calculate(epicsUInt32 type, epicsUInt32 pixelID, epicsUInt32 tof) const;
+  void calculateBatch(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                      epicsFloat64 *pResults, epicsUInt32 numEvents) const;
+  bool calculateBins(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                     epicsUInt32 *pBins, epicsUInt32 numEvents) const;
+
+ protected:
+  void paramsChanged(void);
 
  private:
   //These are the functions that do the real work, at least in this implementation
   epicsFloat64 calc_dspace_static(epicsUInt32 pixelID, epicsUInt32 tof) const;
   epicsFloat64 calc_dspace_dynamic(epicsUInt32 pixelID, epicsUInt32 tof) const;
   epicsFloat64 calc_deltaE(epicsUInt32 pixelID, epicsUInt32 tof) const;
+  epicsUInt32 calc_bin(epicsUInt32 pixelID, epicsUInt32 tof) const;
+  void buildDeltaETables(void);
+  void buildBinTables(void);
+
+  //Precomputed per pixel values for ADNED_TRANSFORM_TYPE3 (structure of arrays, indexed by pixel ID).
+  //Ef in Joules (zero if the pixel can't be transformed), and L2*sqrt(Mn/(2*Ef)) in seconds.
+  epicsFloat64 *p_EfJoules;
+  epicsFloat64 *p_L2Time;
+  epicsUInt32 m_deltaESize;
+
+  //Precomputed per pixel values for calculateBins with ADNED_TRANSFORM_TYPE1. The bin is
+  //((tof * p_BinFactor) + m_binOffsetFixed) >> 32, for tof <= p_BinLimit (which keeps the
+  //product in range). The factor and offset have 32 fractional bits.
+  epicsUInt64 *p_BinFactor;
+  epicsUInt32 *p_BinLimit;
+  epicsUInt32 m_binSize;
+  epicsInt64 m_binOffsetFixed;
 
 };
 
@@ -15,6 +15,10 @@ ADnEDTransformBase::ADnEDTransformBase(void) {
     m_ArraySize[i] = 0;
     p_Array[i] = NULL;
   }
+  m_binScale = 1.0;
+  m_binOffset = 0.0;
+  m_binTofMax = 0;
+  m_debug = false;
 
   printf("ADnEDTransformBase::ADnEDTransformBase: Created OK\n");
 
@@ -39,6 +43,7 @@ int ADnEDTransformBase::setIntParam(epicsUInt32 paramIndex, epicsUInt32 paramVal
   }
   
   m_intParam[paramIndex] = paramVal;
+  paramsChanged();
 
   return ADNED_TRANSFORM_OK;
 }
@@ -55,6 +60,7 @@ int ADnEDTransformBase::setDoubleParam(epicsUInt32 paramIndex, epicsFloat64 para
   }
   
   m_doubleParam[paramIndex] = paramVal;
+  paramsChanged();
 
   return ADNED_TRANSFORM_OK;
 }
@@ -91,7 +97,14 @@ int ADnEDTransformBase::setDoubleArray(epicsUInt32 paramIndex, const epicsFloat6
     p_Array[paramIndex] = static_cast<epicsFloat64 *>(calloc(m_ArraySize[paramIndex], sizeof(epicsFloat64)));
   }
 
+  if (p_Array[paramIndex] == NULL) {
+    m_ArraySize[paramIndex] = 0;
+    paramsChanged();
+    return ADNED_TRANSFORM_ERROR;
+  }
+
   memcpy(p_Array[paramIndex], pSource, m_ArraySize[paramIndex]*sizeof(epicsFloat64));
+  paramsChanged();
 
   return ADNED_TRANSFORM_OK;
 }
@@ -133,5 +146,70 @@ void ADnEDTransformBase::printParams(void) const {
 void ADnEDTransformBase::setDebug(bool debug)
 {
   m_debug = debug;
+  paramsChanged();
+}
+
+/**
+ * Transform a batch of events. This default implementation calls calculate() for 
+ * each event. Derived classes should override this to avoid the per event virtual call.
+ * @param type The calculation type (see calculate)
+ * @param pPixelIDs The pixel IDs, offset so the detector starts at 0 (as for calculate)
+ * @param pTofs The TOF values
+ * @param pResults The transformed values (ADNED_TRANSFORM_ERROR for events that can't be transformed)
+ * @param numEvents The number of events
+ */
+void ADnEDTransformBase::calculateBatch(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                                        epicsFloat64 *pResults, epicsUInt32 numEvents) const
+{
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    pResults[i] = calculate(type, pPixelIDs[i], pTofs[i]);
+  }
+}
+
+/**
+ * Calculate the final TOF bin for a batch of events, using the scale, offset and
+ * maximum TOF bin set by setBinning(). Events outside 0 to tofMax are given the bin
+ * ADNED_TRANSFORM_INVALID_BIN, and transformation errors (where calculate would return
+ * ADNED_TRANSFORM_ERROR) are given ADNED_TRANSFORM_ERROR_BIN. The default implementation 
+ * does not support this.
+ * @param type The calculation type (see calculate)
+ * @param pPixelIDs The pixel IDs, offset so the detector starts at 0 (as for calculate)
+ * @param pTofs The TOF values
+ * @param pBins The TOF bins
+ * @param numEvents The number of events
+ * @return false if this type can't be done this way (use calculateBatch instead)
+ */
+bool ADnEDTransformBase::calculateBins(epicsUInt32 /*type*/, const epicsUInt32 * /*pPixelIDs*/, const epicsUInt32 * /*pTofs*/, 
+                                       epicsUInt32 * /*pBins*/, epicsUInt32 /*numEvents*/) const
+{
+  return false;
+}
+
+/**
+ * Set the values used by calculateBins to convert the result to a TOF bin.
+ * Nothing is recalculated if the values have not changed.
+ * @param scale The scale factor
+ * @param offset The offset (added after the scale factor)
+ * @param tofMax The largest TOF bin
+ */
+int ADnEDTransformBase::setBinning(epicsFloat64 scale, epicsFloat64 offset, epicsUInt32 tofMax)
+{
+  if ((scale == m_binScale) && (offset == m_binOffset) && (tofMax == m_binTofMax)) {
+    return ADNED_TRANSFORM_OK;
+  }
+
+  m_binScale = scale;
+  m_binOffset = offset;
+  m_binTofMax = tofMax;
+  paramsChanged();
+
+  return ADNED_TRANSFORM_OK;
+}
+
+/**
+ * Default does nothing.
+ */
+void ADnEDTransformBase::paramsChanged(void)
+{
 }
 
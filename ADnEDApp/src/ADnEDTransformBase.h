@@ -2,6 +2,12 @@
  * ADnEDTransform base class. Concrete classes should inherit from this.
  * This base class provides default implementations for the parameter storage, 
  * parameter handling and debug functions.
+ *
+ * Derived classes can override paramsChanged() to precompute anything that 
+ * depends only on the parameters, and calculateBatch() to transform a whole 
+ * batch of events with one virtual call. If a calculation can be done in
+ * fixed point, calculateBins() can give the final integer TOF bin directly, with the
+ * scale and offset (from setBinning) folded in.
  */
 
 #ifndef ADNED_TRANSFORM_BASE_H
@@ -20,6 +26,11 @@ class ADnEDTransformBase {
   virtual ~ADnEDTransformBase();
 
   virtual epicsFloat64 calculate(epicsUInt32 type, epicsUInt32 pixelID, epicsUInt32 tof) const = 0;
+  virtual void calculateBatch(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                              epicsFloat64 *pResults, epicsUInt32 numEvents) const;
+  virtual bool calculateBins(epicsUInt32 type, const epicsUInt32 *pPixelIDs, const epicsUInt32 *pTofs, 
+                             epicsUInt32 *pBins, epicsUInt32 numEvents) const;
+  int setBinning(epicsFloat64 scale, epicsFloat64 offset, epicsUInt32 tofMax);
   int setIntParam(epicsUInt32 paramIndex, epicsUInt32 paramVal);
   int setDoubleParam(epicsUInt32 paramIndex, epicsFloat64 paramVal);
   int setDoubleArray(epicsUInt32 paramIndex, const epicsFloat64 *pSource, epicsUInt32 size);
@@ -28,12 +39,20 @@ class ADnEDTransformBase {
 
  protected:
 
+  //Called after any parameter, array or the debug flag has been changed.
+  virtual void paramsChanged(void);
+
   //Storage for parameters and arrays used in the calculations.
   epicsUInt32 m_intParam[ADNED_MAX_TRANSFORM_PARAMS];
   epicsFloat64 m_doubleParam[ADNED_MAX_TRANSFORM_PARAMS];
   epicsFloat64 *p_Array[ADNED_MAX_TRANSFORM_PARAMS];
   epicsUInt32 m_ArraySize[ADNED_MAX_TRANSFORM_PARAMS];
 
+  //Used to convert the result to a TOF bin: bin = floor((result * scale) + offset), 0 <= bin <= tofMax
+  epicsFloat64 m_binScale;
+  epicsFloat64 m_binOffset;
+  epicsUInt32 m_binTofMax;
+
   //Flag to print out intermediate calculation steps for debug (true or false)
   bool m_debug;
 
@@ -0,0 +1,177 @@
+/**
+ * Unit tests for the dirty page flags set by ADnEDHistogram::process.
+ *
+ * The kernels set the flag for the page (ADNED_SHARD_PAGE_SIZE elements) of each
+ * element they write to, so only those pages are merged. A single event must mark
+ * only the page of each element it was counted in, rejected events must mark
+ * nothing, and for a packet of random events the marked pages must be exactly
+ * the pages with non-zero counts, for each of the 2-D plot types.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDHistogram.h"
+
+//One detector, with the 2-D plot and TOF spectrum both several pages long.
+#define TEST_DET_SIZE 4096
+#define TEST_PIXEL_SIZE_X 64
+#define TEST_TOF_MAX 4095
+#define TEST_TOF_BINS 16
+#define TEST_BUFFER_SIZE (TEST_DET_SIZE + TEST_TOF_MAX + 1)
+#define TEST_NUM_PAGES ((TEST_BUFFER_SIZE + ADNED_SHARD_PAGE_SIZE - 1) / ADNED_SHARD_PAGE_SIZE)
+
+static const int plotTypes[] = {ADNED_2D_PLOT_XY, ADNED_2D_PLOT_XTOF, ADNED_2D_PLOT_YTOF, ADNED_2D_PLOT_PIXELIDTOF};
+static const char *plotNames[] = {"XY", "XTOF", "YTOF", "PIXELIDTOF"};
+static const epicsUInt32 numPlotTypes = sizeof(plotTypes) / sizeof(plotTypes[0]);
+
+/**
+ * Set up the configuration for one detector starting at pixel ID 0.
+ * @param pConfig The snapshot to fill in
+ * @param plotType The ADNED_2D_PLOT_* type
+ * @param pixelSizeX The X size for the XTOF and YTOF plots (0 means no 2-D plot for these)
+ */
+static void makeConfig(ADnEDConfigSnapshot *pConfig, int plotType, int pixelSizeX)
+{
+  ADnEDDetConfig *pDetConfig = &pConfig->m_det[1];
+
+  pConfig->m_numDet = 1;
+  pConfig->m_tofMax = TEST_TOF_MAX;
+  pConfig->m_valid = true;
+  pDetConfig->detStart = 0;
+  pDetConfig->detEnd = TEST_DET_SIZE - 1;
+  pDetConfig->detSize = TEST_DET_SIZE;
+  pDetConfig->ndArrayStart = 0;
+  pDetConfig->ndArrayTOFStart = TEST_DET_SIZE;
+  pDetConfig->pixelSizeX = pixelSizeX;
+  pDetConfig->plotType = plotType;
+  pDetConfig->tofBins = TEST_TOF_BINS;
+  pDetConfig->tofBinWidth = (TEST_TOF_MAX + 1) / TEST_TOF_BINS;
+  ADnEDSimd::initDivider(pDetConfig->tofBinWidth, &pDetConfig->tofBinDivider);
+}
+
+/**
+ * Histogram some events into an empty buffer.
+ * @return The number of pages marked
+ */
+static epicsUInt32 histogram(const ADnEDConfigSnapshot *pConfig, const epicsUInt32 *pPixels, const epicsUInt32 *pTofs,
+                             epicsUInt32 numEvents, std::vector<epicsUInt32> &data, std::vector<epicsUInt8> &pages)
+{
+  ADnEDHistogram hist;
+  ADnEDPixelLookup lookup;
+  int detStart[2] = {0, pConfig->m_det[1].detStart};
+  int detEnd[2] = {0, pConfig->m_det[1].detEnd};
+  std::vector<epicsUInt32> detEvents(2, 0);
+  epicsUInt32 numMarked = 0;
+
+  data.assign(TEST_BUFFER_SIZE, 0);
+  pages.assign(TEST_NUM_PAGES, 0);
+  lookup.build(1, detStart, detEnd);
+  hist.process(pConfig, &lookup, NULL, pPixels, pTofs, numEvents, &data[0], &detEvents[0], NULL, &pages[0]);
+  for (epicsUInt32 page=0; page<TEST_NUM_PAGES; ++page) {
+    numMarked += pages[page];
+  }
+  return numMarked;
+}
+
+/**
+ * A single event only marks the pages it was counted in.
+ */
+static void testSingleEvent(void)
+{
+  ADnEDConfigSnapshot config(1);
+  std::vector<epicsUInt32> data;
+  std::vector<epicsUInt8> pages;
+  epicsUInt32 pixel = 2500;
+  epicsUInt32 tof = 3000;
+  epicsUInt32 pixelPage = pixel / ADNED_SHARD_PAGE_SIZE;
+  epicsUInt32 tofPage = (TEST_DET_SIZE + tof) / ADNED_SHARD_PAGE_SIZE;
+
+  //No 2-D plot, so only the TOF spectrum is written.
+  makeConfig(&config, ADNED_2D_PLOT_XTOF, 0);
+  testOk(histogram(&config, &pixel, &tof, 1, data, pages) == 1, "one event in the TOF spectrum marks one page");
+  testOk1(pages[tofPage] == 1);
+
+  makeConfig(&config, ADNED_2D_PLOT_XY, TEST_PIXEL_SIZE_X);
+  testOk(histogram(&config, &pixel, &tof, 1, data, pages) == 2,
+         "one event in the X/Y plot and TOF spectrum marks two pages of %u", TEST_NUM_PAGES);
+  testOk1((pages[pixelPage] == 1) && (pages[tofPage] == 1));
+
+  //The last element of a page and the first of the next.
+  epicsUInt32 pixels[2] = {ADNED_SHARD_PAGE_SIZE - 1, ADNED_SHARD_PAGE_SIZE};
+  epicsUInt32 tofs[2] = {0, 0};
+  makeConfig(&config, ADNED_2D_PLOT_XTOF, 0);
+  testOk(histogram(&config, &pixels[0], &tofs[0], 1, data, pages) == 1, "one event at TOF 0 marks one page");
+  testOk1(pages[TEST_DET_SIZE / ADNED_SHARD_PAGE_SIZE] == 1);
+  makeConfig(&config, ADNED_2D_PLOT_XY, TEST_PIXEL_SIZE_X);
+  testOk1((histogram(&config, &pixels[0], &tofs[0], 2, data, pages) == 3) && (pages[0] == 1) && (pages[1] == 1));
+}
+
+/**
+ * Rejected events don't mark any pages.
+ */
+static void testRejected(void)
+{
+  ADnEDConfigSnapshot config(1);
+  std::vector<epicsUInt32> data;
+  std::vector<epicsUInt8> pages;
+  epicsUInt32 pixels[2] = {100, TEST_DET_SIZE + 100};
+  epicsUInt32 tofs[2] = {TEST_TOF_MAX + 1, 10};
+
+  makeConfig(&config, ADNED_2D_PLOT_XTOF, 0);
+  testOk(histogram(&config, &pixels[0], &tofs[0], 1, data, pages) == 0, "event outside the TOF range marks no pages");
+  testOk(histogram(&config, &pixels[1], &tofs[1], 1, data, pages) == 0, "event outside the detector marks no pages");
+}
+
+/**
+ * For random events, the marked pages are exactly the pages with counts in them.
+ */
+static void testRandom(void)
+{
+  const epicsUInt32 numEvents = 6;
+  std::vector<epicsUInt32> pixels(numEvents);
+  std::vector<epicsUInt32> tofs(numEvents);
+  std::vector<epicsUInt32> data;
+  std::vector<epicsUInt8> pages;
+
+  srand(1234);
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    pixels[i] = rand() % TEST_DET_SIZE;
+    tofs[i] = rand() % (TEST_TOF_MAX + 1);
+  }
+
+  for (epicsUInt32 p=0; p<numPlotTypes; ++p) {
+    ADnEDConfigSnapshot config(1);
+    makeConfig(&config, plotTypes[p], TEST_PIXEL_SIZE_X);
+    epicsUInt32 numMarked = histogram(&config, &pixels[0], &tofs[0], numEvents, data, pages);
+    epicsUInt32 numBad = 0;
+    epicsUInt32 numUsed = 0;
+    for (epicsUInt32 page=0; page<TEST_NUM_PAGES; ++page) {
+      bool used = false;
+      for (epicsUInt32 i=page*ADNED_SHARD_PAGE_SIZE; (i<(page+1)*ADNED_SHARD_PAGE_SIZE) && (i<TEST_BUFFER_SIZE); ++i) {
+        used = used || (data[i] != 0);
+      }
+      numUsed += used;
+      if (used != (pages[page] != 0)) {
+        testDiag("%s plot: page %u has counts %d, marked %u", plotNames[p], page, used, pages[page]);
+        ++numBad;
+      }
+    }
+    testOk(numBad == 0, "%s plot: %u pages marked, %u pages with counts", plotNames[p], numMarked, numUsed);
+  }
+}
+
+MAIN(ADnEDHistogramTest)
+{
+  testPlan(9 + numPlotTypes);
+
+  testSingleEvent();
+  testRejected();
+  testRandom();
+
+  return testDone();
+}
@@ -0,0 +1,185 @@
+/**
+ * Unit tests for ADnEDPixelLookup.
+ *
+ * For each set of detector pixel ID ranges the lookup is compared with the
+ * original mapping, which is a loop over every detector checking
+ * start <= pixelID <= end. Every pixel ID around each range edge is checked,
+ * as well as pixel IDs outside all the ranges (below, in between, above and
+ * at the ends of the 32 bit pixel ID space). Both the dense table and the
+ * sorted range index are covered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDPixelLookup.h"
+
+#define TEST_MAX_DETS 8
+
+/**
+ * Detector pixel ID ranges for one test (indexed by detector number, 1 based).
+ */
+struct TestConfig {
+  const char *name;
+  epicsUInt32 numDet;
+  int detStart[TEST_MAX_DETS+1];
+  int detEnd[TEST_MAX_DETS+1];
+};
+
+static const TestConfig testConfigs[] = {
+  {"single detector",         1, {0, 0}, {0, 1023}},
+  {"contiguous detectors",    3, {0, 0, 1024, 2048}, {0, 1023, 2047, 3071}},
+  {"gaps between detectors",  3, {0, 100, 5000, 9000}, {0, 199, 5999, 9000}},
+  {"overlapping detectors",   4, {0, 0, 500, 200, 0}, {0, 999, 1499, 299, 0}},
+  {"unsorted detectors",      3, {0, 2048, 0, 1024}, {0, 3071, 1023, 2047}},
+  {"empty detector range",    3, {0, 0, 50, 2000}, {0, 999, 10, 2999}},
+  {"sparse pixel IDs",        2, {0, 10, 100000000}, {0, 19, 100000009}},
+  {"top of pixel ID space",   2, {0, 0, 0x7FFFFF00}, {0, 255, 0x7FFFFFFF}},
+  {"more ranges than SIMD",   TEST_MAX_DETS,
+   {0, 0, 20, 40, 60, 80, 100, 120, 140}, {0, 9, 29, 49, 69, 89, 109, 129, 149}},
+};
+
+static const epicsUInt32 numTestConfigs = sizeof(testConfigs) / sizeof(testConfigs[0]);
+
+/**
+ * The original mapping. The detectors whose pixel ID range contains pixelID.
+ */
+static std::vector<epicsUInt32> baselineDets(const TestConfig *pConfig, epicsUInt32 pixelID)
+{
+  std::vector<epicsUInt32> dets;
+  for (epicsUInt32 det=1; det<=pConfig->numDet; ++det) {
+    if ((pixelID >= static_cast<epicsUInt32>(pConfig->detStart[det]))
+        && (pixelID <= static_cast<epicsUInt32>(pConfig->detEnd[det]))) {
+      dets.push_back(det);
+    }
+  }
+  return dets;
+}
+
+/**
+ * Compare the lookup with the original mapping for one pixel ID.
+ * @return true if they match
+ */
+static bool checkPixel(const TestConfig *pConfig, const ADnEDPixelLookup *pLookup, epicsUInt32 pixelID)
+{
+  std::vector<epicsUInt32> expected = baselineDets(pConfig, pixelID);
+  epicsUInt32 seg = pLookup->segment(pixelID);
+  std::vector<epicsUInt32> found(pLookup->detBegin(seg), pLookup->detEnd(seg));
+
+  if ((expected.empty()) != (seg == 0)) {
+    testDiag("%s: pixel ID %u is in segment %u, expected %u detectors",
+             pConfig->name, pixelID, seg, static_cast<epicsUInt32>(expected.size()));
+    return false;
+  }
+  if (found != expected) {
+    testDiag("%s: pixel ID %u maps to %u detectors, expected %u",
+             pConfig->name, pixelID, static_cast<epicsUInt32>(found.size()),
+             static_cast<epicsUInt32>(expected.size()));
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Check the pixel IDs either side of every range edge, and a few outside all the ranges.
+ */
+static void testConfig(const TestConfig *pConfig)
+{
+  ADnEDPixelLookup lookup;
+  std::vector<epicsUInt32> pixelIDs;
+
+  testOk(lookup.build(pConfig->numDet, pConfig->detStart, pConfig->detEnd) == ADNED_PIXEL_LOOKUP_OK,
+         "%s: build", pConfig->name);
+
+  for (epicsUInt32 det=1; det<=pConfig->numDet; ++det) {
+    epicsUInt32 start = static_cast<epicsUInt32>(pConfig->detStart[det]);
+    epicsUInt32 end = static_cast<epicsUInt32>(pConfig->detEnd[det]);
+    for (epicsUInt32 i=0; i<3; ++i) {
+      pixelIDs.push_back(start - i);
+      pixelIDs.push_back(start + i);
+      pixelIDs.push_back(end - i);
+      pixelIDs.push_back(end + i);
+    }
+    pixelIDs.push_back(start + ((end - start) / 2));
+  }
+  pixelIDs.push_back(0);
+  pixelIDs.push_back(1);
+  pixelIDs.push_back(0x7FFFFFFF);
+  pixelIDs.push_back(0x80000000);
+  pixelIDs.push_back(0xFFFFFFFE);
+  pixelIDs.push_back(0xFFFFFFFF);
+
+  epicsUInt32 numBad = 0;
+  for (epicsUInt32 i=0; i<pixelIDs.size(); ++i) {
+    if (!checkPixel(pConfig, &lookup, pixelIDs[i])) {
+      ++numBad;
+    }
+  }
+  testOk(numBad == 0, "%s: %u pixel IDs at the range edges and out of range",
+         pConfig->name, static_cast<epicsUInt32>(pixelIDs.size()));
+
+  //Every pixel ID over the detectors, and some either side, where that is not too many.
+  epicsUInt32 minID = 0xFFFFFFFF;
+  epicsUInt32 maxID = 0;
+  for (epicsUInt32 det=1; det<=pConfig->numDet; ++det) {
+    if (static_cast<epicsUInt32>(pConfig->detStart[det]) < minID) {
+      minID = static_cast<epicsUInt32>(pConfig->detStart[det]);
+    }
+    if (static_cast<epicsUInt32>(pConfig->detEnd[det]) > maxID) {
+      maxID = static_cast<epicsUInt32>(pConfig->detEnd[det]);
+    }
+  }
+  if ((maxID - minID) > 1000000) {
+    testSkip(1, "pixel ID span too big to check every pixel ID");
+    return;
+  }
+  numBad = 0;
+  epicsUInt64 first = (minID > 100) ? (minID - 100) : 0;
+  epicsUInt64 last = static_cast<epicsUInt64>(maxID) + 100;
+  for (epicsUInt64 id=first; (id<=last) && (id<=0xFFFFFFFFULL); ++id) {
+    if (!checkPixel(pConfig, &lookup, static_cast<epicsUInt32>(id))) {
+      ++numBad;
+    }
+  }
+  testOk(numBad == 0, "%s: every pixel ID from %u to %u",
+         pConfig->name, static_cast<epicsUInt32>(first), maxID + 100);
+}
+
+/**
+ * An empty or failed lookup maps every pixel ID to no detector.
+ */
+static void testEmpty(void)
+{
+  ADnEDPixelLookup lookup;
+  int detStart[2] = {0, 10};
+  int detEnd[2] = {0, 5};
+
+  testOk1(lookup.segment(0) == 0);
+  testOk1(lookup.build(0, detStart, detEnd) == ADNED_PIXEL_LOOKUP_ERROR);
+  testOk(lookup.build(1, detStart, detEnd) == ADNED_PIXEL_LOOKUP_ERROR,
+         "build with only an empty detector range fails");
+  testOk1((lookup.segment(7) == 0) && (lookup.segment(10) == 0));
+  testOk1(lookup.detBegin(0) == lookup.detEnd(0));
+
+  detEnd[1] = 20;
+  testOk1(lookup.build(1, detStart, detEnd) == ADNED_PIXEL_LOOKUP_OK);
+  testOk1(lookup.segment(15) != 0);
+  lookup.clear();
+  testOk(lookup.segment(15) == 0, "clear removes the mapping");
+}
+
+MAIN(ADnEDPixelLookupTest)
+{
+  testPlan((numTestConfigs * 3) + 8);
+
+  for (epicsUInt32 i=0; i<numTestConfigs; ++i) {
+    testConfig(&testConfigs[i]);
+  }
+  testEmpty();
+
+  return testDone();
+}
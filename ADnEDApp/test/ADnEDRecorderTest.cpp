@@ -0,0 +1,221 @@
+/**
+ * Unit tests for ADnEDRecorder and ADnEDReplayFile.
+ *
+ * Packets from two channels are recorded, including packets with no events and
+ * with no timestamp, then read back with ADnEDReplayFile. Every packet must come
+ * back with the same channel, status, timestamp, sequence ID, proton charge and
+ * events. The pulse index must have an entry for each packet that has a newer
+ * timestamp than any before it, giving the offset of its packet header. A second
+ * recording must be appended to the same file, and carry on the pulse count.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+#include "epicsThread.h"
+
+#include "ADnEDRecorder.h"
+#include "ADnEDReplayFile.h"
+
+#define TEST_NUM_CHANNELS 2
+#define TEST_FILE_NAME "ADnEDRecorderTest.dat"
+#define TEST_WAIT_MAX 5.0 //Longest wait for the recorder thread (s)
+
+/**
+ * What was recorded, to compare against what is read back.
+ */
+struct TestPacket {
+  epicsUInt32 channelID;
+  ADnEDPacket packet;
+  bool newPulse; //Expect an index entry
+};
+
+/**
+ * Make a packet.
+ * @param seconds The timestamp seconds
+ * @param seqID The timestamp user tag
+ * @param numEvents The number of events
+ * @param status One of ADNED_PACKET_*
+ */
+static ADnEDPacket makePacket(epicsInt64 seconds, int seqID, epicsUInt32 numEvents, epicsUInt32 status)
+{
+  ADnEDPacket packet;
+  epics::pvData::shared_vector<epics::pvData::uint32> pixels(numEvents);
+  epics::pvData::shared_vector<epics::pvData::uint32> tofs(numEvents);
+
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    pixels[i] = (seqID * 1000) + i;
+    tofs[i] = (seqID * 1000) + (2 * i);
+  }
+  packet.pixels = epics::pvData::freeze(pixels);
+  packet.tofs = epics::pvData::freeze(tofs);
+  packet.timeStamp.put(seconds, 1000);
+  packet.timeStamp.setUserTag(seqID);
+  packet.pCharge = 0.5 * seqID;
+  packet.status = status;
+  return packet;
+}
+
+/**
+ * Queue packets, waiting for the recorder thread to write each one. The thread
+ * takes a packet from each channel in turn, so this keeps them in the order queued.
+ * @return true if they were all written in time
+ */
+static bool record(ADnEDRecorder *pRecorder, const std::vector<TestPacket> &packets)
+{
+  for (epicsUInt32 i=0; i<packets.size(); ++i) {
+    epicsUInt32 numPackets = pRecorder->getNumPackets();
+    pRecorder->record(packets[i].packet, packets[i].channelID);
+    for (epicsFloat64 waited=0.0; (pRecorder->getNumPackets() == numPackets) && (waited<TEST_WAIT_MAX); waited+=0.001) {
+      epicsThreadSleep(0.001);
+    }
+  }
+  return ((pRecorder->getNumPackets() == packets.size()) && (pRecorder->getNumDropped() == 0));
+}
+
+/**
+ * Read back the data file, and compare it to the recorded packets.
+ * @return The number of packets that match
+ */
+static epicsUInt32 replay(const std::vector<TestPacket> &packets, std::vector<epicsUInt64> &offsets)
+{
+  ADnEDReplayFile file;
+  ADnEDPacket packet;
+  epicsUInt32 channelID = 0;
+  epicsUInt32 numMatched = 0;
+  epicsUInt64 offset = sizeof(ADnEDRecordFileHeader);
+  int status = ADNED_REPLAY_OK;
+
+  offsets.clear();
+  if (file.open(TEST_FILE_NAME) != ADNED_REPLAY_OK) {
+    return 0;
+  }
+  for (epicsUInt32 i=0; i<packets.size(); ++i) {
+    const ADnEDPacket &expected = packets[i].packet;
+    if ((status = file.read(packet, channelID)) != ADNED_REPLAY_OK) {
+      testDiag("packet %u: read returned %d", i, status);
+      break;
+    }
+    //The events are only written for good packets.
+    epicsUInt32 numEvents = (expected.status == ADNED_PACKET_OK) ? static_cast<epicsUInt32>(expected.pixels.size()) : 0;
+    bool match = ((channelID == packets[i].channelID) && (packet.status == expected.status) &&
+                  (packet.timeStamp == expected.timeStamp) &&
+                  (packet.timeStamp.getUserTag() == expected.timeStamp.getUserTag()) &&
+                  (packet.pCharge == expected.pCharge) &&
+                  (packet.pixels.size() == numEvents) && (packet.tofs.size() == numEvents));
+    for (epicsUInt32 event=0; (match) && (event<numEvents); ++event) {
+      match = ((packet.pixels[event] == expected.pixels[event]) && (packet.tofs[event] == expected.tofs[event]));
+    }
+    if (!match) {
+      testDiag("packet %u (channel %u, seqID %d) does not match", i, packets[i].channelID, expected.timeStamp.getUserTag());
+    }
+    numMatched += match;
+    offsets.push_back(offset);
+    offset += sizeof(ADnEDRecordPacketHeader) + (2 * numEvents * sizeof(epicsUInt32));
+  }
+  testOk((status == ADNED_REPLAY_OK) && (file.read(packet, channelID) == ADNED_REPLAY_END),
+         "end of file after %u packets", static_cast<epicsUInt32>(packets.size()));
+  file.close();
+
+  return numMatched;
+}
+
+/**
+ * Read the pulse index, and compare it to the packets that started a pulse.
+ * @return true if it matches
+ */
+static bool checkIndex(const std::vector<TestPacket> &packets, const std::vector<epicsUInt64> &offsets)
+{
+  std::vector<ADnEDRecordIndexEntry> entries;
+  ADnEDRecordIndexEntry entry;
+  FILE *pIndex = fopen(TEST_FILE_NAME ADNED_RECORD_INDEX_SUFFIX, "rb");
+  epicsUInt32 numEntries = 0;
+  bool match = true;
+
+  if (pIndex == NULL) {
+    return false;
+  }
+  while (fread(&entry, sizeof(entry), 1, pIndex) == 1) {
+    entries.push_back(entry);
+  }
+  fclose(pIndex);
+
+  for (epicsUInt32 i=0; (i<packets.size()) && (i<offsets.size()); ++i) {
+    if (!packets[i].newPulse) {
+      continue;
+    }
+    const ADnEDPacket &packet = packets[i].packet;
+    if ((numEntries >= entries.size()) || (entries[numEntries].pulse != numEntries) ||
+        (entries[numEntries].offset != offsets[i]) ||
+        (entries[numEntries].secondsPastEpoch != packet.timeStamp.getSecondsPastEpoch()) ||
+        (entries[numEntries].nanoseconds != packet.timeStamp.getNanoseconds())) {
+      testDiag("index entry %u does not match packet %u", numEntries, i);
+      match = false;
+    }
+    ++numEntries;
+  }
+
+  return (match && (numEntries == entries.size()));
+}
+
+MAIN(ADnEDRecorderTest)
+{
+  //The recorder thread never exits, so the recorder is never deleted.
+  ADnEDRecorder *pRecorder = new ADnEDRecorder(TEST_NUM_CHANNELS);
+  std::vector<TestPacket> packets;
+  std::vector<TestPacket> appended;
+  std::vector<epicsUInt64> offsets;
+  TestPacket test;
+
+  testPlan(11);
+
+  remove(TEST_FILE_NAME);
+  remove(TEST_FILE_NAME ADNED_RECORD_INDEX_SUFFIX);
+
+  //Two pulses on two channels, the second channel lagging.
+  test.channelID = 0; test.packet = makePacket(100, 1, 10, ADNED_PACKET_OK); test.newPulse = true;
+  packets.push_back(test);
+  test.channelID = 0; test.packet = makePacket(101, 2, 5, ADNED_PACKET_OK); test.newPulse = true;
+  packets.push_back(test);
+  test.channelID = 1; test.packet = makePacket(100, 3, 7, ADNED_PACKET_OK); test.newPulse = false;
+  packets.push_back(test);
+  test.channelID = 1; test.packet = makePacket(101, 4, 0, ADNED_PACKET_NO_EVENTS); test.newPulse = false;
+  packets.push_back(test);
+  //No timestamp, so it can't start a pulse even though the timestamp is newer.
+  test.channelID = 0; test.packet = makePacket(200, 5, 3, ADNED_PACKET_NO_TIMESTAMP); test.newPulse = false;
+  packets.push_back(test);
+  test.channelID = 1; test.packet = makePacket(102, 6, 1000, ADNED_PACKET_OK); test.newPulse = true;
+  packets.push_back(test);
+
+  testOk1(pRecorder->start("recorderTest") == ADNED_RECORD_OK);
+  testOk1((pRecorder->open(TEST_FILE_NAME) == ADNED_RECORD_OK) && (pRecorder->isRecording()));
+  bool recorded = record(pRecorder, packets);
+  testOk(recorded, "%u packets recorded", pRecorder->getNumPackets());
+  testOk(pRecorder->getNumPulses() == 3, "%u pulses", pRecorder->getNumPulses());
+  pRecorder->close();
+
+  testOk(replay(packets, offsets) == packets.size(), "replayed packets match");
+  testOk(checkIndex(packets, offsets), "pulse index matches");
+
+  //A second recording is appended, and older timestamps can start pulses again.
+  test.channelID = 1; test.packet = makePacket(50, 7, 2, ADNED_PACKET_OK); test.newPulse = true;
+  appended.push_back(test);
+  test.channelID = 0; test.packet = makePacket(51, 8, 4, ADNED_PACKET_NO_PCHARGE); test.newPulse = true;
+  appended.push_back(test);
+  pRecorder->open(TEST_FILE_NAME);
+  recorded = record(pRecorder, appended);
+  testOk((recorded) && (pRecorder->getNumPulses() == 5), "appended recording has %u pulses in total",
+         pRecorder->getNumPulses());
+  pRecorder->close();
+  packets.insert(packets.end(), appended.begin(), appended.end());
+  testOk(replay(packets, offsets) == packets.size(), "replayed packets match after appending");
+  testOk(checkIndex(packets, offsets), "pulse index matches after appending");
+
+  remove(TEST_FILE_NAME);
+  remove(TEST_FILE_NAME ADNED_RECORD_INDEX_SUFFIX);
+
+  return testDone();
+}
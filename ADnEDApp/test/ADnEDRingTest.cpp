@@ -0,0 +1,170 @@
+/**
+ * Unit tests for ADnEDRing.
+ *
+ * The size is rounded up to a power of two, and push fails once that many packets
+ * are queued. Packets must come out in the order they went in as the head and tail
+ * counters wrap around the ring many times, with the backlog tracking the number
+ * queued, and pop must drop the references to the event arrays.
+ *
+ * A producer and consumer thread then pass packets through a small ring, using
+ * waitForSpace and waitForData, and every packet must arrive once and in order.
+ */
+
+#include <stdio.h>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+#include "epicsThread.h"
+#include "epicsEvent.h"
+
+#include "ADnEDRing.h"
+
+#define TEST_NUM_THREADED 100000
+
+/**
+ * Make a packet with one event, identified by the sequence number.
+ */
+static ADnEDPacket makePacket(epicsUInt32 seq)
+{
+  ADnEDPacket packet;
+  epics::pvData::shared_vector<epics::pvData::uint32> pixels(1, seq);
+  epics::pvData::shared_vector<epics::pvData::uint32> tofs(1, seq * 2);
+
+  packet.pixels = epics::pvData::freeze(pixels);
+  packet.tofs = epics::pvData::freeze(tofs);
+  packet.timeStamp.setUserTag(static_cast<int>(seq));
+  return packet;
+}
+
+/**
+ * Size rounding, and a full ring.
+ */
+static void testSize(void)
+{
+  ADnEDRing ring(5);
+  epicsUInt32 numPushed = 0;
+
+  testOk(ring.getSize() == 8, "size 5 is rounded up to %u", ring.getSize());
+  testOk1(ADnEDRing(16).getSize() == 16);
+  while ((numPushed < 100) && (ring.push(makePacket(numPushed)))) {
+    ++numPushed;
+  }
+  testOk((numPushed == 8) && (ring.getBacklog() == 8), "ring is full after %u packets", numPushed);
+  ring.pop();
+  testOk1((ring.push(makePacket(numPushed))) && (!ring.push(makePacket(numPushed))));
+}
+
+/**
+ * FIFO order and backlog as the counters wrap around the ring.
+ */
+static void testWrap(void)
+{
+  ADnEDRing ring(4);
+  epicsUInt32 next = 0;
+  epicsUInt32 expected = 0;
+  epicsUInt32 numBad = 0;
+
+  testOk1(ring.front() == NULL);
+
+  //Keep between 1 and 3 packets queued, so the head and tail go round many times.
+  for (epicsUInt32 round=0; round<1000; ++round) {
+    epicsUInt32 numPush = 1 + (round % 3);
+    for (epicsUInt32 i=0; i<numPush; ++i) {
+      if (!ring.push(makePacket(next++))) {
+        ++numBad;
+      }
+    }
+    if (ring.getBacklog() != numPush) {
+      ++numBad;
+    }
+    for (epicsUInt32 i=0; i<numPush; ++i) {
+      ADnEDPacket *pPacket = ring.front();
+      if ((pPacket == NULL) || (pPacket->pixels.size() != 1) || (pPacket->pixels[0] != expected) ||
+          (pPacket->tofs[0] != expected * 2) || (pPacket->timeStamp.getUserTag() != static_cast<int>(expected))) {
+        if (numBad++ < 5) {
+          testDiag("round %u: expected packet %u", round, expected);
+        }
+      }
+      ring.pop();
+      ++expected;
+    }
+  }
+  testOk(numBad == 0, "%u packets came out in order", expected);
+  testOk1((ring.front() == NULL) && (ring.getBacklog() == 0));
+
+  //pop drops the references to the event arrays.
+  ADnEDPacket packet = makePacket(1);
+  ring.push(packet);
+  testOk1(packet.pixels.use_count() == 2);
+  ring.pop();
+  testOk(packet.pixels.use_count() == 1, "pop drops the event array references");
+}
+
+static ADnEDRing *pThreadRing = NULL;
+static epicsEventId producerDone = NULL;
+
+/**
+ * Producer thread. Pushes TEST_NUM_THREADED packets, waiting for space when the ring is full.
+ */
+static void producerTask(void *)
+{
+  for (epicsUInt32 seq=0; seq<TEST_NUM_THREADED; ++seq) {
+    ADnEDPacket packet = makePacket(seq);
+    while (!pThreadRing->push(packet)) {
+      pThreadRing->waitForSpace();
+    }
+  }
+  epicsEventSignal(producerDone);
+}
+
+/**
+ * Pass packets between two threads.
+ */
+static void testThreads(void)
+{
+  ADnEDRing ring(16);
+  epicsUInt32 expected = 0;
+  epicsUInt32 numBad = 0;
+
+  pThreadRing = &ring;
+  producerDone = epicsEventMustCreate(epicsEventEmpty);
+  if (epicsThreadCreate("ringProducer", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackSmall), producerTask, NULL) == NULL) {
+    testSkip(2, "could not create the producer thread");
+    epicsEventDestroy(producerDone);
+    return;
+  }
+
+  while (expected < TEST_NUM_THREADED) {
+    ADnEDPacket *pPacket = ring.front();
+    if (pPacket == NULL) {
+      ring.waitForData();
+      continue;
+    }
+    if (pPacket->pixels[0] != expected) {
+      if (numBad++ < 5) {
+        testDiag("got packet %u, expected %u", pPacket->pixels[0], expected);
+      }
+      expected = pPacket->pixels[0];
+    }
+    ring.pop();
+    ++expected;
+  }
+
+  epicsEventWait(producerDone);
+  testOk(numBad == 0, "%u packets passed between threads in order", TEST_NUM_THREADED);
+  testOk1(ring.front() == NULL);
+  epicsEventDestroy(producerDone);
+  pThreadRing = NULL;
+}
+
+MAIN(ADnEDRingTest)
+{
+  testPlan(4 + 5 + 2);
+
+  testSize();
+  testWrap();
+  testThreads();
+
+  return testDone();
+}
@@ -0,0 +1,222 @@
+/**
+ * Unit tests for the page logic of ADnEDShard.
+ *
+ * mergeInto must add only the dirty pages of the standby half into the destination
+ * and delta buffers, flag those pages in both, and leave the standby half zero and
+ * clean, including the partial page at the end of the buffer. clear() must zero
+ * both halves, and clear(start, size) only the given region. With a footprint
+ * limit, the standby half is given back to the OS once the merged pages go over it.
+ *
+ * clearPages (used for the delta buffer) must zero the region, clear the flags of
+ * the pages wholly inside it, and keep the flags of the pages only partly inside it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDShard.h"
+
+//A few pages, with a partial page at the end.
+#define TEST_SIZE ((3 * ADNED_SHARD_PAGE_SIZE) + 100)
+#define TEST_NUM_PAGES 4
+#define TEST_PAGE_BYTES (ADNED_SHARD_PAGE_SIZE * sizeof(epicsUInt32))
+
+/**
+ * Put a count in the active half of a shard, and flag its page.
+ */
+static void count(ADnEDShard *pShard, epicsUInt32 index, epicsUInt32 value)
+{
+  pShard->getData()[index] += value;
+  pShard->getDirty()[index / ADNED_SHARD_PAGE_SIZE] = 1;
+}
+
+/**
+ * @return The number of non-zero elements in a buffer.
+ */
+static epicsUInt32 numNonZero(const epicsUInt32 *pBuffer, epicsUInt32 size)
+{
+  epicsUInt32 num = 0;
+  for (epicsUInt32 i=0; i<size; ++i) {
+    num += (pBuffer[i] != 0);
+  }
+  return num;
+}
+
+/**
+ * @return The number of flags set.
+ */
+static epicsUInt32 numFlags(const epicsUInt8 *pPages, epicsUInt32 numPages)
+{
+  epicsUInt32 num = 0;
+  for (epicsUInt32 page=0; page<numPages; ++page) {
+    num += (pPages[page] != 0);
+  }
+  return num;
+}
+
+/**
+ * Only the dirty pages are merged, and the standby half is left zero.
+ */
+static void testMerge(void)
+{
+  ADnEDShard shard;
+  std::vector<epicsUInt32> dest(TEST_SIZE, 0);
+  std::vector<epicsUInt32> delta(TEST_SIZE, 0);
+  std::vector<epicsUInt8> changed(TEST_NUM_PAGES, 0);
+  std::vector<epicsUInt8> deltaPages(TEST_NUM_PAGES, 0);
+
+  testOk1((shard.alloc(TEST_SIZE) == ADNED_SHARD_OK) && (ADnEDShard::getNumPages(TEST_SIZE) == TEST_NUM_PAGES));
+
+  shard.lock();
+  count(&shard, 5, 3);
+  count(&shard, TEST_SIZE - 1, 7);
+  shard.swap();
+  shard.unlock();
+
+  testOk(shard.mergeInto(&dest[0], &changed[0], &delta[0], &deltaPages[0]) == 2, "two dirty pages merged");
+  testOk1((dest[5] == 3) && (dest[TEST_SIZE - 1] == 7) && (numNonZero(&dest[0], TEST_SIZE) == 2));
+  testOk1((delta[5] == 3) && (delta[TEST_SIZE - 1] == 7) && (numNonZero(&delta[0], TEST_SIZE) == 2));
+  testOk((changed[0] == 1) && (changed[TEST_NUM_PAGES - 1] == 1) && (numFlags(&changed[0], TEST_NUM_PAGES) == 2),
+         "changed flags set for the merged pages only");
+  testOk1(memcmp(&changed[0], &deltaPages[0], TEST_NUM_PAGES) == 0);
+
+  //The merged half is now active again, and must be zero and clean.
+  shard.lock();
+  shard.swap();
+  testOk((numNonZero(shard.getData(), TEST_SIZE) == 0) && (numFlags(shard.getDirty(), TEST_NUM_PAGES) == 0),
+         "merged half is zero and clean");
+
+  //A second merge adds to the destination, without a delta buffer.
+  count(&shard, ADNED_SHARD_PAGE_SIZE, 1);
+  count(&shard, 5, 2);
+  shard.swap();
+  shard.unlock();
+  memset(&changed[0], 0, TEST_NUM_PAGES);
+  testOk1(shard.mergeInto(&dest[0], &changed[0]) == 2);
+  testOk((dest[5] == 5) && (dest[ADNED_SHARD_PAGE_SIZE] == 1) && (delta[ADNED_SHARD_PAGE_SIZE] == 0),
+         "second merge adds to the destination only");
+  testOk1((changed[0] == 1) && (changed[1] == 1) && (numFlags(&changed[0], TEST_NUM_PAGES) == 2));
+
+  //Nothing dirty, nothing merged.
+  testOk1(shard.mergeInto(&dest[0], &changed[0]) == 0);
+}
+
+/**
+ * clear() zeroes both halves, and clear(start, size) only the region.
+ */
+static void testClear(void)
+{
+  ADnEDShard shard;
+
+  shard.alloc(TEST_SIZE);
+  shard.lock();
+  count(&shard, 10, 1);
+  count(&shard, ADNED_SHARD_PAGE_SIZE + 10, 1);
+  shard.swap();
+  count(&shard, 20, 1);
+  count(&shard, TEST_SIZE - 1, 1);
+
+  //A region from inside page 0 to inside page 1, in both halves.
+  shard.clear(15, ADNED_SHARD_PAGE_SIZE);
+  testOk((shard.getData()[20] == 0) && (shard.getData()[TEST_SIZE - 1] == 1), "clear(start, size) on the active half");
+  shard.swap();
+  testOk((shard.getData()[10] == 1) && (shard.getData()[ADNED_SHARD_PAGE_SIZE + 10] == 0),
+         "clear(start, size) on the standby half");
+
+  //A region past the end is clipped.
+  shard.clear(ADNED_SHARD_PAGE_SIZE, TEST_SIZE);
+  testOk1(shard.getData()[10] == 1);
+
+  shard.clear();
+  bool zero = (numNonZero(shard.getData(), TEST_SIZE) == 0) && (numFlags(shard.getDirty(), TEST_NUM_PAGES) == 0);
+  shard.swap();
+  zero = zero && (numNonZero(shard.getData(), TEST_SIZE) == 0) && (numFlags(shard.getDirty(), TEST_NUM_PAGES) == 0);
+  testOk(zero, "clear() zeroes both halves and their dirty flags");
+  shard.unlock();
+}
+
+/**
+ * The footprint counts the merged pages, and the standby half is given back over the limit.
+ */
+static void testFootprint(void)
+{
+  ADnEDShard shard;
+  std::vector<epicsUInt32> dest(TEST_SIZE, 0);
+  size_t flagBytes = 2 * 2 * TEST_NUM_PAGES;
+
+  //Room for two pages over both halves.
+  shard.alloc(TEST_SIZE, ADNED_MEMORY_DEFAULT, false, false, 2 * TEST_PAGE_BYTES);
+  if (shard.getFootprint() != flagBytes) {
+    testSkip(4, "the shard can't give pages back to the OS on this system");
+    return;
+  }
+  testPass("footprint is just the page flags before anything is merged");
+
+  shard.lock();
+  count(&shard, 0, 1);
+  count(&shard, ADNED_SHARD_PAGE_SIZE, 1);
+  shard.swap();
+  shard.unlock();
+  shard.mergeInto(&dest[0], NULL);
+  testOk(shard.getFootprint() == (flagBytes + (2 * TEST_PAGE_BYTES)), "two merged pages are within the limit");
+
+  shard.lock();
+  count(&shard, 2 * ADNED_SHARD_PAGE_SIZE, 1);
+  shard.swap();
+  shard.unlock();
+  shard.mergeInto(&dest[0], NULL);
+  testOk(shard.getFootprint() == (flagBytes + (2 * TEST_PAGE_BYTES)), "over the limit, the merged half is given back");
+
+  shard.lock();
+  shard.swap();
+  testOk((numNonZero(shard.getData(), TEST_SIZE) == 0) && (numNonZero(&dest[0], TEST_SIZE) == 3),
+         "given back pages read as zero");
+  shard.unlock();
+}
+
+/**
+ * clearPages only clears the flags of the pages wholly inside the region.
+ */
+static void testClearPages(void)
+{
+  std::vector<epicsUInt32> buffer(TEST_SIZE, 1);
+  std::vector<epicsUInt8> pages(TEST_NUM_PAGES, 1);
+
+  //From inside page 0 to inside page 1.
+  ADnEDShard::clearPages(&buffer[0], &pages[0], TEST_SIZE, 10, ADNED_SHARD_PAGE_SIZE);
+  testOk((buffer[9] == 1) && (buffer[10] == 0) && (buffer[ADNED_SHARD_PAGE_SIZE + 9] == 0) &&
+         (buffer[ADNED_SHARD_PAGE_SIZE + 10] == 1) && (numNonZero(&buffer[0], TEST_SIZE) == TEST_SIZE - ADNED_SHARD_PAGE_SIZE),
+         "region is zeroed");
+  testOk(numFlags(&pages[0], TEST_NUM_PAGES) == TEST_NUM_PAGES, "partial pages keep their flags");
+
+  //Pages 1 and 2 exactly.
+  ADnEDShard::clearPages(&buffer[0], &pages[0], TEST_SIZE, ADNED_SHARD_PAGE_SIZE, 2 * ADNED_SHARD_PAGE_SIZE);
+  testOk((pages[0] == 1) && (pages[1] == 0) && (pages[2] == 0) && (pages[3] == 1), "whole pages are cleared");
+
+  //The partial last page counts as whole when the region reaches the end of the buffer.
+  ADnEDShard::clearPages(&buffer[0], &pages[0], TEST_SIZE, 3 * ADNED_SHARD_PAGE_SIZE, 1000000);
+  testOk((pages[3] == 0) && (buffer[TEST_SIZE - 1] == 0), "last partial page is cleared at the end of the buffer");
+
+  //Regions outside the buffer do nothing.
+  buffer.assign(TEST_SIZE, 1);
+  pages.assign(TEST_NUM_PAGES, 1);
+  ADnEDShard::clearPages(&buffer[0], &pages[0], TEST_SIZE, TEST_SIZE, 10);
+  ADnEDShard::clearPages(&buffer[0], &pages[0], TEST_SIZE, 0, 0);
+  testOk1((numNonZero(&buffer[0], TEST_SIZE) == TEST_SIZE) && (numFlags(&pages[0], TEST_NUM_PAGES) == TEST_NUM_PAGES));
+}
+
+MAIN(ADnEDShardTest)
+{
+  testPlan(11 + 4 + 4 + 5);
+
+  testMerge();
+  testClear();
+  testFootprint();
+  testClearPages();
+
+  return testDone();
+}
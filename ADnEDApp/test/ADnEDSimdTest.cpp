@@ -0,0 +1,274 @@
+/**
+ * Unit tests for ADnEDSimd.
+ *
+ * Each implementation that this CPU supports (AVX2, SSE4.1 and scalar) is run on
+ * the same events, and the results must match the scalar implementation and a
+ * plain reference calculation exactly. The pixel IDs are at the edges of the
+ * ranges (including ranges either side of the sign bit, where the vector
+ * versions use signed compares) and the TOFs are at the multiples of the
+ * divisor and at tofMax. The event counts are not multiples of the vector width,
+ * so the scalar tail is covered too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDSimd.h"
+
+static const char *implNames[] = {"avx2", "sse4.1", "scalar"};
+static const epicsUInt32 numImpls = sizeof(implNames) / sizeof(implNames[0]);
+
+static const epicsUInt32 divisors[] = {0, 1, 2, 3, 7, 10, 100, 1000, 4093, 65535, 65536, 1000003, 0x7FFFFFFF};
+static const epicsUInt32 numDivisors = sizeof(divisors) / sizeof(divisors[0]);
+
+static const epicsUInt32 tofMaxes[] = {0, 1000, 160000, 0x7FFFFFFE, ADNED_SIMD_DIVIDE_MAX, 0x80000000, 0xFFFFFFFF};
+static const epicsUInt32 numTofMaxes = sizeof(tofMaxes) / sizeof(tofMaxes[0]);
+
+#define TEST_NUM_RANGE_SETS 4
+
+/**
+ * The original segment calculation, one range at a time.
+ */
+static epicsUInt16 referenceSegment(const ADnEDSimdRanges *pRanges, epicsUInt32 pixelID)
+{
+  for (epicsUInt32 r=0; r<pRanges->numRanges; ++r) {
+    if ((pixelID >= pRanges->start[r])
+        && (static_cast<epicsUInt64>(pixelID) < static_cast<epicsUInt64>(pRanges->start[r]) + pRanges->size[r])) {
+      return static_cast<epicsUInt16>(pRanges->seg[r]);
+    }
+  }
+  return 0;
+}
+
+/**
+ * The original TOF bin calculation, with a divide.
+ */
+static epicsUInt32 referenceBin(epicsUInt32 divisor, epicsUInt32 tofMax, epicsUInt32 tof)
+{
+  if (divisor == 0) {
+    divisor = 1;
+  }
+  return (tof <= tofMax) ? (tof / divisor) : ADNED_SIMD_INVALID;
+}
+
+/**
+ * Set up one of the test range sets.
+ */
+static void makeRanges(epicsUInt32 set, ADnEDSimdRanges *pRanges)
+{
+  pRanges->numRanges = 0;
+  switch (set) {
+  case 0:
+    //One detector starting at 0.
+    pRanges->start[0] = 0; pRanges->size[0] = 1024; pRanges->seg[0] = 1;
+    pRanges->numRanges = 1;
+    break;
+  case 1:
+    //Gaps, single pixel ranges and the largest segment number.
+    pRanges->start[0] = 100; pRanges->size[0] = 100; pRanges->seg[0] = 1;
+    pRanges->start[1] = 200; pRanges->size[1] = 1; pRanges->seg[1] = 2;
+    pRanges->start[2] = 5000; pRanges->size[2] = 1000; pRanges->seg[2] = 3;
+    pRanges->start[3] = 9000; pRanges->size[3] = 1; pRanges->seg[3] = 65535;
+    pRanges->numRanges = 4;
+    break;
+  case 2:
+    //Either side of the sign bit, and the top of the pixel ID space.
+    pRanges->start[0] = 0x7FFFFF00; pRanges->size[0] = 0x100; pRanges->seg[0] = 1;
+    pRanges->start[1] = 0x80000000; pRanges->size[1] = 0x100; pRanges->seg[1] = 2;
+    pRanges->start[2] = 0xFFFFFF00; pRanges->size[2] = 0xFF; pRanges->seg[2] = 3;
+    pRanges->numRanges = 3;
+    break;
+  default:
+    //The most ranges, and one that is bigger than 2^31.
+    for (epicsUInt32 r=0; r<ADNED_SIMD_MAX_RANGES-1; ++r) {
+      pRanges->start[r] = r * 20;
+      pRanges->size[r] = 10;
+      pRanges->seg[r] = r + 1;
+    }
+    pRanges->start[ADNED_SIMD_MAX_RANGES-1] = 0x10000000;
+    pRanges->size[ADNED_SIMD_MAX_RANGES-1] = 0x90000000;
+    pRanges->seg[ADNED_SIMD_MAX_RANGES-1] = ADNED_SIMD_MAX_RANGES;
+    pRanges->numRanges = ADNED_SIMD_MAX_RANGES;
+    break;
+  }
+}
+
+/**
+ * Pixel IDs either side of every range edge, and at the ends of the pixel ID space.
+ */
+static void makePixels(const ADnEDSimdRanges *pRanges, std::vector<epicsUInt32> &pixels)
+{
+  pixels.clear();
+  for (epicsUInt32 r=0; r<pRanges->numRanges; ++r) {
+    epicsUInt32 end = pRanges->start[r] + pRanges->size[r];
+    for (epicsUInt32 i=0; i<3; ++i) {
+      pixels.push_back(pRanges->start[r] - i);
+      pixels.push_back(pRanges->start[r] + i);
+      pixels.push_back(end - i);
+      pixels.push_back(end + i);
+    }
+  }
+  pixels.push_back(0);
+  pixels.push_back(0x7FFFFFFF);
+  pixels.push_back(0x80000000);
+  pixels.push_back(0xFFFFFFFF);
+  //Make sure it is not a multiple of the vector width.
+  if ((pixels.size() % 8) == 0) {
+    pixels.push_back(1);
+  }
+}
+
+/**
+ * TOFs either side of the multiples of the divisor, and either side of tofMax.
+ */
+static void makeTofs(epicsUInt32 divisor, epicsUInt32 tofMax, std::vector<epicsUInt32> &tofs)
+{
+  tofs.clear();
+  if (divisor == 0) {
+    divisor = 1;
+  }
+  for (epicsUInt32 k=0; k<20; ++k) {
+    epicsUInt64 edge = static_cast<epicsUInt64>(k) * divisor;
+    for (epicsInt32 d=-2; d<=2; ++d) {
+      epicsInt64 tof = static_cast<epicsInt64>(edge) + d;
+      if ((tof >= 0) && (tof <= 0xFFFFFFFFLL)) {
+        tofs.push_back(static_cast<epicsUInt32>(tof));
+      }
+    }
+  }
+  //The largest multiples of the divisor that can be represented.
+  epicsUInt32 top = (0xFFFFFFFFU / divisor) * divisor;
+  epicsUInt32 belowSign = (0x7FFFFFFFU / divisor) * divisor;
+  for (epicsUInt32 d=0; d<3; ++d) {
+    tofs.push_back(tofMax - d);
+    tofs.push_back(tofMax + d);
+    tofs.push_back(top - d);
+    tofs.push_back(belowSign - d);
+    tofs.push_back(belowSign + d);
+    tofs.push_back(0x7FFFFFFF + d);
+    tofs.push_back(0xFFFFFFFF - d);
+  }
+  if ((tofs.size() % 8) == 0) {
+    tofs.push_back(divisor);
+  }
+}
+
+/**
+ * Test one implementation. The tests are skipped if this CPU does not support it.
+ */
+static void testImpl(const char *name)
+{
+  ADnEDSimd simd;
+  ADnEDSimd scalar;
+  const epicsUInt32 numTests = TEST_NUM_RANGE_SETS + 1;
+
+  scalar.select("scalar");
+  if (!simd.select(name)) {
+    testSkip(numTests, "not supported on this CPU");
+    return;
+  }
+  testDiag("Implementation %s", simd.getName());
+
+  //classify
+  for (epicsUInt32 set=0; set<TEST_NUM_RANGE_SETS; ++set) {
+    ADnEDSimdRanges ranges;
+    std::vector<epicsUInt32> pixels;
+    makeRanges(set, &ranges);
+    makePixels(&ranges, pixels);
+    epicsUInt32 numEvents = static_cast<epicsUInt32>(pixels.size());
+    std::vector<epicsUInt16> seg(numEvents, 0xAAAA);
+    std::vector<epicsUInt16> scalarSeg(numEvents, 0x5555);
+    epicsUInt32 numBad = 0;
+    //Every length up to the full set, so every split between the vector loop and the tail is done.
+    for (epicsUInt32 length=1; length<=numEvents; ++length) {
+      simd.classify(&ranges, &pixels[0], length, &seg[0]);
+      scalar.classify(&ranges, &pixels[0], length, &scalarSeg[0]);
+      for (epicsUInt32 i=0; i<length; ++i) {
+        epicsUInt16 expected = referenceSegment(&ranges, pixels[i]);
+        if ((seg[i] != expected) || (scalarSeg[i] != expected)) {
+          if (numBad++ == 0) {
+            testDiag("pixel ID 0x%08x: %s %u, scalar %u, expected %u",
+                     pixels[i], name, seg[i], scalarSeg[i], expected);
+          }
+        }
+      }
+    }
+    testOk(numBad == 0, "%s classify, range set %u (%u events)", name, set, numEvents);
+  }
+
+  //tofBins
+  epicsUInt32 numBad = 0;
+  epicsUInt32 numChecked = 0;
+  for (epicsUInt32 d=0; d<numDivisors; ++d) {
+    ADnEDDivider divider;
+    ADnEDSimd::initDivider(divisors[d], &divider);
+    for (epicsUInt32 m=0; m<numTofMaxes; ++m) {
+      std::vector<epicsUInt32> tofs;
+      makeTofs(divisors[d], tofMaxes[m], tofs);
+      epicsUInt32 numEvents = static_cast<epicsUInt32>(tofs.size());
+      std::vector<epicsUInt32> bins(numEvents, 0xAAAAAAAA);
+      std::vector<epicsUInt32> scalarBins(numEvents, 0x55555555);
+      simd.tofBins(&divider, tofMaxes[m], &tofs[0], numEvents, &bins[0]);
+      scalar.tofBins(&divider, tofMaxes[m], &tofs[0], numEvents, &scalarBins[0]);
+      for (epicsUInt32 i=0; i<numEvents; ++i) {
+        epicsUInt32 expected = referenceBin(divisors[d], tofMaxes[m], tofs[i]);
+        ++numChecked;
+        if ((bins[i] != expected) || (scalarBins[i] != expected)) {
+          if (numBad++ == 0) {
+            testDiag("divisor %u, tofMax %u, TOF %u: %s %u, scalar %u, expected %u",
+                     divisors[d], tofMaxes[m], tofs[i], name, bins[i], scalarBins[i], expected);
+          }
+        }
+      }
+    }
+  }
+  testOk(numBad == 0, "%s tofBins (%u events, %u wrong)", name, numChecked, numBad);
+}
+
+/**
+ * The divider must be exact for every numerator up to ADNED_SIMD_DIVIDE_MAX.
+ * Check the numerators around each multiple of the divisor near the top of the range.
+ */
+static void testDivider(void)
+{
+  epicsUInt32 numBad = 0;
+  for (epicsUInt32 d=0; d<numDivisors; ++d) {
+    ADnEDDivider divider;
+    ADnEDSimd::initDivider(divisors[d], &divider);
+    epicsUInt32 divisor = (divisors[d] == 0) ? 1 : divisors[d];
+    for (epicsUInt32 k=0; k<1000; ++k) {
+      epicsInt64 edge = (static_cast<epicsInt64>(ADNED_SIMD_DIVIDE_MAX / divisor) - k) * divisor;
+      for (epicsInt32 j=-1; j<=1; ++j) {
+        epicsInt64 n = edge + j;
+        if ((n < 0) || (n > ADNED_SIMD_DIVIDE_MAX)) {
+          continue;
+        }
+        epicsUInt32 quotient = static_cast<epicsUInt32>((static_cast<epicsUInt64>(n) * divider.magic) >> divider.shift);
+        if (quotient != static_cast<epicsUInt32>(n) / divisor) {
+          ++numBad;
+        }
+      }
+    }
+  }
+  testOk(numBad == 0, "initDivider is exact near ADNED_SIMD_DIVIDE_MAX");
+}
+
+MAIN(ADnEDSimdTest)
+{
+  testPlan((numImpls * (TEST_NUM_RANGE_SETS + 1)) + 2);
+
+  ADnEDSimd simd;
+  testDiag("Best implementation for this CPU: %s", simd.getName());
+  testOk1(!simd.select("none"));
+
+  testDivider();
+  for (epicsUInt32 i=0; i<numImpls; ++i) {
+    testImpl(implNames[i]);
+  }
+
+  return testDone();
+}
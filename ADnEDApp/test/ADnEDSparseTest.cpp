@@ -0,0 +1,90 @@
+/**
+ * Unit tests for ADnEDSparse, which ADnED::copySparse uses to publish sparse
+ * NDArrays and NDPluginDensify uses to rebuild the dense arrays.
+ *
+ * The sparse array must only be used when it is smaller than the dense array,
+ * which is when there are fewer than half as many pairs as elements, so the
+ * boundary is checked for odd and even sizes. Packing then unpacking must give
+ * back the dense array, with the pairs in index order, and pairs with an index
+ * past the end of the dense array must be ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDSparse.h"
+
+/**
+ * Only use the sparse array if numPairs*2 < numElements.
+ */
+static void testIsSmaller(void)
+{
+  testOk(ADnEDSparse::isSmaller(4, 10) && !ADnEDSparse::isSmaller(5, 10), "10 elements: 4 pairs sparse, 5 pairs dense");
+  testOk(ADnEDSparse::isSmaller(5, 11) && !ADnEDSparse::isSmaller(6, 11), "11 elements: 5 pairs sparse, 6 pairs dense");
+  testOk(ADnEDSparse::isSmaller(0, 1) && !ADnEDSparse::isSmaller(1, 1), "1 element: 0 pairs sparse, 1 pair dense");
+  testOk1(!ADnEDSparse::isSmaller(0, 0));
+  //Twice the number of pairs doesn't fit in 32 bits.
+  testOk1(!ADnEDSparse::isSmaller(0x80000000, 0xFFFFFFFF));
+  testOk1(ADnEDSparse::isSmaller(0x7FFFFFFF, 0xFFFFFFFF));
+}
+
+/**
+ * Counting, packing and unpacking.
+ */
+static void testPack(void)
+{
+  const epicsUInt32 numElements = 1001;
+  std::vector<epicsUInt32> dense(numElements, 0);
+  std::vector<epicsUInt32> rebuilt(numElements, 99);
+
+  testOk1(ADnEDSparse::countPairs(&dense[0], numElements) == 0);
+
+  dense[0] = 1;
+  dense[numElements - 1] = 2;
+  srand(1234);
+  for (epicsUInt32 i=0; i<100; ++i) {
+    dense[rand() % numElements] = 1 + (rand() % 1000);
+  }
+  epicsUInt32 numPairs = ADnEDSparse::countPairs(&dense[0], numElements);
+  epicsUInt32 numNonZero = 0;
+  for (epicsUInt32 i=0; i<numElements; ++i) {
+    numNonZero += (dense[i] != 0);
+  }
+  testOk((numPairs == numNonZero) && (ADnEDSparse::isSmaller(numPairs, numElements)),
+         "%u pairs for %u elements", numPairs, numElements);
+
+  std::vector<epicsUInt32> pairs(2 * numPairs, 0);
+  ADnEDSparse::pack(&dense[0], numElements, &pairs[0]);
+  bool ordered = (pairs[0] == 0) && (pairs[1] == 1) && (pairs[(2 * numPairs) - 2] == numElements - 1);
+  for (epicsUInt32 pair=1; pair<numPairs; ++pair) {
+    ordered = ordered && (pairs[2 * pair] > pairs[2 * (pair - 1)]) && (pairs[(2 * pair) + 1] == dense[pairs[2 * pair]]);
+  }
+  testOk(ordered, "pairs are in index order");
+
+  ADnEDSparse::unpack(&pairs[0], numPairs, &rebuilt[0], numElements);
+  testOk(rebuilt == dense, "unpacked array matches the dense array");
+
+  //A pair past the end of a smaller dense array is ignored.
+  std::vector<epicsUInt32> smaller(numElements - 1, 99);
+  ADnEDSparse::unpack(&pairs[0], numPairs, &smaller[0], numElements - 1);
+  testOk1(std::equal(smaller.begin(), smaller.end(), dense.begin()));
+
+  //No pairs gives an empty array.
+  ADnEDSparse::unpack(&pairs[0], 0, &rebuilt[0], numElements);
+  testOk1(ADnEDSparse::countPairs(&rebuilt[0], numElements) == 0);
+}
+
+MAIN(ADnEDSparseTest)
+{
+  testPlan(6 + 6);
+
+  testIsSmaller();
+  testPack();
+
+  return testDone();
+}
@@ -0,0 +1,233 @@
+/**
+ * Unit tests for the fixed point TOF bins of ADnEDTransform (calculateBins with
+ * ADNED_TRANSFORM_TYPE1).
+ *
+ * The bins must be exactly the same as the original floating point binning,
+ * which is calculateBatch followed by floor((result * scale) + offset), with
+ * results outside 0 to tofMax rejected (ADNED_TRANSFORM_INVALID_BIN), and
+ * transformation errors given their own bin (ADNED_TRANSFORM_ERROR_BIN).
+ *
+ * Some of the per pixel factors are chosen so that the fixed point value is
+ * a few units either side of the guard band around a bin edge, where the
+ * result switches between the fixed point and the floating point calculation.
+ * The others are checked at the TOFs either side of each bin edge, and at tofMax.
+ * One offset is big enough that a transformation error (ADNED_TRANSFORM_ERROR)
+ * would be scaled into the TOF range if it was not rejected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "epicsUnitTest.h"
+#include "testMain.h"
+
+#include "ADnEDTransform.h"
+
+/**
+ * TOF rebinning for one test.
+ */
+struct TestBinning {
+  epicsFloat64 scale;
+  epicsFloat64 offset;
+  epicsUInt32 tofMax;
+};
+
+static const TestBinning testBinnings[] = {
+  {1.0, 0.0, 1000},
+  {1.0, 0.5, 1000},
+  {0.5, 0.0, 160000},
+  {3.7, -12.25, 5000},
+  {0.001, 100.0, 1000},
+  {1.0, 10500.0, 20000},
+};
+
+static const epicsUInt32 numTestBinnings = sizeof(testBinnings) / sizeof(testBinnings[0]);
+
+//TOFs used for the factors that are set up to hit the guard band edges.
+static const epicsUInt32 guardTofs[] = {1, 2, 3, 1000, 65535, 1000000};
+static const epicsUInt32 numGuardTofs = sizeof(guardTofs) / sizeof(guardTofs[0]);
+
+//Bins used for the factors that are set up to hit the guard band edges.
+static const epicsUInt32 guardBins[] = {0, 1, 7, 500};
+static const epicsUInt32 numGuardBins = sizeof(guardBins) / sizeof(guardBins[0]);
+
+//Distance (in fixed point units) either side of each guard band edge.
+#define TEST_GUARD_SPREAD 3
+
+static const epicsFloat64 fixedOne = 4294967296.0; //2^32
+
+/**
+ * The original floating point binning, for one event.
+ */
+static epicsUInt32 referenceBin(const TestBinning *pBinning, epicsFloat64 result)
+{
+  if (result == ADNED_TRANSFORM_ERROR) {
+    return ADNED_TRANSFORM_ERROR_BIN;
+  }
+  epicsFloat64 value = (result * pBinning->scale) + pBinning->offset;
+  if ((value <= pBinning->tofMax) && (value >= 0)) {
+    return static_cast<epicsUInt32>(floor(value));
+  }
+  return ADNED_TRANSFORM_INVALID_BIN;
+}
+
+/**
+ * Work out which side of the guard band an event is, from the fixed point value
+ * (calculated the same way as ADnEDTransform does).
+ * @return 1 if it is within TEST_GUARD_SPREAD of a guard band edge, otherwise 0
+ */
+static int atGuardEdge(const TestBinning *pBinning, epicsFloat64 factor, epicsUInt32 tof)
+{
+  epicsUInt64 fixedFactor = static_cast<epicsUInt64>(floor((factor * pBinning->scale * fixedOne) + 0.5));
+  epicsInt64 fixedOffset = static_cast<epicsInt64>(floor((pBinning->offset * fixedOne) + 0.5));
+  epicsInt64 value = static_cast<epicsInt64>(tof * fixedFactor) + fixedOffset;
+  epicsInt64 fraction = value & 0xFFFFFFFF;
+  epicsInt64 guard = (tof >> 1) + ADNED_TRANSFORM_BIN_GUARD;
+  epicsInt64 upper = 0xFFFFFFFFLL - guard;
+  return ((llabs(fraction - guard) <= TEST_GUARD_SPREAD) || (llabs(fraction - upper) <= TEST_GUARD_SPREAD)) ? 1 : 0;
+}
+
+/**
+ * Test one TOF rebinning.
+ */
+static void testBinning(const TestBinning *pBinning)
+{
+  std::vector<epicsFloat64> factors;
+  std::vector<epicsUInt32> pixelIDs;
+  std::vector<epicsUInt32> tofs;
+  epicsUInt32 numAtGuard = 0;
+
+  //Factors that put the fixed point value either side of each guard band edge at
+  //a given TOF: value = bin + (fraction / 2^32), with the fraction around the guard.
+  for (epicsUInt32 t=0; t<numGuardTofs; ++t) {
+    epicsUInt32 tof = guardTofs[t];
+    epicsInt64 guard = (tof >> 1) + ADNED_TRANSFORM_BIN_GUARD;
+    epicsInt64 edges[2] = {guard, 0xFFFFFFFFLL - guard};
+    for (epicsUInt32 b=0; b<numGuardBins; ++b) {
+      for (epicsUInt32 e=0; e<2; ++e) {
+        for (epicsInt64 d=-TEST_GUARD_SPREAD; d<=TEST_GUARD_SPREAD; ++d) {
+          //Bins above the offset, so the factor is not negative.
+          epicsFloat64 bin = guardBins[b] + ((pBinning->offset > 0) ? ceil(pBinning->offset) : 0);
+          epicsFloat64 value = bin + ((edges[e] + d) / fixedOne);
+          epicsFloat64 factor = (value - pBinning->offset) / (pBinning->scale * tof);
+          if (factor < 0) {
+            continue;
+          }
+          pixelIDs.push_back(static_cast<epicsUInt32>(factors.size()));
+          tofs.push_back(tof);
+          numAtGuard += atGuardEdge(pBinning, factor, tof);
+          factors.push_back(factor);
+        }
+      }
+    }
+  }
+
+  //Other factors, at the TOFs either side of each bin edge and of tofMax.
+  static const epicsFloat64 otherFactors[] = {0.0, 0.1, 0.25, 1.0/3.0, 1.0, 2.7182818, 17.0};
+  for (epicsUInt32 f=0; f<sizeof(otherFactors)/sizeof(otherFactors[0]); ++f) {
+    epicsUInt32 pixelID = static_cast<epicsUInt32>(factors.size());
+    factors.push_back(otherFactors[f]);
+    epicsFloat64 perTof = otherFactors[f] * pBinning->scale;
+    for (epicsUInt32 bin=0; bin<=pBinning->tofMax+1; bin+=((bin < 20) ? 1 : 97)) {
+      epicsFloat64 edge = (perTof > 0) ? ((bin - pBinning->offset) / perTof) : bin;
+      if ((edge < 0) || (edge > 4.0e9)) {
+        continue;
+      }
+      epicsUInt32 tof = static_cast<epicsUInt32>(edge);
+      for (epicsUInt32 d=0; d<3; ++d) {
+        pixelIDs.push_back(pixelID);
+        tofs.push_back(tof + d - 1);
+        pixelIDs.push_back(pixelID);
+        tofs.push_back(tof + d);
+      }
+    }
+    pixelIDs.push_back(pixelID);
+    tofs.push_back(0);
+    pixelIDs.push_back(pixelID);
+    tofs.push_back(0xFFFFFFFF);
+  }
+
+  //Pixel IDs past the end of the factor array are transformation errors.
+  pixelIDs.push_back(static_cast<epicsUInt32>(factors.size()));
+  tofs.push_back(10);
+  pixelIDs.push_back(0xFFFFFFFF);
+  tofs.push_back(1000);
+
+  ADnEDTransform transform;
+  epicsUInt32 numEvents = static_cast<epicsUInt32>(pixelIDs.size());
+  std::vector<epicsFloat64> results(numEvents, 0);
+  std::vector<epicsUInt32> bins(numEvents, 0);
+
+  transform.setDoubleArray(0, &factors[0], static_cast<epicsUInt32>(factors.size()));
+  transform.setBinning(pBinning->scale, pBinning->offset, pBinning->tofMax);
+  transform.calculateBatch(ADNED_TRANSFORM_TYPE1, &pixelIDs[0], &tofs[0], &results[0], numEvents);
+  bool fixed = transform.calculateBins(ADNED_TRANSFORM_TYPE1, &pixelIDs[0], &tofs[0], &bins[0], numEvents);
+
+  testOk(fixed, "scale %g, offset %g, tofMax %u: fixed point is used",
+         pBinning->scale, pBinning->offset, pBinning->tofMax);
+
+  epicsUInt32 numBad = 0;
+  epicsUInt32 numValid = 0;
+  for (epicsUInt32 i=0; (fixed) && (i<numEvents); ++i) {
+    epicsUInt32 expected = referenceBin(pBinning, results[i]);
+    numValid += ((expected != ADNED_TRANSFORM_INVALID_BIN) && (expected != ADNED_TRANSFORM_ERROR_BIN));
+    if (bins[i] != expected) {
+      if (numBad++ < 5) {
+        testDiag("pixel ID %u (factor %.17g), TOF %u: bin %u, expected %u (%.17g)",
+                 pixelIDs[i], (pixelIDs[i] < factors.size()) ? factors[pixelIDs[i]] : 0.0, tofs[i],
+                 bins[i], expected, (results[i] * pBinning->scale) + pBinning->offset);
+      }
+    }
+  }
+  testOk(numBad == 0, "scale %g, offset %g, tofMax %u: %u events (%u in range) match floating point",
+         pBinning->scale, pBinning->offset, pBinning->tofMax, numEvents, numValid);
+  testOk(numAtGuard > 0, "scale %g, offset %g, tofMax %u: %u events at the guard band edges",
+         pBinning->scale, pBinning->offset, pBinning->tofMax, numAtGuard);
+}
+
+/**
+ * Cases where the fixed point is not used, and calculateBatch must be used instead.
+ */
+static void testNotFixed(void)
+{
+  ADnEDTransform transform;
+  epicsFloat64 factors[2] = {1.0, 2.0};
+  epicsUInt32 pixelIDs[1] = {0};
+  epicsUInt32 tofs[1] = {10};
+  epicsUInt32 bins[1] = {0};
+
+  transform.setBinning(1.0, 0.0, 1000);
+  testOk(!transform.calculateBins(ADNED_TRANSFORM_TYPE1, pixelIDs, tofs, bins, 1),
+         "not used without a factor array");
+  transform.setDoubleArray(0, factors, 2);
+  testOk1(transform.calculateBins(ADNED_TRANSFORM_TYPE1, pixelIDs, tofs, bins, 1) && (bins[0] == 10));
+  testOk(!transform.calculateBins(ADNED_TRANSFORM_TYPE2, pixelIDs, tofs, bins, 1),
+         "not used for other transformation types");
+  factors[1] = -2.0;
+  transform.setDoubleArray(0, factors, 2);
+  testOk(!transform.calculateBins(ADNED_TRANSFORM_TYPE1, pixelIDs, tofs, bins, 1),
+         "not used with a negative factor");
+  factors[1] = 2.0;
+  transform.setDoubleArray(0, factors, 2);
+  transform.setBinning(1.0, 0.0, ADNED_TRANSFORM_BIN_MAX);
+  testOk(!transform.calculateBins(ADNED_TRANSFORM_TYPE1, pixelIDs, tofs, bins, 1),
+         "not used with a TOF max that is too big");
+  transform.setBinning(1.0, 0.0, 1000);
+  transform.setDebug(true);
+  testOk(!transform.calculateBins(ADNED_TRANSFORM_TYPE1, pixelIDs, tofs, bins, 1),
+         "not used with debug enabled");
+}
+
+MAIN(ADnEDTransformTest)
+{
+  testPlan((numTestBinnings * 3) + 6);
+
+  for (epicsUInt32 i=0; i<numTestBinnings; ++i) {
+    testBinning(&testBinnings[i]);
+  }
+  testNotFixed();
+
+  return testDone();
+}